@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace ricox {
+enum class log_level : uint8_t { off, error, info, debug };
+
+struct access_record final {  // fixed-size, trivially copyable, one per logged request
+   public:
+	static constexpr size_t PATH_SIZE = 128;
+	static constexpr size_t PEER_SIZE = 48;
+
+	uint64_t timestamp_ns;	// wall clock at completion
+	uint64_t duration_ns;
+	uint64_t bytes_out;
+	uint16_t status;
+	uint16_t peer_port;
+	uint8_t method;	 // evhttp_cmd_type bit index
+	char peer[PEER_SIZE];
+	char path[PATH_SIZE];  // raw request URI, truncated
+};
+
+class access_log final {  // Singleton sampled access log: lock-free ring on the hot path, formatted off-thread
+   private:
+	static constexpr size_t CAPACITY = 1 << 14;	 // power of two
+
+	struct slot final {
+		std::atomic<uint64_t> sequence;
+		access_record record;
+	};
+
+	std::unique_ptr<slot[]> slots;
+	std::atomic<uint64_t> enqueue_pos;
+	uint64_t dequeue_pos;  // formatter thread only
+	std::atomic<uint8_t> level;
+	std::atomic<uint32_t> sample_every;	 // keep one successful request in N
+	std::atomic<uint64_t> dropped;		 // ring full
+	std::atomic<bool> stopping;
+	std::thread formatter;
+
+	auto try_pop(access_record& record) -> bool;
+	auto run() -> void;
+
+	access_log();
+	~access_log();
+
+	access_log(const access_log&) = delete;
+	access_log& operator=(const access_log&) = delete;
+
+   public:
+	static auto get_instance() -> access_log&;
+
+	static auto parse_level(const std::string& name, log_level& out) -> bool;
+	static auto level_name(log_level level) -> const char*;
+
+	auto get_level() const -> log_level;
+	auto set_level(log_level new_level) -> void;
+	auto get_sample_every() const -> uint32_t;
+	auto set_sample_every(uint32_t n) -> void;
+	auto get_dropped() const -> uint64_t;
+
+	auto should_log(uint16_t status) const -> bool;	 // level and sampling decision, no side effects but a counter
+	auto push(const access_record& record) -> bool;	 // never blocks, drops the record when the ring is full
+};
+
+}  // namespace ricox
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "data_manager.hpp"
+
+namespace ricox {
+// Singleton recording downloads as index access times, coarsely: a download counts only once the recorded time is
+// a resolution old, and the accesses collected are committed together on the worker pool, one journal append per
+// batch. A batch is flushed when it is full or a resolution after the previous one, on the next download.
+class access_tracker final {
+   private:
+	struct access final {
+		uint64_t version;  // the record read, a newer upload keeps its own time
+		std::time_t time;
+	};
+
+	std::chrono::seconds resolution;
+	std::unordered_map<std::string, access> pending;  // by URL
+	std::chrono::steady_clock::time_point last_flush;
+	bool flushing;	// one batch is committed at a time
+	std::mutex mutex;
+
+	auto flush() -> void;
+
+	access_tracker();
+	~access_tracker() = default;
+
+	access_tracker(const access_tracker&) = delete;
+	access_tracker& operator=(const access_tracker&) = delete;
+
+   public:
+	static auto get_instance() -> access_tracker&;
+
+	auto record(const storage_info& info) -> void;	// cheap when the recorded time is recent
+};
+
+}  // namespace ricox
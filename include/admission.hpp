@@ -0,0 +1,87 @@
+#pragma once
+
+#include <evhttp.h>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace ricox {
+struct token_bucket final {	 // Refills at a fixed rate up to its burst; may go into debt for one large take
+   public:
+	double tokens;
+	std::chrono::steady_clock::time_point updated;
+
+	// Takes amount if any token is left, otherwise returns the seconds until one is
+	auto take(double amount, double rate, double burst, std::chrono::steady_clock::time_point now) -> double;
+};
+
+// Singleton per-client token buckets for expensive requests and their bytes. Used on the event loop thread only,
+// which runs every handler, so the buckets need neither locks nor atomics.
+class rate_limiter final {
+   private:
+	struct client_state final {
+		token_bucket requests;
+		token_bucket bytes;
+	};
+
+	double request_rate;
+	double request_burst;
+	double byte_rate;
+	double byte_burst;
+	size_t max_clients;
+	std::string key_header;
+	std::unordered_set<std::string> api_keys;
+	std::unordered_map<std::string, client_state> clients;
+	client_state overflow;	// shared by new clients while clients is full of ones still paying back
+	std::chrono::steady_clock::time_point last_sweep;
+
+	auto state_of(const std::string& client, std::chrono::steady_clock::time_point now) -> client_state&;
+	auto sweep(std::chrono::steady_clock::time_point now) -> void;	// forgets clients whose buckets are full again
+
+	rate_limiter();
+	~rate_limiter() = default;
+
+	rate_limiter(const rate_limiter&) = delete;
+	rate_limiter& operator=(const rate_limiter&) = delete;
+
+   public:
+	static auto get_instance() -> rate_limiter&;
+
+	auto client_of(evhttp_request* req) const -> std::string;  // a configured API key if sent, else the peer address
+	// One request moving the given bytes; false: limited, retry_after_s tells the client when to come back
+	auto take(const std::string& client, uint64_t bytes, unsigned& retry_after_s) -> bool;
+	auto size() const -> size_t;
+};
+
+// Singleton admission queue for cold compression and decompression, which run on the worker pool. At most
+// max_active run at once, a bounded number wait in arrival order, the rest are turned away. Event loop thread only.
+class admission_queue final {
+   public:
+	using task = std::function<void()>;
+
+   private:
+	size_t max_active;
+	size_t max_queued;
+	size_t active;
+	std::deque<task> waiting;
+
+	admission_queue();
+	~admission_queue() = default;
+
+	admission_queue(const admission_queue&) = delete;
+	admission_queue& operator=(const admission_queue&) = delete;
+
+   public:
+	static auto get_instance() -> admission_queue&;
+
+	auto enter(task t) -> bool;	 // runs t now or once a slot frees, false: the queue is full
+	auto leave() -> void;		 // ends an operation started by enter, every run task calls it exactly once
+	auto active_count() const -> size_t;
+	auto queued_count() const -> size_t;
+};
+
+}  // namespace ricox
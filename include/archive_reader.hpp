@@ -0,0 +1,31 @@
+#pragma once
+
+#include <event2/buffer.h>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace ricox {
+enum class archive_format : uint8_t { tar, bun, zip };
+
+struct archive_entry final {
+   public:
+	std::string name;								// as stored in the archive, may contain directories
+	std::shared_ptr<const std::string> content;	// uncompressed bytes
+};
+
+class archive_reader final {  // Splits an uploaded archive into its regular files
+   public:
+	using entry_sink = std::function<bool(archive_entry entry)>;  // return false to stop reading
+
+	static auto parse_format(const std::string& name, archive_format& out) -> bool;
+
+	// Consumes the archive from the buffer, draining it entry by entry so memory is released as files are handed out
+	static auto read(evbuffer* input, archive_format format, const entry_sink& sink) -> bool;
+
+   private:
+	static auto read_tar(evbuffer* input, const entry_sink& sink) -> bool;
+	static auto read_bundle(evbuffer* input, archive_format format, const entry_sink& sink) -> bool;
+};
+
+}  // namespace ricox
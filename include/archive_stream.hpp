@@ -0,0 +1,58 @@
+#pragma once
+
+#include <evhttp.h>
+#include <memory>
+#include <vector>
+#include "data_manager.hpp"
+#include "fd_cache.hpp"
+#include "reclaimer.hpp"
+#include "small_file_cache.hpp"
+
+namespace ricox {
+// Streams stored files back as one tar in a chunked reply, one entry in flight at a time.
+// Cold entries are decompressed ahead on the worker pool, each behind the admission queue; the session owns itself
+// until the reply ends and keeps every listed file from being reclaimed until then.
+class archive_stream final : public std::enable_shared_from_this<archive_stream> {
+   private:
+	enum class entry_state : uint8_t { pending, preparing, ready, failed };
+
+	struct entry final {
+		storage_info info;
+		entry_state state = entry_state::pending;
+		fd_cache::handle_ptr handle;			// hot file or unlinked decompressed copy
+		small_file_cache::content_ptr content;	// file unpacked from a segment
+	};
+
+	evhttp_request* req;
+	evhttp_connection* connection;
+	reclaimer::read_guard guard;
+	std::vector<entry> entries;
+	size_t next_prepare;
+	size_t next_send;
+	size_t lookahead;	// entries prepared ahead of the one being sent
+	uint64_t sent;		// reply bytes queued so far, the reply is shaped once they reach the bulk threshold
+	bool sending;		// a chunk is waiting to be flushed
+	bool finished;
+	std::shared_ptr<archive_stream> self;  // keeps the session alive while libevent holds raw pointers to it
+
+	auto prepare() -> void;
+	auto prepare_cold(size_t index) -> void;	// queues for an admission slot, fails the entry when turned away
+	auto unpack_cold(size_t index) -> void;	// holds the slot until the result is back on the loop
+	auto pump() -> void;
+	auto send_entry(entry& e) -> bool;
+	auto complete() -> void;
+	auto abort() -> void;
+
+	static auto on_chunk_sent(evhttp_connection* connection, void* arg) -> void;
+	static auto on_close(archive_stream* stream) -> void;
+
+   public:
+	archive_stream(evhttp_request* req, std::vector<storage_info> infos, reclaimer::read_guard guard);
+
+	archive_stream(const archive_stream&) = delete;
+	archive_stream& operator=(const archive_stream&) = delete;
+
+	static auto start(evhttp_request* req, std::vector<storage_info> infos, reclaimer::read_guard guard) -> void;
+};
+
+}  // namespace ricox
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ricox {
+struct storage_info;
+
+class crc32c final {  // Castagnoli CRC, the SSE4.2 crc32 instruction when the CPU has it, slice-by-8 tables otherwise
+   public:
+	static auto update(uint32_t crc, const void* data, size_t len) -> uint32_t;	// extends a finished crc, start at 0
+	static auto hardware() -> bool;
+
+	static auto to_hex(uint32_t crc) -> std::string;
+	static auto to_digest(uint32_t crc) -> std::string;	 // "crc32c=<base64 of the big-endian value>"
+
+	// false, logged and counted when the index records a different checksum for the file
+	static auto verify(const storage_info& info, uint32_t crc) -> bool;
+};
+
+}  // namespace ricox
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "data_manager.hpp"
+
+namespace ricox {
+struct commit_request final {
+   public:
+	std::string temp_path;	 // fully written, not yet synced
+	std::string final_path;	 // a fresh version path, renamed into place once the batch is durable
+	std::function<void(bool ok, const storage_info& info)> callback;  // runs on the event loop thread
+	uint32_t dictionary_id = 0;	 // recorded in the index, the file alone does not say how it was compressed
+	bool has_checksum = false;
+	uint32_t checksum = 0;	// CRC32C of the uploaded bytes, verified whenever they are read back
+	std::string file_url;	// taken from the final path when empty
+	bool remove = false;	// deletes file_url instead of publishing a file, temp and final path stay empty
+	bool chunked = false;	// written by the upload pipeline, recorded like dictionary_id
+};
+
+// Singleton group committer: one sync per batch of uploads, then rename and journal. Versions a commit replaces or
+// deletes stay in their URL's version chain; those trimmed from it are handed to the reclaimer, which removes them
+// once no download can still be reading them.
+class commit_queue final {
+   private:
+	std::deque<std::vector<commit_request>> pending;  // groups are never split across batches
+	size_t pending_count;
+	mutable std::mutex mutex;
+	std::mutex publish_mutex;  // held from rename to journal, so relocations see paths and index agree
+	std::condition_variable cv;
+	std::chrono::microseconds window;  // how long to wait for more uploads to join a batch
+	size_t max_batch;
+	bool stopping;
+	std::thread worker;
+
+	auto run() -> void;
+	// groups: the submit_group call of each request, a failure of any member fails its whole group
+	auto commit_batch(std::vector<commit_request>& batch, const std::vector<size_t>& groups) -> void;
+
+	commit_queue();
+	~commit_queue();
+
+	commit_queue(const commit_queue&) = delete;
+	commit_queue& operator=(const commit_queue&) = delete;
+
+   public:
+	static auto get_instance() -> commit_queue&;
+
+	auto submit(commit_request request) -> void;
+	auto submit_group(std::vector<commit_request> requests) -> void;  // journaled in a single index transaction
+	auto depth() const -> size_t;
+	auto lock_publish() -> std::unique_lock<std::mutex>;	 // for code that moves or unlinks committed files
+
+	static auto make_temp_path(const std::string& final_path) -> std::string;
+	static auto make_version_path(const std::string& storage_path) -> std::string;	// never names an existing file
+	static auto remove_stale_temps(const std::string& dir) -> void;	// leftovers of uploads cut by a crash
+	static auto remove_orphan_versions(const std::string& dir) -> void;	// retired before a crash, not yet removed
+};
+
+}  // namespace ricox
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <event2/bufferevent.h>
+#include <evhttp.h>
+#include <sys/time.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+namespace ricox {
+// Singleton bookkeeping of client connections, used on the event loop thread only. Caps the open connections and
+// the requests served on each, and switches a connection's timeout between reading a request and writing its reply.
+// Large replies are shaped: their connection joins a shared rate-limit group at a lower event priority, so small
+// replies on the other connections keep a fast lane.
+class connection_manager final {
+   public:
+	using close_listener = std::function<void()>;
+
+	static constexpr int CONTROL_PRIORITY = 0;  // completions posted back to the loop, set on their events
+	static constexpr int FAST_PRIORITY = 1;	 // interactive requests and small replies, the libevent default here
+	static constexpr int BULK_PRIORITY = 2;	 // shaped replies
+	static constexpr int PRIORITIES = 3;
+
+   private:
+	struct connection_state final {
+		size_t requests;  // received on this connection
+		bool shaped;	  // the current reply is in the bulk group
+		close_listener listener;
+	};
+
+	size_t max_connections;
+	size_t max_requests;
+	timeval read_timeout;
+	timeval write_timeout;
+	size_t bulk_min_bytes;
+	ev_token_bucket_cfg* connection_rate;  // nullptr: no per-connection limit
+	ev_token_bucket_cfg* global_rate;
+	bufferevent_rate_limit_group* bulk_group;  // nullptr: no global limit
+	std::unordered_map<evhttp_connection*, connection_state> connections;
+
+	static auto on_close(evhttp_connection* evcon, void* arg) -> void;
+	auto unshape(evhttp_connection* evcon, connection_state& state) -> void;
+
+	connection_manager();
+	~connection_manager();
+
+	connection_manager(const connection_manager&) = delete;
+	connection_manager& operator=(const connection_manager&) = delete;
+
+   public:
+	static auto get_instance() -> connection_manager&;
+
+	// Size limits, the read timeout every connection starts with and the bulk group; the base must have been
+	// initialized with PRIORITIES priorities
+	auto configure(event_base* base, evhttp* httpd) -> void;
+	auto admit(evhttp_request* req) -> bool;	// false: over the connection cap, already answered with 503
+	auto shape(evhttp_request* req, uint64_t reply_bytes) -> void;	// no-op below bandwidth_bulk_min_bytes
+	auto complete(evhttp_request* req) -> void;	// reply sent, back to the fast lane and the read timeout
+	// libevent holds one close callback per connection and this class owns it; others listen through here.
+	// Replaces the previous listener, nullptr removes it.
+	auto on_connection_close(evhttp_connection* evcon, close_listener listener) -> void;
+	auto size() const -> size_t;
+};
+
+}  // namespace ricox
@@ -1,8 +1,12 @@
 #pragma once
+#include <atomic>
+#include <set>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
+#include "persistent_map.hpp"
 #include "server_config.hpp"
+#include <mutex>
 #include <shared_mutex>
 
 namespace ricox {
@@ -13,25 +17,78 @@ struct storage_info final {
 	size_t file_size;
 	std::string file_path;
 	std::string file_url;
+	uint64_t segment_id = 0;	 // 0: stored on its own at file_path, else packed into that segment
+	uint64_t block_offset = 0;	 // compressed block holding the file
+	uint32_t block_length = 0;
+	uint32_t entry_offset = 0;	 // start of the file inside the unpacked block
+	uint32_t dictionary_id = 0;	 // standalone cold file compressed with this zstd dictionary, 0: bundle
+	bool chunked = false;		 // standalone cold file compressed block by block by the upload pipeline
+	bool has_checksum = false;	 // files stored before checksums were recorded have none
+	uint32_t checksum = 0;		 // CRC32C of the uncompressed content
+	std::string etag;			 // computed once at commit, kept when the file is relocated
+	uint64_t version = 0;		 // assigned when uploaded, kept when relocated; 0: stored before versioning
+	uint64_t superseded = 0;	 // in a version chain: the version of the upload or deletion that replaced it
 
 	storage_info() = default;
 	~storage_info() = default;
 	storage_info(const std::string& path);
 	auto load_info(const std::string& path) -> bool;
+	auto make_etag() const -> std::string;	// strong from the checksum, weak from name, size and mtime without one
+	auto file_name() const -> std::string;	// as uploaded, the stored path may carry a version suffix
+	auto in_segment() const -> bool { return segment_id != 0; }
+
+	static auto make_url(const std::string& file_name) -> std::string;
+};
+
+struct url_hash final {	// transparent, so lookups by string_view need no temporary key
+   public:
+	using is_transparent = void;
+	auto operator()(std::string_view url) const -> size_t { return std::hash<std::string_view>{}(url); }
+};
+
+// key: download URL, value: storage info; copies are O(1) snapshots, looked up by string_view without a key string
+using index_map = persistent_map<std::string, storage_info, url_hash, std::equal_to<>>;
+// key: download URL, value: the versions it had before the current one or its deletion, newest first
+using version_map = persistent_map<std::string, std::vector<storage_info>, url_hash, std::equal_to<>>;
+
+struct listing final {	// one page of a prefix listing, in URL order
+   public:
+	std::vector<storage_info> files;
+	std::vector<std::string> common_prefixes;	// URLs up to and including the delimiter, each once
+	bool truncated = false;
+	std::string next_marker;  // the last URL or common prefix returned, continues the listing
 };
 
 class data_manager final {
    private:
-	std::string storage_file;
-	std::unordered_map<std::string, storage_info> storage_map;	// key: file name, value: storage info
+	std::string storage_file;	// snapshot of the index, rewritten atomically on compaction
+	std::string journal_file;	// append-only records committed since the snapshot
+	int journal_fd;
+	size_t journal_records;
+	std::mutex journal_mutex;	// serializes commits, taken before mutex
+	index_map storage_map;	// replaced by every commit, readers copy the root under a shared lock
+	version_map history;	// earlier versions, replaced together with storage_map
+	size_t version_retention;
+	std::set<std::string, std::less<>> ordered_urls;	// the keys of storage_map in order, for prefix listings
     mutable std::shared_mutex mutex;
+    std::atomic<uint64_t> last_version;
+    std::atomic<uint64_t> changes;	// bumped by every commit
     bool is_cold_storage;
 
     
     auto store_info() -> bool;
+    // Caller holds journal_mutex; compact tells it the journal has grown enough to be folded into the snapshot
+    auto append_journal(const std::vector<storage_info>& infos, const std::vector<std::string>& removed,
+                        uint64_t removed_version, bool& compact) -> bool;
+    // Uploads, then removals at removed_version. A replaced or removed version moves into the URL's chain; a
+    // record relocated away or trimmed from a chain goes to dropped, the URLs actually removed to erased.
+    auto apply(index_map& map, version_map& chains, const std::vector<storage_info>& infos,
+               const std::vector<std::string>& removed, uint64_t removed_version, std::vector<storage_info>& dropped,
+               std::vector<std::string>& erased) const -> void;
+    auto replay_journal() -> bool;
 
     data_manager();
-	~data_manager() = default;
+	~data_manager();
 
     data_manager(const data_manager&) = delete;
     data_manager& operator=(const data_manager&) = delete;
@@ -39,12 +96,38 @@ class data_manager final {
    public:
     static auto get_instance() -> data_manager&; // singleton class object retriever
 
+    // The same JSON array as the index snapshot file, used for persisted point-in-time snapshots too, which
+    // carry no version chains
+    static auto write_index(const index_map& map, const std::string& path, const version_map* chains = nullptr)
+        -> bool;
+    static auto read_index(const std::string& path, index_map& map, version_map* chains = nullptr) -> bool;
+    // list() over records already in URL order, e.g. from find_as_of
+    static auto list_records(const std::vector<storage_info>& records, std::string_view prefix,
+                             std::string_view delimiter, std::string_view start_after, size_t max_keys,
+                             listing& result) -> void;
+
 	auto initialize() -> bool;
     auto update(const storage_info& info) -> bool;
     auto add_info(const storage_info& info) -> bool;
-    auto find_by_url(const std::string& url, storage_info& info) const -> bool;
+    auto add_infos(const std::vector<storage_info>& infos) -> bool;	// one journal append and sync for all
+    // Upserts infos and removes the given URLs in one journal append; previous receives every record whose file
+    // the caller reclaims: relocated away, or trimmed from a version chain past version_retention. Callers hold
+    // commit_queue::lock_publish().
+    auto commit(const std::vector<storage_info>& infos, const std::vector<std::string>& removed,
+                std::vector<storage_info>& previous) -> bool;
+    auto find_by_url(std::string_view url, storage_info& info) const -> bool;
     auto find_by_path(const std::string& path, storage_info& info) const -> bool;
     auto find_all(std::vector<storage_info>& infos) const -> bool;
+    // Like S3: URLs after start_after beginning with prefix; with a delimiter, the URLs sharing the part up to its
+    // first occurrence after the prefix are rolled up into one common prefix. Visits only the returned range.
+    auto list(std::string_view prefix, std::string_view delimiter, std::string_view start_after, size_t max_keys,
+              listing& result) const -> void;
+    auto snapshot() const -> index_map;	// O(1), unchanged by later commits
+    auto find_version(std::string_view url, uint64_t version, storage_info& info) const -> bool;  // current or chain
+    auto find_as_of(uint64_t version, std::vector<storage_info>& infos) const -> void;	// current then, URL order
+    auto for_each_noncurrent(const std::function<void(const std::string&, const storage_info&)>& f) const -> void;
+    auto next_version() -> uint64_t;	// increasing across restarts, microseconds since the epoch unless taken
+    auto generation() const -> uint64_t { return changes.load(); }	// differs once the index has changed
 };
 
 }  // namespace ricox
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace ricox {
+class zstd_dictionary final {  // Trained zstd dictionary with its prepared compression and decompression tables
+   private:
+	struct tables;	// defined only when built with zstd
+
+	uint32_t id;
+	std::string group;
+	std::string content;
+	std::unique_ptr<tables> prepared;
+
+   public:
+	zstd_dictionary(uint32_t id, std::string group, std::string content, int level);
+	~zstd_dictionary();
+
+	zstd_dictionary(const zstd_dictionary&) = delete;
+	zstd_dictionary& operator=(const zstd_dictionary&) = delete;
+
+	static auto available() -> bool;  // false when built without zstd, every call below then fails
+	static auto train(const std::vector<std::string>& samples, size_t capacity, std::string& content) -> bool;
+	static auto content_size(const char* data, size_t len, size_t& size) -> bool;  // from the frame header
+
+	auto get_id() const -> uint32_t;
+	auto get_group() const -> const std::string&;
+	auto get_content() const -> const std::string&;
+
+	auto compress(const char* data, size_t len, std::string& out) const -> bool;
+	auto decompress(const char* data, size_t len, char* out, size_t out_len) const -> bool;	 // out_len exact
+};
+
+// Singleton of per-group dictionaries trained from cold upload samples, versioned on disk. Training runs on a
+// background thread of its own, one group at a time; the same thread drops versions no stored file uses any more.
+class dictionary_store final {
+   public:
+	using dictionary_ptr = std::shared_ptr<const zstd_dictionary>;
+
+   private:
+	struct sample_set final {
+		std::vector<std::string> samples;
+		size_t bytes = 0;
+		bool training = false;
+	};
+
+	std::string directory;
+	size_t max_file_size;  // larger files compress well enough on their own
+	size_t capacity;
+	size_t min_samples;
+	size_t sample_bytes;  // sample volume collected before (re)training a group
+	int level;
+	std::string delimiter;
+	size_t max_sample_memory;
+	std::chrono::seconds collect_interval;
+
+	std::unordered_map<uint32_t, dictionary_ptr> by_id;	// the newest per group and those stored files use
+	std::unordered_map<std::string, dictionary_ptr> latest;	// newest version per group, used to compress
+	std::unordered_set<uint32_t> unused;	// found unused by the last collection, dropped if still unused at the next
+	std::unordered_map<std::string, sample_set> sample_sets;
+	size_t sampled;	 // bytes buffered in all sample sets, including those being trained on
+	std::deque<std::string> ready;	// groups with enough samples, in the order they got them
+	uint32_t next_id;
+	mutable std::mutex mutex;
+	std::condition_variable cv;
+	bool stopping;
+	std::thread worker;
+
+	auto run() -> void;
+	auto train(const std::string& group, std::vector<std::string> samples) -> void;
+	auto collect() -> void;
+	auto install(const dictionary_ptr& dictionary) -> void;
+	auto dictionary_file(uint32_t id, const std::string& group) const -> std::string;
+
+	dictionary_store();
+	~dictionary_store();
+
+	dictionary_store(const dictionary_store&) = delete;
+	dictionary_store& operator=(const dictionary_store&) = delete;
+
+   public:
+	static auto get_instance() -> dictionary_store&;
+
+	auto start() -> bool;  // loads the stored dictionaries and starts the background thread
+	auto group_of(const std::string& file_name) const -> std::string;  // empty: the name gives no usable group
+
+	auto add_sample(const std::string& file_name, const std::string& content) -> void;
+	auto compress(const std::string& file_name, const std::string& content, std::string& out) const -> uint32_t;  // 0: none
+	auto find(uint32_t id) const -> dictionary_ptr;
+};
+
+}  // namespace ricox
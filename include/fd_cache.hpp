@@ -0,0 +1,72 @@
+#pragma once
+
+#include <event2/buffer.h>
+#include <sys/stat.h>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ricox {
+struct fd_handle final {  // Open descriptor plus the stat taken when it was opened, closed on last release
+   public:
+	int fd;
+	struct stat file_stat;
+	std::string file_path;
+
+	fd_handle(int fd, const struct stat& file_stat, const std::string& path);
+	~fd_handle();
+
+	fd_handle(const fd_handle&) = delete;
+	fd_handle& operator=(const fd_handle&) = delete;
+
+	auto get_file_size() const -> int64_t;
+	auto get_last_write_time() const -> std::time_t;
+	auto read_file(std::string& content) const -> bool;	 // positional read, safe on a shared descriptor
+};
+
+class fd_cache final {	// Singleton LRU cache of open descriptors for hot storage, keyed by path
+   public:
+	using handle_ptr = std::shared_ptr<const fd_handle>;
+
+   private:
+	using lru_list = std::list<std::string>;  // front: most recently used
+
+	struct entry final {
+		handle_ptr handle;
+		lru_list::iterator lru_pos;
+	};
+
+	size_t capacity;
+	lru_list lru;
+	std::unordered_map<std::string, entry> cache;
+	mutable std::mutex mutex;
+
+	auto evict() -> void;  // drops least recently used entries, caller holds the lock
+
+	fd_cache();
+	~fd_cache() = default;
+
+	fd_cache(const fd_cache&) = delete;
+	fd_cache& operator=(const fd_cache&) = delete;
+
+   public:
+	static auto get_instance() -> fd_cache&;
+
+	auto acquire(const std::string& path) -> handle_ptr;  // nullptr if the file cannot be opened
+	auto invalidate(const std::string& path) -> void;
+	auto clear() -> void;
+	auto size() const -> size_t;
+
+	static auto open_handle(const std::string& path) -> handle_ptr;  // opens without caching, e.g. for temp files
+
+	// Adds the file, or length bytes of it from offset, to the buffer as a file segment that keeps the handle alive
+	// until libevent drops it; a range past the end is cut at the end
+	static auto add_to_buffer(evbuffer* buffer, const handle_ptr& handle, uint64_t offset = 0,
+							  uint64_t length = std::numeric_limits<uint64_t>::max()) -> bool;
+};
+
+}  // namespace ricox
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <event2/event.h>
+#include <sys/types.h>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace ricox {
+class io_backend {	// File I/O used by file_util and the request handlers, selected by "io_backend" in config
+   public:
+	using write_callback = std::function<void(bool ok)>;
+
+	virtual ~io_backend() = default;
+
+	static auto get_instance() -> io_backend&;
+
+	virtual auto name() const -> const char* = 0;
+	virtual auto attach(event_base* base) -> bool = 0;	// hooks completions into the event loop
+
+	// Synchronous calls, loop until the whole range is transferred
+	virtual auto read(int fd, void* buf, size_t len, off_t offset) -> bool;
+	virtual auto write(int fd, const void* buf, size_t len, off_t offset) -> bool;
+	virtual auto sync(int fd) -> bool;
+
+	// Asynchronous whole-file write, the callback runs on the event loop thread (inline for the blocking backend)
+	virtual auto async_write_file(const std::string& path, std::shared_ptr<const std::string> data, bool durable,
+								  write_callback callback) -> void = 0;
+};
+
+class blocking_io_backend final : public io_backend {  // plain syscalls on the calling thread
+   public:
+	auto name() const -> const char* override;
+	auto attach(event_base* base) -> bool override;
+	auto async_write_file(const std::string& path, std::shared_ptr<const std::string> data, bool durable,
+						  write_callback callback) -> void override;
+};
+
+}  // namespace ricox
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <event2/event.h>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace ricox {
+class loop_executor final {	 // Singleton that runs tasks posted from worker threads on the event loop thread
+   public:
+	using task = std::function<void()>;
+
+   private:
+	int event_fd;
+	event* ready_event;
+	std::deque<task> tasks;
+	std::mutex mutex;
+
+	auto drain() -> void;
+	static auto on_ready(evutil_socket_t fd, short events, void* arg) -> void;
+
+	loop_executor();
+	~loop_executor();
+
+	loop_executor(const loop_executor&) = delete;
+	loop_executor& operator=(const loop_executor&) = delete;
+
+   public:
+	static auto get_instance() -> loop_executor&;
+
+	auto attach(event_base* base) -> bool;	// tasks posted before attach run once the loop starts
+	auto post(task t) -> void;				// thread-safe
+	auto pending() -> size_t;
+};
+
+}  // namespace ricox
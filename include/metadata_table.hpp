@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include "data_manager.hpp"
+
+namespace ricox {
+enum class storage_tier : uint8_t { hot, cold, count };
+enum class storage_codec : uint8_t { none, bundle, dictionary, segment, count };	 // how the bytes are stored
+
+struct metadata_query final {  // every bound inclusive, an unset one lets everything through
+   public:
+	uint64_t min_size = 0;
+	uint64_t max_size = std::numeric_limits<uint64_t>::max();
+	int64_t modified_after = std::numeric_limits<int64_t>::min();
+	int64_t modified_before = std::numeric_limits<int64_t>::max();
+	int64_t accessed_after = std::numeric_limits<int64_t>::min();
+	int64_t accessed_before = std::numeric_limits<int64_t>::max();
+	uint8_t tiers = 0xff;	// bit 1 << storage_tier per accepted tier
+	uint8_t codecs = 0xff;	// bit 1 << storage_codec per accepted codec
+	size_t limit = 0;		// rows returned, the matches are counted regardless
+};
+
+struct metadata_result final {
+   public:
+	size_t scanned = 0;
+	size_t matched = 0;
+	uint64_t matched_bytes = 0;
+	std::vector<storage_info> rows;	 // the first limit matches, in no particular order
+	std::time_t built = 0;			 // when the columns were copied from the index
+};
+
+// Singleton columnar copy of the index for metadata search: one array per field, so a filter is a branch-free
+// pass over a few dense arrays, four rows per instruction where AVX2 is available. Rebuilt from an index snapshot
+// by the first query after the index changed, at most once per refresh interval; queries run on the worker pool.
+class metadata_table final {
+   private:
+	struct columns final {
+		index_map index;  // the snapshot the rows point into
+		std::vector<const storage_info*> rows;
+		std::vector<uint64_t> size;
+		std::vector<int64_t> modified;
+		std::vector<int64_t> accessed;
+		std::vector<uint8_t> tier;	 // 1 << storage_tier
+		std::vector<uint8_t> codec;	 // 1 << storage_codec
+		uint64_t generation;
+		std::chrono::steady_clock::time_point built_at;
+		std::time_t built;
+	};
+
+	std::chrono::seconds refresh;
+	std::mutex mutex;  // guards table, held across a rebuild so only one runs
+	std::shared_ptr<const columns> table;
+
+	static auto build() -> std::shared_ptr<const columns>;
+	auto current() -> std::shared_ptr<const columns>;
+
+	metadata_table();
+	~metadata_table() = default;
+
+	metadata_table(const metadata_table&) = delete;
+	metadata_table& operator=(const metadata_table&) = delete;
+
+   public:
+	static auto get_instance() -> metadata_table&;
+
+	static auto tier_of(const storage_info& info) -> storage_tier;
+	static auto codec_of(const storage_info& info) -> storage_codec;
+	static auto tier_name(storage_tier tier) -> const char*;
+	static auto codec_name(storage_codec codec) -> const char*;
+	static auto parse_tier(std::string_view name, storage_tier& tier) -> bool;
+	static auto parse_codec(std::string_view name, storage_codec& codec) -> bool;
+
+	auto query(const metadata_query& q) -> metadata_result;	 // blocking, call it off the event loop
+};
+
+}  // namespace ricox
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ricox {
+enum class counter : size_t {
+	upload_requests,
+	download_requests,
+	show_requests,
+	list_requests,
+	search_requests,
+	s3_requests,
+	delete_requests,
+	bytes_in,
+	bytes_out,
+	fd_cache_hits,
+	fd_cache_misses,
+	small_cache_hits,
+	small_cache_misses,
+	checksum_failures,
+	not_modified,
+	connections_shed,
+	rate_limited,
+	admission_rejected,
+	scrub_bytes,
+	count
+};
+
+enum class histogram : size_t {
+	upload_latency,
+	download_latency,
+	show_latency,
+	index_lock_wait,
+	commit_batch_latency,
+	count
+};
+
+enum class codec_histogram : size_t { compress_time, decompress_time, count };
+
+// Log-linear (HDR-style) bucketing of nanosecond values: 2^SUB_BITS linear steps per power of two
+struct latency_buckets final {
+   public:
+	static constexpr size_t SUB_BITS = 2;
+	static constexpr size_t SUB_COUNT = 1 << SUB_BITS;
+	static constexpr size_t MAX_EXPONENT = 40;	// ~18 minutes, larger values land in the last bucket
+	static constexpr size_t COUNT = (MAX_EXPONENT + 1) * SUB_COUNT;
+
+	static auto index_of(uint64_t value) -> size_t {
+		if (value < SUB_COUNT) return value;
+		auto exponent = static_cast<size_t>(63 - __builtin_clzll(value));	// position of the top bit
+		auto sub = static_cast<size_t>((value >> (exponent - SUB_BITS)) & (SUB_COUNT - 1));
+		auto index = (exponent - SUB_BITS + 1) * SUB_COUNT + sub;
+		return index < COUNT ? index : COUNT - 1;
+	}
+
+	static auto upper_bound_of(size_t index) -> uint64_t;  // largest value mapped to this bucket
+};
+
+class metrics final {  // Singleton registry of per-thread metric shards, merged only when scraped
+   public:
+	static constexpr size_t MAX_CODEC = 32;	 // bundle codec ids are below this
+	static constexpr unsigned DICTIONARY_CODEC = MAX_CODEC - 1;	 // zstd with a trained dictionary, not a bundle codec
+
+	struct histogram_data final {
+		std::array<std::atomic<uint64_t>, latency_buckets::COUNT> buckets{};
+		std::atomic<uint64_t> sum{0};
+	};
+
+	struct shard final {  // written by its owning thread only, so updates are plain relaxed load + store
+		std::array<std::atomic<uint64_t>, static_cast<size_t>(counter::count)> counters{};
+		std::array<histogram_data, static_cast<size_t>(histogram::count)> histograms{};
+		std::array<std::array<histogram_data, MAX_CODEC>, static_cast<size_t>(codec_histogram::count)> codecs{};
+		std::array<std::atomic<uint64_t>, MAX_CODEC> codec_bytes_in{};
+		std::array<std::atomic<uint64_t>, MAX_CODEC> codec_bytes_out{};
+	};
+
+	using gauge_reader = std::function<double()>;
+
+   private:
+	std::vector<std::unique_ptr<shard>> shards;	 // shards outlive their threads so totals never go back
+	std::vector<std::pair<std::string, gauge_reader>> gauges;
+	mutable std::mutex mutex;  // guards registration and scraping, never the hot path
+
+	auto register_shard() -> shard*;
+
+	metrics() = default;
+	~metrics() = default;
+
+	metrics(const metrics&) = delete;
+	metrics& operator=(const metrics&) = delete;
+
+	static auto bump(std::atomic<uint64_t>& slot, uint64_t value) -> void {
+		slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	static auto observe(histogram_data& data, uint64_t value) -> void {
+		bump(data.buckets[latency_buckets::index_of(value)], 1);
+		bump(data.sum, value);
+	}
+
+   public:
+	static auto get_instance() -> metrics&;
+
+	static auto local() -> shard& {
+		thread_local auto instance = get_instance().register_shard();
+		return *instance;
+	}
+
+	static auto add(counter c, uint64_t value = 1) -> void { bump(local().counters[static_cast<size_t>(c)], value); }
+
+	static auto record(histogram h, uint64_t nanoseconds) -> void {
+		observe(local().histograms[static_cast<size_t>(h)], nanoseconds);
+	}
+
+	static auto elapsed_ns(std::chrono::steady_clock::time_point start) -> uint64_t {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	static auto record_since(histogram h, std::chrono::steady_clock::time_point start) -> void {
+		record(h, elapsed_ns(start));
+	}
+
+	static auto record_codec(codec_histogram h, unsigned codec, uint64_t nanoseconds, uint64_t bytes_in,
+							 uint64_t bytes_out) -> void {
+		auto& s = local();
+		codec %= MAX_CODEC;
+		observe(s.codecs[static_cast<size_t>(h)][codec], nanoseconds);
+		if (h == codec_histogram::compress_time) {
+			bump(s.codec_bytes_in[codec], bytes_in);
+			bump(s.codec_bytes_out[codec], bytes_out);
+		}
+	}
+
+	auto add_gauge(const std::string& name, gauge_reader reader) -> void;  // sampled at scrape time
+	auto render() const -> std::string;	 // Prometheus text exposition format
+};
+
+class scoped_timer final {	// records the lifetime of the object into a histogram
+   private:
+	histogram target;
+	std::chrono::steady_clock::time_point start;
+	bool armed = true;
+
+   public:
+	explicit scoped_timer(histogram target) : target{target}, start{std::chrono::steady_clock::now()} {}
+	~scoped_timer() {
+		if (armed) metrics::record_since(target, start);
+	}
+
+	auto dismiss() -> void { armed = false; }  // the operation continues asynchronously and records itself
+
+	scoped_timer(const scoped_timer&) = delete;
+	scoped_timer& operator=(const scoped_timer&) = delete;
+};
+
+// Acquires a lock on the index mutex and records how long the caller waited for it
+template <typename lock_type, typename mutex_type>
+auto timed_lock(mutex_type& mutex) -> lock_type {
+	auto start = std::chrono::steady_clock::now();
+	auto lock = lock_type{mutex};
+	metrics::record_since(histogram::index_lock_wait, start);
+	return lock;
+}
+
+}  // namespace ricox
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ricox {
+struct multipart_part final {
+   public:
+	std::string path;	// in the multipart directory, one file per attempt so a retried part never clobbers one
+	uint64_t size = 0;
+	uint32_t checksum = 0;	// CRC32C of the part, verified when the object is assembled
+	std::string etag;		// without quotes, returned by UploadPart and sent back by the client to complete
+};
+
+struct multipart_upload final {
+   public:
+	std::string id;
+	std::string key;
+	std::string storage_type;  // "hot" or "cold", chosen when the upload is created
+	std::time_t time_created = 0;
+	std::map<unsigned, multipart_part> parts;  // by part number, the newest attempt of each
+};
+
+enum class multipart_status : uint8_t { ok, no_such_upload, invalid_part, invalid_order };
+
+// Singleton of the S3 multipart uploads in progress. Parts are separate requests, so a client uploads them over
+// several connections at once; each is written to its own file as it arrives, and completing the upload assembles
+// the listed parts into one object. Uploads live in memory only: the parts left by a previous run are removed.
+class multipart_store final {
+   private:
+	std::string directory;
+	std::chrono::seconds expiry;
+	std::unordered_map<std::string, multipart_upload> uploads;	// by upload id
+	std::atomic<uint64_t> attempts;
+	mutable std::mutex mutex;
+
+	auto drop_expired() -> void;  // caller holds mutex
+
+	multipart_store();
+	~multipart_store() = default;
+
+	multipart_store(const multipart_store&) = delete;
+	multipart_store& operator=(const multipart_store&) = delete;
+
+   public:
+	static constexpr unsigned MAX_PARTS = 10000;
+
+	static auto get_instance() -> multipart_store&;
+
+	auto start() -> bool;
+	auto create(const std::string& key, const std::string& storage_type) -> std::string;	 // the upload id
+	// false when no upload of key has this id
+	auto part_path(const std::string& id, const std::string& key, unsigned number, std::string& path) -> bool;
+	// false once the upload was completed or aborted, the caller then removes the part file
+	auto add_part(const std::string& id, unsigned number, multipart_part part) -> bool;
+	// Removes the upload when the requested (number, etag) list is ascending and names stored parts; selected then
+	// holds those parts in order, the caller assembles them and discards the upload
+	auto take(const std::string& id, const std::string& key,
+			  const std::vector<std::pair<unsigned, std::string>>& requested, multipart_upload& upload,
+			  std::vector<multipart_part>& selected) -> multipart_status;
+	auto abort(const std::string& id, const std::string& key) -> bool;
+	auto size() const -> size_t;
+
+	// Concatenates the parts into the file at path, checking each against its checksum; checksum receives the
+	// CRC32C of the whole object. Blocking, path is removed on failure
+	static auto assemble(const std::vector<multipart_part>& parts, const std::string& path, uint32_t& checksum)
+		-> bool;
+	static auto discard(const multipart_upload& upload) -> void;	// removes every part file, blocking
+};
+
+}  // namespace ricox
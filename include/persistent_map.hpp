@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace ricox {
+// Immutable hash array mapped trie. Every update returns a new map sharing all untouched nodes with the old one,
+// so a copy is O(1) and stays valid, unchanged and safe to read from any thread while the original moves on.
+// Each level consumes 5 hash bits; entries whose whole hash collides share one leaf.
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename Equal = std::equal_to<>>
+class persistent_map final {
+   private:
+	static constexpr unsigned BITS = 5;
+	static constexpr unsigned MASK = (1u << BITS) - 1;
+
+	struct leaf;
+	struct node;
+	using leaf_ptr = std::shared_ptr<const leaf>;
+	using node_ptr = std::shared_ptr<const node>;
+	using slot = std::variant<leaf_ptr, node_ptr>;
+
+	struct leaf final {
+		size_t hash;
+		std::vector<std::pair<Key, Value>> items;  // more than one only on a full hash collision
+	};
+
+	struct node final {
+		uint32_t bitmap = 0;	  // occupied positions among the 32 children
+		std::vector<slot> slots;  // one per set bit, in bit order
+	};
+
+	node_ptr root;
+	size_t count = 0;
+
+	static auto position(const node& n, uint32_t bit) -> size_t { return std::popcount(n.bitmap & (bit - 1)); }
+
+	static auto merge(const leaf_ptr& a, const leaf_ptr& b, unsigned shift) -> node_ptr {
+		// Distinct hashes always part before the bits run out
+		auto n = std::make_shared<node>();
+		auto index_a = (a->hash >> shift) & MASK;
+		auto index_b = (b->hash >> shift) & MASK;
+		if (index_a == index_b) {
+			n->bitmap = 1u << index_a;
+			n->slots.emplace_back(merge(a, b, shift + BITS));
+		} else {
+			n->bitmap = (1u << index_a) | (1u << index_b);
+			n->slots.emplace_back(index_a < index_b ? a : b);
+			n->slots.emplace_back(index_a < index_b ? b : a);
+		}
+		return n;
+	}
+
+	static auto insert(const node_ptr& n, unsigned shift, size_t hash, const Key& key, const Value& value,
+					   bool& added) -> node_ptr {
+		auto bit = uint32_t{1} << ((hash >> shift) & MASK);
+		auto pos = position(*n, bit);
+		auto copy = std::make_shared<node>(*n);
+
+		if (!(n->bitmap & bit)) {
+			copy->bitmap |= bit;
+			copy->slots.emplace(copy->slots.begin() + pos, std::make_shared<const leaf>(leaf{hash, {{key, value}}}));
+			added = true;
+			return copy;
+		}
+
+		if (auto child = std::get_if<node_ptr>(&n->slots[pos])) {
+			copy->slots[pos] = insert(*child, shift + BITS, hash, key, value, added);
+			return copy;
+		}
+
+		const auto& existing = std::get<leaf_ptr>(n->slots[pos]);
+		if (existing->hash != hash) {
+			copy->slots[pos] = merge(existing, std::make_shared<const leaf>(leaf{hash, {{key, value}}}), shift + BITS);
+			added = true;
+			return copy;
+		}
+
+		auto updated = std::make_shared<leaf>(*existing);
+		auto it = std::find_if(updated->items.begin(), updated->items.end(),
+							   [&](const auto& item) -> bool { return Equal{}(item.first, key); });
+		if (it != updated->items.end()) {
+			it->second = value;
+		} else {
+			updated->items.emplace_back(key, value);
+			added = true;
+		}
+		copy->slots[pos] = std::move(updated);
+		return copy;
+	}
+
+	// nullptr once the node is left without children
+	template <typename K>
+	static auto remove(const node_ptr& n, unsigned shift, size_t hash, const K& key, bool& removed) -> node_ptr {
+		auto bit = uint32_t{1} << ((hash >> shift) & MASK);
+		if (!(n->bitmap & bit)) return n;
+
+		auto pos = position(*n, bit);
+		auto replacement = slot{};
+		auto drop = false;
+		if (auto child = std::get_if<node_ptr>(&n->slots[pos])) {
+			auto updated = remove(*child, shift + BITS, hash, key, removed);
+			if (!removed) return n;
+			drop = !updated;
+			replacement = std::move(updated);
+		} else {
+			const auto& existing = std::get<leaf_ptr>(n->slots[pos]);
+			if (existing->hash != hash) return n;
+
+			auto updated = std::make_shared<leaf>(*existing);
+			auto size = updated->items.size();
+			std::erase_if(updated->items, [&](const auto& item) -> bool { return Equal{}(item.first, key); });
+			if (updated->items.size() == size) return n;
+			removed = true;
+			drop = updated->items.empty();
+			replacement = leaf_ptr{std::move(updated)};
+		}
+
+		auto copy = std::make_shared<node>(*n);
+		if (!drop) {
+			copy->slots[pos] = std::move(replacement);
+			return copy;
+		}
+
+		copy->bitmap &= ~bit;
+		copy->slots.erase(copy->slots.begin() + pos);
+		return copy->slots.empty() ? nullptr : copy;
+	}
+
+	template <typename F>
+	static auto visit(const node& n, F& f) -> void {
+		for (const auto& s : n.slots) {
+			if (auto child = std::get_if<node_ptr>(&s)) {
+				visit(**child, f);
+			} else {
+				for (const auto& [key, value] : std::get<leaf_ptr>(s)->items) f(key, value);
+			}
+		}
+	}
+
+	persistent_map(node_ptr root, size_t count) : root{std::move(root)}, count{count} {}
+
+   public:
+	persistent_map() = default;
+
+	auto size() const -> size_t { return count; }
+	auto empty() const -> bool { return count == 0; }
+
+	// nullptr when absent; points into this map, valid while any map sharing the entry lives
+	template <typename K>
+	auto find(const K& key) const -> const Value* {
+		auto hash = static_cast<size_t>(Hash{}(key));
+		auto n = root.get();
+		for (auto shift = 0u; n; shift += BITS) {
+			auto bit = uint32_t{1} << ((hash >> shift) & MASK);
+			if (!(n->bitmap & bit)) return nullptr;
+
+			const auto& s = n->slots[position(*n, bit)];
+			if (auto child = std::get_if<node_ptr>(&s)) {
+				n = child->get();
+				continue;
+			}
+
+			const auto& l = std::get<leaf_ptr>(s);
+			if (l->hash != hash) return nullptr;
+			for (const auto& item : l->items) {
+				if (Equal{}(item.first, key)) return &item.second;
+			}
+			return nullptr;
+		}
+		return nullptr;
+	}
+
+	auto set(const Key& key, const Value& value) const -> persistent_map {
+		auto added = false;
+		auto start = root ? root : std::make_shared<const node>();
+		auto updated = insert(start, 0, static_cast<size_t>(Hash{}(key)), key, value, added);
+		return persistent_map{std::move(updated), count + (added ? 1 : 0)};
+	}
+
+	template <typename K>
+	auto erase(const K& key) const -> persistent_map {
+		if (!root) return *this;
+
+		auto removed = false;
+		auto updated = remove(root, 0, static_cast<size_t>(Hash{}(key)), key, removed);
+		return removed ? persistent_map{std::move(updated), count - 1} : *this;
+	}
+
+	template <typename F>	// f(const Key&, const Value&), in no particular order
+	auto for_each(F f) const -> void {
+		if (root) visit(*root, f);
+	}
+};
+
+}  // namespace ricox
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace ricox {
+// Singleton deferring the removal of files the index no longer refers to: replaced versions, deleted files and
+// emptied segments. Readers pin the current epoch before they look a file up; a file retired in an epoch is removed
+// once no reader pinned in that epoch or earlier is left, on the worker pool so no reader waits for the unlink.
+class reclaimer final {
+   public:
+	class read_guard final {  // pins an epoch for its lifetime, copies pin it again
+	   private:
+		uint64_t epoch;
+		bool active;
+
+	   public:
+		explicit read_guard(uint64_t epoch);
+		read_guard(const read_guard& other);
+		read_guard(read_guard&& other) noexcept;
+		~read_guard();
+
+		read_guard& operator=(const read_guard&) = delete;
+		read_guard& operator=(read_guard&&) = delete;
+	};
+
+   private:
+	std::mutex mutex;
+	uint64_t current_epoch;
+	std::map<uint64_t, size_t> readers;	 // guards alive per epoch, oldest first
+	std::deque<std::pair<uint64_t, std::string>> retired;  // in epoch order
+
+	auto pin(uint64_t epoch) -> void;
+	auto unpin(uint64_t epoch) -> void;
+	auto collect(std::unique_lock<std::mutex>& lock) -> void;	// releases the lock
+
+	reclaimer();
+	~reclaimer() = default;
+
+	reclaimer(const reclaimer&) = delete;
+	reclaimer& operator=(const reclaimer&) = delete;
+
+   public:
+	static auto get_instance() -> reclaimer&;
+
+	auto enter() -> read_guard;	 // before the index lookup, held until the file is open or read
+	auto retire(const std::string& path) -> void;	 // once the index no longer refers to path
+	auto pending() -> size_t;
+};
+
+}  // namespace ricox
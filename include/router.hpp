@@ -0,0 +1,92 @@
+#pragma once
+
+#include <evhttp.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+namespace ricox {
+class request_trace;
+
+struct request_context final {	// Parsed once by the router and handed to the handler
+   public:
+	evhttp_request* req;
+	evhttp_cmd_type method;
+	std::string_view path;	 // URL-decoded; the buffer is reused, copy it before any asynchronous hand-off
+	request_trace* trace;	 // nullptr unless the route is traced and X-Trace was sent
+};
+
+using route_handler = auto (*)(request_context& ctx) -> void;
+
+enum class route_match : uint8_t { exact, prefix };
+
+struct route final {
+   public:
+	std::string_view path;
+	route_match match;
+	unsigned methods;		 // evhttp_cmd_type bits accepted
+	const char* trace_name;	 // handler name in traces, nullptr: never traced
+	route_handler handler;
+};
+
+// Route table built and checked at compile time. Exact paths are sorted for a binary search; prefixes are
+// sorted longest first and only tried when no exact path matches. A path may be shared by routes whose
+// methods do not overlap.
+template <size_t N>
+class router final {
+   private:
+	std::array<route, N> exact{};
+	std::array<route, N> prefixes{};
+	size_t exact_count = 0;
+	size_t prefix_count = 0;
+
+   public:
+	consteval router(const std::array<route, N>& routes) {
+		for (const auto& r : routes) {
+			if (r.path.empty() || r.path.front() != '/' || !r.handler || !r.methods) throw "invalid route";
+			if (r.match == route_match::exact) {
+				exact[exact_count++] = r;
+			} else {
+				prefixes[prefix_count++] = r;
+			}
+		}
+
+		std::sort(exact.begin(), exact.begin() + exact_count,
+				  [](const route& a, const route& b) -> bool { return a.path < b.path; });
+		std::sort(prefixes.begin(), prefixes.begin() + prefix_count,
+				  [](const route& a, const route& b) -> bool { return a.path.size() > b.path.size(); });
+
+		for (auto i = size_t{0}; i < exact_count + prefix_count; ++i) {
+			for (auto j = i + 1; j < exact_count + prefix_count; ++j) {
+				const auto& a = i < exact_count ? exact[i] : prefixes[i - exact_count];
+				const auto& b = j < exact_count ? exact[j] : prefixes[j - exact_count];
+				if (a.match == b.match && a.path == b.path && (a.methods & b.methods)) throw "duplicate route";
+			}
+		}
+	}
+
+	// The route accepting method, else one matching only the path (the caller answers 405), else nullptr
+	constexpr auto find(std::string_view path, unsigned method) const -> const route* {
+		auto end = exact.begin() + exact_count;
+		auto it = std::lower_bound(exact.begin(), end, path,
+								   [](const route& r, std::string_view p) -> bool { return r.path < p; });
+		const route* path_only = nullptr;
+		for (; it != end && it->path == path; ++it) {
+			if (it->methods & method) return &*it;
+			path_only = &*it;
+		}
+		if (path_only) return path_only;
+
+		// Only routes of the longest matching prefix are candidates
+		for (auto i = size_t{0}; i < prefix_count; ++i) {
+			if (path_only ? prefixes[i].path != path_only->path : !path.starts_with(prefixes[i].path)) continue;
+			if (prefixes[i].methods & method) return &prefixes[i];
+			path_only = &prefixes[i];
+		}
+
+		return path_only;
+	}
+};
+
+}  // namespace ricox
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "data_manager.hpp"
+
+namespace ricox {
+class scrubber final {	// Singleton re-reading every checksummed file in the background at a bounded rate
+   private:
+	uint64_t bytes_per_second;
+	std::chrono::seconds interval;
+
+	std::chrono::steady_clock::time_point pass_start;
+	uint64_t pass_bytes;  // read so far in this pass, paces the reads against bytes_per_second
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool stopping;
+	std::thread worker;
+
+	auto run() -> void;
+	auto scrub_pass() -> void;
+	auto checksum_of(const storage_info& info, uint32_t& crc) -> bool;
+	auto throttle(uint64_t bytes) -> bool;	// false once stopping
+
+	scrubber();
+	~scrubber();
+
+	scrubber(const scrubber&) = delete;
+	scrubber& operator=(const scrubber&) = delete;
+
+   public:
+	static auto get_instance() -> scrubber&;
+
+	auto start() -> void;  // no-op when the configured rate is 0
+};
+
+}  // namespace ricox
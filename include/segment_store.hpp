@@ -0,0 +1,76 @@
+#pragma once
+
+#include <sys/types.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "data_manager.hpp"
+
+namespace ricox {
+// Segment file layout: a sequence of blocks, each a block_header followed by one bundle-packed payload holding
+// the concatenated bytes of several small cold files. storage_info addresses a file as (segment, block, offset).
+struct block_header final {
+   public:
+	static constexpr uint32_t MAGIC = 0x47455352;  // "RSEG"
+
+	uint32_t magic;
+	uint32_t packed_length;	 // payload bytes following the header
+	uint32_t raw_length;	 // payload bytes once unpacked
+	uint32_t entry_count;
+};
+
+class segment_store final {	 // Singleton packing small cold files into append-only segments, compacted in the background
+   private:
+	struct packed_entry final {
+		storage_info source;	// index record the bytes were read from
+		storage_info target;	// the same file inside the segment
+		ino_t source_inode;		// standalone sources only, guards against a re-upload while packing
+	};
+
+	std::string directory;
+	size_t max_segment_bytes;
+	size_t block_bytes;
+	size_t file_max_size;
+	std::chrono::seconds interval;
+	double compact_ratio;
+
+	uint64_t current_id;	// segment being appended to, 0 before the first block
+	int current_fd;
+	uint64_t current_size;
+
+	std::mutex mutex;  // background thread state, held during a whole pack or compaction round
+	std::condition_variable cv;
+	bool stopping;
+	std::thread worker;
+
+	auto run() -> void;
+	auto pack_small_files() -> void;  // those compressed with a trained dictionary are left as they are
+	auto compact_segments() -> void;
+
+	auto repack(const std::vector<storage_info>& sources) -> size_t;  // returns how many files were relocated
+	auto append_block(const std::string& raw, std::vector<packed_entry>& entries, size_t first) -> bool;
+	auto open_segment() -> bool;
+	auto publish(std::vector<packed_entry>& entries) -> size_t;
+
+	auto read_source(const storage_info& info, std::string& content, ino_t& inode) const -> bool;
+
+	segment_store();
+	~segment_store();
+
+	segment_store(const segment_store&) = delete;
+	segment_store& operator=(const segment_store&) = delete;
+
+   public:
+	static auto get_instance() -> segment_store&;
+
+	auto start() -> bool;  // finds the last segment and starts the background packer
+
+	auto segment_file(uint64_t id) const -> std::string;
+	auto read(const storage_info& info, std::string& content) const -> bool;  // one file, unpacking its block
+};
+
+}  // namespace ricox
@@ -1,28 +1,113 @@
 #pragma once
 
 #include <evhttp.h>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 #include "data_manager.hpp"
+#include "reclaimer.hpp"
 
 namespace ricox {
+class request_trace;
+struct request_context;
+
+struct byte_range final {	 // the part of a file a Range request asks for
+   public:
+	uint64_t offset = 0;
+	uint64_t length = std::numeric_limits<uint64_t>::max();
+	uint64_t total = 0;	   // size of the whole file
+	bool partial = false;  // false: no usable Range header, the whole file is sent
+};
+
+using s3_params = std::map<std::string, std::string, std::less<>>;	// decoded query of an S3 request
 
 class server final {
    private:
+	using upload_reply = std::function<void(evhttp_request* req, const storage_info& info)>;  // after the commit
+
 	uint16_t server_port;
 	std::string server_ip;
 	std::string download_url_prefix;
 
 	// Main callback functions
 	static auto generic_callback(evhttp_request* req, void* arg) -> void;
-	static auto download(evhttp_request* req, void* arg) -> void;
-	static auto upload(evhttp_request* req, void* arg) -> void;
-	static auto show(evhttp_request* req, void* arg) -> void;
+	static auto download(request_context& ctx) -> void;
+	static auto download_batch(request_context& ctx) -> void;	// streams a tar of the listed URLs
+	static auto upload(request_context& ctx) -> void;
+	static auto upload_batch(request_context& ctx) -> void;	// tar, bun or zip archive of many files
+	static auto remove_file(request_context& ctx) -> void;	// DELETE of a download URL
+	static auto show(request_context& ctx) -> void;
+	static auto list_files(request_context& ctx) -> void;	// S3 style ?prefix=&delimiter= listing as JSON
+	static auto search(request_context& ctx) -> void;	// files by size, time, tier and codec as JSON
+	static auto show_metrics(request_context& ctx) -> void;
+	static auto configure_log(request_context& ctx) -> void;	// GET reports the access log settings, POST sets them
+	static auto manage_snapshots(request_context& ctx) -> void;	// GET lists the index snapshots, POST takes one
+	static auto s3_request(request_context& ctx) -> void;	// path style S3 API on /s3/<bucket>/<key>
+	static auto decompress_download(evhttp_request* req, const storage_info& info, reclaimer::read_guard guard,
+									std::chrono::steady_clock::time_point start, request_trace* trace) -> void;
+	static auto send_stored(evhttp_request* req, const storage_info& info, const std::string& download_path,
+							bool is_temp, request_trace* trace) -> void;	// is_temp: decompressed copy, unlinked
+	static auto send_download(evhttp_request* req, const storage_info& info, const byte_range& range,
+							  request_trace* trace) -> void;	// 206 with Content-Range for a partial range
+	static auto on_request_complete(evhttp_request* req, void* arg) -> void;	// writes the access record
+	static auto on_traced_complete(evhttp_request* req, void* arg) -> void;	// also exports the trace
+	static auto log_access(evhttp_request* req, uint64_t duration_ns) -> void;
+	static auto begin_trace(evhttp_request* req, const char* handler, std::string_view path) -> request_trace*;
 
 	// Helper functions
-	static auto generate_file_list(const std::vector<storage_info>& files) -> std::string;
+	// link_query is appended to every download link; link_versions: each link names its file's version
+	static auto generate_file_list(const std::vector<storage_info>& files, const std::string& link_query,
+								   bool link_versions = false) -> std::string;
+	static auto find_requested(evhttp_request* req, std::string_view url, storage_info& info)
+		-> bool;	// honours ?version= and ?snapshot=, replies on failure
 	static auto format_size(uint64_t bytes) -> std::string;
-	static auto get_etag(const storage_info& info) -> std::string;
+	static auto format_http_date(std::time_t time) -> std::string;
+	static auto parse_http_date(const char* value, std::time_t& time) -> bool;
+	static auto is_not_modified(evhttp_request* req, const storage_info& info) -> bool;	// conditional GET
+	static auto add_validators(evhttp_request* req, const storage_info& info) -> void;	// ETag, Last-Modified, Version
+	static auto cache_key(const storage_info& info) -> std::string;	// small file cache, one per stored version
+	static auto admit_client(evhttp_request* req, uint64_t bytes) -> bool;	// replies 429 when rate limited
+	static auto reject_overloaded(evhttp_request* req) -> void;	// 429, the admission queue is full
+	static auto admin_allowed(evhttp_request* req) -> bool;	// loopback peer or admin token, replies 403 otherwise
+	static auto prepare_storage_directory(evhttp_request* req, const std::string& storage_type, uint64_t size,
+										  std::string& storage_path) -> bool;	// replies on failure
+	// Writes or compresses the content under a fresh version path of file_name, then commits it as file_url;
+	// reply, when given, answers in place of the plain success reply
+	static auto store_upload(evhttp_request* req, const std::string& file_name, const std::string& file_url,
+							 const std::string& storage_type, const std::string& storage_dir,
+							 const std::shared_ptr<const std::string>& content,
+							 std::chrono::steady_clock::time_point start, request_trace* trace, upload_reply reply)
+		-> void;
+	// content: the uncompressed bytes to warm the small file cache with, null when they were never in memory
+	static auto commit_upload(evhttp_request* req, const std::string& temp_path, const std::string& storage_path,
+							  const std::string& file_url, const std::shared_ptr<const std::string>& content,
+							  std::chrono::steady_clock::time_point start, request_trace* trace,
+							  uint32_t dictionary_id, bool chunked, uint32_t checksum, const upload_reply& reply)
+		-> void;
+	static auto write_cold(const std::string& temp_path, const std::string& file_name, const std::string& content,
+						   uint32_t& dictionary_id) -> bool;	// dictionary_id: 0 unless a zstd dictionary was used
+	static auto requested_range(evhttp_request* req, const storage_info& info, uint64_t size, byte_range& range)
+		-> bool;	// size: of what is sent; false when unsatisfiable, 416 is then replied
+
+	// S3 operations, dispatched by s3_request; errors are answered with an S3 XML error body
+	static auto s3_error(evhttp_request* req, int status, const char* code, const char* message) -> void;
+	static auto s3_read_body(evhttp_request* req, std::string& content) -> bool;	// aws-chunked decoded, replies
+	static auto s3_list_buckets(evhttp_request* req) -> void;
+	static auto s3_list_objects(evhttp_request* req, const s3_params& params) -> void;	// ListObjects V1 and V2
+	static auto s3_put_object(request_context& ctx, const std::string& key) -> void;
+	static auto s3_get_object(request_context& ctx, const std::string& key) -> void;	// GET and HEAD
+	static auto s3_delete_object(request_context& ctx, const std::string& key) -> void;
+	static auto s3_create_multipart(evhttp_request* req, const std::string& key) -> void;
+	static auto s3_upload_part(request_context& ctx, const std::string& key, const s3_params& params) -> void;
+	static auto s3_complete_multipart(request_context& ctx, const std::string& key, const std::string& upload_id)
+		-> void;
+	static auto s3_abort_multipart(evhttp_request* req, const std::string& key, const std::string& upload_id) -> void;
 
    public:
 	server();
@@ -3,6 +3,7 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
 
 namespace ricox {
 static constexpr const char* CONFIG_FILE = "../conf/storage_server.json";
@@ -18,7 +19,77 @@ class server_config final {	 // Singleton class to manage server configuration
 	std::string hot_storage_path;
 	std::string storage_info;
 	int bundle_type;  // Compression format
+	size_t fd_cache_capacity;  // Max open descriptors kept for hot storage
+	size_t small_file_cache_bytes;	// Memory budget of the small file cache
+	size_t small_file_max_size;	 // Files up to this size are served from memory
+	std::string io_backend;	 // "blocking" or "io_uring"
+	unsigned io_queue_depth;  // io_uring submission queue entries
+	bool mmap_populate;	 // prefault mapped cold files before decompression
+	unsigned group_commit_window_us;  // time an upload waits for others to share its sync
+	size_t group_commit_max_batch;
+	size_t journal_compact_records;	 // journal length that triggers a snapshot rewrite
 
+	std::string access_log_level;	 // off, error, info or debug, adjustable at runtime via /admin/log
+	unsigned access_log_sample;	 // log one successful request in N
+	std::string admin_token;	 // X-Admin-Token accepted on /admin routes from other hosts, empty: loopback only
+	bool trace_allowed;	 // honour the X-Trace request header
+	std::string trace_path;	 // Chrome trace-event JSON output
+	size_t trace_max_bytes;	 // the output is rotated to <trace_path>.1 beyond this
+	size_t batch_max_entries;	 // files accepted in one /upload-batch archive
+	unsigned worker_threads;	 // CPU-bound work such as batch decompression, 0: one per core
+	std::string segment_path;	 // append-only segment files packing small cold files
+	size_t segment_max_bytes;	 // a segment is sealed once it grows past this
+	size_t segment_block_bytes;	 // uncompressed bytes packed into one block
+	size_t segment_file_max_size;	 // larger cold files, and any compressed with a dictionary, keep their own file
+	unsigned segment_pack_interval_s;
+	double segment_compact_ratio;	 // sealed segments with less live data than this are rewritten
+	std::string dictionary_path;	 // trained zstd dictionaries, <id>-<group>.dict
+	size_t dictionary_max_file_size;	 // cold files up to this size are sampled and dictionary-compressed
+	size_t dictionary_capacity;
+	size_t dictionary_min_samples;
+	size_t dictionary_sample_bytes;	 // sample volume that triggers (re)training a group
+	int dictionary_level;
+	std::string dictionary_group_delimiter;	 // file name prefix before it selects the group
+	size_t dictionary_max_sample_memory;	 // samples buffered across all groups, further ones are skipped
+	unsigned dictionary_collect_interval_s;	 // pause between two passes dropping versions no file uses
+	size_t pipeline_min_bytes;	 // cold uploads from this size are compressed as blocks in a pipeline
+	size_t pipeline_block_bytes;
+	size_t pipeline_window;	 // blocks compressed ahead of the writer, 0: twice the worker threads
+	size_t scrub_bytes_per_s;	 // read rate of the background integrity scrubber, 0 disables it
+	unsigned scrub_interval_s;	 // pause between two passes over the index
+	std::string cache_control;	 // Cache-Control sent with downloads and 304 replies
+	size_t max_connections;	 // open client connections, further ones get 503, 0: unlimited
+	size_t keepalive_max_requests;	 // requests served on one connection before it is closed, 0: unlimited
+	unsigned read_timeout_ms;	 // idle keep-alive wait plus receiving headers and body
+	unsigned write_timeout_ms;	 // sending a reply, stalled readers are dropped after it
+	size_t max_header_bytes;	 // request line and headers
+	size_t max_body_bytes_hot;	 // largest upload body into hot storage
+	size_t max_body_bytes_cold;	 // largest upload body into cold storage
+	double rate_limit_requests_per_s;	 // expensive requests per client, 0 disables request limiting
+	double rate_limit_request_burst;
+	double rate_limit_bytes_per_s;	 // bytes uploaded or read from cold storage per client, 0 disables
+	double rate_limit_byte_burst;
+	size_t rate_limit_max_clients;	 // idle clients are forgotten beyond this many
+	std::string rate_limit_key_header;	// API key header identifying a client, the peer address otherwise
+	std::vector<std::string> rate_limit_api_keys;	// keys accepted in that header, others count as the peer address
+	size_t admission_max_active;	 // concurrent cold compressions and decompressions, 0: worker threads
+	size_t admission_queue_depth;	 // waiting behind them before 429
+	unsigned admission_retry_after_s;	 // Retry-After sent when the queue is full
+	size_t bandwidth_bulk_min_bytes;	 // replies this large are shaped, smaller ones keep the fast lane
+	size_t bandwidth_global_bytes_per_s;	 // shared by all shaped replies, 0: unlimited
+	size_t bandwidth_connection_bytes_per_s;	 // each shaped reply, 0: unlimited
+	unsigned bandwidth_tick_ms;	 // token refill period, shorter is smoother
+	std::string snapshot_path;		 // persisted point-in-time snapshots of the index
+	unsigned snapshot_interval_s;	 // 0: snapshots are only taken on request
+	size_t snapshot_retention;		 // newest snapshots kept, older ones are dropped with the files only they hold
+	size_t version_retention;		 // earlier versions kept per URL, older ones are retired; 0: current only
+	size_t list_max_keys;	 // entries and common prefixes in one /list page, also the default
+	unsigned search_refresh_s;	 // a changed index is copied into the search columns at most this often
+	size_t search_max_results;	 // rows returned by one /search, matches beyond are only counted
+	unsigned access_time_resolution_s;	 // downloads update a recorded access time this old, 0: never recorded
+	std::string s3_bucket;			 // the one bucket the S3 API serves, keys are the file names
+	std::string multipart_path;		 // parts of unfinished S3 multipart uploads
+	unsigned multipart_expiry_s;	 // an upload neither completed nor aborted within this is dropped
 	server_config();
 	server_config(const server_config&) = delete;
 	server_config& operator=(const server_config&) = delete;
@@ -35,6 +106,76 @@ class server_config final {	 // Singleton class to manage server configuration
     auto get_hot_storage_path() const -> const std::string&;
     auto get_storage_info() const -> const std::string&;
     auto get_bundle_type() const -> int;
+    auto get_fd_cache_capacity() const -> size_t;
+    auto get_small_file_cache_bytes() const -> size_t;
+    auto get_small_file_max_size() const -> size_t;
+    auto get_io_backend() const -> const std::string&;
+    auto get_io_queue_depth() const -> unsigned;
+    auto get_mmap_populate() const -> bool;
+    auto get_group_commit_window_us() const -> unsigned;
+    auto get_group_commit_max_batch() const -> size_t;
+    auto get_journal_compact_records() const -> size_t;
+    auto get_access_log_level() const -> const std::string&;
+    auto get_access_log_sample() const -> unsigned;
+    auto get_admin_token() const -> const std::string&;
+    auto get_trace_allowed() const -> bool;
+    auto get_trace_path() const -> const std::string&;
+    auto get_trace_max_bytes() const -> size_t;
+    auto get_batch_max_entries() const -> size_t;
+    auto get_worker_threads() const -> unsigned;
+    auto get_segment_path() const -> const std::string&;
+    auto get_segment_max_bytes() const -> size_t;
+    auto get_segment_block_bytes() const -> size_t;
+    auto get_segment_file_max_size() const -> size_t;
+    auto get_segment_pack_interval_s() const -> unsigned;
+    auto get_segment_compact_ratio() const -> double;
+    auto get_dictionary_path() const -> const std::string&;
+    auto get_dictionary_max_file_size() const -> size_t;
+    auto get_dictionary_capacity() const -> size_t;
+    auto get_dictionary_min_samples() const -> size_t;
+    auto get_dictionary_sample_bytes() const -> size_t;
+    auto get_dictionary_level() const -> int;
+    auto get_dictionary_group_delimiter() const -> const std::string&;
+    auto get_dictionary_max_sample_memory() const -> size_t;
+    auto get_dictionary_collect_interval_s() const -> unsigned;
+    auto get_pipeline_min_bytes() const -> size_t;
+    auto get_pipeline_block_bytes() const -> size_t;
+    auto get_pipeline_window() const -> size_t;
+    auto get_scrub_bytes_per_s() const -> size_t;
+    auto get_scrub_interval_s() const -> unsigned;
+    auto get_cache_control() const -> const std::string&;
+    auto get_max_connections() const -> size_t;
+    auto get_keepalive_max_requests() const -> size_t;
+    auto get_read_timeout_ms() const -> unsigned;
+    auto get_write_timeout_ms() const -> unsigned;
+    auto get_max_header_bytes() const -> size_t;
+    auto get_max_body_bytes_hot() const -> size_t;
+    auto get_max_body_bytes_cold() const -> size_t;
+    auto get_rate_limit_requests_per_s() const -> double;
+    auto get_rate_limit_request_burst() const -> double;
+    auto get_rate_limit_bytes_per_s() const -> double;
+    auto get_rate_limit_byte_burst() const -> double;
+    auto get_rate_limit_max_clients() const -> size_t;
+    auto get_rate_limit_key_header() const -> const std::string&;
+    auto get_rate_limit_api_keys() const -> const std::vector<std::string>&;
+    auto get_admission_max_active() const -> size_t;
+    auto get_admission_queue_depth() const -> size_t;
+    auto get_admission_retry_after_s() const -> unsigned;
+    auto get_bandwidth_bulk_min_bytes() const -> size_t;
+    auto get_bandwidth_global_bytes_per_s() const -> size_t;
+    auto get_bandwidth_connection_bytes_per_s() const -> size_t;
+    auto get_bandwidth_tick_ms() const -> unsigned;
+    auto get_snapshot_path() const -> const std::string&;
+    auto get_snapshot_interval_s() const -> unsigned;
+    auto get_snapshot_retention() const -> size_t;
+    auto get_version_retention() const -> size_t;
+    auto get_list_max_keys() const -> size_t;
+    auto get_search_refresh_s() const -> unsigned;
+    auto get_search_max_results() const -> size_t;
+    auto get_access_time_resolution_s() const -> unsigned;
+    auto get_s3_bucket() const -> const std::string&;
+    auto get_multipart_path() const -> const std::string&;
+    auto get_multipart_expiry_s() const -> unsigned;
 };
 
 }  // namespace ricox
\ No newline at end of file
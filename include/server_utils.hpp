@@ -1,7 +1,9 @@
 #pragma once
 
 #include <jsoncpp/json/json.h>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <vector>
 
 namespace ricox {
@@ -23,17 +25,58 @@ class file_util final {
 	auto read_content(std::string& content, size_t pos, size_t len) const -> bool;	// reads part of file
 	auto write_file(const std::string& content) const -> bool;						// writes entire content buffer
 	auto write_content(const std::string& content, size_t len) const -> bool;		// writes part of content buffer
+	auto write_atomic(const std::string& content) const -> bool;	// temp file, fsync, rename over the target
 	auto compress(const std::string& content, int format) const -> bool;
-	auto decompress(const std::string& download_path) const -> bool;
+	auto compress(const char* data, size_t len, int format) const -> bool;	// packs straight into a mapped file
+	// dictionary_id != 0: a zstd frame compressed with that trained dictionary instead of a bundle payload
+	// checksum: when given, receives the CRC32C of the decompressed bytes
+	// The layout comes from the index record (dictionary_id, chunked), the bytes alone cannot tell it reliably
+	auto decompress(const std::string& download_path, uint32_t dictionary_id = 0, bool chunked = false,
+					uint32_t* checksum = nullptr) const -> bool;	// mapped to mapped
+	auto decompress_content(std::string& content, uint32_t dictionary_id = 0, bool chunked = false) const
+		-> bool;  // mapped to memory
+	static auto unpack(const char* data, size_t len, std::string& content, uint32_t dictionary_id = 0,
+					   bool chunked = false) -> bool;
+	// CRC32C of the decompressed bytes: chunked and unpacked files are streamed piece by piece, calling paced with
+	// the file bytes consumed after each, false from it stops. A single packed payload only unpacks whole, in memory.
+	auto checksum_content(uint32_t dictionary_id, bool chunked, const std::function<bool(size_t)>& paced,
+						  uint32_t& checksum) const -> bool;
+
+	// Size of the decompressed bytes, read from the headers without unpacking anything
+	auto content_size(uint32_t dictionary_id, bool chunked, uint64_t& size) const -> bool;
 
 	auto exists() const -> bool;
 	auto create_directory() const -> bool;
 	auto scan_directory(std::vector<std::string>& files) const -> bool;
 };
 
+class mapped_file final {	// Whole-file memory mapping, unmapped and closed on destruction
+   private:
+	int fd;
+	char* data;
+	size_t size;
+	bool writable;
+
+	auto unmap() -> void;
+
+   public:
+	mapped_file() : fd{-1}, data{nullptr}, size{0}, writable{false} {}
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	auto map_read(const std::string& path, bool populate) -> bool;	 // read-only, advised for sequential access
+	auto map_write(const std::string& path, size_t capacity) -> bool;  // truncates, then preallocates capacity
+	auto finish(size_t final_size) -> bool;							   // unmaps and trims the file to final_size
+
+	auto get_data() const -> char*;
+	auto get_size() const -> size_t;
+};
+
 struct json_util final {
    public:
-	static auto serialize(const Json::Value& json_val, std::string& str) -> bool;
+	static auto serialize(const Json::Value& json_val, std::string& str, bool compact = false) -> bool;
 	static auto deserialize(Json::Value& json_val, const std::string& str) -> bool;
 };
 
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace ricox {
+// Decoders for request text: AVX2 or SSE4.1 kernels chosen at runtime, scalar code for the tails and other CPUs.
+// Both write into a caller-provided string, whose capacity is kept across calls.
+class simd_codec final {
+   public:
+	static auto url_decode(std::string_view in, std::string& out) -> void;	 // %XY escapes and '+' as space
+	static auto base64_decode(std::string_view in, std::string& out) -> bool;  // standard or URL-safe alphabet
+
+	static auto url_decode_scalar(std::string_view in, std::string& out) -> void;
+	static auto base64_decode_scalar(std::string_view in, std::string& out) -> bool;
+
+	static auto isa() -> const char*;  // "avx2", "sse4.1" or "scalar"
+};
+
+}  // namespace ricox
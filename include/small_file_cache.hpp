@@ -0,0 +1,55 @@
+#pragma once
+
+#include <event2/buffer.h>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ricox {
+class small_file_cache final {	// Singleton memory-bounded LRU cache of small file contents, keyed by ETag
+   public:
+	using content_ptr = std::shared_ptr<const std::string>;
+
+   private:
+	using lru_list = std::list<std::string>;  // front: most recently used
+
+	struct entry final {
+		content_ptr content;
+		lru_list::iterator lru_pos;
+	};
+
+	size_t capacity_bytes;	// total bytes of cached content
+	size_t max_file_size;	// larger files are never cached
+	size_t used_bytes;
+	lru_list lru;
+	std::unordered_map<std::string, entry> cache;
+	mutable std::mutex mutex;
+
+	auto evict() -> void;  // drops least recently used entries, caller holds the lock
+
+	small_file_cache();
+	~small_file_cache() = default;
+
+	small_file_cache(const small_file_cache&) = delete;
+	small_file_cache& operator=(const small_file_cache&) = delete;
+
+   public:
+	static auto get_instance() -> small_file_cache&;
+
+	auto is_cacheable(size_t size) const -> bool;
+	auto find(const std::string& etag) -> content_ptr;	// nullptr on miss
+	auto insert(const std::string& etag, content_ptr content) -> void;
+	auto erase(const std::string& etag) -> void;
+	auto size_bytes() const -> size_t;
+
+	// Adds the content, or length bytes of it from offset, to the buffer by reference; the buffer keeps it alive
+	// until sent
+	static auto add_to_buffer(evbuffer* buffer, const content_ptr& content, uint64_t offset = 0,
+							  uint64_t length = std::numeric_limits<uint64_t>::max()) -> bool;
+};
+
+}  // namespace ricox
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "data_manager.hpp"
+
+namespace ricox {
+// Singleton keeping point-in-time snapshots of the index. Taking one copies the index root, so it is O(1) however
+// large the store is; it is then written to the snapshot directory on the worker pool to survive a restart.
+// A file is reclaimed only once neither the index nor any retained snapshot refers to it.
+class snapshot_manager final {
+   public:
+	struct snapshot final {
+	   public:
+		uint64_t id;
+		std::time_t time_created;
+		index_map index;
+	};
+	using snapshot_ptr = std::shared_ptr<const snapshot>;
+
+   private:
+	std::string directory;
+	std::chrono::seconds interval;
+	size_t retention;
+
+	mutable std::mutex mutex;
+	std::map<uint64_t, snapshot_ptr> snapshots;	 // by id, oldest first
+	uint64_t next_id;
+	std::condition_variable cv;
+	bool stopping;
+	std::thread worker;
+
+	auto run() -> void;
+	auto drop_expired() -> void;
+	auto is_referenced(const storage_info& info) const -> bool;	// caller holds mutex
+	auto snapshot_file(const snapshot& s) const -> std::string;
+
+	snapshot_manager();
+	~snapshot_manager();
+
+	snapshot_manager(const snapshot_manager&) = delete;
+	snapshot_manager& operator=(const snapshot_manager&) = delete;
+
+   public:
+	static auto get_instance() -> snapshot_manager&;
+
+	auto start() -> bool;	 // loads persisted snapshots, then takes one every interval unless it is 0
+	auto create() -> snapshot_ptr;
+	auto find(uint64_t id) const -> snapshot_ptr;	 // nullptr once dropped or when unknown
+	auto find_version(std::string_view url, uint64_t version, storage_info& info) const -> bool;  // newest first
+	auto list() const -> std::vector<snapshot_ptr>;	 // oldest first
+	// Retires the files of records an index commit replaced or removed unless a snapshot still holds them.
+	// Callers hold commit_queue::lock_publish(), which orders this with snapshots being taken and dropped.
+	auto release(const std::vector<storage_info>& previous) -> void;
+};
+
+}  // namespace ricox
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <evhttp.h>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ricox {
+class request_trace final {	 // Phase spans of one request, opted in with the X-Trace request header
+   private:
+	struct span final {
+		const char* name;  // string literal
+		uint64_t start_ns;
+		uint64_t duration_ns;
+	};
+
+	uint64_t trace_id;
+	uint64_t start_ns;
+	uint64_t reply_ns;	// when the handler queued the reply, the rest until completion is socket send
+	std::string handler;
+	std::string path;
+	std::vector<span> spans;
+
+   public:
+	request_trace(uint64_t trace_id, const char* handler, std::string_view path);
+
+	static auto now_ns() -> uint64_t;
+	static auto begin(evhttp_request* req, const char* handler, std::string_view path) -> request_trace*;
+
+	auto add_span(const char* name, uint64_t start_ns, uint64_t end_ns) -> void;
+	auto mark_reply() -> void;
+	auto get_trace_id() const -> uint64_t;
+	auto get_start_ns() const -> uint64_t;
+	auto finish() -> void;	// adds the send span, exports the spans and frees the trace
+	// The connection of req closed before the reply completed, so finish() is never called from completion: the
+	// trace is exported and freed once libevent frees req instead, after any reply still being prepared
+	auto abandon(evhttp_request* req) -> void;
+};
+
+class trace_span final {  // records its lifetime as a span, no-op for untraced requests
+   private:
+	request_trace* trace;
+	const char* name;
+	uint64_t start_ns;
+
+   public:
+	trace_span(request_trace* trace, const char* name)
+		: trace{trace}, name{name}, start_ns{trace ? request_trace::now_ns() : 0} {}
+	~trace_span() { end(); }
+
+	trace_span(const trace_span&) = delete;
+	trace_span& operator=(const trace_span&) = delete;
+
+	auto end() -> void {  // closes the span early, e.g. before an asynchronous hand-off
+		if (!trace) return;
+		trace->add_span(name, start_ns, request_trace::now_ns());
+		trace = nullptr;
+	}
+};
+
+class trace_writer final {	// Singleton appending Chrome trace-event JSON ("JSON Array Format") to trace_path
+   private:
+	std::string path;
+	size_t max_bytes;
+	size_t written;	 // bytes in the current output file
+	std::ofstream output;
+	std::mutex mutex;
+
+	auto open_output() -> void;	// appends to path, a new file starts the JSON array
+
+	trace_writer();
+	~trace_writer() = default;
+
+	trace_writer(const trace_writer&) = delete;
+	trace_writer& operator=(const trace_writer&) = delete;
+
+   public:
+	static auto get_instance() -> trace_writer&;
+
+	auto write(const std::string& events) -> void;
+};
+
+}  // namespace ricox
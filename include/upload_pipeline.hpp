@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ricox {
+class mapped_file;
+
+// Chunked cold file layout: a chunked_header followed by block_count blocks, each a chunk_header and a payload
+// packed on its own, so blocks can be compressed in parallel and written as soon as they are ready.
+struct chunked_header final {
+   public:
+	static constexpr uint32_t MAGIC = 0x4b4c4252;  // "RBLK", bundle payloads start with a zero byte instead
+
+	uint32_t magic;
+	uint32_t block_count;
+	uint64_t raw_length;
+};
+
+struct chunk_header final {
+   public:
+	uint32_t format;		 // bundle format of the payload, 0 (RAW): stored as is
+	uint32_t packed_length;	 // payload bytes following the header
+	uint32_t raw_length;
+};
+
+// Compresses a large cold upload block by block on the worker pool while completed blocks are checksummed and
+// appended in order, so compressing later blocks overlaps writing earlier ones. At most `window` blocks wait
+// compressed in memory.
+class upload_pipeline final : public std::enable_shared_from_this<upload_pipeline> {
+   public:
+	using callback = std::function<void(bool ok, uint32_t checksum)>;	 // runs on the event loop
+	using block_sink = std::function<bool(const char* raw, size_t raw_len, size_t packed_len)>;  // false: stop
+
+   private:
+	struct block final {
+		std::string packed;
+		uint32_t format = 0;
+		bool ready = false;
+	};
+
+	std::string temp_path;
+	std::shared_ptr<const void> owner;	// keeps data alive: the upload or the mapping of an assembled file
+	const char* data;
+	uint64_t size;
+	int format;
+	size_t block_bytes;
+	size_t window;
+	callback done;
+
+	int fd;
+	uint64_t offset;	// where the next block is written
+	uint32_t checksum;	// CRC32C of the blocks written so far
+	std::vector<block> blocks;
+	size_t next_compress;
+	size_t next_write;
+	size_t in_flight;  // compression tasks not yet finished
+	bool writing;	   // one worker drains ready blocks at a time, the order on disk is the block order
+	bool failed;
+	std::mutex mutex;
+
+	auto schedule(std::unique_lock<std::mutex>& lock) -> void;
+	auto compress_block(size_t index) -> void;
+	auto write_ready(std::unique_lock<std::mutex>& lock) -> void;
+	auto finish(bool ok, callback cb) -> void;
+
+	static auto run(std::shared_ptr<upload_pipeline> pipeline) -> void;
+
+   public:
+	upload_pipeline(std::string temp_path, std::shared_ptr<const void> owner, const char* data, uint64_t size,
+					int format, callback done);
+	~upload_pipeline();
+
+	upload_pipeline(const upload_pipeline&) = delete;
+	upload_pipeline& operator=(const upload_pipeline&) = delete;
+
+	static auto start(std::string temp_path, std::shared_ptr<const std::string> content, int format, callback done)
+		-> void;
+	static auto start(std::string temp_path, std::shared_ptr<const mapped_file> input, int format, callback done)
+		-> void;	// input: a file mapped read-only, such as an assembled multipart upload
+
+	// Chunked files as written above; the index records which files have this layout, is_chunked only validates
+	// that the magic and the block chain are consistent before they are unpacked
+	static auto is_chunked(const char* data, size_t len) -> bool;
+	static auto raw_length(const char* data) -> uint64_t;  // is_chunked must hold
+	static auto unpack(const char* data, size_t len, char* out, size_t out_len, uint32_t* checksum = nullptr) -> bool;
+	// Hands the blocks to sink one at a time, unpacked into a buffer reused across blocks; false when is_chunked
+	// does not hold, a block is corrupt or sink stopped
+	static auto unpack_blocks(const char* data, size_t len, const block_sink& sink) -> bool;
+};
+
+}  // namespace ricox
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ricox {
+class worker_pool final {  // Singleton pool for CPU-bound work kept off the event loop, results go back via loop_executor
+   public:
+	using task = std::function<void()>;
+
+   private:
+	std::deque<task> tasks;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool stopping;
+	std::vector<std::thread> workers;
+
+	auto run() -> void;
+
+	worker_pool();
+	~worker_pool();
+
+	worker_pool(const worker_pool&) = delete;
+	worker_pool& operator=(const worker_pool&) = delete;
+
+   public:
+	static auto get_instance() -> worker_pool&;
+
+	auto submit(task t) -> void;  // thread-safe
+	auto pending() -> size_t;
+	auto size() const -> size_t;
+};
+
+}  // namespace ricox
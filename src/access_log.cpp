@@ -0,0 +1,155 @@
+#include "access_log.hpp"
+#include "logger.hpp"
+#include "server_config.hpp"
+
+#include <chrono>
+
+namespace ricox {
+static constexpr const char* METHOD_NAMES[] = {"GET",	  "POST",	 "HEAD",  "PUT",	"DELETE",
+											   "OPTIONS", "TRACE",	 "CONNECT", "PATCH"};
+
+access_log::access_log()
+	: slots{std::make_unique<slot[]>(CAPACITY)},
+	  enqueue_pos{0},
+	  dequeue_pos{0},
+	  level{static_cast<uint8_t>(log_level::info)},
+	  sample_every{1},
+	  dropped{0},
+	  stopping{false} {
+	for (auto i = size_t{0}; i < CAPACITY; ++i) slots[i].sequence.store(i, std::memory_order_relaxed);
+
+	auto configured = log_level::info;
+	if (!parse_level(server_config::get_instance().get_access_log_level(), configured)) {
+		common::ERROR("server_logger", "Unknown access_log_level {}, using info",
+					  server_config::get_instance().get_access_log_level());
+	}
+
+	set_level(configured);
+	set_sample_every(server_config::get_instance().get_access_log_sample());
+	formatter = std::thread{[this]() -> void { run(); }};
+}
+
+access_log::~access_log() {
+	stopping.store(true, std::memory_order_release);
+	if (formatter.joinable()) formatter.join();
+}
+
+auto access_log::get_instance() -> access_log& {
+	static auto instance = access_log{};
+	return instance;
+}
+
+auto access_log::parse_level(const std::string& name, log_level& out) -> bool {
+	if (name == "off") {
+		out = log_level::off;
+	} else if (name == "error") {
+		out = log_level::error;
+	} else if (name == "info") {
+		out = log_level::info;
+	} else if (name == "debug") {
+		out = log_level::debug;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+auto access_log::level_name(log_level level) -> const char* {
+	switch (level) {
+		case log_level::off:
+			return "off";
+		case log_level::error:
+			return "error";
+		case log_level::info:
+			return "info";
+		case log_level::debug:
+			return "debug";
+	}
+	return "unknown";
+}
+
+auto access_log::get_level() const -> log_level { return static_cast<log_level>(level.load(std::memory_order_relaxed)); }
+
+auto access_log::set_level(log_level new_level) -> void {
+	level.store(static_cast<uint8_t>(new_level), std::memory_order_relaxed);
+}
+
+auto access_log::get_sample_every() const -> uint32_t { return sample_every.load(std::memory_order_relaxed); }
+
+auto access_log::set_sample_every(uint32_t n) -> void { sample_every.store(n ? n : 1, std::memory_order_relaxed); }
+
+auto access_log::get_dropped() const -> uint64_t { return dropped.load(std::memory_order_relaxed); }
+
+auto access_log::should_log(uint16_t status) const -> bool {
+	// off: nothing; error: failures only; info: failures plus sampled successes; debug: everything
+	auto current = get_level();
+	if (current == log_level::off) return false;
+	if (status >= 400 || current == log_level::debug) return true;
+	if (current == log_level::error) return false;
+
+	thread_local auto seen = uint32_t{0};
+	return ++seen % get_sample_every() == 0;
+}
+
+auto access_log::push(const access_record& record) -> bool {
+	// Bounded MPSC ring (Vyukov): claim a position, write the slot, publish through its sequence
+	auto pos = enqueue_pos.load(std::memory_order_relaxed);
+	while (true) {
+		auto& s = slots[pos & (CAPACITY - 1)];
+		auto sequence = s.sequence.load(std::memory_order_acquire);
+		auto diff = static_cast<int64_t>(sequence) - static_cast<int64_t>(pos);
+
+		if (diff == 0) {
+			if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				s.record = record;
+				s.sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {	// full, the formatter is behind
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		} else {
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+auto access_log::try_pop(access_record& record) -> bool {
+	auto& s = slots[dequeue_pos & (CAPACITY - 1)];
+	if (s.sequence.load(std::memory_order_acquire) != dequeue_pos + 1) return false;
+
+	record = s.record;
+	s.sequence.store(dequeue_pos + CAPACITY, std::memory_order_release);
+	++dequeue_pos;
+	return true;
+}
+
+auto access_log::run() -> void {
+	auto record = access_record{};
+	auto reported_drops = uint64_t{0};
+
+	while (true) {
+		auto idle = true;
+		while (try_pop(record)) {
+			idle = false;
+			auto method = record.method < std::size(METHOD_NAMES) ? METHOD_NAMES[record.method] : "OTHER";
+			common::INFO("server_logger", "access ts={} peer={}:{} method={} path={} status={} bytes={} us={}",
+						 record.timestamp_ns / 1000000, record.peer, record.peer_port, method, record.path,
+						 record.status, record.bytes_out, record.duration_ns / 1000);
+		}
+
+		auto drops = get_dropped();
+		if (drops != reported_drops) {
+			common::ERROR("server_logger", "Access log ring full, {} records dropped so far", drops);
+			reported_drops = drops;
+		}
+
+		if (idle) {
+			if (stopping.load(std::memory_order_acquire)) return;
+			std::this_thread::sleep_for(std::chrono::milliseconds{10});
+		}
+	}
+}
+
+}  // namespace ricox
@@ -0,0 +1,68 @@
+#include "access_tracker.hpp"
+#include "commit_queue.hpp"
+#include "logger.hpp"
+#include "server_config.hpp"
+#include "worker_pool.hpp"
+
+#include <vector>
+
+namespace ricox {
+static constexpr size_t MAX_PENDING = 4096;
+
+access_tracker::access_tracker()
+	: resolution{server_config::get_instance().get_access_time_resolution_s()},
+	  last_flush{std::chrono::steady_clock::now()},
+	  flushing{false} {}
+
+auto access_tracker::get_instance() -> access_tracker& {
+	static auto instance = access_tracker{};
+	return instance;
+}
+
+auto access_tracker::record(const storage_info& info) -> void {
+	auto now = std::time(nullptr);
+	if (resolution.count() == 0 || now - info.time_accessed < resolution.count()) return;
+
+	auto lock = std::lock_guard{mutex};
+	if (flushing && pending.size() >= MAX_PENDING) return;	// a coarse time may skip an access, memory stays bounded
+	pending[info.file_url] = access{info.version, now};
+	auto due = pending.size() >= MAX_PENDING || std::chrono::steady_clock::now() - last_flush >= resolution;
+	if (flushing || !due) return;
+
+	flushing = true;
+	worker_pool::get_instance().submit([this]() -> void { flush(); });
+}
+
+auto access_tracker::flush() -> void {
+	auto batch = std::unordered_map<std::string, access>{};
+	{
+		auto lock = std::lock_guard{mutex};
+		batch.swap(pending);
+	}
+
+	// Under the publish lock no upload, deletion or relocation can slip in between the lookup and the commit
+	auto updated = std::vector<storage_info>{};
+	{
+		auto publish_lock = commit_queue::get_instance().lock_publish();
+		for (const auto& [url, accessed] : batch) {
+			auto current = storage_info{};
+			if (!data_manager::get_instance().find_by_url(url, current) || current.version != accessed.version ||
+				current.time_accessed >= accessed.time) {
+				continue;
+			}
+
+			current.time_accessed = accessed.time;
+			updated.push_back(std::move(current));
+		}
+
+		if (!updated.empty() && !data_manager::get_instance().add_infos(updated)) {
+			common::ERROR("server_logger", "Failed to record access times of {} files", updated.size());
+		}
+	}
+
+	auto lock = std::lock_guard{mutex};
+	last_flush = std::chrono::steady_clock::now();
+	flushing = false;
+}
+
+}  // namespace ricox
@@ -0,0 +1,141 @@
+#include "admission.hpp"
+#include "server_config.hpp"
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ricox {
+static constexpr auto SWEEP_INTERVAL = std::chrono::seconds{1};
+
+auto token_bucket::take(double amount, double rate, double burst, std::chrono::steady_clock::time_point now)
+	-> double {
+	auto elapsed = std::chrono::duration<double>(now - updated).count();
+	tokens = std::min(burst, tokens + elapsed * rate);
+	updated = now;
+
+	// A take larger than the burst is granted once and paid back before the next one
+	if (tokens > 0) {
+		tokens -= amount;
+		return 0;
+	}
+
+	return (1 - tokens) / rate;
+}
+
+rate_limiter::rate_limiter()
+	: request_rate{server_config::get_instance().get_rate_limit_requests_per_s()},
+	  request_burst{server_config::get_instance().get_rate_limit_request_burst()},
+	  byte_rate{server_config::get_instance().get_rate_limit_bytes_per_s()},
+	  byte_burst{server_config::get_instance().get_rate_limit_byte_burst()},
+	  max_clients{server_config::get_instance().get_rate_limit_max_clients()},
+	  key_header{server_config::get_instance().get_rate_limit_key_header()} {
+	request_burst = std::max(request_burst, 1.0);
+	byte_burst = std::max(byte_burst, 1.0);
+	const auto& keys = server_config::get_instance().get_rate_limit_api_keys();
+	api_keys.insert(keys.begin(), keys.end());
+
+	auto now = std::chrono::steady_clock::now();
+	overflow = client_state{{request_burst, now}, {byte_burst, now}};
+}
+
+auto rate_limiter::get_instance() -> rate_limiter& {
+	static auto instance = rate_limiter{};
+	return instance;
+}
+
+auto rate_limiter::client_of(evhttp_request* req) const -> std::string {
+	// Only a configured key names a client, any other value would let each request pick a fresh bucket
+	if (!key_header.empty() && !api_keys.empty()) {
+		auto key = evhttp_find_header(evhttp_request_get_input_headers(req), key_header.c_str());
+		if (key && api_keys.contains(key)) return std::string{"key:"} + key;
+	}
+
+	auto address = static_cast<char*>(nullptr);
+	auto port = ev_uint16_t{0};
+	auto evcon = evhttp_request_get_connection(req);
+	if (evcon) evhttp_connection_get_peer(evcon, &address, &port);
+	return std::string{"ip:"} + (address ? address : "unknown");
+}
+
+auto rate_limiter::take(const std::string& client, uint64_t bytes, unsigned& retry_after_s) -> bool {
+	if (request_rate <= 0 && byte_rate <= 0) return true;
+
+	auto now = std::chrono::steady_clock::now();
+	auto& state = state_of(client, now);
+
+	auto wait = 0.0;
+	if (request_rate > 0) wait = state.requests.take(1, request_rate, request_burst, now);
+	if (wait == 0 && byte_rate > 0) {
+		wait = state.bytes.take(static_cast<double>(bytes), byte_rate, byte_burst, now);
+		if (wait > 0 && request_rate > 0) state.requests.tokens += 1;	// the request was not served after all
+	}
+
+	if (wait == 0) return true;
+	retry_after_s = static_cast<unsigned>(std::ceil(wait));
+	return false;
+}
+
+auto rate_limiter::state_of(const std::string& client, std::chrono::steady_clock::time_point now) -> client_state& {
+	auto it = clients.find(client);
+	if (it != clients.end()) return it->second;
+
+	if (clients.size() >= max_clients && now - last_sweep >= SWEEP_INTERVAL) sweep(now);
+	if (clients.size() >= max_clients) return overflow;	 // no state per client beyond the bound, they share one
+	return clients.emplace(client, client_state{{request_burst, now}, {byte_burst, now}}).first->second;
+}
+
+auto rate_limiter::sweep(std::chrono::steady_clock::time_point now) -> void {
+	last_sweep = now;
+	auto full = [now](const token_bucket& bucket, double rate, double burst) -> bool {
+		return rate <= 0 || bucket.tokens + std::chrono::duration<double>(now - bucket.updated).count() * rate >= burst;
+	};
+
+	// A client whose buckets have refilled is indistinguishable from a new one
+	std::erase_if(clients, [&](const auto& entry) -> bool {
+		return full(entry.second.requests, request_rate, request_burst) &&
+			   full(entry.second.bytes, byte_rate, byte_burst);
+	});
+}
+
+auto rate_limiter::size() const -> size_t { return clients.size(); }
+
+admission_queue::admission_queue()
+	: max_active{server_config::get_instance().get_admission_max_active()},
+	  max_queued{server_config::get_instance().get_admission_queue_depth()},
+	  active{0} {
+	if (max_active == 0) max_active = worker_pool::get_instance().size();
+}
+
+auto admission_queue::get_instance() -> admission_queue& {
+	static auto instance = admission_queue{};
+	return instance;
+}
+
+auto admission_queue::enter(task t) -> bool {
+	if (active < max_active) {
+		++active;
+		t();
+		return true;
+	}
+
+	if (waiting.size() >= max_queued) return false;
+	waiting.push_back(std::move(t));
+	return true;
+}
+
+auto admission_queue::leave() -> void {
+	--active;
+	if (waiting.empty()) return;
+
+	auto next = std::move(waiting.front());
+	waiting.pop_front();
+	++active;
+	next();
+}
+
+auto admission_queue::active_count() const -> size_t { return active; }
+
+auto admission_queue::queued_count() const -> size_t { return waiting.size(); }
+
+}  // namespace ricox
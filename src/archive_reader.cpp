@@ -0,0 +1,179 @@
+#include "archive_reader.hpp"
+#include "bundle.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ricox {
+static constexpr size_t TAR_BLOCK = 512;
+
+// ustar header layout (POSIX.1-1988), offsets and widths of the fields we use
+static constexpr size_t TAR_NAME = 0, TAR_NAME_SIZE = 100;
+static constexpr size_t TAR_SIZE = 124, TAR_SIZE_SIZE = 12;
+static constexpr size_t TAR_CHECKSUM = 148, TAR_CHECKSUM_SIZE = 8;
+static constexpr size_t TAR_TYPE = 156;
+static constexpr size_t TAR_MAGIC = 257;
+static constexpr size_t TAR_PREFIX = 345, TAR_PREFIX_SIZE = 155;
+
+static auto parse_number(const unsigned char* field, size_t size, uint64_t& out) -> bool {
+	out = 0;
+	if (field[0] & 0x80) {	// GNU base-256 encoding for sizes of 8 GiB and more
+		for (auto i = size_t{1}; i < size; ++i) out = (out << 8) | field[i];
+		return true;
+	}
+
+	auto i = size_t{0};
+	while (i < size && field[i] == ' ') ++i;
+	for (; i < size && field[i] >= '0' && field[i] <= '7'; ++i) out = (out << 3) | (field[i] - '0');
+	return i == size || field[i] == ' ' || field[i] == '\0';
+}
+
+static auto field_string(const unsigned char* field, size_t size) -> std::string {
+	auto p = reinterpret_cast<const char*>(field);
+	return std::string{p, strnlen(p, size)};
+}
+
+static auto verify_checksum(const unsigned char* header) -> bool {
+	auto expected = uint64_t{0};
+	if (!parse_number(header + TAR_CHECKSUM, TAR_CHECKSUM_SIZE, expected)) return false;
+
+	// The checksum field itself counts as spaces
+	auto sum = uint64_t{0};
+	for (auto i = size_t{0}; i < TAR_BLOCK; ++i) {
+		auto in_field = i >= TAR_CHECKSUM && i < TAR_CHECKSUM + TAR_CHECKSUM_SIZE;
+		sum += in_field ? ' ' : header[i];
+	}
+	return sum == expected;
+}
+
+static auto pax_path(const std::string& records) -> std::string {
+	// Records are "<length> <key>=<value>\n", the length covering the whole record
+	auto path = std::string{};
+	auto pos = size_t{0};
+	while (pos < records.size()) {
+		auto space = records.find(' ', pos);
+		if (space == std::string::npos) break;
+
+		auto length = std::strtoull(records.c_str() + pos, nullptr, 10);
+		if (length == 0 || pos + length > records.size()) break;
+
+		auto record = std::string_view{records}.substr(space + 1, pos + length - space - 2);	 // drop the newline
+		if (record.starts_with("path=")) path = record.substr(5);
+		pos += length;
+	}
+	return path;
+}
+
+auto archive_reader::parse_format(const std::string& name, archive_format& out) -> bool {
+	if (name.empty() || name == "tar") {
+		out = archive_format::tar;
+	} else if (name == "bun") {
+		out = archive_format::bun;
+	} else if (name == "zip") {
+		out = archive_format::zip;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+auto archive_reader::read(evbuffer* input, archive_format format, const entry_sink& sink) -> bool {
+	return format == archive_format::tar ? read_tar(input, sink) : read_bundle(input, format, sink);
+}
+
+auto archive_reader::read_tar(evbuffer* input, const entry_sink& sink) -> bool {
+	auto long_name = std::string{};	 // from a preceding GNU 'L' or pax 'x' entry
+
+	while (evbuffer_get_length(input) >= TAR_BLOCK) {
+		auto header = evbuffer_pullup(input, TAR_BLOCK);
+		if (std::all_of(header, header + TAR_BLOCK, [](unsigned char c) -> bool { return c == 0; })) {
+			return true;  // end-of-archive marker
+		}
+
+		auto size = uint64_t{0};
+		if (!verify_checksum(header) || !parse_number(header + TAR_SIZE, TAR_SIZE_SIZE, size)) {
+			common::ERROR("server_logger", "Corrupt tar header in batch upload");
+			return false;
+		}
+
+		auto type = static_cast<char>(header[TAR_TYPE]);
+		auto name = field_string(header + TAR_NAME, TAR_NAME_SIZE);
+		if (std::memcmp(header + TAR_MAGIC, "ustar", 5) == 0) {
+			auto prefix = field_string(header + TAR_PREFIX, TAR_PREFIX_SIZE);
+			if (!prefix.empty()) name = prefix + "/" + name;
+		}
+
+		evbuffer_drain(input, TAR_BLOCK);
+
+		// Checked before padding: a base-256 size near 2^64 would wrap around and pass as a small entry
+		auto padded = (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+		if (size > evbuffer_get_length(input) || evbuffer_get_length(input) < padded) {
+			common::ERROR("server_logger", "Truncated tar entry {} in batch upload", name);
+			return false;
+		}
+
+		auto regular = type == '0' || type == '\0' || type == '7';
+		auto metadata = type == 'L' || type == 'x';
+		if (!regular && !metadata) {  // directories, links, devices and global pax headers carry no file
+			evbuffer_drain(input, padded);
+			continue;
+		}
+
+		auto data = std::string(size, '\0');
+		evbuffer_remove(input, data.data(), size);
+		evbuffer_drain(input, padded - size);
+
+		if (type == 'L') {
+			long_name = data.c_str();  // NUL terminated
+			continue;
+		} else if (type == 'x') {
+			long_name = pax_path(data);
+			continue;
+		}
+
+		if (!long_name.empty()) name = std::move(long_name);
+		long_name.clear();
+
+		if (!sink(archive_entry{std::move(name), std::make_shared<const std::string>(std::move(data))})) return true;
+	}
+
+	if (evbuffer_get_length(input) != 0) {
+		common::ERROR("server_logger", "Trailing garbage after the last tar entry in batch upload");
+		return false;
+	}
+
+	return true;  // archive without end-of-archive marker, tolerated
+}
+
+auto archive_reader::read_bundle(evbuffer* input, archive_format format, const entry_sink& sink) -> bool {
+	// Both formats keep their directory at the end, so the whole archive must be in memory first
+	auto size = evbuffer_get_length(input);
+	auto binary = std::string(size, '\0');
+	evbuffer_remove(input, binary.data(), size);
+
+	auto archive = bundle::archive{};
+	auto loaded = format == archive_format::bun ? archive.bun(binary) : archive.zip(binary);
+	binary = std::string{};
+	if (!loaded) {
+		common::ERROR("server_logger", "Unable to parse {} archive in batch upload",
+					  format == archive_format::bun ? "bun" : "zip");
+		return false;
+	}
+
+	for (auto& file : archive) {
+		auto name = file["name"];
+		auto data = std::move(file["data"]);
+		if (format == archive_format::bun && bundle::is_packed(data)) {
+			data = bundle::unpack(data);  // .bun entries are usually packed one by one
+		}
+
+		file.clear();  // release the entry before the next one is handed out
+		if (!sink(archive_entry{std::move(name), std::make_shared<const std::string>(std::move(data))})) break;
+	}
+
+	return true;
+}
+
+}  // namespace ricox
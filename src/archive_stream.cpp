@@ -0,0 +1,265 @@
+#include "archive_stream.hpp"
+#include "access_tracker.hpp"
+#include "admission.hpp"
+#include "checksum.hpp"
+#include "commit_queue.hpp"
+#include "connection_manager.hpp"
+#include "logger.hpp"
+#include "loop_executor.hpp"
+#include "metrics.hpp"
+#include "segment_store.hpp"
+#include "server_config.hpp"
+#include "server_utils.hpp"
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+
+namespace ricox {
+static constexpr size_t TAR_BLOCK = 512;
+static constexpr size_t TAR_NAME_SIZE = 100;
+static constexpr uint64_t TAR_MAX_OCTAL_SIZE = (uint64_t{1} << 33) - 1;	// 11 octal digits
+
+static auto write_number(char* field, size_t size, uint64_t value) -> void {
+	if (value > TAR_MAX_OCTAL_SIZE && size == 12) {	 // GNU base-256 for files of 8 GiB and more
+		field[0] = static_cast<char>(0x80);
+		for (auto i = size - 1; i > 0; --i, value >>= 8) field[i] = static_cast<char>(value & 0xff);
+		return;
+	}
+	std::snprintf(field, size, "%0*llo", static_cast<int>(size - 1), static_cast<unsigned long long>(value));
+}
+
+static auto add_tar_header(evbuffer* buffer, const std::string& name, char type, uint64_t size, std::time_t mtime)
+	-> void {
+	auto header = std::array<char, TAR_BLOCK>{};
+	std::memcpy(header.data(), name.data(), std::min(name.size(), TAR_NAME_SIZE));
+	write_number(header.data() + 100, 8, 0644);	// mode
+	write_number(header.data() + 108, 8, 0);	// uid
+	write_number(header.data() + 116, 8, 0);	// gid
+	write_number(header.data() + 124, 12, size);
+	write_number(header.data() + 136, 12, static_cast<uint64_t>(mtime));
+	header[156] = type;
+	std::memcpy(header.data() + 257, "ustar", 6);
+	std::memcpy(header.data() + 263, "00", 2);
+
+	auto sum = uint64_t{8 * ' '};  // the checksum field counts as spaces
+	for (auto c : header) sum += static_cast<unsigned char>(c);
+	std::snprintf(header.data() + 148, 8, "%06llo", static_cast<unsigned long long>(sum));
+	header[155] = ' ';
+
+	evbuffer_add(buffer, header.data(), header.size());
+}
+
+static auto add_padding(evbuffer* buffer, uint64_t size) -> void {
+	static constexpr auto zeros = std::array<char, TAR_BLOCK>{};
+	if (size % TAR_BLOCK) evbuffer_add(buffer, zeros.data(), TAR_BLOCK - size % TAR_BLOCK);
+}
+
+static auto add_entry_header(evbuffer* buffer, const std::string& name, uint64_t size, std::time_t mtime) -> void {
+	if (name.size() > TAR_NAME_SIZE) {	// GNU long name record, the ustar prefix field cannot hold a flat name
+		add_tar_header(buffer, "././@LongLink", 'L', name.size() + 1, 0);
+		evbuffer_add(buffer, name.c_str(), name.size() + 1);
+		add_padding(buffer, name.size() + 1);
+	}
+	add_tar_header(buffer, name, '0', size, mtime);
+}
+
+archive_stream::archive_stream(evhttp_request* req, std::vector<storage_info> infos, reclaimer::read_guard guard)
+	: req{req},
+	  connection{evhttp_request_get_connection(req)},
+	  guard{std::move(guard)},
+	  next_prepare{0},
+	  next_send{0},
+	  lookahead{2 * worker_pool::get_instance().size()},
+	  sent{0},
+	  sending{false},
+	  finished{false} {
+	entries.reserve(infos.size());
+	for (auto& info : infos) entries.push_back(entry{std::move(info), entry_state::pending, nullptr, nullptr});
+}
+
+auto archive_stream::start(evhttp_request* req, std::vector<storage_info> infos, reclaimer::read_guard guard)
+	-> void {
+	auto stream = std::make_shared<archive_stream>(req, std::move(infos), std::move(guard));
+	stream->self = stream;
+
+	evhttp_add_header(req->output_headers, "Content-Type", "application/x-tar");
+	evhttp_add_header(req->output_headers, "Content-Disposition", "attachment; filename=\"download.tar\"");
+	evhttp_send_reply_start(req, HTTP_OK, "Success");
+	connection_manager::get_instance().on_connection_close(stream->connection,
+															[stream = stream.get()]() -> void { on_close(stream); });
+
+	stream->prepare();
+	stream->pump();
+}
+
+auto archive_stream::prepare() -> void {
+	auto hot_path = server_config::get_instance().get_hot_storage_path();
+	while (next_prepare < entries.size() && next_prepare < next_send + lookahead) {
+		auto index = next_prepare++;
+		auto& e = entries[index];
+
+		if (e.info.in_segment() || e.info.file_path.find(hot_path) == std::string::npos) {
+			prepare_cold(index);
+		} else {
+			e.handle = fd_cache::get_instance().acquire(e.info.file_path);
+			e.state = e.handle ? entry_state::ready : entry_state::failed;
+		}
+	}
+}
+
+auto archive_stream::prepare_cold(size_t index) -> void {
+	auto& e = entries[index];
+	e.state = entry_state::preparing;
+
+	// Each segment read or decompression takes an admission slot like a single cold download, released when its
+	// result is back on the loop
+	auto admitted = admission_queue::get_instance().enter([stream = shared_from_this(), index]() -> void {
+		if (stream->finished) {	 // aborted while waiting for the slot
+			admission_queue::get_instance().leave();
+			return;
+		}
+		stream->unpack_cold(index);
+	});
+
+	if (!admitted) {
+		metrics::add(counter::admission_rejected);
+		e.state = entry_state::failed;
+	}
+}
+
+auto archive_stream::unpack_cold(size_t index) -> void {
+	auto& e = entries[index];
+	if (e.info.in_segment()) {
+		worker_pool::get_instance().submit([stream = shared_from_this(), index, info = e.info]() -> void {
+			auto content = std::make_shared<std::string>();
+			auto ok = segment_store::get_instance().read(info, *content) &&
+					  crc32c::verify(info, crc32c::update(0, content->data(), content->size()));
+
+			loop_executor::get_instance().post([stream, index, ok, content]() -> void {
+				admission_queue::get_instance().leave();
+				auto& e = stream->entries[index];
+				e.content = std::move(content);
+				e.state = ok ? entry_state::ready : entry_state::failed;
+				stream->pump();
+			});
+		});
+		return;
+	}
+
+	// Decompressed into hot storage under a temp name, which is swept at startup should the server die here
+	auto hot_path = server_config::get_instance().get_hot_storage_path();
+	auto name = e.info.file_path.substr(e.info.file_path.find_last_of('/') + 1);
+	auto temp_path = commit_queue::make_temp_path(hot_path + "/" + name);
+	worker_pool::get_instance().submit([stream = shared_from_this(), index, info = e.info, temp_path,
+										hot_path]() -> void {
+		auto handle = fd_cache::handle_ptr{};
+		auto checksum = uint32_t{0};
+		if (file_util{hot_path}.create_directory() &&
+			file_util{info.file_path}.decompress(temp_path, info.dictionary_id, info.chunked, &checksum) &&
+			crc32c::verify(info, checksum)) {
+			handle = fd_cache::open_handle(temp_path);
+		}
+		std::remove(temp_path.c_str());	 // the open descriptor keeps the data until it has been sent
+
+		loop_executor::get_instance().post([stream, index, handle]() -> void {
+			admission_queue::get_instance().leave();
+			auto& e = stream->entries[index];
+			e.handle = handle;
+			e.state = handle ? entry_state::ready : entry_state::failed;
+			stream->pump();
+		});
+	});
+}
+
+auto archive_stream::pump() -> void {
+	if (finished || sending) return;
+
+	if (next_send == entries.size()) {
+		complete();
+		return;
+	}
+
+	auto& e = entries[next_send];
+	if (e.state == entry_state::pending || e.state == entry_state::preparing) return;  // resumed by the worker
+
+	if (e.state == entry_state::failed || !send_entry(e)) {
+		// The status line is gone already, cutting the connection is the only way to report the failure
+		common::ERROR("server_logger", "Unable to stream {} in batch download, aborting", e.info.file_path);
+		abort();
+		return;
+	}
+
+	e.handle.reset();
+	e.content.reset();
+	++next_send;
+	prepare();
+}
+
+auto archive_stream::send_entry(entry& e) -> bool {
+	auto buffer = evbuffer_new();
+	if (!buffer) return false;
+
+	auto size = e.content ? e.content->size() : static_cast<uint64_t>(e.handle->get_file_size());
+	auto mtime = e.content ? e.info.time_modified : e.handle->get_last_write_time();
+	add_entry_header(buffer, e.info.file_name(), size, mtime);
+
+	auto added = !size || (e.content ? small_file_cache::add_to_buffer(buffer, e.content)
+									 : fd_cache::add_to_buffer(buffer, e.handle));
+	if (!added) {
+		evbuffer_free(buffer);
+		return false;
+	}
+	add_padding(buffer, size);
+
+	// The next entry goes out once this one has been flushed, so at most one entry is buffered
+	auto len = evbuffer_get_length(buffer);
+	metrics::add(counter::bytes_out, len);
+	sent += len;
+	connection_manager::get_instance().shape(req, sent);	// on what is sent, cold entries grow when unpacked
+	access_tracker::get_instance().record(e.info);
+	sending = true;
+	evhttp_send_reply_chunk_with_cb(req, buffer, on_chunk_sent, this);
+	evbuffer_free(buffer);
+	return true;
+}
+
+auto archive_stream::complete() -> void {
+	static constexpr auto end_of_archive = std::array<char, 2 * TAR_BLOCK>{};
+
+	auto buffer = evbuffer_new();
+	if (buffer) {
+		evbuffer_add(buffer, end_of_archive.data(), end_of_archive.size());
+		evhttp_send_reply_chunk(req, buffer);
+		evbuffer_free(buffer);
+	}
+
+	finished = true;
+	connection_manager::get_instance().on_connection_close(connection, nullptr);
+	evhttp_send_reply_end(req);
+	self.reset();  // may destroy this session, nothing may follow
+}
+
+auto archive_stream::abort() -> void {
+	finished = true;
+	connection_manager::get_instance().on_connection_close(connection, nullptr);
+	evhttp_connection_free(connection);	 // also frees the request
+	self.reset();
+}
+
+auto archive_stream::on_chunk_sent(evhttp_connection* connection, void* arg) -> void {
+	auto stream = static_cast<archive_stream*>(arg);
+	stream->sending = false;
+	stream->pump();
+}
+
+auto archive_stream::on_close(archive_stream* stream) -> void {
+	// The client went away mid-stream: libevent detaches the request and leaves freeing it to us
+	stream->finished = true;
+	if (!evhttp_request_get_connection(stream->req)) evhttp_send_reply_end(stream->req);
+	stream->self.reset();
+}
+
+}  // namespace ricox
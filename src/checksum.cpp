@@ -0,0 +1,116 @@
+#include "checksum.hpp"
+#include "base64.hpp"
+#include "data_manager.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace ricox {
+static constexpr uint32_t POLYNOMIAL = 0x82f63b78;	// reflected Castagnoli polynomial
+
+using crc_tables = std::array<std::array<uint32_t, 256>, 8>;
+
+static constexpr auto make_tables() -> crc_tables {
+	auto tables = crc_tables{};
+	for (auto i = uint32_t{0}; i < 256; ++i) {
+		auto crc = i;
+		for (auto bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (crc & 1 ? POLYNOMIAL : 0);
+		tables[0][i] = crc;
+	}
+
+	for (auto i = size_t{0}; i < 256; ++i) {
+		for (auto t = size_t{1}; t < 8; ++t) tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xff];
+	}
+
+	return tables;
+}
+
+static constexpr auto TABLES = make_tables();
+
+static auto update_software(uint32_t crc, const unsigned char* p, size_t len) -> uint32_t {
+	for (; len && reinterpret_cast<uintptr_t>(p) % 8; --len) crc = (crc >> 8) ^ TABLES[0][(crc ^ *p++) & 0xff];
+
+	for (; len >= 8; len -= 8, p += 8) {
+		auto low = uint32_t{};
+		auto high = uint32_t{};
+		std::memcpy(&low, p, 4);
+		std::memcpy(&high, p + 4, 4);
+		low ^= crc;
+		crc = TABLES[7][low & 0xff] ^ TABLES[6][(low >> 8) & 0xff] ^ TABLES[5][(low >> 16) & 0xff] ^
+			  TABLES[4][low >> 24] ^ TABLES[3][high & 0xff] ^ TABLES[2][(high >> 8) & 0xff] ^
+			  TABLES[1][(high >> 16) & 0xff] ^ TABLES[0][high >> 24];
+	}
+
+	for (; len; --len) crc = (crc >> 8) ^ TABLES[0][(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static auto update_hardware(uint32_t crc, const unsigned char* p, size_t len)
+	-> uint32_t {
+	for (; len && reinterpret_cast<uintptr_t>(p) % 8; --len) crc = _mm_crc32_u8(crc, *p++);
+
+	auto crc64 = uint64_t{crc};
+	for (; len >= 8; len -= 8, p += 8) {
+		auto word = uint64_t{};
+		std::memcpy(&word, p, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+
+	crc = static_cast<uint32_t>(crc64);
+	for (; len; --len) crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+
+static auto has_sse42() -> bool {
+	static const auto supported = (__builtin_cpu_init(), __builtin_cpu_supports("sse4.2"));
+	return supported;
+}
+#endif
+
+auto crc32c::hardware() -> bool {
+#if defined(__x86_64__)
+	return has_sse42();
+#else
+	return false;
+#endif
+}
+
+auto crc32c::update(uint32_t crc, const void* data, size_t len) -> uint32_t {
+	auto p = static_cast<const unsigned char*>(data);
+	crc = ~crc;
+#if defined(__x86_64__)
+	if (has_sse42()) return ~update_hardware(crc, p, len);
+#endif
+	return ~update_software(crc, p, len);
+}
+
+auto crc32c::to_hex(uint32_t crc) -> std::string {
+	auto hex = std::array<char, 9>{};
+	std::snprintf(hex.data(), hex.size(), "%08x", crc);
+	return std::string{hex.data()};
+}
+
+auto crc32c::to_digest(uint32_t crc) -> std::string {
+	auto bytes = std::array<unsigned char, 4>{static_cast<unsigned char>(crc >> 24), static_cast<unsigned char>(crc >> 16),
+											  static_cast<unsigned char>(crc >> 8), static_cast<unsigned char>(crc)};
+	return "crc32c=" + base64_encode(bytes.data(), bytes.size());
+}
+
+auto crc32c::verify(const storage_info& info, uint32_t crc) -> bool {
+	if (!info.has_checksum || info.checksum == crc) return true;
+
+	metrics::add(counter::checksum_failures);
+	common::ERROR("server_logger", "Checksum mismatch for {}: expected {}, computed {}", info.file_url,
+				  to_hex(info.checksum), to_hex(crc));
+	return false;
+}
+
+}  // namespace ricox
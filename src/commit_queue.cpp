@@ -0,0 +1,282 @@
+#include "commit_queue.hpp"
+#include "logger.hpp"
+#include "loop_executor.hpp"
+#include "metrics.hpp"
+#include "server_config.hpp"
+#include "server_utils.hpp"
+#include "snapshot_manager.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <set>
+#include <unordered_set>
+
+namespace ricox {
+static constexpr const char* TEMP_MARKER = ".uploading.";
+static constexpr const char* VERSION_MARKER = ".~v";
+
+commit_queue::commit_queue()
+	: pending_count{0},
+	  window{server_config::get_instance().get_group_commit_window_us()},
+	  max_batch{server_config::get_instance().get_group_commit_max_batch()},
+	  stopping{false},
+	  worker{[this]() -> void { run(); }} {}
+
+commit_queue::~commit_queue() {
+	{
+		auto lock = std::lock_guard{mutex};
+		stopping = true;
+	}
+
+	cv.notify_all();
+	if (worker.joinable()) worker.join();
+}
+
+auto commit_queue::get_instance() -> commit_queue& {
+	static auto instance = commit_queue{};
+	return instance;
+}
+
+auto commit_queue::submit(commit_request request) -> void {
+	auto group = std::vector<commit_request>{};
+	group.push_back(std::move(request));
+	submit_group(std::move(group));
+}
+
+auto commit_queue::submit_group(std::vector<commit_request> requests) -> void {
+	if (requests.empty()) return;
+
+	{
+		auto lock = std::lock_guard{mutex};
+		pending_count += requests.size();
+		pending.push_back(std::move(requests));
+	}
+
+	cv.notify_one();
+}
+
+auto commit_queue::depth() const -> size_t {
+	auto lock = std::lock_guard{mutex};
+	return pending_count;
+}
+
+auto commit_queue::lock_publish() -> std::unique_lock<std::mutex> { return std::unique_lock{publish_mutex}; }
+
+auto commit_queue::make_temp_path(const std::string& final_path) -> std::string {
+	static auto counter = std::atomic<uint64_t>{0};
+	return final_path + TEMP_MARKER + std::to_string(getpid()) + "." + std::to_string(counter.fetch_add(1));
+}
+
+auto commit_queue::make_version_path(const std::string& storage_path) -> std::string {
+	static auto counter = std::atomic<uint64_t>{0};
+	auto now =
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
+	return storage_path + VERSION_MARKER + std::to_string(now.count()) + "." + std::to_string(counter.fetch_add(1));
+}
+
+auto commit_queue::remove_stale_temps(const std::string& dir) -> void {
+	auto files = std::vector<std::string>{};
+	if (!file_util{dir}.exists() || !file_util{dir}.scan_directory(files)) return;
+
+	for (const auto& file : files) {
+		if (file.find(TEMP_MARKER) == std::string::npos) continue;
+		common::INFO("server_logger", "Removing unfinished upload {}", file);
+		std::remove(file.c_str());
+	}
+}
+
+auto commit_queue::remove_orphan_versions(const std::string& dir) -> void {
+	auto files = std::vector<std::string>{};
+	if (!file_util{dir}.exists() || !file_util{dir}.scan_directory(files)) return;
+
+	// Held by the index, its version chains or a retained snapshot; a record packed into a segment keeps the path
+	// it was packed from, which no longer holds it
+	auto referenced = std::unordered_set<std::string>{};
+	auto collect = [&](const std::string&, const storage_info& info) -> void {
+		if (!info.in_segment()) referenced.insert(info.file_path);
+	};
+	data_manager::get_instance().snapshot().for_each(collect);
+	data_manager::get_instance().for_each_noncurrent(collect);
+	for (const auto& s : snapshot_manager::get_instance().list()) s->index.for_each(collect);
+
+	for (const auto& file : files) {
+		if (file.find(VERSION_MARKER) == std::string::npos || file.find(TEMP_MARKER) != std::string::npos ||
+			referenced.contains(file)) {
+			continue;
+		}
+
+		common::INFO("server_logger", "Removing unreferenced version {}", file);
+		std::remove(file.c_str());
+	}
+}
+
+// The URL a request publishes or deletes, as commit_batch records it
+static auto url_of(const commit_request& request) -> std::string {
+	if (!request.file_url.empty()) return request.file_url;
+	return storage_info::make_url(file_util{request.final_path}.get_file_name());
+}
+
+auto commit_queue::run() -> void {
+	while (true) {
+		auto batch = std::vector<commit_request>{};
+		auto groups = std::vector<size_t>{};	// group of each request, numbered within the batch
+		{
+			auto lock = std::unique_lock{mutex};
+			cv.wait(lock, [this]() -> bool { return stopping || !pending.empty(); });
+			if (pending.empty()) return;  // stopping and drained
+
+			// Give concurrent uploads a short window to join, so they share one sync
+			cv.wait_for(lock, window, [this]() -> bool { return stopping || pending_count >= max_batch; });
+
+			// Whole groups only; a group larger than max_batch is committed on its own. A batch applies all its
+			// uploads before its removals, so an upload and a removal of the same URL cannot share one: the group
+			// that would mix them starts the next batch and the two keep their submission order.
+			auto uploaded = std::unordered_set<std::string>{};
+			auto removed = std::unordered_set<std::string>{};
+			while (!pending.empty() && (batch.empty() || batch.size() + pending.front().size() <= max_batch)) {
+				auto& group = pending.front();
+				auto conflicts = std::any_of(group.begin(), group.end(), [&](const commit_request& request) -> bool {
+					return (request.remove ? uploaded : removed).contains(url_of(request));
+				});
+				if (conflicts && !batch.empty()) break;
+
+				for (const auto& request : group) (request.remove ? removed : uploaded).insert(url_of(request));
+				pending_count -= group.size();
+				groups.insert(groups.end(), group.size(), groups.empty() ? 0 : groups.back() + 1);
+				std::move(group.begin(), group.end(), std::back_inserter(batch));
+				pending.pop_front();
+			}
+		}
+
+		commit_batch(batch, groups);
+	}
+}
+
+auto commit_queue::commit_batch(std::vector<commit_request>& batch, const std::vector<size_t>& groups) -> void {
+	auto timer = scoped_timer{histogram::commit_batch_latency};
+	auto ok = std::vector<bool>(batch.size(), true);
+	auto renamed = std::vector<bool>(batch.size(), false);
+	auto group_ok = std::vector<bool>(groups.empty() ? 0 : groups.back() + 1, true);
+
+	// 1. Make every temp file durable with one syncfs per filesystem instead of one fsync per file
+	auto synced_devices = std::set<dev_t>{};
+	for (auto i = size_t{0}; i < batch.size(); ++i) {
+		if (batch[i].remove) continue;
+
+		struct stat file_stat;
+		if (stat(batch[i].temp_path.c_str(), &file_stat) != 0) {
+			common::ERROR("server_logger", "Upload temp file vanished: {}", batch[i].temp_path);
+			group_ok[groups[i]] = false;
+			continue;
+		}
+
+		if (synced_devices.contains(file_stat.st_dev)) continue;
+
+		auto fd = open(batch[i].temp_path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0 || syncfs(fd) != 0) {
+			common::ERROR("server_logger", "Unable to sync filesystem of {}: {}", batch[i].temp_path, strerror(errno));
+			group_ok[groups[i]] = false;
+		} else {
+			synced_devices.insert(file_stat.st_dev);
+		}
+
+		if (fd >= 0) close(fd);
+	}
+
+	// 2. Publish the files atomically, then persist the directory entries once per directory
+	auto publish_lock = lock_publish();
+	auto directories = std::set<std::string>{};
+	for (auto i = size_t{0}; i < batch.size(); ++i) {
+		if (!group_ok[groups[i]] || batch[i].remove) continue;
+
+		if (std::rename(batch[i].temp_path.c_str(), batch[i].final_path.c_str()) != 0) {
+			common::ERROR("server_logger", "Unable to rename {} into place: {}", batch[i].temp_path, strerror(errno));
+			group_ok[groups[i]] = false;
+			continue;
+		}
+
+		renamed[i] = true;
+		auto pos = batch[i].final_path.find_last_of('/');
+		directories.insert(pos == std::string::npos ? "." : batch[i].final_path.substr(0, pos));
+	}
+
+	for (const auto& dir : directories) {
+		auto fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd >= 0) {
+			fsync(fd);
+			close(fd);
+		}
+	}
+
+	// 3. Every record is prepared first: a group is journaled whole or not at all
+	auto records = std::vector<storage_info>(batch.size());
+	for (auto i = size_t{0}; i < batch.size(); ++i) {
+		if (!group_ok[groups[i]]) continue;
+
+		if (batch[i].remove) {
+			// The publish lock keeps relocations out until the journal is written, and run() never batches a
+			// removal with an upload of the same URL, so this lookup stays true
+			if (!data_manager::get_instance().find_by_url(batch[i].file_url, records[i])) group_ok[groups[i]] = false;
+			continue;
+		}
+
+		auto& info = records[i];
+		if (!info.load_info(batch[i].final_path)) group_ok[groups[i]] = false;
+		if (!batch[i].file_url.empty()) info.file_url = batch[i].file_url;
+		info.dictionary_id = batch[i].dictionary_id;
+		info.chunked = batch[i].chunked;
+		info.has_checksum = batch[i].has_checksum;
+		info.checksum = batch[i].checksum;
+		info.etag = info.make_etag();
+	}
+
+	// The files of a failed group are unpublished: nothing refers to their fresh version paths yet
+	for (auto i = size_t{0}; i < batch.size(); ++i) {
+		ok[i] = group_ok[groups[i]];
+		if (ok[i] || batch[i].remove) continue;
+		std::remove((renamed[i] ? batch[i].final_path : batch[i].temp_path).c_str());
+	}
+
+	// 4. One journal record per file or removal, appended and synced once for the whole batch
+	auto infos = std::vector<storage_info>{};
+	auto removed = std::vector<std::string>{};
+	for (auto i = size_t{0}; i < batch.size(); ++i) {
+		if (!ok[i]) continue;
+
+		if (batch[i].remove) {
+			removed.push_back(batch[i].file_url);
+		} else {
+			records[i].version = data_manager::get_instance().next_version();
+			infos.push_back(records[i]);
+		}
+	}
+
+	auto previous = std::vector<storage_info>{};
+	auto journaled =
+		(infos.empty() && removed.empty()) || data_manager::get_instance().commit(infos, removed, previous);
+	if (!journaled) {
+		common::ERROR("server_logger", "Failed to journal a batch of {} uploads and {} removals", infos.size(),
+					  removed.size());
+	}
+
+	// Replaced and deleted versions go once no snapshot holds them and the downloads that looked them up are done
+	snapshot_manager::get_instance().release(previous);
+	publish_lock.unlock();
+
+	// 5. Acknowledge on the event loop
+	for (auto i = size_t{0}; i < batch.size(); ++i) {
+		auto info = ok[i] ? records[i] : storage_info{};
+		auto success = ok[i] && journaled;
+		loop_executor::get_instance().post([callback = std::move(batch[i].callback), success, info]() -> void {
+			callback(success, info);
+		});
+	}
+}
+
+}  // namespace ricox
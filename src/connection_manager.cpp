@@ -0,0 +1,139 @@
+#include "connection_manager.hpp"
+#include "metrics.hpp"
+#include "server_config.hpp"
+
+#include <algorithm>
+
+namespace ricox {
+static auto to_timeval(unsigned ms) -> timeval {
+	auto tv = timeval{};
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
+	return tv;
+}
+
+// Write limit of bytes_per_s spread over ticks of tick_ms, reads stay unlimited; nullptr for no limit
+static auto make_rate(size_t bytes_per_s, unsigned tick_ms) -> ev_token_bucket_cfg* {
+	if (bytes_per_s == 0) return nullptr;
+
+	auto tick = to_timeval(tick_ms);
+	auto per_tick = std::max<size_t>(bytes_per_s * tick_ms / 1000, 1);
+	return ev_token_bucket_cfg_new(EV_RATE_LIMIT_MAX, EV_RATE_LIMIT_MAX, per_tick, per_tick, &tick);
+}
+
+connection_manager::connection_manager()
+	: max_connections{server_config::get_instance().get_max_connections()},
+	  max_requests{server_config::get_instance().get_keepalive_max_requests()},
+	  read_timeout{to_timeval(server_config::get_instance().get_read_timeout_ms())},
+	  write_timeout{to_timeval(server_config::get_instance().get_write_timeout_ms())},
+	  bulk_min_bytes{server_config::get_instance().get_bandwidth_bulk_min_bytes()},
+	  connection_rate{make_rate(server_config::get_instance().get_bandwidth_connection_bytes_per_s(),
+								server_config::get_instance().get_bandwidth_tick_ms())},
+	  global_rate{make_rate(server_config::get_instance().get_bandwidth_global_bytes_per_s(),
+							server_config::get_instance().get_bandwidth_tick_ms())},
+	  bulk_group{nullptr} {}
+
+connection_manager::~connection_manager() {
+	if (bulk_group) bufferevent_rate_limit_group_free(bulk_group);
+	if (global_rate) ev_token_bucket_cfg_free(global_rate);
+	if (connection_rate) ev_token_bucket_cfg_free(connection_rate);
+}
+
+auto connection_manager::get_instance() -> connection_manager& {
+	static auto instance = connection_manager{};
+	return instance;
+}
+
+auto connection_manager::configure(event_base* base, evhttp* httpd) -> void {
+	const auto& config = server_config::get_instance();
+
+	// libevent rejects a larger body with 413 while receiving it; the tier limit is checked once the tier is known
+	auto max_body = std::max(config.get_max_body_bytes_hot(), config.get_max_body_bytes_cold());
+	evhttp_set_max_body_size(httpd, static_cast<ev_ssize_t>(max_body));
+	evhttp_set_max_headers_size(httpd, static_cast<ev_ssize_t>(config.get_max_header_bytes()));
+	evhttp_set_timeout_tv(httpd, &read_timeout);
+
+	if (global_rate && !bulk_group) bulk_group = bufferevent_rate_limit_group_new(base, global_rate);
+}
+
+auto connection_manager::admit(evhttp_request* req) -> bool {
+	auto evcon = evhttp_request_get_connection(req);
+	if (!evcon) return true;
+
+	auto it = connections.find(evcon);
+	if (it == connections.end()) {
+		// A new connection over the cap is told to come back instead of queueing behind the others
+		if (max_connections && connections.size() >= max_connections) {
+			metrics::add(counter::connections_shed);
+			auto headers = evhttp_request_get_output_headers(req);
+			evhttp_add_header(headers, "Connection", "close");
+			evhttp_add_header(headers, "Retry-After", "1");
+			evhttp_send_reply(req, HTTP_SERVUNAVAIL, "Too many connections", nullptr);
+			return false;
+		}
+
+		it = connections.emplace(evcon, connection_state{0, false, nullptr}).first;
+		evhttp_connection_set_closecb(evcon, on_close, this);
+		bufferevent_priority_set(evhttp_connection_get_bufferevent(evcon), FAST_PRIORITY);
+	}
+
+	// The last request allowed on this connection closes it once answered
+	if (max_requests && ++it->second.requests >= max_requests) {
+		evhttp_add_header(evhttp_request_get_output_headers(req), "Connection", "close");
+	}
+
+	evhttp_connection_set_timeout_tv(evcon, &write_timeout);
+	return true;
+}
+
+auto connection_manager::shape(evhttp_request* req, uint64_t reply_bytes) -> void {
+	if (reply_bytes < bulk_min_bytes) return;
+
+	auto evcon = evhttp_request_get_connection(req);
+	auto it = evcon ? connections.find(evcon) : connections.end();
+	if (it == connections.end() || it->second.shaped) return;
+
+	auto bev = evhttp_connection_get_bufferevent(evcon);
+	if (connection_rate) bufferevent_set_rate_limit(bev, connection_rate);
+	if (bulk_group) bufferevent_add_to_rate_limit_group(bev, bulk_group);
+	bufferevent_priority_set(bev, BULK_PRIORITY);
+	it->second.shaped = true;
+}
+
+auto connection_manager::complete(evhttp_request* req) -> void {
+	auto evcon = evhttp_request_get_connection(req);
+	auto it = evcon ? connections.find(evcon) : connections.end();
+	if (it == connections.end()) return;
+
+	// A keep-alive connection may ask for a small file next, which must not inherit the bulk limits
+	if (it->second.shaped) unshape(evcon, it->second);
+	evhttp_connection_set_timeout_tv(evcon, &read_timeout);
+}
+
+auto connection_manager::unshape(evhttp_connection* evcon, connection_state& state) -> void {
+	auto bev = evhttp_connection_get_bufferevent(evcon);
+	if (bulk_group) bufferevent_remove_from_rate_limit_group(bev);
+	if (connection_rate) bufferevent_set_rate_limit(bev, nullptr);
+	bufferevent_priority_set(bev, FAST_PRIORITY);
+	state.shaped = false;
+}
+
+auto connection_manager::on_connection_close(evhttp_connection* evcon, close_listener listener) -> void {
+	auto it = connections.find(evcon);
+	if (it != connections.end()) it->second.listener = std::move(listener);
+}
+
+auto connection_manager::size() const -> size_t { return connections.size(); }
+
+auto connection_manager::on_close(evhttp_connection* evcon, void* arg) -> void {
+	// libevent takes a freed bufferevent out of its rate-limit group itself
+	auto& connections = static_cast<connection_manager*>(arg)->connections;
+	auto it = connections.find(evcon);
+	if (it == connections.end()) return;
+
+	auto listener = std::move(it->second.listener);
+	connections.erase(it);
+	if (listener) listener();
+}
+
+}  // namespace ricox
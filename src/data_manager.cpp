@@ -1,8 +1,16 @@
 #include "data_manager.hpp"
+#include "checksum.hpp"
+#include "fd_cache.hpp"
+#include "io_backend.hpp"
 #include "logger.hpp"
+#include "metrics.hpp"
 #include "server_config.hpp"
 #include "server_utils.hpp"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
 #include <vector>
 
 namespace ricox {
@@ -19,126 +27,401 @@ auto storage_info::load_info(const std::string& path) -> bool {
 	time_accessed = file.get_last_access_time();
 	file_size = static_cast<size_t>(file.get_file_size());
 	file_path = path;
-	file_url = server_config::get_instance().get_download_url_prefix() + "/" + file.get_file_name();
-
-	common::INFO("server_logger", "Loaded storage info for file: {}", path);
-	common::INFO("server_logger", "URL: {}, Last Modified: {}, Last Accessed: {}, Size: {}", file_url, time_modified,
-				 time_accessed, file_size);
+	file_url = make_url(file.get_file_name());
+	segment_id = 0;
+	dictionary_id = 0;
+	chunked = false;
+	has_checksum = false;
+	checksum = 0;
+	etag.clear();
 
 	return true;
 }
 
-data_manager::data_manager() : storage_file{server_config::get_instance().get_storage_info()}, is_cold_storage{false} {}
+auto storage_info::make_etag() const -> std::string {
+	if (has_checksum) return "\"" + crc32c::to_hex(checksum) + "-" + std::to_string(file_size) + "\"";
+
+	auto name = file_path.substr(file_path.find_last_of('/') + 1);
+	return "W/\"" + name + "-" + std::to_string(file_size) + "-" + std::to_string(time_modified) + "\"";
+}
+
+auto storage_info::file_name() const -> std::string {
+	// Names may hold '/' (S3 keys), so strip the prefix rather than take the last path component
+	const auto& prefix = server_config::get_instance().get_download_url_prefix();
+	if (file_url.size() > prefix.size() && file_url.starts_with(prefix) && file_url[prefix.size()] == '/') {
+		return file_url.substr(prefix.size() + 1);
+	}
+	return file_url.substr(file_url.find_last_of('/') + 1);
+}
+
+auto storage_info::make_url(const std::string& file_name) -> std::string {
+	return server_config::get_instance().get_download_url_prefix() + "/" + file_name;
+}
+
+// Index records are the same JSON objects in the snapshot array and in the journal lines
+static auto to_json(const storage_info& info) -> Json::Value {
+	auto item = Json::Value{};
+	item["time_modified"] = static_cast<Json::Int64>(info.time_modified);
+	item["time_accessed"] = static_cast<Json::Int64>(info.time_accessed);
+	item["file_size"] = static_cast<Json::UInt64>(info.file_size);
+	item["file_path"] = info.file_path.c_str();
+	item["file_url"] = info.file_url.c_str();
+	if (info.in_segment()) {
+		item["segment_id"] = static_cast<Json::UInt64>(info.segment_id);
+		item["block_offset"] = static_cast<Json::UInt64>(info.block_offset);
+		item["block_length"] = info.block_length;
+		item["entry_offset"] = info.entry_offset;
+	}
+	if (info.dictionary_id) item["dictionary_id"] = info.dictionary_id;
+	if (info.chunked) item["chunked"] = true;
+	if (info.has_checksum) item["crc32c"] = info.checksum;
+	item["etag"] = info.etag.c_str();
+	if (info.version) item["version"] = static_cast<Json::UInt64>(info.version);
+	if (info.superseded) item["superseded"] = static_cast<Json::UInt64>(info.superseded);
+	return item;
+}
+
+static auto from_json(const Json::Value& item) -> storage_info {
+	auto file_info = storage_info{};
+	file_info.time_modified = item["time_modified"].asInt64();
+	file_info.time_accessed = item["time_accessed"].asInt64();
+	file_info.file_size = item["file_size"].asUInt64();
+	file_info.file_path = item["file_path"].asString();
+	file_info.file_url = item["file_url"].asString();
+	file_info.segment_id = item.get("segment_id", 0).asUInt64();
+	file_info.block_offset = item.get("block_offset", 0).asUInt64();
+	file_info.block_length = item.get("block_length", 0).asUInt();
+	file_info.entry_offset = item.get("entry_offset", 0).asUInt();
+	file_info.dictionary_id = item.get("dictionary_id", 0).asUInt();
+	file_info.chunked = item.get("chunked", false).asBool();
+	file_info.has_checksum = item.isMember("crc32c");
+	file_info.checksum = item.get("crc32c", 0).asUInt();
+	file_info.etag = item.get("etag", "").asString();
+	if (file_info.etag.empty()) file_info.etag = file_info.make_etag();	 // index written before ETags were stored
+	file_info.version = item.get("version", 0).asUInt64();
+	file_info.superseded = item.get("superseded", 0).asUInt64();
+	return file_info;
+}
+
+data_manager::data_manager()
+	: storage_file{server_config::get_instance().get_storage_info()},
+	  journal_file{storage_file + ".journal"},
+	  journal_fd{-1},
+	  journal_records{0},
+	  version_retention{server_config::get_instance().get_version_retention()},
+	  last_version{0},
+	  changes{0},
+	  is_cold_storage{false} {}
+
+data_manager::~data_manager() {
+	if (journal_fd >= 0) close(journal_fd);
+}
 
 auto data_manager::get_instance() -> data_manager& {
 	static auto instance = data_manager{};
 	return instance;
 }
 
-auto data_manager::add_info(const storage_info& info) -> bool {
-	auto lock = std::unique_lock{mutex};
-	storage_map.try_emplace(info.file_url, info);
-	if (is_cold_storage && !store_info()) {
-		common::ERROR("server_logger", "Failed to store storage info for cold storage");
+auto data_manager::write_index(const index_map& map, const std::string& path, const version_map* chains) -> bool {
+	auto root = Json::Value{Json::arrayValue};
+
+	// Prepare JSON array to hold storage info, earlier versions marked and each chain newest first
+	map.for_each([&](const std::string&, const storage_info& info) -> void { root.append(to_json(info)); });
+	if (chains) {
+		chains->for_each([&](const std::string&, const std::vector<storage_info>& chain) -> void {
+			for (const auto& info : chain) {
+				auto item = to_json(info);
+				item["noncurrent"] = true;
+				root.append(item);
+			}
+		});
+	}
+
+	// Serialize JSON to string
+	auto json_str = std::string{};
+	if (!json_util::serialize(root, json_str)) {
+		common::ERROR("server_logger", "Failed to serialize storage info to JSON");
+		return false;
+	}
+
+	// Replace the file atomically, a crash leaves either the old or the new one
+	if (!file_util{path}.write_atomic(json_str)) {
+		common::ERROR("server_logger", "Failed to write storage info to file: {}", path);
 		return false;
 	}
 
 	return true;
 }
 
-auto data_manager::store_info() -> bool {
-	auto infos = std::vector<storage_info>{};
-	if (!find_all(infos)) {
-		common::ERROR("server_logger", "Failed to find all storage info (Maybe empty map)");
+auto data_manager::read_index(const std::string& path, index_map& map, version_map* chains) -> bool {
+	auto body = std::string{};
+	if (!file_util{path}.read_file(body)) {
+		common::ERROR("server_logger", "Failed to read storage info file: {}", path);
 		return false;
 	}
 
 	auto root = Json::Value{};
+	if (!json_util::deserialize(root, body)) {
+		common::ERROR("server_logger", "Failed to parse storage info JSON in {}", path);
+		return false;
+	}
+
+	for (const auto& item : root) {
+		auto file_info = from_json(item);
+		if (!item.get("noncurrent", false).asBool()) {
+			map = map.set(file_info.file_url, file_info);
+		} else if (chains) {
+			auto held = chains->find(file_info.file_url);
+			auto chain = held ? *held : std::vector<storage_info>{};
+			chain.push_back(file_info);
+			*chains = chains->set(file_info.file_url, std::move(chain));
+		}
+	}
+
+	return true;
+}
+
+auto data_manager::add_info(const storage_info& info) -> bool { return add_infos({info}); }
 
-	// Prepare JSON array to hold storage info
+auto data_manager::add_infos(const std::vector<storage_info>& infos) -> bool {
+	auto previous = std::vector<storage_info>{};
+	return commit(infos, {}, previous);
+}
+
+auto data_manager::commit(const std::vector<storage_info>& infos, const std::vector<std::string>& removed,
+						  std::vector<storage_info>& previous) -> bool {
+	auto compact = false;
+	{
+		// Commits are serialized by the journal lock, so records land in the journal in the order they change the
+		// index, and the new root is only published once its records are durable
+		auto journal_lock = std::lock_guard{journal_mutex};
+		auto map = index_map{};	 // built on the side; snapshots taken before keep the old roots
+		auto chains = version_map{};
+		{
+			auto lock = timed_lock<std::shared_lock<std::shared_mutex>>(mutex);
+			map = storage_map;
+			chains = history;
+		}
+
+		auto removed_version = removed.empty() ? 0 : next_version();
+		auto dropped = std::vector<storage_info>{};
+		auto erased = std::vector<std::string>{};
+		apply(map, chains, infos, removed, removed_version, dropped, erased);
+
+		if (!append_journal(infos, removed, removed_version, compact)) {
+			common::ERROR("server_logger", "Failed to journal {} storage info records", infos.size() + removed.size());
+			return false;
+		}
+
+		auto lock = timed_lock<std::unique_lock<std::shared_mutex>>(mutex);
+		for (const auto& info : infos) ordered_urls.insert(info.file_url);
+		for (const auto& url : erased) ordered_urls.erase(url);
+		storage_map = std::move(map);
+		history = std::move(chains);
+		++changes;
+		previous.insert(previous.end(), dropped.begin(), dropped.end());
+	}
+
+	if (compact && !store_info()) {
+		common::ERROR("server_logger", "Failed to compact index journal into {}", storage_file);
+	}
+
+	return true;
+}
+
+auto data_manager::apply(index_map& map, version_map& chains, const std::vector<storage_info>& infos,
+						 const std::vector<std::string>& removed, uint64_t removed_version,
+						 std::vector<storage_info>& dropped, std::vector<std::string>& erased) const -> void {
+	auto retire = [&](storage_info earlier, uint64_t superseded) -> void {
+		if (version_retention == 0) {
+			dropped.push_back(std::move(earlier));
+			return;
+		}
+
+		auto held = chains.find(earlier.file_url);
+		auto chain = held ? *held : std::vector<storage_info>{};
+		earlier.superseded = superseded;
+		chain.insert(chain.begin(), std::move(earlier));
+		while (chain.size() > version_retention) {	// the oldest versions go first
+			dropped.push_back(std::move(chain.back()));
+			chain.pop_back();
+		}
+
+		chains = chains.set(chain.front().file_url, std::move(chain));
+	};
+
+	for (const auto& info : infos) {
+		if (auto existing = map.find(info.file_url)) {
+			// A relocation keeps the version, only its old location goes
+			if (existing->version == info.version) {
+				dropped.push_back(*existing);
+			} else {
+				retire(*existing, info.version);
+			}
+		}
+		map = map.set(info.file_url, info);
+	}
+
+	for (const auto& url : removed) {
+		auto existing = map.find(url);
+		if (!existing) continue;
+
+		retire(*existing, removed_version);
+		erased.push_back(url);
+		map = map.erase(url);
+	}
+}
+
+auto data_manager::append_journal(const std::vector<storage_info>& infos, const std::vector<std::string>& removed,
+								  uint64_t removed_version, bool& compact) -> bool {
+	auto records = std::string{};
 	for (const auto& info : infos) {
+		auto line = std::string{};
+		if (!json_util::serialize(to_json(info), line, true)) return false;
+		records += line + "\n";
+	}
+
+	// A removal is a tombstone record, replay moves the URL's record into its version chain
+	for (const auto& url : removed) {
 		auto item = Json::Value{};
-		item["time_modified"] = static_cast<Json::Int64>(info.time_modified);
-		item["time_accessed"] = static_cast<Json::Int64>(info.time_accessed);
-		item["file_size"] = static_cast<Json::UInt64>(info.file_size);
-		item["file_path"] = info.file_path.c_str();
-		item["file_url"] = info.file_url.c_str();
-		root.append(item);
+		item["file_url"] = url.c_str();
+		item["deleted"] = true;
+		item["version"] = static_cast<Json::UInt64>(removed_version);
+
+		auto line = std::string{};
+		if (!json_util::serialize(item, line, true)) return false;
+		records += line + "\n";
 	}
 
-	// Serialize JSON to string
-	auto json_str = std::string{};
-	if (!json_util::serialize(root, json_str)) {
-		common::ERROR("server_logger", "Failed to serialize storage info to JSON");
+	if (journal_fd < 0) {
+		journal_fd = open(journal_file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (journal_fd < 0) {
+			common::ERROR("server_logger", "Unable to open index journal {}", journal_file);
+			return false;
+		}
+	}
+
+	// One append and one sync for the whole batch of records (O_APPEND ignores the offset)
+	if (!io_backend::get_instance().write(journal_fd, records.data(), records.size(), 0) ||
+		!io_backend::get_instance().sync(journal_fd)) {
+		common::ERROR("server_logger", "Failed to append to index journal {}", journal_file);
 		return false;
 	}
 
-	// Write JSON string to file
-	auto file = file_util{storage_file};
-	if (!file.write_file(json_str)) {
-		common::ERROR("server_logger", "Failed to write storage info to file: {}", storage_file);
+	journal_records += infos.size() + removed.size();
+	compact = journal_records >= server_config::get_instance().get_journal_compact_records();
+	return true;
+}
+
+auto data_manager::store_info() -> bool {
+	// Held across snapshot and truncation so no journal record can fall between the two
+	auto journal_lock = std::lock_guard{journal_mutex};
+	auto map = index_map{};
+	auto chains = version_map{};
+	{
+		auto lock = timed_lock<std::shared_lock<std::shared_mutex>>(mutex);
+		map = storage_map;
+		chains = history;
+	}
+	if (!write_index(map, storage_file, &chains)) return false;
+
+	// Everything journaled so far is in the snapshot now
+	if (journal_fd >= 0 && ftruncate(journal_fd, 0) != 0) {
+		common::ERROR("server_logger", "Failed to truncate index journal {}", journal_file);
 		return false;
 	}
 
+	journal_records = 0;
 	return true;
 }
 
 auto data_manager::initialize() -> bool {
 	auto file = file_util{storage_file};
-	if (!file.exists()) {
+	if (file.exists()) {
+		auto map = index_map{};
+		auto chains = version_map{};
+		if (!read_index(storage_file, map, &chains)) return false;
+
+		auto lock = timed_lock<std::unique_lock<std::shared_mutex>>(mutex);
+		storage_map = std::move(map);
+		history = std::move(chains);
+		storage_map.for_each([this](const std::string& url, const storage_info&) -> void { ordered_urls.insert(url); });
+	} else {
 		common::ERROR("server_logger", "Storage info file does not exist: {}", storage_file);
-		return true;
 	}
 
+	if (!replay_journal()) return false;
+
+	// Versions handed out from now on stay above every recorded one, even after the clock went back
+	auto map = snapshot();
+	auto newest = uint64_t{0};
+	map.for_each(
+		[&](const std::string&, const storage_info& info) -> void { newest = std::max(newest, info.version); });
+	for_each_noncurrent([&](const std::string&, const storage_info& info) -> void {
+		newest = std::max({newest, info.version, info.superseded});
+	});
+	last_version = newest;
+
+	common::INFO("server_logger", "Initialized data manager with {} storage entries", map.size());
+	return true;
+}
+
+auto data_manager::replay_journal() -> bool {
+	auto journal = file_util{journal_file};
+	if (!journal.exists()) return true;
+
 	auto body = std::string{};
-	if (!file.read_file(body)) {
-		common::ERROR("server_logger", "Failed to read storage info file: {}", storage_file);
+	if (!journal.read_file(body)) {
+		common::ERROR("server_logger", "Failed to read index journal: {}", journal_file);
 		return false;
 	}
 
-	auto root = Json::Value{};
-	if (!json_util::deserialize(root, body)) {
-		common::ERROR("server_logger", "Failed to parse storage info JSON");
-		return false;
-	}
+	// Records are applied one by one as commit() applied them; versions trimmed here were retired before the
+	// crash or are orphans the startup sweep removes
+	auto lock = timed_lock<std::unique_lock<std::shared_mutex>>(mutex);
+	auto dropped = std::vector<storage_info>{};
+	auto erased = std::vector<std::string>{};
+	auto start = size_t{0};
+	while (start < body.size()) {
+		auto end = body.find('\n', start);
+		if (end == std::string::npos) break;  // torn final record from a crash, never acknowledged
 
-	for (const auto& item : root) {
-		auto file_info = storage_info{};
-		file_info.time_modified = item["time_modified"].asInt64();
-		file_info.time_accessed = item["time_accessed"].asInt64();
-		file_info.file_size = item["file_size"].asUInt64();
-		file_info.file_path = item["file_path"].asString();
-		file_info.file_url = item["file_url"].asString();
-
-		if (!add_info(file_info)) {
-			common::ERROR("server_logger", "Failed to add storage info for file: {}", file_info.file_path);
-			return false;
+		auto item = Json::Value{};
+		if (json_util::deserialize(item, body.substr(start, end - start))) {
+			if (item.get("deleted", false).asBool()) {
+				auto url = item["file_url"].asString();
+				apply(storage_map, history, {}, {url}, item.get("version", 0).asUInt64(), dropped, erased);
+				ordered_urls.erase(url);
+			} else {
+				auto file_info = from_json(item);
+				apply(storage_map, history, {file_info}, {}, 0, dropped, erased);
+				ordered_urls.insert(file_info.file_url);
+			}
+			dropped.clear();
+			erased.clear();
+			++journal_records;
 		}
+
+		start = end + 1;
 	}
 
-	common::INFO("server_logger", "Initialized data manager with {} storage entries", storage_map.size());
 	return true;
 }
 
 auto data_manager::update(const storage_info& info) -> bool {
-	{
-		auto lock = std::unique_lock{mutex};
-		storage_map[info.file_url] = info;
-	}
-
-	if (!store_info()) {
+	if (!add_infos({info})) {
 		common::ERROR("server_logger", "Failed to update storage info for file: {}", info.file_path);
 		return false;
 	}
 
+	fd_cache::get_instance().invalidate(info.file_path);  // cached descriptor and stat may be stale now
 	return true;
 }
 
-auto data_manager::find_by_url(const std::string& url, storage_info& info) const -> bool {
-	auto lock = std::shared_lock{mutex};
-	auto it = storage_map.find(url);
-	if (it != storage_map.end()) {
-		info = it->second;
+auto data_manager::find_by_url(std::string_view url, storage_info& info) const -> bool {
+	auto lock = timed_lock<std::shared_lock<std::shared_mutex>>(mutex);
+	if (auto found = storage_map.find(url)) {
+		info = *found;
 		return true;
 	}
 
@@ -146,25 +429,182 @@ auto data_manager::find_by_url(const std::string& url, storage_info& info) const
 }
 
 auto data_manager::find_by_path(const std::string& path, storage_info& info) const -> bool {
-	auto lock = std::shared_lock{mutex};
-	for (const auto& [_, storage_info] : storage_map) {
-		if (storage_info.file_path == path) {
-			info = storage_info;
-			return true;
+	auto found = false;
+	snapshot().for_each([&](const std::string&, const storage_info& current) -> void {
+		if (found || current.file_path != path) return;
+		info = current;
+		found = true;
+	});
+
+	return found;
+}
+
+auto data_manager::find_all(std::vector<storage_info>& infos) const -> bool {
+	// Copied from a snapshot, so commits are not held up while the entries are copied
+	auto map = snapshot();
+	infos.clear();
+	infos.reserve(map.size());
+	map.for_each([&](const std::string&, const storage_info& info) -> void { infos.emplace_back(info); });
+
+	return !infos.empty();
+}
+
+// The first string after every string beginning with prefix, empty when there is none
+static auto prefix_end(std::string prefix) -> std::string {
+	while (!prefix.empty() && static_cast<unsigned char>(prefix.back()) == 0xff) prefix.pop_back();
+	if (!prefix.empty()) prefix.back() = static_cast<char>(static_cast<unsigned char>(prefix.back()) + 1);
+	return prefix;
+}
+
+// The paging of a listing over URLs in order from it: url_of and record_of read an entry, lower_bound finds the
+// first entry not before a URL
+template <typename Iterator, typename LowerBound, typename UrlOf, typename RecordOf>
+static auto list_range(Iterator it, Iterator last, LowerBound lower_bound, UrlOf url_of, RecordOf record_of,
+					   std::string_view prefix, std::string_view delimiter, std::string_view start_after,
+					   size_t max_keys, listing& result) -> void {
+	auto skip_past = [&](const std::string& rolled_up) -> Iterator {
+		auto end = prefix_end(rolled_up);
+		return end.empty() ? last : lower_bound(end);
+	};
+
+	// A page of no keys is never truncated, it would have no marker to continue from
+	if (max_keys == 0) return;
+
+	auto returned = size_t{0};
+	while (it != last && url_of(it).starts_with(prefix)) {
+		const auto& url = url_of(it);
+		auto rest = std::string_view{url}.substr(prefix.size());
+		auto pos = delimiter.empty() ? std::string_view::npos : rest.find(delimiter);
+		if (pos != std::string_view::npos) {
+			// One entry for the whole group, then straight past it
+			auto rolled_up = url.substr(0, prefix.size() + pos + delimiter.size());
+			if (rolled_up == start_after) {
+				it = skip_past(rolled_up);	// returned on the previous page
+				continue;
+			}
+
+			if (returned == max_keys) {
+				result.truncated = true;
+				break;
+			}
+
+			it = skip_past(rolled_up);
+			result.next_marker = rolled_up;
+			result.common_prefixes.push_back(std::move(rolled_up));
+			++returned;
+			continue;
 		}
+
+		if (returned == max_keys) {
+			result.truncated = true;
+			break;
+		}
+
+		result.files.push_back(record_of(it));
+		result.next_marker = url;
+		++returned;
+		++it;
 	}
+}
 
-	return false;
+auto data_manager::list(std::string_view prefix, std::string_view delimiter, std::string_view start_after,
+						size_t max_keys, listing& result) const -> void {
+	auto lock = timed_lock<std::shared_lock<std::shared_mutex>>(mutex);
+	using iterator = decltype(ordered_urls.begin());
+	auto it = start_after > prefix ? ordered_urls.upper_bound(start_after) : ordered_urls.lower_bound(prefix);
+	list_range(
+		it, ordered_urls.end(), [this](const std::string& url) -> iterator { return ordered_urls.lower_bound(url); },
+		[](iterator at) -> const std::string& { return *at; },
+		[this](iterator at) -> const storage_info& { return *storage_map.find(*at); }, prefix, delimiter,
+		start_after, max_keys, result);
 }
 
-auto data_manager::find_all(std::vector<storage_info>& infos) const -> bool {
-	auto lock = std::shared_lock{mutex};
+auto data_manager::list_records(const std::vector<storage_info>& records, std::string_view prefix,
+								std::string_view delimiter, std::string_view start_after, size_t max_keys,
+								listing& result) -> void {
+	using iterator = std::vector<storage_info>::const_iterator;
+	auto by_url = [](const storage_info& info, std::string_view url) -> bool { return info.file_url < url; };
+	auto lower_bound = [&](std::string_view url) -> iterator {
+		return std::lower_bound(records.begin(), records.end(), url, by_url);
+	};
+
+	auto it = lower_bound(start_after > prefix ? start_after : prefix);
+	if (start_after > prefix && it != records.end() && it->file_url == start_after) ++it;
+	list_range(
+		it, records.end(), lower_bound, [](iterator at) -> const std::string& { return at->file_url; },
+		[](iterator at) -> const storage_info& { return *at; }, prefix, delimiter, start_after, max_keys, result);
+}
+
+auto data_manager::snapshot() const -> index_map {
+	auto lock = timed_lock<std::shared_lock<std::shared_mutex>>(mutex);
+	return storage_map;
+}
+
+auto data_manager::find_version(std::string_view url, uint64_t version, storage_info& info) const -> bool {
+	auto lock = timed_lock<std::shared_lock<std::shared_mutex>>(mutex);
+	if (auto current = storage_map.find(url); current && current->version == version) {
+		info = *current;
+		return true;
+	}
+
+	auto chain = history.find(url);
+	if (!chain) return false;
+
+	auto held = std::find_if(chain->begin(), chain->end(),
+							 [version](const storage_info& earlier) -> bool { return earlier.version == version; });
+	if (held == chain->end()) return false;
+
+	info = *held;
+	return true;
+}
+
+auto data_manager::find_as_of(uint64_t version, std::vector<storage_info>& infos) const -> void {
+	auto map = index_map{};
+	auto chains = version_map{};
+	{
+		auto lock = timed_lock<std::shared_lock<std::shared_mutex>>(mutex);
+		map = storage_map;
+		chains = history;
+	}
+
+	// A record was current from its own version until the one that superseded it; records without that bound
+	// (deleted before deletions were versioned) are left out
 	infos.clear();
-	for (const auto& [_, info] : storage_map) {
-		infos.emplace_back(info);
+	map.for_each([&](const std::string&, const storage_info& info) -> void {
+		if (info.version <= version) infos.push_back(info);
+	});
+	chains.for_each([&](const std::string&, const std::vector<storage_info>& chain) -> void {
+		for (const auto& info : chain) {
+			if (info.version <= version && version < info.superseded) infos.push_back(info);
+		}
+	});
+
+	std::sort(infos.begin(), infos.end(),
+			  [](const storage_info& a, const storage_info& b) -> bool { return a.file_url < b.file_url; });
+}
+
+auto data_manager::for_each_noncurrent(const std::function<void(const std::string&, const storage_info&)>& f) const
+	-> void {
+	auto chains = version_map{};
+	{
+		auto lock = timed_lock<std::shared_lock<std::shared_mutex>>(mutex);
+		chains = history;
 	}
 
-	return !infos.empty();
+	chains.for_each([&](const std::string& url, const std::vector<storage_info>& chain) -> void {
+		for (const auto& info : chain) f(url, info);
+	});
+}
+
+auto data_manager::next_version() -> uint64_t {
+	auto now = static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch())
+			.count());
+	auto last = last_version.load();
+	while (!last_version.compare_exchange_weak(last, std::max(now, last + 1))) {
+	}
+
+	return std::max(now, last + 1);
 }
 
 }  // namespace ricox
\ No newline at end of file
@@ -0,0 +1,372 @@
+#include "dictionary_store.hpp"
+#include "data_manager.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "server_config.hpp"
+#include "server_utils.hpp"
+#include "snapshot_manager.hpp"
+
+#ifdef STORAGE_SERVER_WITH_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace ricox {
+static constexpr const char* DICTIONARY_SUFFIX = ".dict";
+static constexpr size_t MAX_GROUPS = 256;  // bounds sample memory when names yield many groups
+static constexpr size_t MAX_GROUP_NAME = 64;
+
+#ifdef STORAGE_SERVER_WITH_ZSTD
+struct zstd_dictionary::tables final {
+	ZSTD_CDict* cdict;
+	ZSTD_DDict* ddict;
+
+	~tables() {
+		ZSTD_freeCDict(cdict);
+		ZSTD_freeDDict(ddict);
+	}
+};
+
+// Contexts are reused per thread, the prepared dictionary tables are shared read-only
+static auto compression_context() -> ZSTD_CCtx* {
+	thread_local auto context = std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)>{ZSTD_createCCtx(), ZSTD_freeCCtx};
+	return context.get();
+}
+
+static auto decompression_context() -> ZSTD_DCtx* {
+	thread_local auto context = std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)>{ZSTD_createDCtx(), ZSTD_freeDCtx};
+	return context.get();
+}
+
+zstd_dictionary::zstd_dictionary(uint32_t id, std::string group, std::string content, int level)
+	: id{id}, group{std::move(group)}, content{std::move(content)} {
+	prepared = std::make_unique<tables>(tables{ZSTD_createCDict(this->content.data(), this->content.size(), level),
+											   ZSTD_createDDict(this->content.data(), this->content.size())});
+}
+
+auto zstd_dictionary::available() -> bool { return true; }
+
+auto zstd_dictionary::train(const std::vector<std::string>& samples, size_t capacity, std::string& content) -> bool {
+	auto buffer = std::string{};
+	auto sizes = std::vector<size_t>{};
+	sizes.reserve(samples.size());
+	for (const auto& sample : samples) {
+		buffer += sample;
+		sizes.push_back(sample.size());
+	}
+
+	content.resize(capacity);
+	auto size = ZDICT_trainFromBuffer(content.data(), capacity, buffer.data(), sizes.data(),
+									  static_cast<unsigned>(sizes.size()));
+	if (ZDICT_isError(size)) {
+		common::ERROR("server_logger", "Dictionary training failed: {}", ZDICT_getErrorName(size));
+		return false;
+	}
+
+	content.resize(size);
+	return true;
+}
+
+auto zstd_dictionary::content_size(const char* data, size_t len, size_t& size) -> bool {
+	auto frame_size = ZSTD_getFrameContentSize(data, len);
+	if (frame_size == ZSTD_CONTENTSIZE_UNKNOWN || frame_size == ZSTD_CONTENTSIZE_ERROR) return false;
+
+	size = static_cast<size_t>(frame_size);
+	return true;
+}
+
+auto zstd_dictionary::compress(const char* data, size_t len, std::string& out) const -> bool {
+	if (!prepared->cdict) return false;
+
+	out.resize(ZSTD_compressBound(len));
+	auto size = ZSTD_compress_usingCDict(compression_context(), out.data(), out.size(), data, len, prepared->cdict);
+	if (ZSTD_isError(size)) return false;
+
+	out.resize(size);
+	return true;
+}
+
+auto zstd_dictionary::decompress(const char* data, size_t len, char* out, size_t out_len) const -> bool {
+	if (!prepared->ddict) return false;
+
+	auto size = ZSTD_decompress_usingDDict(decompression_context(), out, out_len, data, len, prepared->ddict);
+	if (ZSTD_isError(size)) {
+		common::ERROR("server_logger", "Dictionary {} decompression failed: {}", id, ZSTD_getErrorName(size));
+		return false;
+	}
+
+	return size == out_len;
+}
+#else
+struct zstd_dictionary::tables final {};
+
+zstd_dictionary::zstd_dictionary(uint32_t id, std::string group, std::string content, int level)
+	: id{id}, group{std::move(group)}, content{std::move(content)}, prepared{std::make_unique<tables>()} {}
+
+auto zstd_dictionary::available() -> bool { return false; }
+
+auto zstd_dictionary::train(const std::vector<std::string>& samples, size_t capacity, std::string& content) -> bool {
+	return false;
+}
+
+auto zstd_dictionary::content_size(const char* data, size_t len, size_t& size) -> bool { return false; }
+
+auto zstd_dictionary::compress(const char* data, size_t len, std::string& out) const -> bool { return false; }
+
+auto zstd_dictionary::decompress(const char* data, size_t len, char* out, size_t out_len) const -> bool {
+	common::ERROR("server_logger", "File needs dictionary {}, but the server was built without zstd", id);
+	return false;
+}
+#endif	// STORAGE_SERVER_WITH_ZSTD
+
+zstd_dictionary::~zstd_dictionary() = default;
+
+auto zstd_dictionary::get_id() const -> uint32_t { return id; }
+
+auto zstd_dictionary::get_group() const -> const std::string& { return group; }
+
+auto zstd_dictionary::get_content() const -> const std::string& { return content; }
+
+dictionary_store::dictionary_store()
+	: directory{server_config::get_instance().get_dictionary_path()},
+	  max_file_size{server_config::get_instance().get_dictionary_max_file_size()},
+	  capacity{server_config::get_instance().get_dictionary_capacity()},
+	  min_samples{server_config::get_instance().get_dictionary_min_samples()},
+	  sample_bytes{server_config::get_instance().get_dictionary_sample_bytes()},
+	  level{server_config::get_instance().get_dictionary_level()},
+	  delimiter{server_config::get_instance().get_dictionary_group_delimiter()},
+	  max_sample_memory{server_config::get_instance().get_dictionary_max_sample_memory()},
+	  collect_interval{std::max(server_config::get_instance().get_dictionary_collect_interval_s(), 1u)},
+	  sampled{0},
+	  next_id{1},
+	  stopping{false} {}
+
+dictionary_store::~dictionary_store() {
+	{
+		auto lock = std::lock_guard{mutex};
+		stopping = true;
+	}
+
+	cv.notify_all();
+	if (worker.joinable()) worker.join();
+}
+
+auto dictionary_store::get_instance() -> dictionary_store& {
+	static auto instance = dictionary_store{};
+	return instance;
+}
+
+auto dictionary_store::start() -> bool {
+	auto dir = file_util{directory};
+	if (!dir.create_directory()) {
+		common::ERROR("server_logger", "Failed to create dictionary directory: {}", directory);
+		return false;
+	}
+
+	// Files are named <id>-<group>.dict, ids only grow so the largest per group is the newest version
+	auto files = std::vector<std::string>{};
+	dir.scan_directory(files);
+	for (const auto& file : files) {
+		auto name = file.substr(file.find_last_of('/') + 1);
+		auto dash = name.find('-');
+		if (!name.ends_with(DICTIONARY_SUFFIX) || dash == 0 || dash == std::string::npos ||
+			name.find_first_not_of("0123456789") != dash) {
+			continue;
+		}
+
+		auto content = std::string{};
+		if (!file_util{file}.read_file(content)) {
+			common::ERROR("server_logger", "Failed to read dictionary {}", file);
+			continue;
+		}
+
+		auto id = static_cast<uint32_t>(std::stoul(name.substr(0, dash)));
+		auto group = name.substr(dash + 1, name.size() - dash - 1 - strlen(DICTIONARY_SUFFIX));
+		install(std::make_shared<const zstd_dictionary>(id, std::move(group), std::move(content), level));
+	}
+
+	common::INFO("server_logger", "Loaded {} compression dictionaries", by_id.size());
+	worker = std::thread{[this]() -> void { run(); }};
+	return true;
+}
+
+auto dictionary_store::dictionary_file(uint32_t id, const std::string& group) const -> std::string {
+	return directory + "/" + std::to_string(id) + "-" + group + DICTIONARY_SUFFIX;
+}
+
+auto dictionary_store::run() -> void {
+	auto next_collection = std::chrono::steady_clock::now() + collect_interval;
+	auto lock = std::unique_lock{mutex};
+	while (true) {
+		cv.wait_until(lock, next_collection, [this]() -> bool { return stopping || !ready.empty(); });
+		if (stopping) return;
+
+		// Off the worker pool, so training never delays the downloads and uploads queued there
+		if (!ready.empty()) {
+			auto group = std::move(ready.front());
+			ready.pop_front();
+			auto samples = std::move(sample_sets[group].samples);
+			sample_sets[group].samples = {};
+
+			lock.unlock();
+			train(group, std::move(samples));
+			lock.lock();
+		}
+
+		if (std::chrono::steady_clock::now() >= next_collection) {
+			lock.unlock();
+			collect();
+			lock.lock();
+			next_collection = std::chrono::steady_clock::now() + collect_interval;
+		}
+	}
+}
+
+auto dictionary_store::install(const dictionary_ptr& dictionary) -> void {
+	auto lock = std::lock_guard{mutex};
+	by_id[dictionary->get_id()] = dictionary;
+	next_id = std::max(next_id, dictionary->get_id() + 1);
+
+	auto& current = latest[dictionary->get_group()];
+	if (!current || current->get_id() < dictionary->get_id()) current = dictionary;
+}
+
+auto dictionary_store::group_of(const std::string& file_name) const -> std::string {
+	// Tenant or prefix before the delimiter, e.g. "acme_2024-01-01.json" -> "acme"; else by extension
+	auto pos = delimiter.empty() ? std::string::npos : file_name.find(delimiter);
+	auto group = std::string{};
+	if (pos != std::string::npos && pos > 0) {
+		group = file_name.substr(0, pos);
+	} else if (auto dot = file_name.find_last_of('.'); dot != std::string::npos && dot + 1 < file_name.size()) {
+		group = "ext." + file_name.substr(dot + 1);
+	}
+
+	auto valid = group.size() <= MAX_GROUP_NAME &&
+				 std::all_of(group.begin(), group.end(), [](char c) -> bool {
+					 return std::isalnum(static_cast<unsigned char>(c)) || c == '.' || c == '_' || c == '-';
+				 });
+	return valid ? group : std::string{};
+}
+
+auto dictionary_store::add_sample(const std::string& file_name, const std::string& content) -> void {
+	if (!zstd_dictionary::available() || content.empty() || content.size() > max_file_size) return;
+
+	auto group = group_of(file_name);
+	if (group.empty()) return;
+
+	auto lock = std::lock_guard{mutex};
+	if (!sample_sets.contains(group) && sample_sets.size() >= MAX_GROUPS) return;
+	if (sampled + content.size() > max_sample_memory) return;
+
+	auto& set = sample_sets[group];
+	if (set.training) return;
+
+	set.samples.push_back(content);
+	set.bytes += content.size();
+	sampled += content.size();
+	if (set.samples.size() < min_samples || set.bytes < sample_bytes) return;
+
+	// Enough material for a new version, trained on the background thread
+	set.training = true;
+	set.bytes = 0;
+	ready.push_back(std::move(group));
+	cv.notify_one();
+}
+
+auto dictionary_store::train(const std::string& group, std::vector<std::string> samples) -> void {
+	auto start = std::chrono::steady_clock::now();
+	auto content = std::string{};
+	auto trained = zstd_dictionary::train(samples, capacity, content);
+
+	auto id = uint32_t{0};
+	{
+		auto lock = std::lock_guard{mutex};
+		sample_sets[group].training = false;
+		for (const auto& sample : samples) sampled -= sample.size();
+		if (trained) id = next_id++;
+	}
+	if (!trained) return;
+
+	auto path = dictionary_file(id, group);
+	if (!file_util{path}.write_atomic(content)) {
+		common::ERROR("server_logger", "Failed to store dictionary {}", path);
+		return;
+	}
+
+	install(std::make_shared<const zstd_dictionary>(id, group, std::move(content), level));
+	common::INFO("server_logger", "Trained dictionary {} for group {} from {} samples in {} ms", id, group,
+				 samples.size(), metrics::elapsed_ns(start) / 1000000);
+}
+
+auto dictionary_store::collect() -> void {
+	// Versions a stored file needs: those the index, its version chains and every retained snapshot refer to
+	auto used = std::unordered_set<uint32_t>{};
+	auto note = [&](const std::string&, const storage_info& info) -> void {
+		if (info.dictionary_id) used.insert(info.dictionary_id);
+	};
+	data_manager::get_instance().snapshot().for_each(note);
+	data_manager::get_instance().for_each_noncurrent(note);
+	for (const auto& s : snapshot_manager::get_instance().list()) s->index.for_each(note);
+
+	// A version is dropped only when it was unused on the previous pass too: an upload compressed with one just
+	// replaced may not be committed yet, and a reader may still be about to decompress a file replaced since
+	auto dropped = std::vector<dictionary_ptr>{};
+	{
+		auto lock = std::lock_guard{mutex};
+		auto now_unused = std::unordered_set<uint32_t>{};
+		for (auto it = by_id.begin(); it != by_id.end();) {
+			auto id = it->first;
+			if (used.contains(id) || latest[it->second->get_group()] == it->second) {
+				++it;
+			} else if (unused.contains(id)) {
+				dropped.push_back(std::move(it->second));
+				it = by_id.erase(it);
+			} else {
+				now_unused.insert(id);
+				++it;
+			}
+		}
+		unused = std::move(now_unused);
+	}
+
+	for (const auto& dictionary : dropped) {
+		std::remove(dictionary_file(dictionary->get_id(), dictionary->get_group()).c_str());
+	}
+	if (!dropped.empty()) common::INFO("server_logger", "Dropped {} unused compression dictionaries", dropped.size());
+}
+
+auto dictionary_store::compress(const std::string& file_name, const std::string& content, std::string& out) const
+	-> uint32_t {
+	if (content.empty() || content.size() > max_file_size) return 0;
+
+	auto group = group_of(file_name);
+	auto dictionary = dictionary_ptr{};
+	{
+		auto lock = std::lock_guard{mutex};
+		auto it = latest.find(group);
+		if (it == latest.end()) return 0;
+		dictionary = it->second;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	auto compressed = dictionary->compress(content.data(), content.size(), out);
+	metrics::record_codec(codec_histogram::compress_time, metrics::DICTIONARY_CODEC, metrics::elapsed_ns(start),
+						  content.size(), compressed ? out.size() : content.size());
+
+	// Not worth a dictionary dependency when it does not shrink the file
+	return compressed && out.size() < content.size() ? dictionary->get_id() : 0;
+}
+
+auto dictionary_store::find(uint32_t id) const -> dictionary_ptr {
+	auto lock = std::lock_guard{mutex};
+	auto it = by_id.find(id);
+	return it == by_id.end() ? nullptr : it->second;
+}
+
+}  // namespace ricox
@@ -0,0 +1,152 @@
+#include "fd_cache.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "server_config.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+namespace ricox {
+fd_handle::fd_handle(int fd, const struct stat& file_stat, const std::string& path)
+	: fd{fd}, file_stat{file_stat}, file_path{path} {}
+
+fd_handle::~fd_handle() {
+	if (fd >= 0) close(fd);
+}
+
+auto fd_handle::get_file_size() const -> int64_t { return static_cast<int64_t>(file_stat.st_size); }
+
+auto fd_handle::get_last_write_time() const -> std::time_t { return file_stat.st_mtime; }
+
+auto fd_handle::read_file(std::string& content) const -> bool {
+	content.resize(get_file_size());
+	auto done = size_t{0};
+	while (done < content.size()) {
+		auto ret = pread(fd, content.data() + done, content.size() - done, done);
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret <= 0) {
+			common::ERROR("server_logger", "Read file content error {}", file_path);
+			return false;
+		}
+		done += ret;
+	}
+
+	return true;
+}
+
+fd_cache::fd_cache() : capacity{server_config::get_instance().get_fd_cache_capacity()} {}
+
+auto fd_cache::get_instance() -> fd_cache& {
+	static auto instance = fd_cache{};
+	return instance;
+}
+
+auto fd_cache::open_handle(const std::string& path) -> handle_ptr {
+	auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		common::ERROR("server_logger", "Unable to open file {}: {}", path, strerror(errno));
+		return nullptr;
+	}
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+		common::ERROR("server_logger", "Unable to stat regular file {}", path);
+		close(fd);
+		return nullptr;
+	}
+
+	return std::make_shared<const fd_handle>(fd, file_stat, path);
+}
+
+auto fd_cache::acquire(const std::string& path) -> handle_ptr {
+	{
+		auto lock = std::lock_guard{mutex};
+		auto it = cache.find(path);
+		if (it != cache.end()) {
+			lru.splice(lru.begin(), lru, it->second.lru_pos);  // mark as most recently used
+			metrics::add(counter::fd_cache_hits);
+			return it->second.handle;
+		}
+	}
+
+	metrics::add(counter::fd_cache_misses);
+
+	// Miss: open and stat outside the lock so a slow disk does not stall other lookups
+	auto handle = open_handle(path);
+	if (!handle) return nullptr;
+	if (capacity == 0) return handle;  // caching disabled, handle is owned by the caller only
+
+	auto lock = std::lock_guard{mutex};
+	auto it = cache.find(path);
+	if (it != cache.end()) {  // another thread opened it first, keep the cached one
+		lru.splice(lru.begin(), lru, it->second.lru_pos);
+		return it->second.handle;
+	}
+
+	lru.push_front(path);
+	cache.try_emplace(path, entry{handle, lru.begin()});
+	evict();
+	return handle;
+}
+
+auto fd_cache::evict() -> void {
+	// Outstanding handles keep their descriptor open, eviction only drops the cache's reference
+	while (cache.size() > capacity) {
+		cache.erase(lru.back());
+		lru.pop_back();
+	}
+}
+
+auto fd_cache::invalidate(const std::string& path) -> void {
+	auto lock = std::lock_guard{mutex};
+	auto it = cache.find(path);
+	if (it == cache.end()) return;
+
+	lru.erase(it->second.lru_pos);
+	cache.erase(it);
+}
+
+auto fd_cache::clear() -> void {
+	auto lock = std::lock_guard{mutex};
+	cache.clear();
+	lru.clear();
+}
+
+auto fd_cache::size() const -> size_t {
+	auto lock = std::lock_guard{mutex};
+	return cache.size();
+}
+
+auto fd_cache::add_to_buffer(evbuffer* buffer, const handle_ptr& handle, uint64_t offset, uint64_t length) -> bool {
+	auto size = static_cast<uint64_t>(handle->get_file_size());
+	if (offset >= size) return true;  // nothing to map or send
+	length = std::min(length, size - offset);
+
+	// No EVBUF_FS_CLOSE_ON_FREE: the descriptor belongs to the handle, not to the segment
+	auto segment =
+		evbuffer_file_segment_new(handle->fd, static_cast<ev_off_t>(offset), static_cast<ev_off_t>(length), 0);
+	if (!segment) {
+		common::ERROR("server_logger", "Unable to create file segment for {}", handle->file_path);
+		return false;
+	}
+
+	// The segment holds its own reference, released by libevent once the data has been sent
+	evbuffer_file_segment_add_cleanup_cb(
+		segment,
+		[](const evbuffer_file_segment*, int, void* arg) -> void { delete static_cast<handle_ptr*>(arg); },
+		new handle_ptr{handle});
+
+	auto ret = evbuffer_add_file_segment(buffer, segment, 0, static_cast<ev_off_t>(length));
+	evbuffer_file_segment_free(segment);  // drops our reference, the buffer keeps its own
+
+	if (ret != 0) {
+		common::ERROR("server_logger", "Unable to add file segment for {} to buffer", handle->file_path);
+		return false;
+	}
+
+	return true;
+}
+
+}  // namespace ricox
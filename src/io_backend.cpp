@@ -0,0 +1,253 @@
+#include "io_backend.hpp"
+#include "connection_manager.hpp"
+#include "logger.hpp"
+#include "server_config.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#ifdef STORAGE_SERVER_WITH_URING
+#include <liburing.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace ricox {
+auto io_backend::read(int fd, void* buf, size_t len, off_t offset) -> bool {
+	auto done = size_t{0};
+	while (done < len) {
+		auto ret = pread(fd, static_cast<char*>(buf) + done, len - done, offset + done);
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret <= 0) return false;	 // error or unexpected end of file
+		done += ret;
+	}
+
+	return true;
+}
+
+auto io_backend::write(int fd, const void* buf, size_t len, off_t offset) -> bool {
+	auto done = size_t{0};
+	while (done < len) {
+		auto ret = pwrite(fd, static_cast<const char*>(buf) + done, len - done, offset + done);
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret < 0) return false;
+		done += ret;
+	}
+
+	return true;
+}
+
+auto io_backend::sync(int fd) -> bool { return fdatasync(fd) == 0; }
+
+auto blocking_io_backend::name() const -> const char* { return "blocking"; }
+
+auto blocking_io_backend::attach(event_base* base) -> bool { return true; }
+
+auto blocking_io_backend::async_write_file(const std::string& path, std::shared_ptr<const std::string> data,
+										   bool durable, write_callback callback) -> void {
+	auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		common::ERROR("server_logger", "Unable to open file {}: {}", path, strerror(errno));
+		callback(false);
+		return;
+	}
+
+	auto ok = write(fd, data->data(), data->size(), 0) && (!durable || sync(fd));
+	close(fd);
+	callback(ok);
+}
+
+#ifdef STORAGE_SERVER_WITH_URING
+class uring_io_backend final : public io_backend {	// io_uring submissions, completions drained through an eventfd
+   private:
+	struct operation final {  // one whole-file write walking through open -> transfer -> sync -> close
+		enum class stage { open, transfer, sync, close };
+
+		stage current;
+		bool durable;
+		std::string path;
+		std::shared_ptr<const std::string> input;
+		size_t done;
+		int fd;
+		bool ok;
+		write_callback on_write;
+	};
+
+	io_uring ring;
+	int event_fd;
+	event* ready_event;
+
+	auto submit(operation* op) -> void;	 // queues the sqe for the current stage of op
+	auto advance(operation* op, int res) -> void;
+	auto finish(operation* op) -> void;
+	auto drain() -> void;
+
+	static auto on_ready(evutil_socket_t fd, short events, void* arg) -> void;
+
+   public:
+	uring_io_backend() : ring{}, event_fd{-1}, ready_event{nullptr} {}
+	~uring_io_backend() override;
+
+	auto init(unsigned entries) -> bool;
+
+	auto name() const -> const char* override { return "io_uring"; }
+	auto attach(event_base* base) -> bool override;
+	auto async_write_file(const std::string& path, std::shared_ptr<const std::string> data, bool durable,
+						  write_callback callback) -> void override;
+};
+
+uring_io_backend::~uring_io_backend() {
+	if (ready_event) event_free(ready_event);
+	if (event_fd >= 0) close(event_fd);
+	io_uring_queue_exit(&ring);
+}
+
+auto uring_io_backend::init(unsigned entries) -> bool {
+	auto ret = io_uring_queue_init(entries, &ring, 0);
+	if (ret < 0) {
+		common::ERROR("server_logger", "io_uring_queue_init failed: {}", strerror(-ret));
+		return false;
+	}
+
+	event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (event_fd < 0 || io_uring_register_eventfd(&ring, event_fd) < 0) {
+		common::ERROR("server_logger", "Unable to register eventfd with io_uring");
+		return false;
+	}
+
+	return true;
+}
+
+auto uring_io_backend::attach(event_base* base) -> bool {
+	ready_event = event_new(base, event_fd, EV_READ | EV_PERSIST, on_ready, this);
+	if (ready_event) event_priority_set(ready_event, connection_manager::CONTROL_PRIORITY);
+	if (!ready_event || event_add(ready_event, nullptr) != 0) {
+		common::ERROR("server_logger", "Unable to add io_uring completion event to event base");
+		return false;
+	}
+
+	return true;
+}
+
+auto uring_io_backend::on_ready(evutil_socket_t fd, short events, void* arg) -> void {
+	auto counter = eventfd_t{};
+	eventfd_read(fd, &counter);	 // reset the eventfd, completions are counted in the CQ ring itself
+	static_cast<uring_io_backend*>(arg)->drain();
+}
+
+auto uring_io_backend::drain() -> void {
+	auto cqe = static_cast<io_uring_cqe*>(nullptr);
+	while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+		auto op = static_cast<operation*>(io_uring_cqe_get_data(cqe));
+		auto res = cqe->res;
+		io_uring_cqe_seen(&ring, cqe);
+		advance(op, res);
+	}
+}
+
+auto uring_io_backend::submit(operation* op) -> void {
+	auto sqe = io_uring_get_sqe(&ring);
+	if (!sqe) {	 // submission queue full, flush it and retry once
+		io_uring_submit(&ring);
+		sqe = io_uring_get_sqe(&ring);
+	}
+
+	if (!sqe) {
+		common::ERROR("server_logger", "io_uring submission queue exhausted for {}", op->path);
+		if (op->fd >= 0) close(op->fd);  // opened by an earlier stage, its close cannot be queued either
+		op->ok = false;
+		finish(op);
+		return;
+	}
+
+	switch (op->current) {
+		case operation::stage::open:
+			io_uring_prep_openat(sqe, AT_FDCWD, op->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			break;
+		case operation::stage::transfer:
+			io_uring_prep_write(sqe, op->fd, op->input->data() + op->done, op->input->size() - op->done, op->done);
+			break;
+		case operation::stage::sync:
+			io_uring_prep_fsync(sqe, op->fd, IORING_FSYNC_DATASYNC);
+			break;
+		case operation::stage::close:
+			io_uring_prep_close(sqe, op->fd);
+			break;
+	}
+
+	io_uring_sqe_set_data(sqe, op);
+	io_uring_submit(&ring);
+}
+
+auto uring_io_backend::advance(operation* op, int res) -> void {
+	switch (op->current) {
+		case operation::stage::open:
+			if (res < 0) {
+				common::ERROR("server_logger", "io_uring open of {} failed: {}", op->path, strerror(-res));
+				op->ok = false;
+				finish(op);
+				return;
+			}
+			op->fd = res;
+			op->current = op->input->empty() ? operation::stage::sync : operation::stage::transfer;
+			break;
+		case operation::stage::transfer:
+			if (res == -EINTR || res == -EAGAIN) break;	 // resubmit the same range
+			if (res < 0) {
+				common::ERROR("server_logger", "io_uring transfer on {} failed: {}", op->path, strerror(-res));
+				op->ok = false;
+				op->current = operation::stage::close;
+				break;
+			}
+			op->done += res;
+			if (op->done == op->input->size()) {
+				op->current = op->durable ? operation::stage::sync : operation::stage::close;
+			}
+			break;
+		case operation::stage::sync:
+			op->ok = res >= 0;
+			op->current = operation::stage::close;
+			break;
+		case operation::stage::close:
+			finish(op);
+			return;
+	}
+
+	submit(op);
+}
+
+auto uring_io_backend::finish(operation* op) -> void {
+	auto owned = std::unique_ptr<operation>{op};
+	owned->on_write(owned->ok);
+}
+
+auto uring_io_backend::async_write_file(const std::string& path, std::shared_ptr<const std::string> data,
+										bool durable, write_callback callback) -> void {
+	submit(new operation{operation::stage::open, durable, path, std::move(data), 0, -1, true, std::move(callback)});
+}
+#endif	// STORAGE_SERVER_WITH_URING
+
+static auto make_backend() -> std::unique_ptr<io_backend> {
+	const auto& requested = server_config::get_instance().get_io_backend();
+	if (requested == "io_uring") {
+#ifdef STORAGE_SERVER_WITH_URING
+		auto backend = std::make_unique<uring_io_backend>();
+		if (backend->init(server_config::get_instance().get_io_queue_depth())) return backend;
+		common::ERROR("server_logger", "io_uring unavailable, falling back to blocking I/O");
+#else
+		common::ERROR("server_logger", "Built without liburing, falling back to blocking I/O");
+#endif
+	} else if (requested != "blocking") {
+		common::ERROR("server_logger", "Unknown io_backend {}, falling back to blocking I/O", requested);
+	}
+
+	return std::make_unique<blocking_io_backend>();
+}
+
+auto io_backend::get_instance() -> io_backend& {
+	static auto instance = make_backend();
+	return *instance;
+}
+
+}  // namespace ricox
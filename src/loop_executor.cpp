@@ -0,0 +1,65 @@
+#include "loop_executor.hpp"
+#include "connection_manager.hpp"
+#include "logger.hpp"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace ricox {
+loop_executor::loop_executor() : event_fd{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)}, ready_event{nullptr} {
+	if (event_fd < 0) common::FATAL("server_logger", "Unable to create eventfd for loop executor");
+}
+
+loop_executor::~loop_executor() {
+	if (ready_event) event_free(ready_event);
+	if (event_fd >= 0) close(event_fd);
+}
+
+auto loop_executor::get_instance() -> loop_executor& {
+	static auto instance = loop_executor{};
+	return instance;
+}
+
+auto loop_executor::attach(event_base* base) -> bool {
+	ready_event = event_new(base, event_fd, EV_READ | EV_PERSIST, on_ready, this);
+	if (ready_event) event_priority_set(ready_event, connection_manager::CONTROL_PRIORITY);  // ahead of bulk sends
+	if (!ready_event || event_add(ready_event, nullptr) != 0) {
+		common::ERROR("server_logger", "Unable to add loop executor event to event base");
+		return false;
+	}
+
+	eventfd_write(event_fd, 1);	 // pick up anything posted before the loop existed
+	return true;
+}
+
+auto loop_executor::post(task t) -> void {
+	{
+		auto lock = std::lock_guard{mutex};
+		tasks.push_back(std::move(t));
+	}
+
+	eventfd_write(event_fd, 1);
+}
+
+auto loop_executor::pending() -> size_t {
+	auto lock = std::lock_guard{mutex};
+	return tasks.size();
+}
+
+auto loop_executor::on_ready(evutil_socket_t fd, short events, void* arg) -> void {
+	auto counter = eventfd_t{};
+	eventfd_read(fd, &counter);
+	static_cast<loop_executor*>(arg)->drain();
+}
+
+auto loop_executor::drain() -> void {
+	auto batch = std::deque<task>{};
+	{
+		auto lock = std::lock_guard{mutex};
+		batch.swap(tasks);
+	}
+
+	for (auto& t : batch) t();
+}
+
+}  // namespace ricox
@@ -0,0 +1,204 @@
+#include "metadata_table.hpp"
+#include "logger.hpp"
+#include "server_config.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace ricox {
+static constexpr size_t SCAN_CHUNK = 4096;	// match flags of one chunk stay in L1
+static constexpr std::array<const char*, static_cast<size_t>(storage_tier::count)> TIER_NAMES{"hot", "cold"};
+static constexpr std::array<const char*, static_cast<size_t>(storage_codec::count)> CODEC_NAMES{
+	"none", "bundle", "dictionary", "segment"};
+
+metadata_table::metadata_table() : refresh{server_config::get_instance().get_search_refresh_s()} {}
+
+auto metadata_table::get_instance() -> metadata_table& {
+	static auto instance = metadata_table{};
+	return instance;
+}
+
+auto metadata_table::tier_of(const storage_info& info) -> storage_tier {
+	// Same rule as downloads: anything outside hot storage is compressed
+	auto hot = info.file_path.find(server_config::get_instance().get_hot_storage_path()) != std::string::npos;
+	return hot && !info.in_segment() ? storage_tier::hot : storage_tier::cold;
+}
+
+auto metadata_table::codec_of(const storage_info& info) -> storage_codec {
+	if (info.in_segment()) return storage_codec::segment;
+	if (tier_of(info) == storage_tier::hot) return storage_codec::none;
+	return info.dictionary_id ? storage_codec::dictionary : storage_codec::bundle;
+}
+
+auto metadata_table::tier_name(storage_tier tier) -> const char* { return TIER_NAMES[static_cast<size_t>(tier)]; }
+
+auto metadata_table::codec_name(storage_codec codec) -> const char* { return CODEC_NAMES[static_cast<size_t>(codec)]; }
+
+auto metadata_table::parse_tier(std::string_view name, storage_tier& tier) -> bool {
+	auto it = std::find(TIER_NAMES.begin(), TIER_NAMES.end(), name);
+	if (it == TIER_NAMES.end()) return false;
+	tier = static_cast<storage_tier>(it - TIER_NAMES.begin());
+	return true;
+}
+
+auto metadata_table::parse_codec(std::string_view name, storage_codec& codec) -> bool {
+	auto it = std::find(CODEC_NAMES.begin(), CODEC_NAMES.end(), name);
+	if (it == CODEC_NAMES.end()) return false;
+	codec = static_cast<storage_codec>(it - CODEC_NAMES.begin());
+	return true;
+}
+
+// One chunk of the columns, laid out for the scan kernels
+struct scan_input final {
+	const uint64_t* size;
+	const int64_t* modified;
+	const int64_t* accessed;
+	const uint8_t* tier;
+	const uint8_t* codec;
+	size_t n;
+};
+
+// Sets hits[i] to 1 for every matching row, returns the matches and adds their sizes to bytes
+static auto scan_scalar(const scan_input& in, size_t start, const metadata_query& q, uint8_t* hits, uint64_t& bytes)
+	-> size_t {
+	auto matched = size_t{0};
+	for (auto i = start; i < in.n; ++i) {
+		auto hit = static_cast<uint8_t>(
+			(in.size[i] >= q.min_size) & (in.size[i] <= q.max_size) & (in.modified[i] >= q.modified_after) &
+			(in.modified[i] <= q.modified_before) & (in.accessed[i] >= q.accessed_after) &
+			(in.accessed[i] <= q.accessed_before) & ((in.tier[i] & q.tiers) != 0) & ((in.codec[i] & q.codecs) != 0));
+		hits[i] = hit;
+		matched += hit;
+		bytes += in.size[i] & (uint64_t{0} - hit);
+	}
+	return matched;
+}
+
+#if defined(__x86_64__)
+// Four rows per step, every predicate evaluated for every row. AVX2 only compares signed 64-bit lanes, so sizes
+// are compared with their sign bit flipped.
+__attribute__((target("avx2"))) static auto scan_avx2(const scan_input& in, const metadata_query& q, uint8_t* hits,
+													  uint64_t& bytes) -> size_t {
+	const auto sign = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+	const auto min_size = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(q.min_size)), sign);
+	const auto max_size = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(q.max_size)), sign);
+	const auto modified_after = _mm256_set1_epi64x(q.modified_after);
+	const auto modified_before = _mm256_set1_epi64x(q.modified_before);
+	const auto accessed_after = _mm256_set1_epi64x(q.accessed_after);
+	const auto accessed_before = _mm256_set1_epi64x(q.accessed_before);
+	const auto tiers = _mm256_set1_epi64x(q.tiers);
+	const auto codecs = _mm256_set1_epi64x(q.codecs);
+	const auto zero = _mm256_setzero_si256();
+
+	auto matched = size_t{0};
+	auto sum = _mm256_setzero_si256();
+	auto i = size_t{0};
+	for (; i + 4 <= in.n; i += 4) {
+		auto size = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in.size + i));
+		auto biased = _mm256_xor_si256(size, sign);
+		auto modified = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in.modified + i));
+		auto accessed = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in.accessed + i));
+		auto tier32 = uint32_t{0};
+		auto codec32 = uint32_t{0};
+		std::memcpy(&tier32, in.tier + i, sizeof(tier32));
+		std::memcpy(&codec32, in.codec + i, sizeof(codec32));
+		auto tier = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(static_cast<int>(tier32)));
+		auto codec = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(static_cast<int>(codec32)));
+
+		auto miss = _mm256_or_si256(_mm256_cmpgt_epi64(min_size, biased), _mm256_cmpgt_epi64(biased, max_size));
+		miss = _mm256_or_si256(miss, _mm256_cmpgt_epi64(modified_after, modified));
+		miss = _mm256_or_si256(miss, _mm256_cmpgt_epi64(modified, modified_before));
+		miss = _mm256_or_si256(miss, _mm256_cmpgt_epi64(accessed_after, accessed));
+		miss = _mm256_or_si256(miss, _mm256_cmpgt_epi64(accessed, accessed_before));
+		miss = _mm256_or_si256(miss, _mm256_cmpeq_epi64(_mm256_and_si256(tier, tiers), zero));
+		miss = _mm256_or_si256(miss, _mm256_cmpeq_epi64(_mm256_and_si256(codec, codecs), zero));
+
+		sum = _mm256_add_epi64(sum, _mm256_andnot_si256(miss, size));
+		auto mask = static_cast<unsigned>(~_mm256_movemask_pd(_mm256_castsi256_pd(miss))) & 0xfu;
+		matched += std::popcount(mask);
+		for (auto lane = 0u; lane < 4; ++lane) hits[i + lane] = static_cast<uint8_t>((mask >> lane) & 1u);
+	}
+
+	auto lanes = std::array<uint64_t, 4>{};
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes.data()), sum);
+	bytes += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	return matched + scan_scalar(in, i, q, hits, bytes);
+}
+#endif
+
+static auto scan(const scan_input& in, const metadata_query& q, uint8_t* hits, uint64_t& bytes) -> size_t {
+#if defined(__x86_64__)
+	static const auto has_avx2 = []() -> bool {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	}();
+	if (has_avx2) return scan_avx2(in, q, hits, bytes);
+#endif
+	return scan_scalar(in, 0, q, hits, bytes);
+}
+
+auto metadata_table::build() -> std::shared_ptr<const columns> {
+	// Read before the snapshot, a commit in between only makes the next query rebuild again
+	auto table = std::make_shared<columns>();
+	table->generation = data_manager::get_instance().generation();
+	table->index = data_manager::get_instance().snapshot();
+	table->built_at = std::chrono::steady_clock::now();
+	table->built = std::time(nullptr);
+
+	auto rows = table->index.size();
+	table->rows.reserve(rows);
+	table->size.reserve(rows);
+	table->modified.reserve(rows);
+	table->accessed.reserve(rows);
+	table->tier.reserve(rows);
+	table->codec.reserve(rows);
+	table->index.for_each([&](const std::string&, const storage_info& info) -> void {
+		table->rows.push_back(&info);
+		table->size.push_back(info.file_size);
+		table->modified.push_back(info.time_modified);
+		table->accessed.push_back(info.time_accessed);
+		table->tier.push_back(static_cast<uint8_t>(1u << static_cast<unsigned>(tier_of(info))));
+		table->codec.push_back(static_cast<uint8_t>(1u << static_cast<unsigned>(codec_of(info))));
+	});
+
+	common::INFO("server_logger", "Built metadata search columns for {} files", rows);
+	return table;
+}
+
+auto metadata_table::current() -> std::shared_ptr<const columns> {
+	auto lock = std::lock_guard{mutex};
+	auto stale = !table || (table->generation != data_manager::get_instance().generation() &&
+							std::chrono::steady_clock::now() - table->built_at >= refresh);
+	if (stale) table = build();
+	return table;
+}
+
+auto metadata_table::query(const metadata_query& q) -> metadata_result {
+	auto t = current();
+	auto result = metadata_result{};
+	result.scanned = t->rows.size();
+	result.built = t->built;
+
+	// Filters a chunk at a time into match flags, rows are only touched for the matches returned
+	auto hits = std::array<uint8_t, SCAN_CHUNK>{};
+	for (auto base = size_t{0}; base < t->rows.size(); base += SCAN_CHUNK) {
+		auto n = std::min(SCAN_CHUNK, t->rows.size() - base);
+		auto in = scan_input{t->size.data() + base, t->modified.data() + base, t->accessed.data() + base,
+							 t->tier.data() + base, t->codec.data() + base, n};
+		auto matched = scan(in, q, hits.data(), result.matched_bytes);
+		result.matched += matched;
+		for (auto i = size_t{0}; i < n && matched && result.rows.size() < q.limit; ++i) {
+			if (hits[i]) result.rows.push_back(*t->rows[base + i]);
+		}
+	}
+
+	return result;
+}
+
+}  // namespace ricox
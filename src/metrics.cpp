@@ -0,0 +1,186 @@
+#include "metrics.hpp"
+#include "bundle.hpp"
+
+#include <sstream>
+
+namespace ricox {
+static constexpr size_t FIRST_EXPORTED_EXPONENT = 10;  // ~1 us
+static constexpr size_t LAST_EXPORTED_EXPONENT = 36;   // ~69 s
+
+static auto codec_name(size_t codec) -> std::string {
+	return codec == metrics::DICTIONARY_CODEC ? "ZSTD_DICT" : bundle::name_of(static_cast<unsigned>(codec));
+}
+
+struct histogram_snapshot final {
+	std::array<uint64_t, latency_buckets::COUNT> buckets{};
+	uint64_t sum = 0;
+	uint64_t count = 0;
+
+	auto merge(const metrics::histogram_data& data) -> void {
+		for (auto i = size_t{0}; i < latency_buckets::COUNT; ++i) {
+			auto n = data.buckets[i].load(std::memory_order_relaxed);
+			buckets[i] += n;
+			count += n;
+		}
+		sum += data.sum.load(std::memory_order_relaxed);
+	}
+
+	auto quantile(double q) const -> uint64_t {
+		auto rank = static_cast<uint64_t>(q * count);
+		auto seen = uint64_t{0};
+		for (auto i = size_t{0}; i < latency_buckets::COUNT; ++i) {
+			seen += buckets[i];
+			if (seen > rank) return latency_buckets::upper_bound_of(i);
+		}
+		return 0;
+	}
+};
+
+auto latency_buckets::upper_bound_of(size_t index) -> uint64_t {
+	if (index < SUB_COUNT) return index;
+	auto exponent = index / SUB_COUNT + SUB_BITS - 1;
+	auto sub = index % SUB_COUNT;
+	auto step = uint64_t{1} << (exponent - SUB_BITS);
+	return ((SUB_COUNT + sub) << (exponent - SUB_BITS)) + step - 1;
+}
+
+auto metrics::get_instance() -> metrics& {
+	static auto instance = metrics{};
+	return instance;
+}
+
+auto metrics::register_shard() -> shard* {
+	auto lock = std::lock_guard{mutex};
+	shards.push_back(std::make_unique<shard>());
+	return shards.back().get();
+}
+
+auto metrics::add_gauge(const std::string& name, gauge_reader reader) -> void {
+	auto lock = std::lock_guard{mutex};
+	gauges.emplace_back(name, std::move(reader));
+}
+
+using labeled_histogram = std::pair<std::string, const histogram_snapshot*>;	 // labels, without braces
+
+// One histogram family, then its HDR quantiles as a gauge family of their own: the exposition format allows only
+// _bucket, _sum and _count series inside a histogram family
+static auto write_histograms(std::stringstream& ss, const std::string& name,
+							 const std::vector<labeled_histogram>& series) -> void {
+	ss << "# TYPE " << name << " histogram\n";
+	for (const auto& [labels, snapshot] : series) {
+		auto prefix = labels.empty() ? std::string{"{"} : "{" + labels + ",";
+		auto cumulative = uint64_t{0};
+		auto next = size_t{0};
+
+		// Prometheus buckets at each power of two, the finer HDR buckets feed the quantiles below
+		for (auto exponent = FIRST_EXPORTED_EXPONENT; exponent <= LAST_EXPORTED_EXPONENT; ++exponent) {
+			auto last_index = (exponent - latency_buckets::SUB_BITS + 2) * latency_buckets::SUB_COUNT - 1;
+			for (; next <= last_index; ++next) cumulative += snapshot->buckets[next];
+			ss << name << "_bucket" << prefix << "le=\"" << latency_buckets::upper_bound_of(last_index) / 1e9
+			   << "\"} " << cumulative << "\n";
+		}
+
+		ss << name << "_bucket" << prefix << "le=\"+Inf\"} " << snapshot->count << "\n";
+		ss << name << "_sum" << (labels.empty() ? "" : "{" + labels + "}") << " " << snapshot->sum / 1e9 << "\n";
+		ss << name << "_count" << (labels.empty() ? "" : "{" + labels + "}") << " " << snapshot->count << "\n";
+	}
+
+	ss << "# TYPE " << name << "_quantile gauge\n";
+	for (const auto& [labels, snapshot] : series) {
+		auto prefix = labels.empty() ? std::string{"{"} : "{" + labels + ",";
+		for (auto q : {0.5, 0.9, 0.99, 0.999}) {
+			ss << name << "_quantile" << prefix << "quantile=\"" << q << "\"} " << snapshot->quantile(q) / 1e9
+			   << "\n";
+		}
+	}
+}
+
+auto metrics::render() const -> std::string {
+	auto lock = std::lock_guard{mutex};
+
+	auto counters = std::array<uint64_t, static_cast<size_t>(counter::count)>{};
+	auto histograms = std::array<histogram_snapshot, static_cast<size_t>(histogram::count)>{};
+	auto codecs = std::array<std::array<histogram_snapshot, MAX_CODEC>, static_cast<size_t>(codec_histogram::count)>{};
+	auto codec_in = std::array<uint64_t, MAX_CODEC>{};
+	auto codec_out = std::array<uint64_t, MAX_CODEC>{};
+
+	for (const auto& s : shards) {
+		for (auto i = size_t{0}; i < counters.size(); ++i) counters[i] += s->counters[i].load(std::memory_order_relaxed);
+		for (auto i = size_t{0}; i < histograms.size(); ++i) histograms[i].merge(s->histograms[i]);
+		for (auto h = size_t{0}; h < codecs.size(); ++h) {
+			for (auto c = size_t{0}; c < MAX_CODEC; ++c) codecs[h][c].merge(s->codecs[h][c]);
+		}
+		for (auto c = size_t{0}; c < MAX_CODEC; ++c) {
+			codec_in[c] += s->codec_bytes_in[c].load(std::memory_order_relaxed);
+			codec_out[c] += s->codec_bytes_out[c].load(std::memory_order_relaxed);
+		}
+	}
+
+	auto value = [&](counter c) -> uint64_t { return counters[static_cast<size_t>(c)]; };
+	auto ss = std::stringstream{};
+
+	ss << "# TYPE storage_requests_total counter\n"
+	   << "storage_requests_total{handler=\"upload\"} " << value(counter::upload_requests) << "\n"
+	   << "storage_requests_total{handler=\"download\"} " << value(counter::download_requests) << "\n"
+	   << "storage_requests_total{handler=\"show\"} " << value(counter::show_requests) << "\n"
+	   << "storage_requests_total{handler=\"list\"} " << value(counter::list_requests) << "\n"
+	   << "storage_requests_total{handler=\"search\"} " << value(counter::search_requests) << "\n"
+	   << "storage_requests_total{handler=\"s3\"} " << value(counter::s3_requests) << "\n"
+	   << "storage_requests_total{handler=\"delete\"} " << value(counter::delete_requests) << "\n"
+	   << "# TYPE storage_bytes_received_total counter\n"
+	   << "storage_bytes_received_total " << value(counter::bytes_in) << "\n"
+	   << "# TYPE storage_bytes_sent_total counter\n"
+	   << "storage_bytes_sent_total " << value(counter::bytes_out) << "\n"
+	   << "# TYPE storage_cache_hits_total counter\n"
+	   << "storage_cache_hits_total{cache=\"fd\"} " << value(counter::fd_cache_hits) << "\n"
+	   << "storage_cache_hits_total{cache=\"small_file\"} " << value(counter::small_cache_hits) << "\n"
+	   << "# TYPE storage_cache_misses_total counter\n"
+	   << "storage_cache_misses_total{cache=\"fd\"} " << value(counter::fd_cache_misses) << "\n"
+	   << "storage_cache_misses_total{cache=\"small_file\"} " << value(counter::small_cache_misses) << "\n"
+	   << "# TYPE storage_not_modified_total counter\n"
+	   << "storage_not_modified_total " << value(counter::not_modified) << "\n"
+	   << "# TYPE storage_connections_shed_total counter\n"
+	   << "storage_connections_shed_total " << value(counter::connections_shed) << "\n"
+	   << "# TYPE storage_rate_limited_total counter\n"
+	   << "storage_rate_limited_total " << value(counter::rate_limited) << "\n"
+	   << "# TYPE storage_admission_rejected_total counter\n"
+	   << "storage_admission_rejected_total " << value(counter::admission_rejected) << "\n"
+	   << "# TYPE storage_checksum_failures_total counter\n"
+	   << "storage_checksum_failures_total " << value(counter::checksum_failures) << "\n"
+	   << "# TYPE storage_scrub_bytes_total counter\n"
+	   << "storage_scrub_bytes_total " << value(counter::scrub_bytes) << "\n";
+
+	auto snapshot = [&](histogram h) -> const histogram_snapshot& { return histograms[static_cast<size_t>(h)]; };
+	write_histograms(ss, "storage_request_duration_seconds",
+					 {{"handler=\"upload\"", &snapshot(histogram::upload_latency)},
+					  {"handler=\"download\"", &snapshot(histogram::download_latency)},
+					  {"handler=\"show\"", &snapshot(histogram::show_latency)}});
+	write_histograms(ss, "storage_index_lock_wait_seconds", {{"", &snapshot(histogram::index_lock_wait)}});
+	write_histograms(ss, "storage_commit_batch_duration_seconds", {{"", &snapshot(histogram::commit_batch_latency)}});
+
+	auto codec_names = std::array<const char*, 2>{"storage_compress_duration_seconds",
+												  "storage_decompress_duration_seconds"};
+	for (auto h = size_t{0}; h < codecs.size(); ++h) {
+		auto series = std::vector<labeled_histogram>{};
+		for (auto c = size_t{0}; c < MAX_CODEC; ++c) {
+			if (codecs[h][c].count == 0) continue;
+			series.emplace_back("codec=\"" + codec_name(c) + "\"", &codecs[h][c]);
+		}
+		write_histograms(ss, codec_names[h], series);
+	}
+
+	ss << "# TYPE storage_compression_ratio gauge\n";
+	for (auto c = size_t{0}; c < MAX_CODEC; ++c) {
+		if (codec_out[c] == 0) continue;
+		ss << "storage_compression_ratio{codec=\"" << codec_name(c) << "\"} "
+		   << static_cast<double>(codec_in[c]) / codec_out[c] << "\n";
+	}
+
+	for (const auto& [name, reader] : gauges) {
+		ss << "# TYPE " << name << " gauge\n" << name << " " << reader() << "\n";
+	}
+
+	return ss.str();
+}
+
+}  // namespace ricox
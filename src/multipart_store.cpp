@@ -0,0 +1,198 @@
+#include "multipart_store.hpp"
+#include "checksum.hpp"
+#include "io_backend.hpp"
+#include "logger.hpp"
+#include "server_config.hpp"
+#include "server_utils.hpp"
+#include "worker_pool.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+namespace ricox {
+multipart_store::multipart_store()
+	: directory{server_config::get_instance().get_multipart_path()},
+	  expiry{server_config::get_instance().get_multipart_expiry_s()},
+	  attempts{0} {}
+
+auto multipart_store::get_instance() -> multipart_store& {
+	static auto instance = multipart_store{};
+	return instance;
+}
+
+auto multipart_store::start() -> bool {
+	auto dir = file_util{directory};
+	if (!dir.create_directory()) {
+		common::ERROR("server_logger", "Failed to create multipart directory: {}", directory);
+		return false;
+	}
+
+	// The uploads they belonged to were only known to the previous process
+	auto files = std::vector<std::string>{};
+	dir.scan_directory(files);
+	for (const auto& file : files) std::remove(file.c_str());
+	if (!files.empty()) common::INFO("server_logger", "Removed {} parts of unfinished multipart uploads", files.size());
+	return true;
+}
+
+auto multipart_store::create(const std::string& key, const std::string& storage_type) -> std::string {
+	static auto random = std::mt19937_64{std::random_device{}()};
+
+	auto lock = std::lock_guard{mutex};
+	drop_expired();
+
+	// Unguessable, so one client cannot add parts to another's upload by counting
+	char text[33];
+	do {
+		std::snprintf(text, sizeof(text), "%016lx%016lx", static_cast<unsigned long>(random()),
+					  static_cast<unsigned long>(random()));
+	} while (uploads.contains(text));
+
+	uploads.emplace(text, multipart_upload{text, key, storage_type, std::time(nullptr), {}});
+	return text;
+}
+
+auto multipart_store::drop_expired() -> void {
+	if (!expiry.count()) return;
+
+	auto now = std::time(nullptr);
+	for (auto it = uploads.begin(); it != uploads.end();) {
+		if (now - it->second.time_created < expiry.count()) {
+			++it;
+			continue;
+		}
+
+		common::INFO("server_logger", "Dropping expired multipart upload {} of {}", it->first, it->second.key);
+		worker_pool::get_instance().submit([upload = std::move(it->second)]() -> void { discard(upload); });
+		it = uploads.erase(it);
+	}
+}
+
+auto multipart_store::part_path(const std::string& id, const std::string& key, unsigned number, std::string& path)
+	-> bool {
+	{
+		auto lock = std::lock_guard{mutex};
+		auto it = uploads.find(id);
+		if (it == uploads.end() || it->second.key != key) return false;
+	}
+
+	path = directory + "/" + id + "." + std::to_string(number) + "." + std::to_string(attempts.fetch_add(1));
+	return true;
+}
+
+auto multipart_store::add_part(const std::string& id, unsigned number, multipart_part part) -> bool {
+	auto replaced = std::string{};
+	{
+		auto lock = std::lock_guard{mutex};
+		auto it = uploads.find(id);
+		if (it == uploads.end()) return false;
+
+		auto& slot = it->second.parts[number];
+		replaced = std::move(slot.path);
+		slot = std::move(part);
+	}
+
+	if (!replaced.empty()) std::remove(replaced.c_str());
+	return true;
+}
+
+auto multipart_store::take(const std::string& id, const std::string& key,
+						   const std::vector<std::pair<unsigned, std::string>>& requested, multipart_upload& upload,
+						   std::vector<multipart_part>& selected) -> multipart_status {
+	auto lock = std::lock_guard{mutex};
+	auto it = uploads.find(id);
+	if (it == uploads.end() || it->second.key != key) return multipart_status::no_such_upload;
+	if (requested.empty()) return multipart_status::invalid_part;
+
+	selected.clear();
+	selected.reserve(requested.size());
+	for (auto i = size_t{0}; i < requested.size(); ++i) {
+		const auto& [number, etag] = requested[i];
+		if (i && number <= requested[i - 1].first) return multipart_status::invalid_order;
+
+		auto part = it->second.parts.find(number);
+		if (part == it->second.parts.end() || part->second.etag != etag) return multipart_status::invalid_part;
+		selected.push_back(part->second);
+	}
+
+	// From here on no part can be replaced and the upload cannot be aborted
+	upload = std::move(it->second);
+	uploads.erase(it);
+	return multipart_status::ok;
+}
+
+auto multipart_store::abort(const std::string& id, const std::string& key) -> bool {
+	auto upload = multipart_upload{};
+	{
+		auto lock = std::lock_guard{mutex};
+		auto it = uploads.find(id);
+		if (it == uploads.end() || it->second.key != key) return false;
+
+		upload = std::move(it->second);
+		uploads.erase(it);
+	}
+
+	worker_pool::get_instance().submit([upload = std::move(upload)]() -> void { discard(upload); });
+	return true;
+}
+
+auto multipart_store::size() const -> size_t {
+	auto lock = std::lock_guard{mutex};
+	return uploads.size();
+}
+
+auto multipart_store::assemble(const std::vector<multipart_part>& parts, const std::string& path, uint32_t& checksum)
+	-> bool {
+	static constexpr size_t SLICE = 1 << 20;
+
+	auto out = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out < 0) {
+		common::ERROR("server_logger", "Unable to create assembled object {}", path);
+		return false;
+	}
+
+	// Copied a slice at a time, so the object is never held in memory whatever its size
+	auto buffer = std::string(SLICE, '\0');
+	auto offset = uint64_t{0};
+	auto ok = true;
+	checksum = 0;
+	for (const auto& part : parts) {
+		auto fd = open(part.path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			common::ERROR("server_logger", "Unable to open multipart part {}", part.path);
+			ok = false;
+			break;
+		}
+
+		auto part_checksum = uint32_t{0};
+		for (auto done = uint64_t{0}; ok && done < part.size; done += SLICE) {
+			auto len = static_cast<size_t>(std::min<uint64_t>(part.size - done, SLICE));
+			ok = io_backend::get_instance().read(fd, buffer.data(), len, done) &&
+				 io_backend::get_instance().write(out, buffer.data(), len, offset + done);
+			part_checksum = crc32c::update(part_checksum, buffer.data(), len);
+			checksum = crc32c::update(checksum, buffer.data(), len);
+		}
+		close(fd);
+
+		if (!ok || part_checksum != part.checksum) {
+			common::ERROR("server_logger", "Multipart part {} is unreadable or failed its checksum", part.path);
+			ok = false;
+			break;
+		}
+
+		offset += part.size;
+	}
+
+	close(out);
+	if (!ok) std::remove(path.c_str());
+	return ok;
+}
+
+auto multipart_store::discard(const multipart_upload& upload) -> void {
+	for (const auto& [_, part] : upload.parts) std::remove(part.path.c_str());
+}
+
+}  // namespace ricox
@@ -0,0 +1,83 @@
+#include "reclaimer.hpp"
+#include "fd_cache.hpp"
+#include "logger.hpp"
+#include "worker_pool.hpp"
+
+#include <cstdio>
+#include <vector>
+
+namespace ricox {
+reclaimer::read_guard::read_guard(uint64_t epoch) : epoch{epoch}, active{true} {}
+
+reclaimer::read_guard::read_guard(const read_guard& other) : epoch{other.epoch}, active{other.active} {
+	if (active) reclaimer::get_instance().pin(epoch);
+}
+
+reclaimer::read_guard::read_guard(read_guard&& other) noexcept : epoch{other.epoch}, active{other.active} {
+	other.active = false;
+}
+
+reclaimer::read_guard::~read_guard() {
+	if (active) reclaimer::get_instance().unpin(epoch);
+}
+
+reclaimer::reclaimer() : current_epoch{0} {}
+
+auto reclaimer::get_instance() -> reclaimer& {
+	static auto instance = reclaimer{};
+	return instance;
+}
+
+auto reclaimer::enter() -> read_guard {
+	auto lock = std::lock_guard{mutex};
+	++readers[current_epoch];
+	return read_guard{current_epoch};
+}
+
+auto reclaimer::pin(uint64_t epoch) -> void {
+	auto lock = std::lock_guard{mutex};
+	++readers[epoch];
+}
+
+auto reclaimer::unpin(uint64_t epoch) -> void {
+	auto lock = std::unique_lock{mutex};
+	auto it = readers.find(epoch);
+	if (--it->second) return;
+
+	readers.erase(it);
+	collect(lock);
+}
+
+auto reclaimer::retire(const std::string& path) -> void {
+	// Readers entering from now on look up the new index state and cannot reach path
+	fd_cache::get_instance().invalidate(path);
+
+	auto lock = std::unique_lock{mutex};
+	retired.emplace_back(current_epoch++, path);
+	collect(lock);
+}
+
+auto reclaimer::collect(std::unique_lock<std::mutex>& lock) -> void {
+	// A file retired in epoch e may still be read by guards of epoch e or older
+	auto oldest = readers.empty() ? current_epoch : readers.begin()->first;
+	auto paths = std::vector<std::string>{};
+	while (!retired.empty() && retired.front().first < oldest) {
+		paths.push_back(std::move(retired.front().second));
+		retired.pop_front();
+	}
+	lock.unlock();
+
+	if (paths.empty()) return;
+	worker_pool::get_instance().submit([paths = std::move(paths)]() -> void {
+		for (const auto& path : paths) {
+			if (std::remove(path.c_str()) != 0) common::ERROR("server_logger", "Unable to reclaim {}", path);
+		}
+	});
+}
+
+auto reclaimer::pending() -> size_t {
+	auto lock = std::lock_guard{mutex};
+	return retired.size();
+}
+
+}  // namespace ricox
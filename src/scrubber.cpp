@@ -0,0 +1,145 @@
+#include "scrubber.hpp"
+#include "checksum.hpp"
+#include "io_backend.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "segment_store.hpp"
+#include "server_config.hpp"
+#include "server_utils.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+namespace ricox {
+static constexpr size_t READ_CHUNK = 1 << 20;
+
+scrubber::scrubber()
+	: bytes_per_second{server_config::get_instance().get_scrub_bytes_per_s()},
+	  interval{server_config::get_instance().get_scrub_interval_s()},
+	  pass_bytes{0},
+	  stopping{false} {}
+
+scrubber::~scrubber() {
+	{
+		auto lock = std::lock_guard{mutex};
+		stopping = true;
+	}
+
+	cv.notify_all();
+	if (worker.joinable()) worker.join();
+}
+
+auto scrubber::get_instance() -> scrubber& {
+	static auto instance = scrubber{};
+	return instance;
+}
+
+auto scrubber::start() -> void {
+	if (bytes_per_second == 0 || worker.joinable()) return;
+	worker = std::thread{[this]() -> void { run(); }};
+}
+
+auto scrubber::run() -> void {
+	while (true) {
+		{
+			auto lock = std::unique_lock{mutex};
+			cv.wait_for(lock, interval, [this]() -> bool { return stopping; });
+			if (stopping) return;
+		}
+
+		scrub_pass();
+	}
+}
+
+auto scrubber::scrub_pass() -> void {
+	// A snapshot of the persistent index is shared, not copied; for_each cannot stop early, so after stopping the
+	// remaining entries are only skipped
+	auto index = data_manager::get_instance().snapshot();
+
+	pass_start = std::chrono::steady_clock::now();
+	pass_bytes = 0;
+	auto checked = size_t{0};
+	auto corrupted = size_t{0};
+	auto stopped = false;
+	index.for_each([&](const std::string&, const storage_info& info) -> void {
+		if (stopped || !info.has_checksum) return;
+
+		auto crc = uint32_t{0};
+		if (!checksum_of(info, crc)) {
+			auto lock = std::lock_guard{mutex};
+			stopped = stopping;
+			return;	 // removed or relocated meanwhile, or unreadable, which the next download reports
+		}
+
+		++checked;
+		if (crc == info.checksum) return;
+
+		// A re-upload or relocation during the read is no corruption, only a mismatch against the current record
+		auto current = storage_info{};
+		if (!data_manager::get_instance().find_by_url(info.file_url, current) || current.file_path != info.file_path ||
+			current.segment_id != info.segment_id || current.block_offset != info.block_offset ||
+			current.time_modified != info.time_modified || current.checksum != info.checksum) {
+			return;
+		}
+
+		crc32c::verify(info, crc);
+		++corrupted;
+	});
+	if (stopped) return;
+
+	common::INFO("server_logger", "Scrubbed {} files ({} bytes), {} failed their checksum", checked, pass_bytes,
+				 corrupted);
+}
+
+auto scrubber::checksum_of(const storage_info& info, uint32_t& crc) -> bool {
+	auto content = std::string{};
+	if (info.in_segment()) {
+		if (!segment_store::get_instance().read(info, content)) return false;
+		crc = crc32c::update(0, content.data(), content.size());
+		return throttle(info.block_length);
+	}
+
+	const auto& hot_path = server_config::get_instance().get_hot_storage_path();
+	if (!info.file_path.starts_with(hot_path)) {
+		// Streamed and paced as it is decompressed, a single packed payload is unpacked in memory
+		return file_util{info.file_path}.checksum_content(
+			info.dictionary_id, info.chunked, [this](size_t bytes) -> bool { return throttle(bytes); }, crc);
+	}
+
+	// Hot files are read in chunks, paced chunk by chunk so large files do not burst
+	auto fd = open(info.file_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+
+	struct stat file_stat;
+	auto ok = fstat(fd, &file_stat) == 0;
+	auto size = ok ? static_cast<uint64_t>(file_stat.st_size) : 0;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	crc = 0;
+	content.resize(std::min<uint64_t>(size, READ_CHUNK));
+	for (auto offset = uint64_t{0}; ok && offset < size;) {
+		auto len = static_cast<size_t>(std::min<uint64_t>(size - offset, READ_CHUNK));
+		ok = io_backend::get_instance().read(fd, content.data(), len, offset);
+		if (ok) crc = crc32c::update(crc, content.data(), len);
+		offset += len;
+		ok = ok && throttle(len);
+	}
+
+	close(fd);
+	return ok;
+}
+
+auto scrubber::throttle(uint64_t bytes) -> bool {
+	metrics::add(counter::scrub_bytes, bytes);
+	pass_bytes += bytes;
+
+	auto due = pass_start + std::chrono::microseconds{pass_bytes * 1000000 / bytes_per_second};
+	auto lock = std::unique_lock{mutex};
+	cv.wait_until(lock, due, [this]() -> bool { return stopping; });
+	return !stopping;
+}
+
+}  // namespace ricox
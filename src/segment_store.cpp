@@ -0,0 +1,353 @@
+#include "segment_store.hpp"
+#include "bundle.hpp"
+#include "commit_queue.hpp"
+#include "fd_cache.hpp"
+#include "io_backend.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "reclaimer.hpp"
+#include "server_config.hpp"
+#include "server_utils.hpp"
+#include "snapshot_manager.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <set>
+
+namespace ricox {
+static constexpr const char* SEGMENT_PREFIX = "segment-";
+static constexpr const char* SEGMENT_SUFFIX = ".seg";
+static constexpr size_t FILES_PER_ROUND = 4096;	 // relocations published together
+
+static auto same_location(const storage_info& a, const storage_info& b) -> bool {
+	return a.file_path == b.file_path && a.segment_id == b.segment_id && a.block_offset == b.block_offset &&
+		   a.entry_offset == b.entry_offset && a.file_size == b.file_size && a.time_modified == b.time_modified;
+}
+
+static auto sync_directory(const std::string& dir) -> void {
+	auto fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+}
+
+static auto parse_segment_id(const std::string& path, uint64_t& id) -> bool {
+	auto name = path.substr(path.find_last_of('/') + 1);
+	if (!name.starts_with(SEGMENT_PREFIX) || !name.ends_with(SEGMENT_SUFFIX)) return false;
+
+	auto digits = name.substr(strlen(SEGMENT_PREFIX), name.size() - strlen(SEGMENT_PREFIX) - strlen(SEGMENT_SUFFIX));
+	if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos) return false;
+
+	id = std::stoull(digits);
+	return id != 0;
+}
+
+// Live bytes per segment: every block still referenced by the index counts once
+static auto live_bytes() -> std::map<uint64_t, uint64_t> {
+	auto blocks = std::set<std::pair<uint64_t, uint64_t>>{};
+	auto live = std::map<uint64_t, uint64_t>{};
+	auto count = [&](const std::string&, const storage_info& info) -> void {
+		if (!info.in_segment() || !blocks.emplace(info.segment_id, info.block_offset).second) return;
+		live[info.segment_id] += info.block_length;
+	};
+
+	// Blocks an earlier version or a retained snapshot still refers to are live as well
+	data_manager::get_instance().snapshot().for_each(count);
+	data_manager::get_instance().for_each_noncurrent(count);
+	for (const auto& s : snapshot_manager::get_instance().list()) s->index.for_each(count);
+	return live;
+}
+
+segment_store::segment_store()
+	: directory{server_config::get_instance().get_segment_path()},
+	  max_segment_bytes{server_config::get_instance().get_segment_max_bytes()},
+	  block_bytes{server_config::get_instance().get_segment_block_bytes()},
+	  file_max_size{server_config::get_instance().get_segment_file_max_size()},
+	  interval{server_config::get_instance().get_segment_pack_interval_s()},
+	  compact_ratio{server_config::get_instance().get_segment_compact_ratio()},
+	  current_id{0},
+	  current_fd{-1},
+	  current_size{0},
+	  stopping{false} {}
+
+segment_store::~segment_store() {
+	{
+		auto lock = std::lock_guard{mutex};
+		stopping = true;
+	}
+
+	cv.notify_all();
+	if (worker.joinable()) worker.join();
+	if (current_fd >= 0) close(current_fd);
+}
+
+auto segment_store::get_instance() -> segment_store& {
+	static auto instance = segment_store{};
+	return instance;
+}
+
+auto segment_store::segment_file(uint64_t id) const -> std::string {
+	char name[32];
+	std::snprintf(name, sizeof(name), "%s%010llu%s", SEGMENT_PREFIX, static_cast<unsigned long long>(id),
+				  SEGMENT_SUFFIX);
+	return directory + "/" + name;
+}
+
+auto segment_store::start() -> bool {
+	auto dir = file_util{directory};
+	if (!dir.create_directory()) {
+		common::ERROR("server_logger", "Failed to create segment directory: {}", directory);
+		return false;
+	}
+
+	// Appending resumes in the newest segment; a block torn by a crash is never referenced, so it is just dead space
+	auto files = std::vector<std::string>{};
+	dir.scan_directory(files);
+	for (const auto& file : files) {
+		auto id = uint64_t{0};
+		if (parse_segment_id(file, id) && id > current_id) current_id = id;
+	}
+
+	if (current_id) {
+		current_fd = open(segment_file(current_id).c_str(), O_WRONLY | O_CLOEXEC);
+		current_size = current_fd >= 0 ? static_cast<uint64_t>(lseek(current_fd, 0, SEEK_END)) : 0;
+	}
+
+	worker = std::thread{[this]() -> void { run(); }};
+	return true;
+}
+
+auto segment_store::run() -> void {
+	auto lock = std::unique_lock{mutex};
+	while (true) {
+		cv.wait_for(lock, interval, [this]() -> bool { return stopping; });
+		if (stopping) return;
+
+		pack_small_files();
+		compact_segments();
+	}
+}
+
+auto segment_store::pack_small_files() -> void {
+	auto infos = std::vector<storage_info>{};
+	data_manager::get_instance().find_all(infos);
+
+	auto& cold_path = server_config::get_instance().get_cold_storage_path();
+	auto sources = std::vector<storage_info>{};
+	auto packed = size_t{0};
+	for (auto& info : infos) {
+		if (info.in_segment() || !info.file_path.starts_with(cold_path) || info.file_size > file_max_size) continue;
+		if (info.dictionary_id) continue;  // its group's dictionary already compresses it, a block would undo that
+
+		sources.push_back(std::move(info));
+		if (sources.size() == FILES_PER_ROUND) {
+			packed += repack(sources);
+			sources.clear();
+		}
+	}
+
+	packed += repack(sources);
+	if (packed) common::INFO("server_logger", "Packed {} small cold files into segments", packed);
+}
+
+auto segment_store::compact_segments() -> void {
+	auto files = std::vector<std::string>{};
+	if (!file_util{directory}.scan_directory(files)) return;
+
+	auto live = live_bytes();
+	for (const auto& file : files) {
+		auto id = uint64_t{0};
+		if (!parse_segment_id(file, id) || id == current_id) continue;
+
+		auto size = static_cast<uint64_t>(file_util{file}.get_file_size());
+		if (live[id] && live[id] >= compact_ratio * size) continue;
+
+		if (live[id]) {
+			// Rewrite what is still referenced into the current segment
+			auto infos = std::vector<storage_info>{};
+			data_manager::get_instance().find_all(infos);
+			std::erase_if(infos, [id](const storage_info& info) -> bool { return info.segment_id != id; });
+			if (infos.empty()) continue;  // only held by snapshots or earlier versions, removed once they go
+
+			auto moved = repack(infos);
+			common::INFO("server_logger", "Compacted segment {}: moved {} of {} files", id, moved, infos.size());
+			if (live_bytes()[id]) continue;	 // some entries could not be moved, retried next round
+		}
+
+		// Readers holding the old location retry against the index, see read()
+		reclaimer::get_instance().retire(file);
+		common::INFO("server_logger", "Retired segment {} with no live files", id);
+	}
+}
+
+auto segment_store::repack(const std::vector<storage_info>& sources) -> size_t {
+	auto entries = std::vector<packed_entry>{};
+	auto raw = std::string{};
+	auto block_first = size_t{0};
+
+	for (const auto& source : sources) {
+		auto content = std::string{};
+		auto inode = ino_t{0};
+		if (!read_source(source, content, inode)) continue;
+
+		if (!raw.empty() && raw.size() + content.size() > block_bytes) {
+			if (!append_block(raw, entries, block_first)) {
+				entries.resize(block_first);
+				return publish(entries);
+			}
+			raw.clear();
+			block_first = entries.size();
+		}
+
+		auto target = source;
+		target.entry_offset = static_cast<uint32_t>(raw.size());
+		target.file_size = content.size();	// uncompressed, the block carries the compression
+		target.dictionary_id = 0;
+		target.chunked = false;
+		entries.push_back(packed_entry{source, std::move(target), inode});
+		raw += content;
+	}
+
+	if (!raw.empty() && !append_block(raw, entries, block_first)) entries.resize(block_first);
+	return publish(entries);
+}
+
+auto segment_store::read_source(const storage_info& info, std::string& content, ino_t& inode) const -> bool {
+	if (info.in_segment()) {
+		inode = 0;
+		return read(info, content);
+	}
+
+	struct stat file_stat;
+	if (stat(info.file_path.c_str(), &file_stat) != 0) return false;
+	inode = file_stat.st_ino;
+
+	return file_util{info.file_path}.decompress_content(content, info.dictionary_id, info.chunked);
+}
+
+auto segment_store::open_segment() -> bool {
+	if (current_fd >= 0 && current_size < max_segment_bytes) return true;
+
+	if (current_fd >= 0) {	// sealed, its blocks are published with the rest of the round
+		io_backend::get_instance().sync(current_fd);
+		close(current_fd);
+	}
+
+	++current_id;
+	current_size = 0;
+	current_fd = open(segment_file(current_id).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (current_fd < 0) {
+		common::ERROR("server_logger", "Unable to create segment {}", segment_file(current_id));
+		return false;
+	}
+
+	return true;
+}
+
+auto segment_store::append_block(const std::string& raw, std::vector<packed_entry>& entries, size_t first) -> bool {
+	if (!open_segment()) return false;
+
+	auto format = server_config::get_instance().get_bundle_type();
+	auto payload = std::string{};
+	auto start = std::chrono::steady_clock::now();
+	bundle::pack(format, payload, raw);	 // keeps the bytes unpacked if they do not compress
+	metrics::record_codec(codec_histogram::compress_time, format, metrics::elapsed_ns(start), raw.size(),
+						  payload.size());
+
+	auto header = block_header{block_header::MAGIC, static_cast<uint32_t>(payload.size()),
+							   static_cast<uint32_t>(raw.size()), static_cast<uint32_t>(entries.size() - first)};
+	auto block = std::string(reinterpret_cast<const char*>(&header), sizeof(header)) + payload;
+	if (!io_backend::get_instance().write(current_fd, block.data(), block.size(), current_size)) {
+		common::ERROR("server_logger", "Failed to append block to segment {}", segment_file(current_id));
+		return false;
+	}
+
+	for (auto i = first; i < entries.size(); ++i) {
+		entries[i].target.segment_id = current_id;
+		entries[i].target.block_offset = current_size;
+		entries[i].target.block_length = static_cast<uint32_t>(block.size());
+	}
+
+	current_size += block.size();
+	return true;
+}
+
+auto segment_store::publish(std::vector<packed_entry>& entries) -> size_t {
+	if (entries.empty()) return 0;
+
+	// The blocks are durable before any index record points at them
+	if (!io_backend::get_instance().sync(current_fd)) {
+		common::ERROR("server_logger", "Failed to sync segment {}", segment_file(current_id));
+		return 0;
+	}
+	sync_directory(directory);
+
+	// No upload can rename over a source while the publish lock is held, so the checks below stay true
+	auto publish_lock = commit_queue::get_instance().lock_publish();
+	auto moved = std::vector<storage_info>{};
+	auto obsolete = std::vector<storage_info>{};
+	for (const auto& e : entries) {
+		auto current = storage_info{};
+		if (!data_manager::get_instance().find_by_url(e.source.file_url, current)) continue;
+		if (!same_location(current, e.source)) continue;  // replaced while packing, its copy stays dead
+
+		if (!e.source.in_segment()) {
+			struct stat file_stat;
+			if (stat(e.source.file_path.c_str(), &file_stat) != 0 || file_stat.st_ino != e.source_inode) continue;
+			obsolete.push_back(e.source);
+		}
+		moved.push_back(e.target);
+	}
+
+	if (moved.empty() || !data_manager::get_instance().add_infos(moved)) return 0;
+
+	snapshot_manager::get_instance().release(obsolete);
+
+	return moved.size();
+}
+
+auto segment_store::read(const storage_info& info, std::string& content) const -> bool {
+	auto located = info;
+	for (auto attempt = 0; attempt < 2; ++attempt) {
+		auto handle = fd_cache::get_instance().acquire(segment_file(located.segment_id));
+		auto block = std::string(located.block_length, '\0');
+		if (handle && io_backend::get_instance().read(handle->fd, block.data(), block.size(), located.block_offset)) {
+			auto header = block_header{};
+			memcpy(&header, block.data(), sizeof(header));
+			if (header.magic != block_header::MAGIC || sizeof(header) + header.packed_length != block.size()) {
+				common::ERROR("server_logger", "Corrupt block at {} in segment {}", located.block_offset,
+							  located.segment_id);
+				return false;
+			}
+
+			auto raw = std::string{};
+			if (!file_util::unpack(block.data() + sizeof(header), header.packed_length, raw) ||
+				located.entry_offset + located.file_size > raw.size()) {
+				common::ERROR("server_logger", "Corrupt block at {} in segment {}", located.block_offset,
+							  located.segment_id);
+				return false;
+			}
+
+			content.assign(raw, located.entry_offset, located.file_size);
+			return true;
+		}
+
+		// Compaction may have moved the file since the caller looked it up
+		auto current = storage_info{};
+		if (!data_manager::get_instance().find_by_url(info.file_url, current) || !current.in_segment() ||
+			same_location(current, located)) {
+			break;
+		}
+		located = current;
+	}
+
+	common::ERROR("server_logger", "Unable to read {} from segment {}", info.file_url, info.segment_id);
+	return false;
+}
+
+}  // namespace ricox
@@ -1,281 +1,1930 @@
 #include "server.hpp"
+#include "access_log.hpp"
+#include "access_tracker.hpp"
+#include "admission.hpp"
+#include "archive_reader.hpp"
+#include "archive_stream.hpp"
+#include "checksum.hpp"
+#include "commit_queue.hpp"
+#include "connection_manager.hpp"
+#include "dictionary_store.hpp"
+#include "fd_cache.hpp"
+#include "io_backend.hpp"
 #include "logger.hpp"
+#include "loop_executor.hpp"
+#include "metadata_table.hpp"
+#include "metrics.hpp"
+#include "multipart_store.hpp"
+#include "reclaimer.hpp"
+#include "router.hpp"
 #include "server_config.hpp"
+#include "scrubber.hpp"
+#include "segment_store.hpp"
 #include "server_utils.hpp"
+#include "simd_codec.hpp"
+#include "snapshot_manager.hpp"
+#include "small_file_cache.hpp"
+#include "trace.hpp"
+#include "upload_pipeline.hpp"
+#include "worker_pool.hpp"
 
 #include <event.h>
 #include <event2/http.h>
 #include <evhttp.h>
 #include <fcntl.h>
 #include <array>
+#include <charconv>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <fstream>
 #include <regex>
 #include <sstream>
-#include "base64.hpp"
+#include <string_view>
 
 namespace ricox {
 
-// Utility functions
-static auto to_hex(uint8_t x) -> uint8_t { return x + (x < 10 ? '0' : 'a' - 10); }
+server::server() {
+	server_port = server_config::get_instance().get_server_port();
+	server_ip = server_config::get_instance().get_server_ip();
+	download_url_prefix = server_config::get_instance().get_download_url_prefix();
+}
+
+// static functions of the class
+auto server::generic_callback(evhttp_request* req, void* arg) -> void {
+	static constexpr auto GET = unsigned{EVHTTP_REQ_GET | EVHTTP_REQ_HEAD};
+	static constexpr auto POST = unsigned{EVHTTP_REQ_POST | EVHTTP_REQ_PUT};
+	static constexpr auto routes = router<12>{{{
+		{"/download-batch", route_match::exact, POST, nullptr, download_batch},	 // many files as one tar
+		{"/download", route_match::prefix, GET, "download", download},			 // any download URL
+		{"/download", route_match::prefix, EVHTTP_REQ_DELETE, "delete", remove_file},
+		{"/upload", route_match::exact, POST, "upload", upload},
+		{"/upload-batch", route_match::exact, POST, "upload_batch", upload_batch},	// committed together
+		{"/", route_match::exact, GET, "show", show},								// list of files
+		{"/list", route_match::exact, GET, "list", list_files},						// one page under a prefix
+		{"/search", route_match::exact, GET, "search", search},						// by size, time and tier
+		{"/metrics", route_match::exact, GET, nullptr, show_metrics},				// Prometheus scrape
+		{"/admin/log", route_match::exact, GET | POST, nullptr, configure_log},		// access log level and sampling
+		{"/admin/snapshot", route_match::exact, GET | POST, nullptr, manage_snapshots},	// point-in-time index
+		{"/s3", route_match::prefix, GET | POST | EVHTTP_REQ_DELETE, "s3", s3_request},		// S3 API subset
+	}}};
+
+	if (!connection_manager::get_instance().admit(req)) return;
+
+	// Decoded once into a buffer reused by every request: all handlers run on this event loop thread
+	thread_local auto path = std::string{};
+	simd_codec::url_decode(evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req)), path);
+
+	// Once libevent completes the reply: one access record, and the connection waits for the next request
+	auto start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+						std::chrono::steady_clock::now().time_since_epoch())
+						.count();
+	evhttp_request_set_on_complete_cb(req, on_request_complete,
+									  reinterpret_cast<void*>(static_cast<uintptr_t>(start_ns)));
+
+	auto method = evhttp_request_get_command(req);
+	auto route = routes.find(path, method);
+	if (!route) {
+		evhttp_send_reply(req, HTTP_NOTIMPLEMENTED, "Request not implemented", nullptr);
+		return;
+	}
+
+	if (!(route->methods & method)) {
+		evhttp_send_reply(req, HTTP_BADMETHOD, "Method not allowed", nullptr);
+		return;
+	}
+
+	auto trace = route->trace_name ? begin_trace(req, route->trace_name, path) : nullptr;
+	auto ctx = request_context{req, method, path, trace};
+	route->handler(ctx);
+}
+
+auto server::download(request_context& ctx) -> void {
+	metrics::add(counter::download_requests);
+	auto timer = scoped_timer{histogram::download_latency};
+	auto req = ctx.req;
+	auto trace = ctx.trace;
+
+	// get the storage_info from the path the router decoded; the file it names outlives the guard
+	auto guard = reclaimer::get_instance().enter();
+	auto info = storage_info{};
+	auto lookup_span = trace_span{trace, "index_lookup"};
+	if (!find_requested(req, ctx.path, info)) return;
+	lookup_span.end();
+
+	// Validators come from the index, so a conditional request is answered without touching the file
+	add_validators(req, info);
+	if (is_not_modified(req, info)) {
+		metrics::add(counter::not_modified);
+		if (trace) trace->mark_reply();
+		evhttp_send_reply(req, HTTP_NOTMODIFIED, "Not Modified", nullptr);
+		return;
+	}
+
+	auto key = cache_key(info);
+	auto output_buffer = evhttp_request_get_output_buffer(req);
+
+	auto cache_span = trace_span{trace, "cache_lookup"};
+	auto cached = small_file_cache::get_instance().find(key);
+	cache_span.end();
+
+	if (!cached && info.in_segment()) {
+		// Small cold file packed into a segment: unpack its block, keep the bytes for the next request
+		auto segment_span = trace_span{trace, "segment_read"};
+		auto content = std::make_shared<std::string>();
+		if (!segment_store::get_instance().read(info, *content)) {
+			evhttp_send_reply(req, HTTP_INTERNAL, "Cannot read file from segment", nullptr);
+			return;
+		}
+
+		if (!crc32c::verify(info, crc32c::update(0, content->data(), content->size()))) {
+			evhttp_send_reply(req, HTTP_INTERNAL, "Stored file failed its integrity check", nullptr);
+			return;
+		}
+
+		small_file_cache::get_instance().insert(key, content);
+		cached = std::move(content);
+	}
+
+	if (cached) {
+		// Small file already in memory, no filesystem access at all
+		auto range = byte_range{};
+		if (!requested_range(req, info, cached->size(), range)) return;
+		if (!small_file_cache::add_to_buffer(output_buffer, cached, range.offset, range.length)) {
+			evhttp_send_reply(req, HTTP_INTERNAL, "Cannot add file to response buffer", nullptr);
+			return;
+		}
+
+		send_download(req, info, range, trace);
+		return;
+	}
+
+	if (info.file_path.find(server_config::get_instance().get_hot_storage_path()) != std::string::npos) {
+		send_stored(req, info, info.file_path, false, trace);
+		return;
+	}
+
+	if (ctx.method == EVHTTP_REQ_HEAD) {
+		// Compressed in cold storage, but a HEAD only needs the size its headers record
+		auto size = uint64_t{0};
+		auto range = byte_range{};
+		if (!file_util{info.file_path}.content_size(info.dictionary_id, info.chunked, size)) {
+			common::ERROR("server_logger", "Cannot read the size of stored file {}", info.file_path);
+			evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot read stored file", nullptr);
+			return;
+		}
+		if (!requested_range(req, info, size, range)) return;
+
+		evhttp_add_header(req->output_headers, "Content-Length", std::to_string(range.length).c_str());
+		send_download(req, info, range, trace);
+		return;
+	}
+
+	// The file is compressed in cold storage: limited per client, then decompressed on the worker pool once the
+	// admission queue has a slot, so a few clients cannot take all decompression CPU and disk
+	if (!admit_client(req, info.file_size)) return;
+
+	timer.dismiss();  // recorded when the decompressed file is sent
+	auto start = std::chrono::steady_clock::now();
+	auto admitted = admission_queue::get_instance().enter(
+		[=]() -> void { decompress_download(req, info, guard, start, trace); });
+	if (!admitted) reject_overloaded(req);
+}
+
+auto server::decompress_download(evhttp_request* req, const storage_info& info, reclaimer::read_guard guard,
+								 std::chrono::steady_clock::time_point start, request_trace* trace) -> void {
+	// A private copy in hot storage, concurrent downloads of the same file each decompress their own
+	const auto& hot_path = server_config::get_instance().get_hot_storage_path();
+	auto download_path = commit_queue::make_temp_path(
+		hot_path + std::string{info.file_path.begin() + info.file_path.find_last_of('/') + 1, info.file_path.end()});
+
+	auto decompress_start = request_trace::now_ns();
+	worker_pool::get_instance().submit([=, guard = std::move(guard)]() -> void {
+		// Decompress file to hot storage for download, checksumming the output as it is produced
+		auto created = file_util{hot_path}.create_directory();
+		auto checksum = uint32_t{0};
+		auto decompressed =
+			created && file_util{info.file_path}.decompress(download_path, info.dictionary_id, info.chunked, &checksum);
+		auto intact = !decompressed || crc32c::verify(info, checksum);
+
+		loop_executor::get_instance().post([=]() -> void {
+			admission_queue::get_instance().leave();
+			metrics::record_since(histogram::download_latency, start);
+			if (trace) trace->add_span("decompress", decompress_start, request_trace::now_ns());
+
+			if (!created) {
+				common::ERROR("server_logger", "Failed to create directory for download: {}", hot_path);
+				evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot create download directory", nullptr);
+				return;
+			}
+
+			if (!intact) {
+				std::remove(download_path.c_str());
+				evhttp_send_reply(req, HTTP_INTERNAL, "Stored file failed its integrity check", nullptr);
+				return;
+			}
+
+			send_stored(req, info, download_path, true, trace);
+		});
+	});
+}
+
+auto server::send_stored(evhttp_request* req, const storage_info& info, const std::string& download_path,
+						 bool is_temp, request_trace* trace) -> void {
+	// The file is available in hot storage
+	auto open_span = trace_span{trace, "open"};
+	auto handle = is_temp ? fd_cache::open_handle(download_path) : fd_cache::get_instance().acquire(download_path);
+	if (!handle && is_temp) {
+		// Decompression from cold storage failed
+		common::ERROR("server_logger", "Server decompression error, sending 500");
+		evhttp_send_reply(req, HTTP_INTERNAL, "Decompression failed", nullptr);
+		return;
+	} else if (!handle) {
+		// User requested a file that does not exist in hot storage
+		common::ERROR("server_logger", "Unknown error, file does not exist at {}", download_path.c_str());
+		evhttp_send_reply(req, HTTP_NOTFOUND, "File non-existent", nullptr);
+		return;
+	}
+
+	open_span.end();
+
+	// The open descriptor keeps a decompressed copy readable, its name is not needed past this point
+	if (is_temp) std::remove(download_path.c_str());
+
+	// Ranges are taken against what is sent: the index records the compressed size of a cold file
+	auto range = byte_range{};
+	if (!requested_range(req, info, handle->get_file_size(), range)) return;
+
+	auto output_buffer = evhttp_request_get_output_buffer(req);
+	auto loaded = false;
+	if (small_file_cache::get_instance().is_cacheable(handle->get_file_size())) {
+		auto read_span = trace_span{trace, "read_small_file"};
+		// First download of a small file: keep its bytes so repeat requests skip the filesystem
+		auto content = std::make_shared<std::string>();
+		if (handle->read_file(*content)) {
+			if (!crc32c::verify(info, crc32c::update(0, content->data(), content->size()))) {
+				evhttp_send_reply(req, HTTP_INTERNAL, "Stored file failed its integrity check", nullptr);
+				return;
+			}
+
+			small_file_cache::get_instance().insert(cache_key(info), content);
+			loaded = small_file_cache::add_to_buffer(output_buffer, content, range.offset, range.length);
+		}
+	}
+
+	// Load the file into the response to client, the segment keeps the descriptor alive until sent
+	if (!loaded && !fd_cache::add_to_buffer(output_buffer, handle, range.offset, range.length)) {
+		common::ERROR("server_logger", "Unable to load file {} to buffer", download_path.c_str());
+		evhttp_send_reply(req, HTTP_INTERNAL, "Cannot add file to response buffer", nullptr);
+		return;
+	}
+
+	send_download(req, info, range, trace);
+}
+
+auto server::send_download(evhttp_request* req, const storage_info& info, const byte_range& range,
+						   request_trace* trace) -> void {
+	// Build response header with Accept-ranges: bytes, the validators are already set
+	evhttp_add_header(req->output_headers, "Accept-Ranges", "bytes");
+	if (info.has_checksum) evhttp_add_header(req->output_headers, "Digest", crc32c::to_digest(info.checksum).c_str());
+	evhttp_add_header(req->output_headers, "Content-Type", "application/octet-stream");
+	auto reply_bytes = evbuffer_get_length(evhttp_request_get_output_buffer(req));
+	metrics::add(counter::bytes_out, reply_bytes);
+	connection_manager::get_instance().shape(req, reply_bytes);
+	if (evhttp_request_get_command(req) != EVHTTP_REQ_HEAD) access_tracker::get_instance().record(info);
+	if (trace) trace->mark_reply();
+
+	if (range.partial) {  // the buffer holds only the requested bytes
+		auto content_range = "bytes " + std::to_string(range.offset) + "-" +
+							 std::to_string(range.offset + range.length - 1) + "/" + std::to_string(range.total);
+		evhttp_add_header(req->output_headers, "Content-Range", content_range.c_str());
+		evhttp_send_reply(req, 206, "Partial Content", nullptr);
+	} else {  // no Range, or If-Range no longer names this version
+		evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+	}
+}
+
+auto server::download_batch(request_context& ctx) -> void {
+	metrics::add(counter::download_requests);
+	auto req = ctx.req;
+
+	// The body lists one download URL per line, as shown on the file list; the files stay until the stream ends
+	auto guard = reclaimer::get_instance().enter();
+	auto input_buffer = evhttp_request_get_input_buffer(req);
+	auto max_entries = server_config::get_instance().get_batch_max_entries();
+	auto infos = std::vector<storage_info>{};
 
-static auto from_hex(uint8_t x) -> uint8_t {
-	return x - (x <= '9' ? '0' : (x >= 'a' ? 'a' - 10 : (x >= 'A' ? 'A' - 10 : 0)));
+	auto url = std::string{};
+	while (auto line = evbuffer_readln(input_buffer, nullptr, EVBUFFER_EOL_CRLF)) {
+		simd_codec::url_decode(line, url);
+		free(line);
+		if (url.empty()) continue;
+
+		if (infos.size() == max_entries) {
+			common::ERROR("server_logger", "Batch download exceeds {} entries", max_entries);
+			evhttp_send_reply(req, HTTP_ENTITYTOOLARGE, "Too many files requested", nullptr);
+			return;
+		}
+
+		// Every entry is resolved up front, the status line cannot change once streaming starts
+		auto info = storage_info{};
+		if (!data_manager::get_instance().find_by_url(url, info)) {
+			common::ERROR("server_logger", "No storage info for requested URL: {}", url.c_str());
+			evhttp_send_reply(req, HTTP_NOTFOUND, "File non-existent", nullptr);
+			return;
+		}
+		infos.push_back(std::move(info));
+	}
+
+	if (infos.empty()) {
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid request (no files listed)", nullptr);
+		return;
+	}
+
+	// Charged like single cold downloads: the stored size of every entry that has to be unpacked
+	const auto& hot_path = server_config::get_instance().get_hot_storage_path();
+	auto cold_bytes = uint64_t{0};
+	for (const auto& info : infos) {
+		if (info.in_segment() || info.file_path.find(hot_path) == std::string::npos) cold_bytes += info.file_size;
+	}
+	if (cold_bytes && !admit_client(req, cold_bytes)) return;
+
+	archive_stream::start(req, std::move(infos), std::move(guard));
+}
+
+auto server::upload(request_context& ctx) -> void {
+	metrics::add(counter::upload_requests);
+	auto start = std::chrono::steady_clock::now();	// the reply is sent by the committer, timed there
+	auto req = ctx.req;
+	auto trace = ctx.trace;
+
+	// Hot storage: directly store
+	// Cold storage: first compress then store
+
+	auto input_buffer = evhttp_request_get_input_buffer(req);
+	if (!input_buffer) {
+		common::ERROR("server_logger", "Failed to get input buffer");
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid request (invalid input buffer)", nullptr);
+		return;
+	}
+
+	auto buffer_size = evbuffer_get_length(input_buffer);
+	metrics::add(counter::bytes_in, buffer_size);
+	if (!buffer_size) {
+		common::ERROR("server_logger", "Uploading an empty file");
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid request (empty file)", nullptr);
+		return;
+	}
+
+	if (!admit_client(req, buffer_size)) return;
+
+	auto read_span = trace_span{trace, "read_body"};
+	auto data = std::string(buffer_size, '\0');
+	if (evbuffer_copyout(input_buffer, reinterpret_cast<void*>(data.data()), buffer_size) == -1) {
+		common::ERROR("server_logger", "Failed to copy from input buffer");
+		evhttp_send_reply(req, HTTP_INTERNAL, "Unable to copy from uploaded file", nullptr);
+		return;
+	}
+
+	read_span.end();
+
+	auto encoded_name = evhttp_find_header(req->input_headers, "FileName");
+	auto file_name = std::string{};
+	if (!encoded_name || !simd_codec::base64_decode(encoded_name, file_name) || file_name.empty()) {
+		common::ERROR("server_logger", "Invalid FileName header: {}", encoded_name ? encoded_name : "(missing)");
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid request (bad file name)", nullptr);
+		return;
+	}
+
+	auto storage_type = std::string{evhttp_find_header(req->input_headers, "StorageType")};
+	auto storage_dir = std::string{};
+	if (!prepare_storage_directory(req, storage_type, buffer_size, storage_dir)) return;
+
+	store_upload(req, file_name, storage_info::make_url(file_name), storage_type, storage_dir,
+				 std::make_shared<const std::string>(std::move(data)), start, trace, nullptr);
+}
+
+auto server::store_upload(evhttp_request* req, const std::string& file_name, const std::string& file_url,
+						  const std::string& storage_type, const std::string& storage_dir,
+						  const std::shared_ptr<const std::string>& content,
+						  std::chrono::steady_clock::time_point start, request_trace* trace, upload_reply reply)
+	-> void {
+	// Every upload gets a fresh path, a download of the version it replaces keeps reading the old file
+	auto storage_path = commit_queue::make_version_path(storage_dir + "/" + file_name);
+
+	// Write to a temp file first; the final path only ever holds complete, synced content
+	auto temp_path = commit_queue::make_temp_path(storage_path);
+	if (storage_type == "cold" && content->size() >= server_config::get_instance().get_pipeline_min_bytes()) {
+		// Large cold upload: blocks are compressed on the worker pool while the finished ones are written
+		auto admitted = admission_queue::get_instance().enter([=]() -> void {
+			auto compress_start = request_trace::now_ns();
+			upload_pipeline::start(temp_path, content, server_config::get_instance().get_bundle_type(),
+								   [=](bool ok, uint32_t checksum) -> void {
+									   admission_queue::get_instance().leave();
+									   if (trace) trace->add_span("compress", compress_start, request_trace::now_ns());
+									   if (!ok) {
+										   common::ERROR("server_logger", "Failed to compress file for cold storage");
+										   evhttp_send_reply(req, HTTP_INTERNAL,
+															 "Server error: cannot compress file for cold storage",
+															 nullptr);
+										   return;
+									   }
+
+									   commit_upload(req, temp_path, storage_path, file_url, content, start, trace, 0,
+													 true, checksum, reply);
+								   });
+		});
+
+		if (!admitted) reject_overloaded(req);
+		return;
+	}
+
+	// Checksum of the bytes as received, recorded in the index and verified whenever they are read back
+	auto checksum_span = trace_span{trace, "checksum"};
+	auto checksum = crc32c::update(0, content->data(), content->size());
+	checksum_span.end();
+
+	if (storage_type == "cold") {
+		// Cold storage: compressed on the worker pool once the admission queue has a slot, then committed
+		auto admitted = admission_queue::get_instance().enter([=]() -> void {
+			auto compress_start = request_trace::now_ns();
+			worker_pool::get_instance().submit([=]() -> void {
+				auto dictionary_id = uint32_t{0};
+				auto ok = write_cold(temp_path, file_name, *content, dictionary_id);
+				if (!ok) std::remove(temp_path.c_str());
+
+				loop_executor::get_instance().post([=]() -> void {
+					admission_queue::get_instance().leave();
+					if (trace) trace->add_span("compress", compress_start, request_trace::now_ns());
+					if (!ok) {
+						common::ERROR("server_logger", "Failed to compress file for cold storage");
+						evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot compress file for cold storage",
+										  nullptr);
+						return;
+					}
+
+					commit_upload(req, temp_path, storage_path, file_url, content, start, trace, dictionary_id,
+								  false, checksum, reply);
+				});
+			});
+		});
+
+		if (!admitted) reject_overloaded(req);
+	} else {
+		// Hot storage: directly write, the commit starts once the backend completes the write
+		auto write_start = request_trace::now_ns();
+		io_backend::get_instance().async_write_file(temp_path, content, false, [=](bool ok) -> void {
+			if (trace) trace->add_span("write", write_start, request_trace::now_ns());
+			if (!ok) {
+				common::ERROR("server_logger", "Failed to write file for hot storage");
+				std::remove(temp_path.c_str());
+				evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot write file for hot storage", nullptr);
+				return;
+			}
+
+			commit_upload(req, temp_path, storage_path, file_url, content, start, trace, 0, false, checksum, reply);
+		});
+	}
+}
+
+auto server::commit_upload(evhttp_request* req, const std::string& temp_path, const std::string& storage_path,
+						   const std::string& file_url, const std::shared_ptr<const std::string>& content,
+						   std::chrono::steady_clock::time_point start, request_trace* trace,
+						   uint32_t dictionary_id, bool chunked, uint32_t checksum, const upload_reply& reply) -> void {
+	// Group commit: sync shared with concurrent uploads, rename into place, journal the index record
+	auto commit_start = request_trace::now_ns();
+	auto request = commit_request{temp_path, storage_path, nullptr, dictionary_id, true, checksum, file_url};
+	request.chunked = chunked;
+	request.callback = [=](bool ok, const storage_info& info) -> void {
+		metrics::record_since(histogram::upload_latency, start);
+		if (trace) {
+			trace->add_span("commit", commit_start, request_trace::now_ns());
+			trace->mark_reply();
+		}
+
+		if (!ok) {
+			common::ERROR("server_logger", "Failed to commit upload to {}", storage_path.c_str());
+			evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot commit uploaded file", nullptr);
+			return;
+		}
+
+		// Warm the small file cache with the uncompressed bytes, so even a cold file is served from memory
+		small_file_cache::get_instance().insert(cache_key(info), content);
+
+		evhttp_add_header(req->output_headers, "ETag", info.etag.c_str());
+		evhttp_add_header(req->output_headers, "Version", std::to_string(info.version).c_str());
+		if (reply) {
+			reply(req, info);
+			return;
+		}
+
+		evhttp_send_reply(req, HTTP_OK, "File uploaded successfully", nullptr);
+	};
+
+	commit_queue::get_instance().submit(std::move(request));
+}
+
+auto server::write_cold(const std::string& temp_path, const std::string& file_name, const std::string& content,
+						uint32_t& dictionary_id) -> bool {
+	// Small files of a group with a trained dictionary become a zstd frame, everything else a bundle payload
+	dictionary_store::get_instance().add_sample(file_name, content);
+
+	auto file = file_util{temp_path};
+	auto compressed = std::string{};
+	dictionary_id = dictionary_store::get_instance().compress(file_name, content, compressed);
+	if (dictionary_id) return file.write_file(compressed);
+
+	return file.compress(content, server_config::get_instance().get_bundle_type());
+}
+
+auto server::upload_batch(request_context& ctx) -> void {
+	metrics::add(counter::upload_requests);
+	auto start = std::chrono::steady_clock::now();	// the reply is sent once the whole group is committed
+	auto req = ctx.req;
+	auto trace = ctx.trace;
+
+	auto input_buffer = evhttp_request_get_input_buffer(req);
+	if (!input_buffer || !evbuffer_get_length(input_buffer)) {
+		common::ERROR("server_logger", "Batch upload without a body");
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid request (empty archive)", nullptr);
+		return;
+	}
+	metrics::add(counter::bytes_in, evbuffer_get_length(input_buffer));
+	if (!admit_client(req, evbuffer_get_length(input_buffer))) return;
+
+	auto format = archive_format::tar;
+	auto archive_type = evhttp_find_header(req->input_headers, "ArchiveType");
+	if (!archive_reader::parse_format(archive_type ? archive_type : "", format)) {
+		common::ERROR("server_logger", "Invalid archive type specified by user");
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid archive type", nullptr);
+		return;
+	}
+
+	auto storage_type_header = evhttp_find_header(req->input_headers, "StorageType");
+	auto storage_type = std::string{storage_type_header ? storage_type_header : ""};
+	auto storage_dir = std::string{};
+	if (!prepare_storage_directory(req, storage_type, evbuffer_get_length(input_buffer), storage_dir)) return;
+
+	// Unpacked on the loop, each entry gets its own temp file; nothing is visible before the group commit
+	struct unpacked_batch final {
+		std::vector<std::string> names;
+		std::vector<commit_request> requests;
+		std::vector<std::shared_ptr<const std::string>> contents;
+	};
+	auto max_entries = server_config::get_instance().get_batch_max_entries();
+	auto batch = std::make_shared<unpacked_batch>();
+	auto too_many = false;
+
+	auto unpack_span = trace_span{trace, "unpack"};
+	auto parsed = archive_reader::read(input_buffer, format, [&](archive_entry entry) -> bool {
+		// The store is flat: keep the base name, skip directory entries
+		auto name = entry.name.substr(entry.name.find_last_of('/') + 1);
+		if (name.empty() || name == "." || name == "..") return true;
+
+		if (batch->requests.size() == max_entries) {
+			too_many = true;
+			return false;
+		}
+
+		auto storage_path = commit_queue::make_version_path(storage_dir + "/" + name);
+		auto temp_path = commit_queue::make_temp_path(storage_path);
+		auto checksum = crc32c::update(0, entry.content->data(), entry.content->size());
+		batch->requests.push_back(commit_request{std::move(temp_path), std::move(storage_path), nullptr, 0, true,
+												 checksum, storage_info::make_url(name)});
+		batch->names.push_back(std::move(name));
+		batch->contents.push_back(std::move(entry.content));
+		return true;
+	});
+	unpack_span.end();
+
+	if (!parsed || too_many || batch->requests.empty()) {
+		if (!parsed) {
+			evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid request (corrupt archive)", nullptr);
+		} else if (too_many) {
+			common::ERROR("server_logger", "Batch upload exceeds {} entries", max_entries);
+			evhttp_send_reply(req, HTTP_ENTITYTOOLARGE, "Too many files in archive", nullptr);
+		} else {
+			evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid request (archive contains no files)", nullptr);
+		}
+		return;
+	}
+
+	// The group is renamed and journaled in one batch; the last acknowledgement sends the reply
+	auto submit = [=]() -> void {
+		struct batch_state final {
+			size_t remaining;
+			size_t failed;
+		};
+		auto count = batch->requests.size();
+		auto state = std::make_shared<batch_state>(batch_state{count, 0});
+		auto commit_start = request_trace::now_ns();
+
+		for (auto i = size_t{0}; i < count; ++i) {
+			batch->requests[i].callback = [=, content = batch->contents[i]](bool ok, const storage_info& info) -> void {
+				if (ok) {
+					small_file_cache::get_instance().insert(cache_key(info), content);
+				} else {
+					++state->failed;
+				}
+
+				if (--state->remaining) return;
+
+				metrics::record_since(histogram::upload_latency, start);
+				if (trace) {
+					trace->add_span("commit", commit_start, request_trace::now_ns());
+					trace->mark_reply();
+				}
+
+				if (state->failed) {
+					common::ERROR("server_logger", "Failed to commit {} of {} batch entries", state->failed, count);
+					evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot commit uploaded files", nullptr);
+					return;
+				}
+
+				evbuffer_add_printf(evhttp_request_get_output_buffer(req), "%zu files uploaded\n", count);
+				evhttp_add_header(req->output_headers, "Content-Type", "text/plain; charset=UTF-8");
+				evhttp_send_reply(req, HTTP_OK, "Files uploaded successfully", nullptr);
+			};
+		}
+
+		commit_queue::get_instance().submit_group(std::move(batch->requests));
+	};
+
+	// Written or compressed on the worker pool, a cold batch under one admission slot like a single cold upload;
+	// the group is submitted once the last entry is on disk
+	auto cold = storage_type == "cold";
+	auto write = [=]() -> void {
+		auto write_start = request_trace::now_ns();
+		worker_pool::get_instance().submit([=]() -> void {
+			auto written = true;
+			for (auto i = size_t{0}; written && i < batch->requests.size(); ++i) {
+				auto& request = batch->requests[i];
+				written = cold ? write_cold(request.temp_path, batch->names[i], *batch->contents[i],
+											request.dictionary_id)
+							   : file_util{request.temp_path}.write_file(*batch->contents[i]);
+				if (!written) common::ERROR("server_logger", "Failed to write batch entry {}", batch->names[i]);
+			}
+			if (!written) {
+				for (const auto& request : batch->requests) std::remove(request.temp_path.c_str());
+			}
+
+			loop_executor::get_instance().post([=]() -> void {
+				if (cold) admission_queue::get_instance().leave();
+				if (trace) trace->add_span(cold ? "compress" : "write", write_start, request_trace::now_ns());
+				if (!written) {
+					evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot write archive entry", nullptr);
+					return;
+				}
+
+				submit();
+			});
+		});
+	};
+
+	if (!cold) {
+		write();
+	} else if (!admission_queue::get_instance().enter(write)) {
+		reject_overloaded(req);
+	}
+}
+
+auto server::remove_file(request_context& ctx) -> void {
+	metrics::add(counter::delete_requests);
+	auto req = ctx.req;
+	auto trace = ctx.trace;
+	auto url = std::string{ctx.path};
+
+	auto info = storage_info{};
+	if (!data_manager::get_instance().find_by_url(url, info)) {
+		common::ERROR("server_logger", "No storage info for URL to delete: {}", url);
+		evhttp_send_reply(req, HTTP_NOTFOUND, "File non-existent", nullptr);
+		return;
+	}
+
+	// A tombstone journaled by the committer; downloads already past their lookup keep reading the file
+	auto request = commit_request{};
+	request.file_url = url;
+	request.remove = true;
+	auto commit_start = request_trace::now_ns();
+	request.callback = [=](bool ok, const storage_info& removed) -> void {
+		if (trace) {
+			trace->add_span("commit", commit_start, request_trace::now_ns());
+			trace->mark_reply();
+		}
+
+		if (!ok) {
+			// A concurrent delete of the same URL got there first
+			auto current = storage_info{};
+			if (!data_manager::get_instance().find_by_url(url, current)) {
+				evhttp_send_reply(req, HTTP_NOTFOUND, "File non-existent", nullptr);
+				return;
+			}
+
+			common::ERROR("server_logger", "Failed to commit removal of {}", url);
+			evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot delete file", nullptr);
+			return;
+		}
+
+		small_file_cache::get_instance().erase(cache_key(removed));
+		evhttp_send_reply(req, HTTP_NOCONTENT, "File deleted", nullptr);
+	};
+
+	commit_queue::get_instance().submit(std::move(request));
+}
+
+auto server::admit_client(evhttp_request* req, uint64_t bytes) -> bool {
+	auto& limiter = rate_limiter::get_instance();
+	auto client = limiter.client_of(req);
+	auto retry_after_s = unsigned{0};
+	if (limiter.take(client, bytes, retry_after_s)) return true;
+
+	metrics::add(counter::rate_limited);
+	common::ERROR("server_logger", "Rate limited {} for {} bytes, retry after {}s", client, bytes, retry_after_s);
+	evhttp_add_header(req->output_headers, "Retry-After", std::to_string(retry_after_s).c_str());
+	evhttp_send_reply(req, 429, "Too Many Requests", nullptr);
+	return false;
+}
+
+auto server::reject_overloaded(evhttp_request* req) -> void {
+	metrics::add(counter::admission_rejected);
+	auto retry_after_s = std::to_string(server_config::get_instance().get_admission_retry_after_s());
+	evhttp_add_header(req->output_headers, "Retry-After", retry_after_s.c_str());
+	evhttp_send_reply(req, 429, "Too Many Requests", nullptr);
+}
+
+auto server::prepare_storage_directory(evhttp_request* req, const std::string& storage_type, uint64_t size,
+									   std::string& storage_path) -> bool {
+	auto max_body = size_t{0};
+	if (storage_type == "hot") {
+		storage_path = server_config::get_instance().get_hot_storage_path();
+		max_body = server_config::get_instance().get_max_body_bytes_hot();
+	} else if (storage_type == "cold") {
+		storage_path = server_config::get_instance().get_cold_storage_path();
+		max_body = server_config::get_instance().get_max_body_bytes_cold();
+	} else {
+		common::ERROR("server_logger", "Invalid storage type specified by user");
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid storage type", nullptr);
+		return false;
+	}
+
+	if (size > max_body) {
+		common::ERROR("server_logger", "Upload of {} bytes exceeds the {} storage limit of {}", size, storage_type,
+					  max_body);
+		evhttp_send_reply(req, HTTP_ENTITYTOOLARGE, "Upload too large for this storage type", nullptr);
+		return false;
+	}
+
+	auto new_dir = file_util{storage_path};	 // Create directory for storage if not exist
+	if (!new_dir.create_directory()) {
+		common::ERROR("server_logger", "Failed to create directory for upload: {}", storage_path.c_str());
+		evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot create storage directory", nullptr);
+		return false;
+	}
+
+	return true;
+}
+
+// Decimal digits only, the whole text
+static auto parse_offset(std::string_view text, uint64_t& value) -> bool {
+	auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+	return !text.empty() && ec == std::errc{} && end == text.data() + text.size();
+}
+
+auto server::show(request_context& ctx) -> void {
+	metrics::add(counter::show_requests);
+	auto timer = scoped_timer{histogram::show_latency};
+	auto req = ctx.req;
+	auto trace = ctx.trace;
+
+	// ?snapshot=ID lists the store as it was when that snapshot was taken, ?version=N as it was once version N
+	// was committed
+	auto params = evkeyvalq{};
+	auto query = evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req));
+	if (query && evhttp_parse_query_str(query, &params) != 0) {
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid query", nullptr);
+		return;
+	}
+	auto snapshot_param = evhttp_find_header(&params, "snapshot");
+	auto requested = std::string{snapshot_param ? snapshot_param : ""};
+	auto version_param = evhttp_find_header(&params, "version");
+	auto as_of = std::string{version_param ? version_param : ""};
+	auto link_query = std::string{};
+	auto link_versions = false;
+	evhttp_clear_headers(&params);
+
+	auto id = uint64_t{0};
+	auto version = uint64_t{0};
+	if ((!requested.empty() && !parse_offset(requested, id)) || (!as_of.empty() && !parse_offset(as_of, version)) ||
+		(!requested.empty() && !as_of.empty())) {
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid version or snapshot", nullptr);
+		return;
+	}
+
+	auto scan_span = trace_span{trace, "index_scan"};
+	auto files = std::vector<storage_info>{};
+	if (!requested.empty()) {
+		auto snapshot = snapshot_manager::get_instance().find(id);
+		if (!snapshot) {
+			evhttp_send_reply(req, HTTP_NOTFOUND, "Snapshot non-existent", nullptr);
+			return;
+		}
+
+		files.reserve(snapshot->index.size());
+		snapshot->index.for_each([&](const std::string&, const storage_info& info) -> void { files.push_back(info); });
+		link_query = "?snapshot=" + std::to_string(id);
+	} else if (!as_of.empty()) {
+		// Each link names the version it lists, most of them are no longer current
+		data_manager::get_instance().find_as_of(version, files);
+		link_versions = true;
+	} else if (!data_manager::get_instance().find_all(files)) {
+		common::ERROR("server_logger", "Failed to retrieve file list from data manager");
+		evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot retrieve file list", nullptr);
+		return;
+	}
+
+	scan_span.end();
+
+	auto render_span = trace_span{trace, "render"};
+	auto ifs = std::ifstream{"./static/index.html"};
+	auto html_template = std::string{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+
+	// Replace {{FILE_LIST}} in html_template with generated file list
+	html_template = std::regex_replace(html_template, std::regex(R"(\{\{FILE_LIST\}\})"),
+									   generate_file_list(files, link_query, link_versions));
+	// Replace {{BACKEND_URL}} in html_template with Backend URL from config
+	html_template = std::regex_replace(html_template, std::regex(R"(\{\{BACKEND_URL\}\})"),
+									   "http://" + server_config::get_instance().get_server_ip() + ":" +
+										   std::to_string(server_config::get_instance().get_server_port()));
+
+	auto output_buffer = evhttp_request_get_output_buffer(req);
+	if (evbuffer_add(output_buffer, reinterpret_cast<const void*>(html_template.c_str()), html_template.size()) == -1) {
+		common::ERROR("server_logger", "Failed to add HTML content to output buffer");
+		evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot prepare HTML content", nullptr);
+		return;
+	}
+
+	render_span.end();
+
+	evhttp_add_header(req->output_headers, "Content-Type", "text/html; charset=UTF-8");
+	if (trace) trace->mark_reply();
+	evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+}
+
+auto server::list_files(request_context& ctx) -> void {
+	metrics::add(counter::list_requests);
+	auto req = ctx.req;
+	auto trace = ctx.trace;
+
+	// GET /list?prefix=&delimiter=&marker=&max-keys= on file names, as uploaded; &snapshot=ID or &version=N list a
+	// past state like the file list page does
+	auto params = evkeyvalq{};
+	auto query = evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req));
+	if (query && evhttp_parse_query_str(query, &params) != 0) {
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid query", nullptr);
+		return;
+	}
+
+	auto param = [&](const char* name) -> std::string {
+		auto value = evhttp_find_header(&params, name);
+		return value ? value : "";
+	};
+	auto url_prefix = server_config::get_instance().get_download_url_prefix() + "/";
+	auto prefix = param("prefix");
+	auto delimiter = param("delimiter");
+	auto marker = param("marker");
+	auto requested_keys = param("max-keys");
+	auto snapshot_id = param("snapshot");
+	auto version = param("version");
+	evhttp_clear_headers(&params);
+
+	auto snapshot = uint64_t{0};
+	auto as_of = uint64_t{0};
+	if ((!snapshot_id.empty() && !parse_offset(snapshot_id, snapshot)) ||
+		(!version.empty() && !parse_offset(version, as_of)) || (!snapshot_id.empty() && !version.empty())) {
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid version or snapshot", nullptr);
+		return;
+	}
+
+	// A page holds at least one key, whatever the configuration says
+	auto max_keys = std::max<size_t>(server_config::get_instance().get_list_max_keys(), 1);
+	if (!requested_keys.empty()) {
+		auto keys = uint64_t{0};
+		if (!parse_offset(requested_keys, keys) || keys == 0) {
+			evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid max-keys", nullptr);
+			return;
+		}
+		max_keys = std::min<size_t>(max_keys, keys);
+	}
+
+	auto scan_span = trace_span{trace, "index_scan"};
+	auto page = listing{};
+	auto start_after = marker.empty() ? "" : url_prefix + marker;
+	if (!snapshot_id.empty() || !version.empty()) {
+		// Past states are not kept in URL order, their records are collected and sorted first
+		auto records = std::vector<storage_info>{};
+		if (!snapshot_id.empty()) {
+			auto held = snapshot_manager::get_instance().find(snapshot);
+			if (!held) {
+				evhttp_send_reply(req, HTTP_NOTFOUND, "Snapshot non-existent", nullptr);
+				return;
+			}
+
+			held->index.for_each(
+				[&](const std::string&, const storage_info& info) -> void { records.push_back(info); });
+			std::sort(records.begin(), records.end(), [](const storage_info& a, const storage_info& b) -> bool {
+				return a.file_url < b.file_url;
+			});
+		} else {
+			data_manager::get_instance().find_as_of(as_of, records);
+		}
+
+		data_manager::list_records(records, url_prefix + prefix, delimiter, start_after, max_keys, page);
+	} else {
+		data_manager::get_instance().list(url_prefix + prefix, delimiter, start_after, max_keys, page);
+	}
+	scan_span.end();
+
+	auto root = Json::Value{};
+	root["prefix"] = prefix;
+	root["delimiter"] = delimiter;
+	root["is_truncated"] = page.truncated;
+	if (page.truncated) root["next_marker"] = page.next_marker.substr(url_prefix.size());
+
+	root["contents"] = Json::Value{Json::arrayValue};
+	for (const auto& info : page.files) {
+		auto item = Json::Value{};
+		item["key"] = info.file_name();
+		item["size"] = static_cast<Json::UInt64>(info.file_size);
+		item["etag"] = info.etag;
+		item["last_modified"] = format_http_date(info.time_modified);
+		item["version"] = static_cast<Json::UInt64>(info.version);
+		root["contents"].append(item);
+	}
+
+	root["common_prefixes"] = Json::Value{Json::arrayValue};
+	for (const auto& common : page.common_prefixes) root["common_prefixes"].append(common.substr(url_prefix.size()));
+
+	auto body = std::string{};
+	if (!json_util::serialize(root, body)) {
+		evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot serialize listing", nullptr);
+		return;
+	}
+
+	evbuffer_add(evhttp_request_get_output_buffer(req), body.data(), body.size());
+	evhttp_add_header(req->output_headers, "Content-Type", "application/json");
+	if (trace) trace->mark_reply();
+	evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+}
+
+// If-Range takes the strong comparison: a weak tag on either side never matches, nor does a date
+static auto if_range_matches(std::string_view if_range, std::string_view etag) -> bool {
+	return !if_range.starts_with("W/") && !etag.starts_with("W/") && if_range == etag;
+}
+
+auto server::requested_range(evhttp_request* req, const storage_info& info, uint64_t size, byte_range& range)
+	-> bool {
+	range = byte_range{};
+	range.total = size;
+	auto header = evhttp_find_header(req->input_headers, "Range");
+	if (!header || !std::string_view{header}.starts_with("bytes=")) return true;
+
+	// If-Range names the version the client holds part of, any other one is sent whole
+	auto if_range = evhttp_find_header(req->input_headers, "If-Range");
+	if (if_range && !if_range_matches(if_range, info.etag)) return true;
+
+	// A single range; a list or a malformed one is answered with the whole file, as RFC 9110 allows
+	auto spec = std::string_view{header}.substr(strlen("bytes="));
+	auto dash = spec.find('-');
+	if (dash == std::string_view::npos || spec.find(',') != std::string_view::npos) return true;
+
+	auto unsatisfiable = [&]() -> bool {
+		evhttp_add_header(req->output_headers, "Content-Range", ("bytes */" + std::to_string(range.total)).c_str());
+		evhttp_send_reply(req, 416, "Range Not Satisfiable", nullptr);
+		return false;
+	};
+
+	auto first = uint64_t{0};
+	auto last = uint64_t{0};
+	if (dash == 0) {  // bytes=-n: the last n bytes
+		if (!parse_offset(spec.substr(1), last)) return true;
+		if (!last || !size) return unsatisfiable();
+		range.offset = size - std::min(last, size);
+	} else {
+		if (!parse_offset(spec.substr(0, dash), first)) return true;
+		if (first >= size) return unsatisfiable();
+		if (dash + 1 < spec.size() && (!parse_offset(spec.substr(dash + 1), last) || last < first)) return true;
+		range.offset = first;
+		if (dash + 1 < spec.size()) size = std::min(size, last + 1);
+	}
+
+	range.length = size - range.offset;
+	range.partial = true;
+	return true;
+}
+
+// An unsigned query parameter; false when present but not a number
+static auto query_number(evkeyvalq* params, const char* name, uint64_t& value, bool& present) -> bool {
+	auto text = evhttp_find_header(params, name);
+	present = text != nullptr;
+	return !present || parse_offset(text, value);
+}
+
+// A time bound: unix seconds, or "<n>d" for n days before now; false when present but neither
+static auto query_time(evkeyvalq* params, const char* name, int64_t& value) -> bool {
+	auto text = evhttp_find_header(params, name);
+	if (!text) return true;
+
+	auto end = static_cast<char*>(nullptr);
+	auto number = std::strtoll(text, &end, 10);
+	if (!*text || end == text) return false;
+	if (*end == 'd' && !end[1]) {
+		value = static_cast<int64_t>(std::time(nullptr)) - number * 86400;
+		return true;
+	}
+
+	value = number;
+	return !*end;
+}
+
+// A comma separated list of tier or codec names as a bitmask; false on an unknown name
+template <typename Enum>
+static auto query_names(evkeyvalq* params, const char* name, auto (*parse)(std::string_view, Enum&)->bool,
+						uint8_t& mask) -> bool {
+	auto text = evhttp_find_header(params, name);
+	if (!text) return true;
+
+	mask = 0;
+	auto names = std::string_view{text};
+	while (true) {
+		auto comma = names.find(',');
+		auto value = Enum{};
+		if (!parse(names.substr(0, comma), value)) return false;
+		mask |= static_cast<uint8_t>(1u << static_cast<unsigned>(value));
+		if (comma == std::string_view::npos) return true;
+		names.remove_prefix(comma + 1);
+	}
+}
+
+auto server::search(request_context& ctx) -> void {
+	metrics::add(counter::search_requests);
+	auto req = ctx.req;
+
+	// GET /search?min_size=&max_size=&modified_after=&modified_before=&accessed_after=&accessed_before=
+	// &tier=hot,cold&codec=none,bundle,dictionary,segment&limit=; every bound inclusive, times also as "<n>d"
+	auto params = evkeyvalq{};
+	auto query = evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req));
+	auto q = metadata_query{};
+	auto has_min = false, has_max = false, has_limit = false;
+	auto limit = uint64_t{0};
+	auto valid = (!query || evhttp_parse_query_str(query, &params) == 0) &&
+				 query_number(&params, "min_size", q.min_size, has_min) &&
+				 query_number(&params, "max_size", q.max_size, has_max) &&
+				 query_time(&params, "modified_after", q.modified_after) &&
+				 query_time(&params, "modified_before", q.modified_before) &&
+				 query_time(&params, "accessed_after", q.accessed_after) &&
+				 query_time(&params, "accessed_before", q.accessed_before) &&
+				 query_names(&params, "tier", metadata_table::parse_tier, q.tiers) &&
+				 query_names(&params, "codec", metadata_table::parse_codec, q.codecs) &&
+				 query_number(&params, "limit", limit, has_limit);
+	evhttp_clear_headers(&params);
+	if (!valid) {
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid search parameter", nullptr);
+		return;
+	}
+
+	q.limit = server_config::get_instance().get_search_max_results();
+	if (has_limit) q.limit = std::min<size_t>(q.limit, limit);
+
+	// The scan and a possible rebuild of the columns stay off the event loop
+	auto scan_start = request_trace::now_ns();
+	worker_pool::get_instance().submit([req, q, trace = ctx.trace, scan_start]() -> void {
+		auto result = metadata_table::get_instance().query(q);
+		auto scan_end = request_trace::now_ns();
+
+		auto root = Json::Value{};
+		root["scanned"] = static_cast<Json::UInt64>(result.scanned);
+		root["matched"] = static_cast<Json::UInt64>(result.matched);
+		root["matched_bytes"] = static_cast<Json::UInt64>(result.matched_bytes);
+		root["built"] = format_http_date(result.built);
+		root["results"] = Json::Value{Json::arrayValue};
+		for (const auto& info : result.rows) {
+			auto item = Json::Value{};
+			item["key"] = info.file_name();
+			item["url"] = info.file_url;
+			item["size"] = static_cast<Json::UInt64>(info.file_size);
+			item["last_modified"] = format_http_date(info.time_modified);
+			item["last_accessed"] = format_http_date(info.time_accessed);
+			item["tier"] = metadata_table::tier_name(metadata_table::tier_of(info));
+			item["codec"] = metadata_table::codec_name(metadata_table::codec_of(info));
+			item["version"] = static_cast<Json::UInt64>(info.version);
+			root["results"].append(item);
+		}
+
+		auto body = std::make_shared<std::string>();
+		auto serialized = json_util::serialize(root, *body);
+		loop_executor::get_instance().post([req, body, serialized, trace, scan_start, scan_end]() -> void {
+			if (trace) trace->add_span("metadata_scan", scan_start, scan_end);
+			if (!serialized) {
+				evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot serialize search results", nullptr);
+				return;
+			}
+
+			evbuffer_add(evhttp_request_get_output_buffer(req), body->data(), body->size());
+			evhttp_add_header(req->output_headers, "Content-Type", "application/json");
+			if (trace) trace->mark_reply();
+			evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+		});
+	});
+}
+
+static constexpr const char* XML_DECLARATION = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+static constexpr const char* S3_NAMESPACE = "http://s3.amazonaws.com/doc/2006-03-01/";
+
+static auto xml_escape(std::string_view text) -> std::string {
+	auto out = std::string{};
+	out.reserve(text.size());
+	for (auto c : text) {
+		switch (c) {
+			case '&': out += "&amp;"; break;
+			case '<': out += "&lt;"; break;
+			case '>': out += "&gt;"; break;
+			case '"': out += "&quot;"; break;
+			case '\'': out += "&apos;"; break;
+			default: out += c;
+		}
+	}
+	return out;
+}
+
+// Text of the first <name> element, with the entities S3 clients write resolved; false when there is none
+static auto xml_element(std::string_view xml, std::string_view name, std::string& value) -> bool {
+	static constexpr std::array<std::pair<std::string_view, char>, 6> ENTITIES{
+		{{"&quot;", '"'}, {"&#34;", '"'}, {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&apos;", '\''}}};
+
+	auto open = "<" + std::string{name} + ">";
+	auto begin = xml.find(open);
+	if (begin == std::string_view::npos) return false;
+	begin += open.size();
+	auto end = xml.find("</" + std::string{name} + ">", begin);
+	if (end == std::string_view::npos) return false;
+
+	auto text = xml.substr(begin, end - begin);
+	value.clear();
+	for (auto i = size_t{0}; i < text.size();) {
+		auto entity = std::find_if(ENTITIES.begin(), ENTITIES.end(), [&](const auto& e) -> bool {
+			return text[i] == '&' && text.substr(i).starts_with(e.first);
+		});
+		if (entity != ENTITIES.end()) {
+			value += entity->second;
+			i += entity->first.size();
+		} else {
+			value += text[i++];
+		}
+	}
+	return true;
+}
+
+// encoding-type=url of S3 listings: everything but unreserved characters and '/' escaped
+static auto url_encode(std::string_view text) -> std::string {
+	static constexpr const char* HEX = "0123456789ABCDEF";
+	auto out = std::string{};
+	for (auto c : text) {
+		auto byte = static_cast<unsigned char>(c);
+		if (std::isalnum(byte) || c == '-' || c == '_' || c == '.' || c == '~' || c == '/') {
+			out += c;
+		} else {
+			out += '%';
+			out += HEX[byte >> 4];
+			out += HEX[byte & 0xf];
+		}
+	}
+	return out;
+}
+
+static auto s3_time(std::time_t time) -> std::string {	// ISO 8601 in UTC, as S3 lists it
+	auto tm = std::tm{};
+	gmtime_r(&time, &tm);
+	char text[32];
+	std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S.000Z", &tm);
+	return text;
+}
+
+// The store is flat, so the '/' of a key is escaped in its file name, and '%' with it to keep names distinct
+static auto s3_file_name(std::string_view key) -> std::string {
+	auto name = std::string{};
+	name.reserve(key.size());
+	for (auto c : key) {
+		if (c == '/') {
+			name += "%2F";
+		} else if (c == '%') {
+			name += "%25";
+		} else {
+			name += c;
+		}
+	}
+	return name;
+}
+
+// STANDARD, or no class at all, is hot storage; the infrequent access and archive classes are cold
+static auto s3_storage_type(evhttp_request* req) -> std::string {
+	auto storage_class = evhttp_find_header(req->input_headers, "x-amz-storage-class");
+	auto standard = !storage_class || !std::strcmp(storage_class, "STANDARD") ||
+					!std::strcmp(storage_class, "REDUCED_REDUNDANCY");
+	return standard ? "hot" : "cold";
+}
+
+static auto s3_storage_class(const storage_info& info) -> const char* {
+	return metadata_table::tier_of(info) == storage_tier::hot ? "STANDARD" : "STANDARD_IA";
+}
+
+// S3 sends bare flags such as ?uploads, which evhttp_parse_query_str rejects
+static auto parse_s3_query(const char* query, s3_params& params) -> void {
+	auto rest = std::string_view{query ? query : ""};
+	auto key = std::string{};
+	auto value = std::string{};
+	while (!rest.empty()) {
+		auto amp = rest.find('&');
+		auto pair = rest.substr(0, amp);
+		auto eq = pair.find('=');
+		simd_codec::url_decode(pair.substr(0, eq), key);
+		value.clear();
+		if (eq != std::string_view::npos) simd_codec::url_decode(pair.substr(eq + 1), value);
+		if (!key.empty()) params.insert_or_assign(key, value);
+
+		if (amp == std::string_view::npos) break;
+		rest.remove_prefix(amp + 1);
+	}
 }
 
-static auto url_decode(const std::string& str) -> std::string {
-	auto result = std::string{};
-	result.reserve(str.size());
+// aws-chunked body: "<hex size>[;chunk-signature=...]\r\n<data>\r\n" per chunk up to a zero-size one, then the
+// trailer lines. Chunk signatures are not checked, the server does not authenticate requests.
+static auto decode_aws_chunked(std::string_view in, std::string& out, std::string& trailers) -> bool {
+	out.clear();
+	while (true) {
+		auto eol = in.find("\r\n");
+		if (eol == std::string_view::npos) return false;
 
-	for (auto i = 0; i < str.size(); ++i) {
-		if (str[i] == '%' && i + 2 < str.size() && isxdigit(str[i + 1]) && isxdigit(str[i + 2])) {
-			result += static_cast<char>((from_hex(str[i + 1]) << 4) | from_hex(str[i + 2]));
-			i += 2;
-		} else if (str[i] == '+')
-			result += ' ';
-		else
-			result += str[i];
+		auto size = uint64_t{0};
+		auto [end, ec] = std::from_chars(in.data(), in.data() + eol, size, 16);
+		if (ec != std::errc{} || end == in.data()) return false;
+		in.remove_prefix(eol + 2);
+		if (!size) break;
+
+		if (in.size() < size + 2 || in.substr(size, 2) != "\r\n") return false;
+		out.append(in.data(), size);
+		in.remove_prefix(size + 2);
 	}
-	return result;
+
+	trailers = in;
+	return true;
 }
 
-server::server() {
-	server_port = server_config::get_instance().get_server_port();
-	server_ip = server_config::get_instance().get_server_ip();
-	download_url_prefix = server_config::get_instance().get_download_url_prefix();
+static auto send_xml(evhttp_request* req, const std::string& body) -> void {
+	evbuffer_add(evhttp_request_get_output_buffer(req), body.data(), body.size());
+	evhttp_add_header(req->output_headers, "Content-Type", "application/xml");
+	evhttp_send_reply(req, HTTP_OK, "OK", nullptr);
 }
 
-// static functions of the class
-auto server::generic_callback(evhttp_request* req, void* arg) -> void {
-	auto path = std::string{evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req))};
-	path = std::move(url_decode(path));
-
-	common::INFO("server_logger", "Generic Request: URI: {}", path.c_str());
-
-	if (path.find("/download") != std::string::npos) {
-		// Download
-		server::download(req, arg);
-	} else if (path == "/upload") {
-		// Upload
-		server::upload(req, arg);
-	} else if (path == "/") {
-		// Display list of files
-		server::show(req, arg);
-	} else {
-		evhttp_send_reply(req, HTTP_NOTIMPLEMENTED, "Request not implemented", nullptr);
-	}
+auto server::s3_error(evhttp_request* req, int status, const char* code, const char* message) -> void {
+	auto body = std::string{XML_DECLARATION} + "<Error><Code>" + code + "</Code><Message>" + xml_escape(message) +
+				"</Message></Error>";
+	evbuffer_add(evhttp_request_get_output_buffer(req), body.data(), body.size());
+	evhttp_add_header(req->output_headers, "Content-Type", "application/xml");
+	evhttp_send_reply(req, status, code, nullptr);
 }
 
-auto server::download(evhttp_request* req, void* arg) -> void {
-	// get the path from the request
-	auto path = std::string{evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req))};
-	path = std::move(url_decode(path));
+auto server::s3_request(request_context& ctx) -> void {
+	metrics::add(counter::s3_requests);
+	auto req = ctx.req;
 
-	// get the storage_info from the path
-	auto info = storage_info{};
-	data_manager::get_instance().find_by_url(path, info);
-
-	auto download_path = info.file_path;
-	if (download_path.find(server_config::get_instance().get_hot_storage_path()) == std::string::npos) {
-		// The file is compressed in cold storage, not available in hot storage
-		// The file needs decompression first
-		common::INFO("server_logger", "Decompressing file at: {}", download_path.c_str());
-		auto file = file_util{download_path};
-		download_path = server_config::get_instance().get_hot_storage_path() +
-						std::string{download_path.begin() + download_path.find_last_of('/') + 1, download_path.end()};
-
-		auto new_dir = file_util{server_config::get_instance().get_hot_storage_path()};
-		if (!new_dir.create_directory()) {
-			common::ERROR("server_logger", "Failed to create directory for download: {}",
-						  server_config::get_instance().get_hot_storage_path());
-			return;
-		}
+	// Path style only, /s3/<bucket>/<key>, with the key URL-decoded by the router; requests are not authenticated
+	auto path = ctx.path.substr(strlen("/s3"));
+	if (!path.empty() && path.front() != '/') {
+		evhttp_send_reply(req, HTTP_NOTFOUND, "Not found", nullptr);
+		return;
+	}
+
+	if (!path.empty()) path.remove_prefix(1);
+	auto slash = path.find('/');
+	auto bucket = path.substr(0, slash);
+	auto key = slash == std::string_view::npos ? std::string{} : std::string{path.substr(slash + 1)};
+	auto params = s3_params{};
+	parse_s3_query(evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req)), params);
+	params.erase("x-id");  // the operation name, appended by some SDKs
 
-		file.decompress(download_path);	 // Decompress file to hot_storage for download
+	auto method = ctx.method;
+	auto fetch = method == EVHTTP_REQ_GET || method == EVHTTP_REQ_HEAD;
+	if (bucket.empty()) {
+		if (fetch) {
+			s3_list_buckets(req);
+		} else {
+			s3_error(req, HTTP_BADMETHOD, "MethodNotAllowed", "Only the bucket list is served here");
+		}
+		return;
 	}
 
-	// The file is available in hot storage
-	common::INFO("server_logger", "Download requested at: {}", download_path.c_str());
-	auto file = file_util{download_path};
-	if (!file.exists() && info.file_path.find("storage/cold") != std::string::npos) {
-		// Decompression from cold storage failed
-		common::ERROR("server_logger", "Server decompression error, sending 500");
-		evhttp_send_reply(req, HTTP_INTERNAL, "Decompression failed", nullptr);
+	if (bucket != server_config::get_instance().get_s3_bucket()) {
+		s3_error(req, HTTP_NOTFOUND, "NoSuchBucket", "The specified bucket does not exist");
 		return;
-	} else if (!file.exists() && info.file_path.find("storage/cold") != std::string::npos) {
-		// User requested a wrong file from hot storage, and the file does not exist
-		common::ERROR("server_logger", "User's bad request for non-existent file, sending 400");
-		evhttp_send_reply(req, HTTP_BADREQUEST, "File non-existent", nullptr);
+	}
+
+	auto not_implemented = [&]() -> void {
+		s3_error(req, HTTP_NOTIMPLEMENTED, "NotImplemented", "This operation is not supported by this server");
+	};
+
+	if (key.empty()) {
+		static constexpr std::array<std::string_view, 9> LIST_PARAMS{
+			"list-type", "prefix", "delimiter", "marker", "max-keys", "continuation-token", "start-after",
+			"encoding-type", "fetch-owner"};
+		auto listing = std::all_of(params.begin(), params.end(), [](const auto& param) -> bool {
+			return std::find(LIST_PARAMS.begin(), LIST_PARAMS.end(), param.first) != LIST_PARAMS.end();
+		});
+
+		if (method == EVHTTP_REQ_HEAD || (method == EVHTTP_REQ_PUT && params.empty())) {
+			evhttp_send_reply(req, HTTP_OK, "OK", nullptr);	 // HeadBucket, CreateBucket of the served bucket
+		} else if (method == EVHTTP_REQ_GET && params.size() == 1 && params.contains("location")) {
+			send_xml(req, std::string{XML_DECLARATION} + "<LocationConstraint xmlns=\"" + S3_NAMESPACE + "\"/>");
+		} else if (method == EVHTTP_REQ_GET && listing) {
+			s3_list_objects(req, params);
+		} else {
+			not_implemented();
+		}
 		return;
 	}
 
-	// If the file has been sent but not complete, use RE-TRANS
-	auto retrans = false;
-	auto old_etag = std::string{};
-	auto if_range = evhttp_find_header(req->input_headers, "If-Range");
+	auto upload_id = params.find("uploadId");
+	if (method == EVHTTP_REQ_PUT) {
+		if (upload_id != params.end() && params.contains("partNumber")) {
+			s3_upload_part(ctx, key, params);
+		} else if (params.empty() && !evhttp_find_header(req->input_headers, "x-amz-copy-source")) {
+			s3_put_object(ctx, key);
+		} else {
+			not_implemented();	// CopyObject, UploadPartCopy, object ACLs and tags
+		}
+	} else if (fetch) {
+		if (upload_id == params.end()) {
+			s3_get_object(ctx, key);
+		} else {
+			not_implemented();	// ListParts
+		}
+	} else if (method == EVHTTP_REQ_DELETE) {
+		if (upload_id == params.end()) {
+			s3_delete_object(ctx, key);
+		} else {
+			s3_abort_multipart(req, key, upload_id->second);
+		}
+	} else if (method == EVHTTP_REQ_POST && params.contains("uploads")) {
+		s3_create_multipart(req, key);
+	} else if (method == EVHTTP_REQ_POST && upload_id != params.end()) {
+		s3_complete_multipart(ctx, key, upload_id->second);
+	} else {
+		not_implemented();
+	}
+}
+
+auto server::s3_read_body(evhttp_request* req, std::string& content) -> bool {
+	auto input_buffer = evhttp_request_get_input_buffer(req);
+	auto size = evbuffer_get_length(input_buffer);
+	metrics::add(counter::bytes_in, size);
+	content.resize(size);
+	if (size && evbuffer_copyout(input_buffer, content.data(), size) != static_cast<ev_ssize_t>(size)) {
+		common::ERROR("server_logger", "Failed to copy from input buffer");
+		s3_error(req, HTTP_INTERNAL, "InternalError", "Cannot read the request body");
+		return false;
+	}
 
-	if (if_range) {
-		old_etag = std::string{if_range};
-		if (old_etag == get_etag(info)) {  // if the etag is still up to date, then eligible for re-transmission
-			common::INFO("server_logger", "File {} eligible for resume transmission from breakpoint",
-						 download_path.c_str());
-			retrans = true;
+	// Current SDKs stream payloads as aws-chunked, possibly with the checksum in a trailer
+	auto trailers = std::string{};
+	auto encoding = evhttp_find_header(req->input_headers, "Content-Encoding");
+	auto payload_hash = evhttp_find_header(req->input_headers, "x-amz-content-sha256");
+	if ((encoding && std::strstr(encoding, "aws-chunked")) ||
+		(payload_hash && std::string_view{payload_hash}.starts_with("STREAMING-"))) {
+		auto decoded = std::string{};
+		if (!decode_aws_chunked(content, decoded, trailers)) {
+			s3_error(req, HTTP_BADREQUEST, "IncompleteBody", "Malformed aws-chunked request body");
+			return false;
 		}
+		content = std::move(decoded);
 	}
 
-	// Load the file into the response to client
-	if (!file.exists()) {
-		common::ERROR("server_logger", "Unknown error, file does not exist at {}", download_path.c_str());
-		evhttp_send_reply(req, HTTP_NOTFOUND, "File non-existent, unknown error", nullptr);
-		return;
+	auto decoded_length = evhttp_find_header(req->input_headers, "x-amz-decoded-content-length");
+	if (decoded_length && std::strtoull(decoded_length, nullptr, 10) != content.size()) {
+		s3_error(req, HTTP_BADREQUEST, "IncompleteBody", "The body is shorter than announced");
+		return false;
 	}
 
-	auto output_buffer = evhttp_request_get_output_buffer(req);
-	auto fd = open(download_path.c_str(), O_RDONLY);  // Use C-style file descriptor to be compatible with libevent
-	if (fd < 0) {
-		common::ERROR("server_logger", "Unable to create file descriptor for file: {}", download_path.c_str());
-		evhttp_send_reply(req, HTTP_INTERNAL, strerror(errno), nullptr);
-		return;
+	// Of the checksums S3 clients send, CRC32C is the one recorded in the index, so it is the one verified
+	static constexpr std::string_view CRC32C_TRAILER = "x-amz-checksum-crc32c:";
+	auto expected = std::string{};
+	if (auto header = evhttp_find_header(req->input_headers, "x-amz-checksum-crc32c")) {
+		expected = header;
+	} else if (auto at = trailers.find(CRC32C_TRAILER); at != std::string::npos) {
+		auto begin = trailers.find_first_not_of(' ', at + CRC32C_TRAILER.size());
+		expected = trailers.substr(begin, trailers.find_first_of("\r\n", begin) - begin);
 	}
 
-	if (evbuffer_add_file(output_buffer, fd, 0, file.get_file_size()) == -1) {
-		common::ERROR("server_logger", "Unable to load file {} to buffer", download_path.c_str());
-		evhttp_send_reply(req, HTTP_INTERNAL, "Cannot add file to response buffer", nullptr);
-		return;
+	if (!expected.empty() &&
+		crc32c::to_digest(crc32c::update(0, content.data(), content.size())) != "crc32c=" + expected) {
+		s3_error(req, HTTP_BADREQUEST, "BadDigest", "The CRC32C checksum did not match");
+		return false;
 	}
 
-	// Build response header with ETag, Accept-ranges: bytes
-	evhttp_add_header(req->output_headers, "Accept-Ranges", "bytes");
-	evhttp_add_header(req->output_headers, "ETag", get_etag(info).c_str());
-	evhttp_add_header(req->output_headers, "Content-Type", "application/octet-stream");
+	return true;
+}
 
-	if (retrans) {	// retrans uses 206
-		common::INFO("server_logger", "Sending response 206 [Retransmission] : {}", download_path.c_str());
-		evhttp_send_reply(req, 206, "Resume transmission from breakpoint", nullptr);
-	} else {  // Normal transmission, no retrans
-		common::INFO("server_logger", "Sending response 200 [Transmission] : {}", download_path.c_str());
-		evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+auto server::s3_list_buckets(evhttp_request* req) -> void {
+	auto body = std::string{XML_DECLARATION} + "<ListAllMyBucketsResult xmlns=\"" + S3_NAMESPACE +
+				"\"><Owner><ID>storage_server</ID><DisplayName>storage_server</DisplayName></Owner><Buckets><Bucket>"
+				"<Name>" +
+				xml_escape(server_config::get_instance().get_s3_bucket()) + "</Name><CreationDate>" + s3_time(0) +
+				"</CreationDate></Bucket></Buckets></ListAllMyBucketsResult>";
+	send_xml(req, body);
+}
+
+auto server::s3_list_objects(evhttp_request* req, const s3_params& params) -> void {
+	auto param = [&](std::string_view name) -> std::string {
+		auto it = params.find(name);
+		return it == params.end() ? "" : it->second;
+	};
+
+	// ListObjectsV2 pages with continuation-token or start-after, V1 with marker; both are the key to start after
+	auto v2 = param("list-type") == "2";
+	auto prefix = param("prefix");
+	auto delimiter = param("delimiter");
+	auto token = param("continuation-token");
+	auto start_after = v2 ? (token.empty() ? param("start-after") : token) : param("marker");
+	// S3 takes max-keys=0 and answers it with an empty page that is not truncated
+	auto max_keys = std::max<size_t>(server_config::get_instance().get_list_max_keys(), 1);
+	if (auto requested = param("max-keys"); !requested.empty()) {
+		if (requested.find_first_not_of("0123456789") != std::string::npos) {
+			s3_error(req, HTTP_BADREQUEST, "InvalidArgument", "max-keys must be a non-negative integer");
+			return;
+		}
+		max_keys = std::min<size_t>(max_keys, std::strtoull(requested.c_str(), nullptr, 10));
+	}
+
+	auto encode = param("encoding-type") == "url";
+	auto text = [&](std::string_view value) -> std::string { return xml_escape(encode ? url_encode(value) : value); };
+
+	auto url_prefix = server_config::get_instance().get_download_url_prefix() + "/";
+	auto marker = start_after.empty() ? std::string{} : url_prefix + start_after;
+	auto page = listing{};
+	data_manager::get_instance().list(url_prefix + prefix, delimiter, marker, max_keys, page);
+
+	auto body = std::string{XML_DECLARATION} + "<ListBucketResult xmlns=\"" + S3_NAMESPACE + "\"><Name>" +
+				xml_escape(server_config::get_instance().get_s3_bucket()) + "</Name><Prefix>" + text(prefix) +
+				"</Prefix>";
+	if (v2) {
+		body += "<KeyCount>" + std::to_string(page.files.size() + page.common_prefixes.size()) + "</KeyCount>";
+		if (!token.empty()) body += "<ContinuationToken>" + xml_escape(token) + "</ContinuationToken>";
+		if (token.empty() && !start_after.empty()) body += "<StartAfter>" + text(start_after) + "</StartAfter>";
+	} else {
+		body += "<Marker>" + text(start_after) + "</Marker>";
+	}
+
+	body += "<MaxKeys>" + std::to_string(max_keys) + "</MaxKeys>";
+	if (!delimiter.empty()) body += "<Delimiter>" + text(delimiter) + "</Delimiter>";
+	if (encode) body += "<EncodingType>url</EncodingType>";
+	body += std::string{"<IsTruncated>"} + (page.truncated ? "true" : "false") + "</IsTruncated>";
+	if (page.truncated) {
+		auto next = page.next_marker.substr(url_prefix.size());
+		body += v2 ? "<NextContinuationToken>" + xml_escape(next) + "</NextContinuationToken>"
+				   : "<NextMarker>" + text(next) + "</NextMarker>";
+	}
+
+	for (const auto& info : page.files) {
+		body += "<Contents><Key>" + text(info.file_name()) + "</Key><LastModified>" + s3_time(info.time_modified) +
+				"</LastModified><ETag>" + xml_escape(info.etag) + "</ETag><Size>" + std::to_string(info.file_size) +
+				"</Size><StorageClass>" + s3_storage_class(info) + "</StorageClass></Contents>";
 	}
 
-	if (download_path != info.file_path) {
-		std::remove(download_path.c_str());
+	for (const auto& common : page.common_prefixes) {
+		body += "<CommonPrefixes><Prefix>" + text(common.substr(url_prefix.size())) + "</Prefix></CommonPrefixes>";
 	}
+
+	body += "</ListBucketResult>";
+	send_xml(req, body);
 }
 
-auto server::upload(evhttp_request* req, void* arg) -> void {
-	// Hot storage: directly store
-	// Cold storage: first compress then store
+auto server::s3_put_object(request_context& ctx, const std::string& key) -> void {
+	metrics::add(counter::upload_requests);
+	auto start = std::chrono::steady_clock::now();	// the reply is sent by the committer, timed there
+	auto req = ctx.req;
 
-	auto input_buffer = evhttp_request_get_input_buffer(req);
-	if (!input_buffer) {
-		common::ERROR("server_logger", "Failed to get input buffer");
-		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid request (invalid input buffer)", nullptr);
+	auto content = std::string{};
+	if (!s3_read_body(req, content) || !admit_client(req, content.size())) return;
+
+	// An empty object has nothing to compress
+	auto storage_type = content.empty() ? std::string{"hot"} : s3_storage_type(req);
+	auto storage_dir = std::string{};
+	if (!prepare_storage_directory(req, storage_type, content.size(), storage_dir)) return;
+
+	store_upload(req, s3_file_name(key), storage_info::make_url(key), storage_type, storage_dir,
+				 std::make_shared<const std::string>(std::move(content)), start, ctx.trace, nullptr);
+}
+
+auto server::s3_get_object(request_context& ctx, const std::string& key) -> void {
+	auto req = ctx.req;
+	auto url = storage_info::make_url(key);
+	auto info = storage_info{};
+	if (!data_manager::get_instance().find_by_url(url, info)) {
+		s3_error(req, HTTP_NOTFOUND, "NoSuchKey", "The specified key does not exist");
 		return;
 	}
 
-	auto buffer_size = evbuffer_get_length(input_buffer);
-	if (!buffer_size) {
-		common::ERROR("server_logger", "Uploading an empty file");
-		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid request (empty file)", nullptr);
+	if (metadata_table::tier_of(info) == storage_tier::cold) {
+		evhttp_add_header(req->output_headers, "x-amz-storage-class", s3_storage_class(info));
+	}
+
+	// HEAD is answered from the index, except for a standalone cold file whose recorded size is the compressed one:
+	// download then reads the size from the file headers
+	if (ctx.method == EVHTTP_REQ_HEAD && (info.in_segment() || metadata_table::tier_of(info) == storage_tier::hot)) {
+		add_validators(req, info);
+		if (is_not_modified(req, info)) {
+			evhttp_send_reply(req, HTTP_NOTMODIFIED, "Not Modified", nullptr);
+			return;
+		}
+
+		evhttp_add_header(req->output_headers, "Content-Length", std::to_string(info.file_size).c_str());
+		evhttp_add_header(req->output_headers, "Content-Type", "application/octet-stream");
+		evhttp_add_header(req->output_headers, "Accept-Ranges", "bytes");
+		evhttp_send_reply(req, HTTP_OK, "OK", nullptr);
 		return;
 	}
 
-	auto data = std::string(buffer_size, '\0');
-	if (evbuffer_copyout(input_buffer, reinterpret_cast<void*>(data.data()), buffer_size) == -1) {
-		common::ERROR("server_logger", "Failed to copy from input buffer");
-		evhttp_send_reply(req, HTTP_INTERNAL, "Unable to copy from uploaded file", nullptr);
+	auto forwarded = request_context{req, ctx.method, url, ctx.trace};
+	download(forwarded);
+}
+
+auto server::s3_delete_object(request_context& ctx, const std::string& key) -> void {
+	auto url = storage_info::make_url(key);
+	auto info = storage_info{};
+	if (!data_manager::get_instance().find_by_url(url, info)) {
+		evhttp_send_reply(ctx.req, HTTP_NOCONTENT, "No Content", nullptr);	// deleting a missing key succeeds
 		return;
 	}
 
-	auto file_name = std::string{evhttp_find_header(req->input_headers, "FileName")};
-	file_name = std::move(base64_decode(file_name));
+	auto forwarded = request_context{ctx.req, ctx.method, url, ctx.trace};
+	remove_file(forwarded);
+}
 
-	auto storage_type = std::string{evhttp_find_header(req->input_headers, "StorageType")};
-	auto storage_path = std::string{};
+auto server::s3_create_multipart(evhttp_request* req, const std::string& key) -> void {
+	auto upload_id = multipart_store::get_instance().create(key, s3_storage_type(req));
+	send_xml(req, std::string{XML_DECLARATION} + "<InitiateMultipartUploadResult xmlns=\"" + S3_NAMESPACE +
+					  "\"><Bucket>" + xml_escape(server_config::get_instance().get_s3_bucket()) + "</Bucket><Key>" +
+					  xml_escape(key) + "</Key><UploadId>" + upload_id + "</UploadId></InitiateMultipartUploadResult>");
+}
 
-	if (storage_type == "hot") {
-		storage_path = server_config::get_instance().get_hot_storage_path();
-	} else if (storage_type == "cold") {
-		storage_path = server_config::get_instance().get_cold_storage_path();
-	} else {
-		common::ERROR("server_logger", "Invalid storage type specified by user");
-		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid storage type", nullptr);
+auto server::s3_upload_part(request_context& ctx, const std::string& key, const s3_params& params) -> void {
+	auto req = ctx.req;
+	auto trace = ctx.trace;
+	auto upload_id = params.find("uploadId")->second;
+	auto number = uint64_t{0};
+	if (!parse_offset(params.find("partNumber")->second, number) || !number || number > multipart_store::MAX_PARTS) {
+		s3_error(req, HTTP_BADREQUEST, "InvalidArgument", "Part number must be an integer between 1 and 10000");
 		return;
 	}
 
-	auto new_dir = file_util{storage_path};	 // Create directory for storage if not exist
-	if (!new_dir.create_directory()) {
-		common::ERROR("server_logger", "Failed to create directory for upload: {}", storage_path.c_str());
-		evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot create storage directory", nullptr);
+	auto content = std::string{};
+	if (!s3_read_body(req, content) || !admit_client(req, content.size())) return;
+
+	auto path = std::string{};
+	if (!multipart_store::get_instance().part_path(upload_id, key, static_cast<unsigned>(number), path)) {
+		s3_error(req, HTTP_NOTFOUND, "NoSuchUpload", "The specified upload does not exist");
 		return;
 	}
 
-	storage_path += "/" + file_name;
-	auto file = file_util{storage_path};  // Create file util object for the new file
-	if (storage_type == "cold") {
-		// Cold storage: compress first
-		if (!file.compress(data, server_config::get_instance().get_bundle_type())) {
-			common::ERROR("server_logger", "Failed to compress file for cold storage");
-			evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot compress file for cold storage", nullptr);
-			return;
+	auto part = multipart_part{path, content.size(), crc32c::update(0, content.data(), content.size()), {}};
+	part.etag = crc32c::to_hex(part.checksum) + "-" + std::to_string(part.size);
+	auto data = std::make_shared<const std::string>(std::move(content));
+
+	// Written on the worker pool, so parts arriving over several connections go to disk at the same time
+	auto write_start = request_trace::now_ns();
+	worker_pool::get_instance().submit([=]() -> void {
+		auto written = file_util{path}.write_file(*data);
+		loop_executor::get_instance().post([=]() -> void {
+			if (trace) trace->add_span("write", write_start, request_trace::now_ns());
+			if (written && multipart_store::get_instance().add_part(upload_id, static_cast<unsigned>(number), part)) {
+				evhttp_add_header(req->output_headers, "ETag", ("\"" + part.etag + "\"").c_str());
+				if (trace) trace->mark_reply();
+				evhttp_send_reply(req, HTTP_OK, "OK", nullptr);
+				return;
+			}
+
+			std::remove(path.c_str());
+			if (!written) {
+				common::ERROR("server_logger", "Failed to write part {} of multipart upload {}", number, upload_id);
+				s3_error(req, HTTP_INTERNAL, "InternalError", "Cannot write the part");
+				return;
+			}
+
+			s3_error(req, HTTP_NOTFOUND, "NoSuchUpload", "The upload was completed or aborted");
+		});
+	});
+}
+
+auto server::s3_complete_multipart(request_context& ctx, const std::string& key, const std::string& upload_id)
+	-> void {
+	metrics::add(counter::upload_requests);
+	auto start = std::chrono::steady_clock::now();	// the reply is sent by the committer, timed there
+	auto req = ctx.req;
+	auto trace = ctx.trace;
+
+	// <CompleteMultipartUpload><Part><PartNumber>1</PartNumber><ETag>"..."</ETag></Part>...</CompleteMultipartUpload>
+	auto body = std::string{};
+	if (!s3_read_body(req, body)) return;
+
+	auto requested = std::vector<std::pair<unsigned, std::string>>{};
+	auto malformed = false;
+	for (auto pos = body.find("<Part>"); pos != std::string::npos; pos = body.find("<Part>", pos)) {
+		auto end = body.find("</Part>", pos);
+		auto number_text = std::string{};
+		auto etag = std::string{};
+		auto number = uint64_t{0};
+		if (end == std::string::npos) {
+			malformed = true;
+			break;
 		}
-	} else {
-		// Hot storage: directly write
-		if (!file.write_file(data)) {
-			common::ERROR("server_logger", "Failed to write file for hot storage");
-			evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot write file for hot storage", nullptr);
-			return;
+
+		auto part = std::string_view{body}.substr(pos, end - pos);
+		if (!xml_element(part, "PartNumber", number_text) || !xml_element(part, "ETag", etag) ||
+			!parse_offset(number_text, number) || number > multipart_store::MAX_PARTS) {
+			malformed = true;
+			break;
 		}
+
+		if (etag.size() >= 2 && etag.front() == '"' && etag.back() == '"') etag = etag.substr(1, etag.size() - 2);
+		requested.emplace_back(static_cast<unsigned>(number), std::move(etag));
+		pos = end;
 	}
 
-	// Add storage info to data manager
-	auto info = storage_info{storage_path};
-	if (!data_manager::get_instance().add_info(info)) {
-		common::ERROR("server_logger", "Failed to add storage info to data manager");
-		evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot update storage info", nullptr);
+	if (malformed || requested.empty()) {
+		s3_error(req, HTTP_BADREQUEST, "MalformedXML", "The part list is not valid");
 		return;
 	}
 
-	common::INFO("server_logger", "File {} uploaded successfully to {}", file_name.c_str(), storage_path.c_str());
-	evhttp_send_reply(req, HTTP_OK, "File uploaded successfully", nullptr);
-}
+	auto upload = multipart_upload{};
+	auto selected = std::vector<multipart_part>{};
+	switch (multipart_store::get_instance().take(upload_id, key, requested, upload, selected)) {
+		case multipart_status::ok: break;
+		case multipart_status::no_such_upload:
+			s3_error(req, HTTP_NOTFOUND, "NoSuchUpload", "The specified upload does not exist");
+			return;
+		case multipart_status::invalid_part:
+			s3_error(req, HTTP_BADREQUEST, "InvalidPart", "A listed part was not uploaded or its ETag differs");
+			return;
+		case multipart_status::invalid_order:
+			s3_error(req, HTTP_BADREQUEST, "InvalidPartOrder", "The parts must be listed in ascending order");
+			return;
+	}
 
-auto server::show(evhttp_request* req, void* arg) -> void {
-	auto files = std::vector<storage_info>{};
-	if (!data_manager::get_instance().find_all(files)) {
-		common::ERROR("server_logger", "Failed to retrieve file list from data manager");
-		evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot retrieve file list", nullptr);
+	auto total = uint64_t{0};
+	for (const auto& part : selected) total += part.size;
+	auto storage_type = total ? upload.storage_type : std::string{"hot"};
+	auto storage_dir = std::string{};
+	if (!prepare_storage_directory(req, storage_type, total, storage_dir)) {
+		worker_pool::get_instance().submit(
+			[upload = std::move(upload)]() -> void { multipart_store::discard(upload); });
 		return;
 	}
 
-	auto ifs = std::ifstream{"./static/index.html"};
-	auto html_template = std::string{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+	auto file_url = storage_info::make_url(key);
+	auto storage_path = commit_queue::make_version_path(storage_dir + "/" + s3_file_name(key));
+	auto temp_path = commit_queue::make_temp_path(storage_path);
+	auto reply = upload_reply{[key, file_url](evhttp_request* req, const storage_info& info) -> void {
+		send_xml(req, std::string{XML_DECLARATION} + "<CompleteMultipartUploadResult xmlns=\"" + S3_NAMESPACE +
+						  "\"><Location>" + xml_escape(file_url) + "</Location><Bucket>" +
+						  xml_escape(server_config::get_instance().get_s3_bucket()) + "</Bucket><Key>" +
+						  xml_escape(key) + "</Key><ETag>" + xml_escape(info.etag) +
+						  "</ETag></CompleteMultipartUploadResult>");
+	}};
 
-	// Replace {{FILE_LIST}} in html_template with generated file list
-	html_template = std::regex_replace(html_template, std::regex(R"(\{\{FILE_LIST\}\})"), generate_file_list(files));
-	// Replace {{BACKEND_URL}} in html_template with Backend URL from config
-	html_template = std::regex_replace(html_template, std::regex(R"(\{\{BACKEND_URL\}\})"),
-									   "http://" + server_config::get_instance().get_server_ip() + ":" +
-										   std::to_string(server_config::get_instance().get_server_port()));
+	// Streamed from the part files into the temp file on the worker pool, each part checked against the checksum
+	// taken when it arrived, so the object is never held in memory; a cold object is then packed from its mapping,
+	// block by block through the upload pipeline from pipeline_min_bytes on, like a single cold upload
+	auto cold = storage_type == "cold";
+	auto assemble = [=]() -> void {
+		auto assemble_start = request_trace::now_ns();
+		worker_pool::get_instance().submit([=]() -> void {
+			auto checksum = uint32_t{0};
+			auto assembled_path = cold ? commit_queue::make_temp_path(storage_path) : temp_path;
+			auto ok = multipart_store::assemble(selected, assembled_path, checksum);
+			multipart_store::discard(upload);
+
+			auto input = std::make_shared<mapped_file>();
+			if (ok && cold) {
+				ok = input->map_read(assembled_path, false);
+				std::remove(assembled_path.c_str());  // the mapping keeps the bytes
+			}
+
+			auto format = server_config::get_instance().get_bundle_type();
+			auto chunked = ok && cold && input->get_size() >= server_config::get_instance().get_pipeline_min_bytes();
+			if (ok && cold && !chunked) {
+				ok = file_util{temp_path}.compress(input->get_data(), input->get_size(), format);
+				if (!ok) std::remove(temp_path.c_str());
+			}
+
+			auto assembled = [=](bool ok) -> void {
+				if (cold) admission_queue::get_instance().leave();
+				if (trace) trace->add_span("assemble", assemble_start, request_trace::now_ns());
+				if (!ok) {
+					s3_error(req, HTTP_INTERNAL, "InternalError", "Cannot assemble the uploaded parts");
+					return;
+				}
+
+				commit_upload(req, temp_path, storage_path, file_url, nullptr, start, trace, 0, chunked, checksum,
+							  reply);
+			};
 
+			if (chunked) {
+				upload_pipeline::start(temp_path, std::shared_ptr<const mapped_file>{std::move(input)}, format,
+									   [=](bool ok, uint32_t) -> void { assembled(ok); });
+				return;
+			}
+			loop_executor::get_instance().post([=]() -> void { assembled(ok); });
+		});
+	};
+
+	if (!cold) {
+		assemble();
+	} else if (!admission_queue::get_instance().enter(assemble)) {
+		worker_pool::get_instance().submit(
+			[upload = std::move(upload)]() -> void { multipart_store::discard(upload); });
+		reject_overloaded(req);
+	}
+}
+
+auto server::s3_abort_multipart(evhttp_request* req, const std::string& key, const std::string& upload_id) -> void {
+	if (!multipart_store::get_instance().abort(upload_id, key)) {
+		s3_error(req, HTTP_NOTFOUND, "NoSuchUpload", "The specified upload does not exist");
+		return;
+	}
+
+	evhttp_send_reply(req, HTTP_NOCONTENT, "No Content", nullptr);
+}
+
+auto server::show_metrics(request_context& ctx) -> void {
+	auto req = ctx.req;
+	auto body = metrics::get_instance().render();
 	auto output_buffer = evhttp_request_get_output_buffer(req);
-	if (evbuffer_add(output_buffer, reinterpret_cast<const void*>(html_template.c_str()), html_template.size()) == -1) {
-		common::ERROR("server_logger", "Failed to add HTML content to output buffer");
-		evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot prepare HTML content", nullptr);
+	if (evbuffer_add(output_buffer, body.data(), body.size()) == -1) {
+		common::ERROR("server_logger", "Failed to add metrics to output buffer");
+		evhttp_send_reply(req, HTTP_INTERNAL, "Server error: cannot prepare metrics", nullptr);
 		return;
 	}
 
-	evhttp_add_header(req->output_headers, "Content-Type", "text/html; charset=UTF-8");
+	evhttp_add_header(req->output_headers, "Content-Type", "text/plain; version=0.0.4");
+	evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+}
+
+auto server::admin_allowed(evhttp_request* req) -> bool {
+	// From this host, or from elsewhere with the configured token
+	char* address = nullptr;
+	auto port = uint16_t{0};
+	auto conn = evhttp_request_get_connection(req);
+	if (conn) evhttp_connection_get_peer(conn, &address, &port);
+	auto peer = std::string_view{address ? address : ""};
+	if (peer.starts_with("127.") || peer == "::1" || peer.starts_with("::ffff:127.")) return true;
+
+	const auto& token = server_config::get_instance().get_admin_token();
+	auto given = evhttp_find_header(evhttp_request_get_input_headers(req), "X-Admin-Token");
+	if (!token.empty() && given && token == given) return true;
+
+	evhttp_send_reply(req, 403, "Forbidden", nullptr);
+	return false;
+}
+
+auto server::configure_log(request_context& ctx) -> void {
+	auto req = ctx.req;
+	if (!admin_allowed(req)) return;
+
+	// POST /admin/log?level=debug&sample=100 adjusts the access log, GET only reports the settings
+	auto params = evkeyvalq{};
+	auto query = ctx.method == EVHTTP_REQ_POST || ctx.method == EVHTTP_REQ_PUT
+					 ? evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req))
+					 : nullptr;
+	if (query && evhttp_parse_query_str(query, &params) != 0) {
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid query", nullptr);
+		return;
+	}
+
+	auto& log = access_log::get_instance();
+	auto level = evhttp_find_header(&params, "level");
+	auto new_level = log.get_level();
+	if (level && !access_log::parse_level(level, new_level)) {
+		evhttp_clear_headers(&params);
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Unknown level", nullptr);
+		return;
+	}
+
+	auto sample = evhttp_find_header(&params, "sample");
+	log.set_level(new_level);
+	if (sample) log.set_sample_every(static_cast<uint32_t>(std::strtoul(sample, nullptr, 10)));
+	evhttp_clear_headers(&params);
+
+	evbuffer_add_printf(evhttp_request_get_output_buffer(req), "level=%s sample=%u dropped=%lu\n",
+						access_log::level_name(log.get_level()), log.get_sample_every(),
+						static_cast<unsigned long>(log.get_dropped()));
+	evhttp_add_header(req->output_headers, "Content-Type", "text/plain");
+	evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+}
+
+auto server::manage_snapshots(request_context& ctx) -> void {
+	auto req = ctx.req;
+	if (!admin_allowed(req)) return;
+
+	if (ctx.method == EVHTTP_REQ_POST || ctx.method == EVHTTP_REQ_PUT) {
+		// Taking one waits for the publish lock, which a commit holds across its directory syncs
+		worker_pool::get_instance().submit([req]() -> void {
+			auto taken = snapshot_manager::get_instance().create();
+			loop_executor::get_instance().post([req, id = taken->id]() -> void {
+				evbuffer_add_printf(evhttp_request_get_output_buffer(req), "%lu\n", static_cast<unsigned long>(id));
+				evhttp_add_header(req->output_headers, "Content-Type", "text/plain");
+				evhttp_send_reply(req, HTTP_OK, "Snapshot taken", nullptr);
+			});
+		});
+		return;
+	}
+
+	// One line per retained snapshot: id, creation time, number of files
+	auto output_buffer = evhttp_request_get_output_buffer(req);
+	for (const auto& s : snapshot_manager::get_instance().list()) {
+		evbuffer_add_printf(output_buffer, "%lu %s %zu\n", static_cast<unsigned long>(s->id),
+							format_http_date(s->time_created).c_str(), s->index.size());
+	}
+	evhttp_add_header(req->output_headers, "Content-Type", "text/plain");
 	evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
 }
 
-auto server::generate_file_list(const std::vector<storage_info>& files) -> std::string {
+auto server::begin_trace(evhttp_request* req, const char* handler, std::string_view path) -> request_trace* {
+	auto trace = request_trace::begin(req, handler, path);
+	if (trace) {  // replaces the plain access log callback, the traced one logs too
+		evhttp_request_set_on_complete_cb(req, on_traced_complete, trace);
+		// Without completion a dropped connection would leak the trace
+		connection_manager::get_instance().on_connection_close(evhttp_request_get_connection(req),
+																[req, trace]() -> void { trace->abandon(req); });
+	}
+
+	return trace;
+}
+
+auto server::on_request_complete(evhttp_request* req, void* arg) -> void {
+	connection_manager::get_instance().complete(req);
+	if (access_log::get_instance().get_level() == log_level::off) return;
+
+	auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				   std::chrono::steady_clock::now().time_since_epoch())
+				   .count();
+	log_access(req, now - static_cast<uint64_t>(reinterpret_cast<uintptr_t>(arg)));
+}
+
+auto server::on_traced_complete(evhttp_request* req, void* arg) -> void {
+	auto trace = static_cast<request_trace*>(arg);
+	connection_manager::get_instance().on_connection_close(evhttp_request_get_connection(req), nullptr);
+	connection_manager::get_instance().complete(req);
+	log_access(req, request_trace::now_ns() - trace->get_start_ns());
+	trace->finish();
+}
+
+auto server::log_access(evhttp_request* req, uint64_t duration_ns) -> void {
+	auto status = static_cast<uint16_t>(evhttp_request_get_response_code(req));
+	auto& log = access_log::get_instance();
+	if (!log.should_log(status)) return;
+
+	auto record = access_record{};
+	record.timestamp_ns =
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+			.count();
+	record.duration_ns = duration_ns;
+	record.status = status;
+	record.method = static_cast<uint8_t>(__builtin_ctz(evhttp_request_get_command(req)));
+
+	auto length = evhttp_find_header(evhttp_request_get_output_headers(req), "Content-Length");
+	record.bytes_out = length ? std::strtoull(length, nullptr, 10) : 0;
+
+	auto uri = evhttp_request_get_uri(req);
+	std::strncpy(record.path, uri ? uri : "", access_record::PATH_SIZE - 1);
+
+	auto conn = evhttp_request_get_connection(req);
+	if (conn) {
+		auto address = static_cast<char*>(nullptr);
+		auto port = ev_uint16_t{0};
+		evhttp_connection_get_peer(conn, &address, &port);
+		std::strncpy(record.peer, address ? address : "", access_record::PEER_SIZE - 1);
+		record.peer_port = port;
+	}
+
+	log.push(record);
+}
+
+auto server::generate_file_list(const std::vector<storage_info>& files, const std::string& link_query,
+								bool link_versions) -> std::string {
 	// Generate text in HTML format to display the files
 	auto ss = std::stringstream{};
 	ss << "<div class='file-list'><h3>Uploaded Files</h3>";
 
 	for (const auto& file : files) {
-		auto file_name = file_util{file.file_path}.get_file_name();
+		auto file_name = file.file_name();
 		auto is_cold = file.file_path.find("storage/cold") != std::string::npos ? true : false;
 
 		ss << "<div class='file-item'>"
@@ -285,7 +1934,8 @@ auto server::generate_file_list(const std::vector<storage_info>& files) -> std::
 		   << "<span>" << format_size(file.file_size) << "</span>"
 		   << "<span>" << std::ctime(&file.time_modified) << "</span>"
 		   << "</div>"
-		   << "<button onclick=\"window.location='" << file.file_url << "'\">⬇️ Download</button>"
+		   << "<button onclick=\"window.location='" << file.file_url << link_query
+		   << (link_versions ? "?version=" + std::to_string(file.version) : "") << "'\">⬇️ Download</button>"
 		   << "</div>";
 	}
 
@@ -305,7 +1955,103 @@ auto server::format_size(uint64_t bytes) -> std::string {
 	return std::to_string(bytes) + " " + units[idx];
 }
 
-auto server::get_etag(const storage_info& info) -> std::string {
+auto server::format_http_date(std::time_t time) -> std::string {
+	auto tm = std::tm{};
+	gmtime_r(&time, &tm);
+
+	auto date = std::array<char, 32>{};
+	std::strftime(date.data(), date.size(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return std::string{date.data()};
+}
+
+auto server::parse_http_date(const char* value, std::time_t& time) -> bool {
+	auto tm = std::tm{};
+	auto end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	if (!end || *end) return false;
+
+	time = timegm(&tm);
+	return true;
+}
+
+// Weak comparison as If-None-Match requires: the W/ prefix is ignored on both sides
+static auto opaque_tag(std::string_view tag) -> std::string_view {
+	if (tag.starts_with("W/")) tag.remove_prefix(2);
+	return tag;
+}
+
+static auto etag_matches(std::string_view list, std::string_view etag) -> bool {
+	auto own = opaque_tag(etag);
+	while (!list.empty()) {
+		auto comma = list.find(',');
+		auto tag = list.substr(0, comma);
+		list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+
+		auto first = tag.find_first_not_of(" \t");
+		if (first == std::string_view::npos) continue;
+		tag = tag.substr(first, tag.find_last_not_of(" \t") - first + 1);
+
+		if (tag == "*" || opaque_tag(tag) == own) return true;
+	}
+
+	return false;
+}
+
+auto server::is_not_modified(evhttp_request* req, const storage_info& info) -> bool {
+	// If-Modified-Since only counts without If-None-Match, the ETag is the more precise validator
+	if (auto if_none_match = evhttp_find_header(req->input_headers, "If-None-Match")) {
+		return etag_matches(if_none_match, info.etag);
+	}
+
+	auto since = std::time_t{};
+	auto if_modified_since = evhttp_find_header(req->input_headers, "If-Modified-Since");
+	return if_modified_since && parse_http_date(if_modified_since, since) && info.time_modified <= since;
+}
+
+auto server::add_validators(evhttp_request* req, const storage_info& info) -> void {
+	evhttp_add_header(req->output_headers, "ETag", info.etag.c_str());
+	evhttp_add_header(req->output_headers, "Last-Modified", format_http_date(info.time_modified).c_str());
+	evhttp_add_header(req->output_headers, "Cache-Control", server_config::get_instance().get_cache_control().c_str());
+	if (info.version) evhttp_add_header(req->output_headers, "Version", std::to_string(info.version).c_str());
+}
+
+auto server::find_requested(evhttp_request* req, std::string_view url, storage_info& info) -> bool {
+	auto params = evkeyvalq{};
+	auto query = evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req));
+	auto version = uint64_t{0};
+	auto snapshot_id = uint64_t{0};
+	auto has_version = false;
+	auto has_snapshot = false;
+	auto valid = (!query || evhttp_parse_query_str(query, &params) == 0) &&
+				 query_number(&params, "version", version, has_version) &&
+				 query_number(&params, "snapshot", snapshot_id, has_snapshot);
+	evhttp_clear_headers(&params);
+	if (!valid) {
+		evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid version or snapshot", nullptr);
+		return false;
+	}
+
+	// ?snapshot= reads the record as of that snapshot; ?version= the current one or one kept in its version chain,
+	// else the newest snapshot holding it
+	auto found = false;
+	if (has_snapshot) {
+		auto snapshot = snapshot_manager::get_instance().find(snapshot_id);
+		auto held = snapshot ? snapshot->index.find(url) : nullptr;
+		found = held && (!has_version || held->version == version);
+		if (found) info = *held;
+	} else {
+		found = has_version ? data_manager::get_instance().find_version(url, version, info)
+							: data_manager::get_instance().find_by_url(url, info);
+		if (has_version && !found) found = snapshot_manager::get_instance().find_version(url, version, info);
+	}
+
+	if (!found) {
+		common::ERROR("server_logger", "No storage info for requested URL: {}", url);
+		evhttp_send_reply(req, HTTP_NOTFOUND, "File non-existent", nullptr);
+	}
+	return found;
+}
+
+auto server::cache_key(const storage_info& info) -> std::string {
 	// Format: NAME-SIZE-TIME_MODIFIED
 	auto file = file_util{info.file_path};
 	auto etag = file.get_file_name();
@@ -324,6 +2070,12 @@ auto server::start_server() -> bool {
 		return false;
 	}
 
+	// Loop wake-ups run first, then requests and small replies, connections answering large replies last
+	if (event_base_priority_init(base, connection_manager::PRIORITIES) != 0) {
+		common::ERROR("server_logger", "Cannot set event base priorities");
+		return false;
+	}
+
 	auto httpd = evhttp_new(base);
 	if (!httpd) {
 		common::ERROR("server_logger", "Cannot create httpd");
@@ -339,6 +2091,84 @@ auto server::start_server() -> bool {
 		return false;
 	}
 
+	// Load the index, drop uploads that never reached their commit and versions retired but not yet removed
+	if (!data_manager::get_instance().initialize()) {
+		common::ERROR("server_logger", "Cannot initialize storage index");
+		return false;
+	}
+
+	commit_queue::remove_stale_temps(server_config::get_instance().get_hot_storage_path());
+	commit_queue::remove_stale_temps(server_config::get_instance().get_cold_storage_path());
+	if (!multipart_store::get_instance().start()) {
+		common::ERROR("server_logger", "Cannot prepare the multipart upload directory");
+		return false;
+	}
+
+	// Snapshots are loaded first, the versions they hold are no orphans
+	if (!snapshot_manager::get_instance().start()) {
+		common::ERROR("server_logger", "Cannot start index snapshots");
+		return false;
+	}
+
+	commit_queue::remove_orphan_versions(server_config::get_instance().get_hot_storage_path());
+	commit_queue::remove_orphan_versions(server_config::get_instance().get_cold_storage_path());
+
+	// Dictionaries written by earlier runs must be loaded before any file compressed with them is read
+	if (!dictionary_store::get_instance().start()) {
+		common::ERROR("server_logger", "Cannot load compression dictionaries");
+		return false;
+	}
+
+	// Small cold files are packed into segments and segments compacted in the background
+	if (!segment_store::get_instance().start()) {
+		common::ERROR("server_logger", "Cannot start segment store");
+		return false;
+	}
+
+	// Stored files are re-read at a bounded rate, so bit-rot shows up before a download hits it
+	scrubber::get_instance().start();
+
+	// Completions from worker threads (e.g. the upload committer) are handed back to this loop
+	if (!loop_executor::get_instance().attach(base)) {
+		common::ERROR("server_logger", "Cannot attach loop executor to event base");
+		return false;
+	}
+
+	// Route file I/O completions of the selected backend through this event loop
+	if (!io_backend::get_instance().attach(base)) {
+		common::ERROR("server_logger", "Cannot attach {} I/O backend to event base", io_backend::get_instance().name());
+		return false;
+	}
+
+	// Queue depths and cache sizes are sampled when /metrics is scraped
+	metrics::get_instance().add_gauge("storage_commit_queue_depth",
+									  []() -> double { return commit_queue::get_instance().depth(); });
+	metrics::get_instance().add_gauge("storage_loop_executor_pending",
+									  []() -> double { return loop_executor::get_instance().pending(); });
+	metrics::get_instance().add_gauge("storage_worker_pool_pending",
+									  []() -> double { return worker_pool::get_instance().pending(); });
+	metrics::get_instance().add_gauge("storage_fd_cache_entries",
+									  []() -> double { return fd_cache::get_instance().size(); });
+	metrics::get_instance().add_gauge("storage_small_file_cache_bytes",
+									  []() -> double { return small_file_cache::get_instance().size_bytes(); });
+	metrics::get_instance().add_gauge("storage_reclaim_pending",
+									  []() -> double { return reclaimer::get_instance().pending(); });
+	metrics::get_instance().add_gauge("storage_snapshots",
+									  []() -> double { return snapshot_manager::get_instance().list().size(); });
+	metrics::get_instance().add_gauge("storage_multipart_uploads",
+									  []() -> double { return multipart_store::get_instance().size(); });
+
+	// Body and header size limits, the read timeout, the bulk bandwidth group, and the connection count for /metrics
+	connection_manager::get_instance().configure(base, httpd);
+	metrics::get_instance().add_gauge("storage_open_connections",
+									  []() -> double { return connection_manager::get_instance().size(); });
+	metrics::get_instance().add_gauge("storage_admission_active",
+									  []() -> double { return admission_queue::get_instance().active_count(); });
+	metrics::get_instance().add_gauge("storage_admission_queued",
+									  []() -> double { return admission_queue::get_instance().queued_count(); });
+	metrics::get_instance().add_gauge("storage_rate_limiter_clients",
+									  []() -> double { return rate_limiter::get_instance().size(); });
+
 	// Set generic callback function (not specific to URL)
 	evhttp_set_gencb(httpd, generic_callback, nullptr);
 
@@ -44,7 +44,77 @@ auto server_config::load_config() -> bool {
     hot_storage_path = root.get("hot_storage_path", "./storage/hot").asString();
     storage_info = root.get("storage_info", "./default_storage").asString();
     bundle_type = root.get("bundle_type", 4).asInt();  // Default to 4 if not specified
+    fd_cache_capacity = root.get("fd_cache_capacity", 1024).asUInt64();  // 0 disables the cache
+    small_file_cache_bytes = root.get("small_file_cache_bytes", 64 << 20).asUInt64();  // 0 disables the cache
+    small_file_max_size = root.get("small_file_max_size", 64 << 10).asUInt64();
+    io_backend = root.get("io_backend", "blocking").asString();
+    io_queue_depth = root.get("io_queue_depth", 256).asUInt();
+    mmap_populate = root.get("mmap_populate", false).asBool();
+    group_commit_window_us = root.get("group_commit_window_us", 2000).asUInt();
+    group_commit_max_batch = root.get("group_commit_max_batch", 256).asUInt64();
+    journal_compact_records = root.get("journal_compact_records", 10000).asUInt64();
 
+    access_log_level = root.get("access_log_level", "info").asString();
+    access_log_sample = root.get("access_log_sample", 1).asUInt();
+    admin_token = root.get("admin_token", "").asString();
+    trace_allowed = root.get("trace_allowed", false).asBool();
+    trace_path = root.get("trace_path", "./storage_server_trace.json").asString();
+    trace_max_bytes = root.get("trace_max_bytes", 64 * 1024 * 1024).asUInt64();
+    batch_max_entries = root.get("batch_max_entries", 10000).asUInt64();
+    worker_threads = root.get("worker_threads", 0).asUInt();
+    segment_path = root.get("segment_path", "./storage/segments").asString();
+    segment_max_bytes = root.get("segment_max_bytes", 256 << 20).asUInt64();
+    segment_block_bytes = root.get("segment_block_bytes", 256 << 10).asUInt64();
+    segment_file_max_size = root.get("segment_file_max_size", 64 << 10).asUInt64();
+    segment_pack_interval_s = root.get("segment_pack_interval_s", 60).asUInt();
+    segment_compact_ratio = root.get("segment_compact_ratio", 0.5).asDouble();
+    dictionary_path = root.get("dictionary_path", "./storage/dictionaries").asString();
+    dictionary_max_file_size = root.get("dictionary_max_file_size", 64 << 10).asUInt64();
+    dictionary_capacity = root.get("dictionary_capacity", 64 << 10).asUInt64();
+    dictionary_min_samples = root.get("dictionary_min_samples", 256).asUInt64();
+    dictionary_sample_bytes = root.get("dictionary_sample_bytes", 4 << 20).asUInt64();
+    dictionary_level = root.get("dictionary_level", 3).asInt();
+    dictionary_group_delimiter = root.get("dictionary_group_delimiter", "_").asString();
+    dictionary_max_sample_memory = root.get("dictionary_max_sample_memory", 64 << 20).asUInt64();
+    dictionary_collect_interval_s = root.get("dictionary_collect_interval_s", 3600).asUInt();
+    pipeline_min_bytes = root.get("pipeline_min_bytes", 8 << 20).asUInt64();
+    pipeline_block_bytes = root.get("pipeline_block_bytes", 1 << 20).asUInt64();
+    pipeline_window = root.get("pipeline_window", 0).asUInt64();
+    scrub_bytes_per_s = root.get("scrub_bytes_per_s", 8 << 20).asUInt64();
+    scrub_interval_s = root.get("scrub_interval_s", 3600).asUInt();
+    cache_control = root.get("cache_control", "no-cache").asString();
+    max_connections = root.get("max_connections", 4096).asUInt64();
+    keepalive_max_requests = root.get("keepalive_max_requests", 1000).asUInt64();
+    read_timeout_ms = root.get("read_timeout_ms", 30000).asUInt();
+    write_timeout_ms = root.get("write_timeout_ms", 60000).asUInt();
+    max_header_bytes = root.get("max_header_bytes", 16 << 10).asUInt64();
+    max_body_bytes_hot = root.get("max_body_bytes_hot", Json::UInt64{1} << 30).asUInt64();
+    max_body_bytes_cold = root.get("max_body_bytes_cold", Json::UInt64{4} << 30).asUInt64();
+    rate_limit_requests_per_s = root.get("rate_limit_requests_per_s", 20.0).asDouble();
+    rate_limit_request_burst = root.get("rate_limit_request_burst", 40.0).asDouble();
+    rate_limit_bytes_per_s = root.get("rate_limit_bytes_per_s", 64.0 * (1 << 20)).asDouble();
+    rate_limit_byte_burst = root.get("rate_limit_byte_burst", 256.0 * (1 << 20)).asDouble();
+    rate_limit_max_clients = root.get("rate_limit_max_clients", 65536).asUInt64();
+    rate_limit_key_header = root.get("rate_limit_key_header", "X-Api-Key").asString();
+    for (const auto& key : root["rate_limit_api_keys"]) rate_limit_api_keys.push_back(key.asString());
+    admission_max_active = root.get("admission_max_active", 0).asUInt64();
+    admission_queue_depth = root.get("admission_queue_depth", 64).asUInt64();
+    admission_retry_after_s = root.get("admission_retry_after_s", 1).asUInt();
+    bandwidth_bulk_min_bytes = root.get("bandwidth_bulk_min_bytes", 1 << 20).asUInt64();
+    bandwidth_global_bytes_per_s = root.get("bandwidth_global_bytes_per_s", 0).asUInt64();
+    bandwidth_connection_bytes_per_s = root.get("bandwidth_connection_bytes_per_s", 0).asUInt64();
+    bandwidth_tick_ms = root.get("bandwidth_tick_ms", 50).asUInt();
+    snapshot_path = root.get("snapshot_path", "./storage/snapshots").asString();
+    snapshot_interval_s = root.get("snapshot_interval_s", 86400).asUInt();
+    snapshot_retention = root.get("snapshot_retention", 7).asUInt64();
+    version_retention = root.get("version_retention", 8).asUInt64();
+    list_max_keys = root.get("list_max_keys", 1000).asUInt64();
+    search_refresh_s = root.get("search_refresh_s", 60).asUInt();
+    search_max_results = root.get("search_max_results", 1000).asUInt64();
+    access_time_resolution_s = root.get("access_time_resolution_s", 3600).asUInt();
+    s3_bucket = root.get("s3_bucket", "storage").asString();
+    multipart_path = root.get("multipart_path", "./storage/multipart").asString();
+    multipart_expiry_s = root.get("multipart_expiry_s", 86400).asUInt();
     return true;
 }
 
@@ -62,4 +132,139 @@ auto server_config::get_storage_info() const -> const std::string& { return stor
 
 auto server_config::get_bundle_type() const -> int { return bundle_type; }
 
+auto server_config::get_fd_cache_capacity() const -> size_t { return fd_cache_capacity; }
+
+auto server_config::get_small_file_cache_bytes() const -> size_t { return small_file_cache_bytes; }
+
+auto server_config::get_small_file_max_size() const -> size_t { return small_file_max_size; }
+
+auto server_config::get_io_backend() const -> const std::string& { return io_backend; }
+
+auto server_config::get_io_queue_depth() const -> unsigned { return io_queue_depth; }
+
+auto server_config::get_mmap_populate() const -> bool { return mmap_populate; }
+
+auto server_config::get_group_commit_window_us() const -> unsigned { return group_commit_window_us; }
+
+auto server_config::get_group_commit_max_batch() const -> size_t { return group_commit_max_batch; }
+
+auto server_config::get_journal_compact_records() const -> size_t { return journal_compact_records; }
+
+auto server_config::get_access_log_level() const -> const std::string& { return access_log_level; }
+
+auto server_config::get_access_log_sample() const -> unsigned { return access_log_sample; }
+
+auto server_config::get_admin_token() const -> const std::string& { return admin_token; }
+
+auto server_config::get_trace_allowed() const -> bool { return trace_allowed; }
+
+auto server_config::get_trace_path() const -> const std::string& { return trace_path; }
+
+auto server_config::get_trace_max_bytes() const -> size_t { return trace_max_bytes; }
+
+auto server_config::get_batch_max_entries() const -> size_t { return batch_max_entries; }
+
+auto server_config::get_worker_threads() const -> unsigned { return worker_threads; }
+
+auto server_config::get_segment_path() const -> const std::string& { return segment_path; }
+
+auto server_config::get_segment_max_bytes() const -> size_t { return segment_max_bytes; }
+
+auto server_config::get_segment_block_bytes() const -> size_t { return segment_block_bytes; }
+
+auto server_config::get_segment_file_max_size() const -> size_t { return segment_file_max_size; }
+
+auto server_config::get_segment_pack_interval_s() const -> unsigned { return segment_pack_interval_s; }
+
+auto server_config::get_segment_compact_ratio() const -> double { return segment_compact_ratio; }
+
+auto server_config::get_dictionary_path() const -> const std::string& { return dictionary_path; }
+
+auto server_config::get_dictionary_max_file_size() const -> size_t { return dictionary_max_file_size; }
+
+auto server_config::get_dictionary_capacity() const -> size_t { return dictionary_capacity; }
+
+auto server_config::get_dictionary_min_samples() const -> size_t { return dictionary_min_samples; }
+
+auto server_config::get_dictionary_sample_bytes() const -> size_t { return dictionary_sample_bytes; }
+
+auto server_config::get_dictionary_level() const -> int { return dictionary_level; }
+
+auto server_config::get_dictionary_group_delimiter() const -> const std::string& { return dictionary_group_delimiter; }
+
+auto server_config::get_dictionary_max_sample_memory() const -> size_t { return dictionary_max_sample_memory; }
+
+auto server_config::get_dictionary_collect_interval_s() const -> unsigned { return dictionary_collect_interval_s; }
+
+auto server_config::get_pipeline_min_bytes() const -> size_t { return pipeline_min_bytes; }
+
+auto server_config::get_pipeline_block_bytes() const -> size_t { return pipeline_block_bytes; }
+
+auto server_config::get_pipeline_window() const -> size_t { return pipeline_window; }
+
+auto server_config::get_scrub_bytes_per_s() const -> size_t { return scrub_bytes_per_s; }
+
+auto server_config::get_scrub_interval_s() const -> unsigned { return scrub_interval_s; }
+
+auto server_config::get_cache_control() const -> const std::string& { return cache_control; }
+
+auto server_config::get_max_connections() const -> size_t { return max_connections; }
+
+auto server_config::get_keepalive_max_requests() const -> size_t { return keepalive_max_requests; }
+
+auto server_config::get_read_timeout_ms() const -> unsigned { return read_timeout_ms; }
+
+auto server_config::get_write_timeout_ms() const -> unsigned { return write_timeout_ms; }
+
+auto server_config::get_max_header_bytes() const -> size_t { return max_header_bytes; }
+
+auto server_config::get_max_body_bytes_hot() const -> size_t { return max_body_bytes_hot; }
+
+auto server_config::get_max_body_bytes_cold() const -> size_t { return max_body_bytes_cold; }
+
+auto server_config::get_rate_limit_requests_per_s() const -> double { return rate_limit_requests_per_s; }
+
+auto server_config::get_rate_limit_request_burst() const -> double { return rate_limit_request_burst; }
+
+auto server_config::get_rate_limit_bytes_per_s() const -> double { return rate_limit_bytes_per_s; }
+
+auto server_config::get_rate_limit_byte_burst() const -> double { return rate_limit_byte_burst; }
+
+auto server_config::get_rate_limit_max_clients() const -> size_t { return rate_limit_max_clients; }
+
+auto server_config::get_rate_limit_key_header() const -> const std::string& { return rate_limit_key_header; }
+
+auto server_config::get_rate_limit_api_keys() const -> const std::vector<std::string>& { return rate_limit_api_keys; }
+
+auto server_config::get_admission_max_active() const -> size_t { return admission_max_active; }
+
+auto server_config::get_admission_queue_depth() const -> size_t { return admission_queue_depth; }
+
+auto server_config::get_admission_retry_after_s() const -> unsigned { return admission_retry_after_s; }
+
+auto server_config::get_bandwidth_bulk_min_bytes() const -> size_t { return bandwidth_bulk_min_bytes; }
+
+auto server_config::get_bandwidth_global_bytes_per_s() const -> size_t { return bandwidth_global_bytes_per_s; }
+
+auto server_config::get_bandwidth_connection_bytes_per_s() const -> size_t {
+    return bandwidth_connection_bytes_per_s;
+}
+
+auto server_config::get_bandwidth_tick_ms() const -> unsigned { return bandwidth_tick_ms; }
+
+auto server_config::get_snapshot_path() const -> const std::string& { return snapshot_path; }
+auto server_config::get_snapshot_interval_s() const -> unsigned { return snapshot_interval_s; }
+auto server_config::get_snapshot_retention() const -> size_t { return snapshot_retention; }
+auto server_config::get_version_retention() const -> size_t { return version_retention; }
+
+auto server_config::get_list_max_keys() const -> size_t { return list_max_keys; }
+
+auto server_config::get_search_refresh_s() const -> unsigned { return search_refresh_s; }
+auto server_config::get_search_max_results() const -> size_t { return search_max_results; }
+auto server_config::get_access_time_resolution_s() const -> unsigned { return access_time_resolution_s; }
+
+auto server_config::get_s3_bucket() const -> const std::string& { return s3_bucket; }
+auto server_config::get_multipart_path() const -> const std::string& { return multipart_path; }
+auto server_config::get_multipart_expiry_s() const -> unsigned { return multipart_expiry_s; }
+
 }  // namespace ricox
@@ -1,11 +1,22 @@
 #include "server_utils.hpp"
 #include "bundle.hpp"
+#include "checksum.hpp"
+#include "dictionary_store.hpp"
+#include "io_backend.hpp"
 #include "logger.hpp"
+#include "metrics.hpp"
+#include "server_config.hpp"
+#include "upload_pipeline.hpp"
 
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <cstdio>
 #include <ctime>
-#include <fstream>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -60,73 +71,303 @@ auto file_util::read_content(std::string& content, size_t pos, size_t len) const
 		return false;
 	}
 
-	auto ifs = std::ifstream{};
-	ifs.open(file_name.c_str(), std::ios::binary);	// open in binary mode
-	if (!ifs.is_open()) {
+	auto fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
 		common::ERROR("server_logger", "Unable to open file {}", get_file_name().c_str());
 		return false;
 	}
 
-	ifs.seekg(pos, std::ios::beg);	// offset read position from beginning
 	content.resize(len);
-	ifs.read(content.data(), len);
-	if (!ifs.good()) {	// check for error flags if any
+	if (!io_backend::get_instance().read(fd, content.data(), len, pos)) {
 		common::ERROR("server_logger", "Read file content error {}", get_file_name().c_str());
-		ifs.close();
+		close(fd);
 		return false;
 	}
 
-	ifs.close();
+	close(fd);
 	return true;
 }
 
 auto file_util::read_file(std::string& content) const -> bool { return read_content(content, 0, get_file_size()); }
 
 auto file_util::write_content(const std::string& content, size_t len) const -> bool {
-	auto ofs = std::ofstream{};
-	ofs.open(file_name, std::ios::binary);	// open in binary mode
-
-	if (!ofs.is_open()) {
+	auto fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
 		common::ERROR("server_logger", "Unable to open file {}", get_file_name().c_str());
 		return false;
 	}
 
-	ofs.write(content.c_str(), len);
-
-	if (!ofs.good()) {	// check for error flags if any
+	if (!io_backend::get_instance().write(fd, content.c_str(), len, 0)) {
 		common::ERROR("server_logger", "Write file content error {}", get_file_name().c_str());
-		ofs.close();
+		close(fd);
 		return false;
 	}
 
-	ofs.close();
+	close(fd);
 	return true;
 }
 
 auto file_util::write_file(const std::string& content) const -> bool { return write_content(content, content.size()); }
 
+auto file_util::write_atomic(const std::string& content) const -> bool {
+	auto temp_name = file_name + ".tmp";
+	auto fd = open(temp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		common::ERROR("server_logger", "Unable to open file {}", temp_name.c_str());
+		return false;
+	}
+
+	auto ok = io_backend::get_instance().write(fd, content.data(), content.size(), 0) && fsync(fd) == 0;
+	close(fd);
+
+	if (!ok || std::rename(temp_name.c_str(), file_name.c_str()) != 0) {
+		common::ERROR("server_logger", "Atomic write of {} failed", get_file_name().c_str());
+		std::remove(temp_name.c_str());
+		return false;
+	}
+
+	// The rename lives in the directory, which is synced too or a crash may still bring back the old file
+	auto slash = file_name.find_last_of('/');
+	auto dir = slash == std::string::npos ? std::string{"."} : file_name.substr(0, slash ? slash : 1);
+	auto dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd < 0 || fsync(dir_fd) != 0) {
+		common::ERROR("server_logger", "Unable to sync directory {} after replacing {}", dir, get_file_name().c_str());
+		if (dir_fd >= 0) close(dir_fd);
+		return false;
+	}
+
+	close(dir_fd);
+	return true;
+}
+
 auto file_util::compress(const std::string& content, int format) const -> bool {
-	auto compressed_data = bundle::pack(format, content);
+	return compress(content.data(), content.size(), format);
+}
 
-	if (compressed_data.size() == 0) {
+auto file_util::compress(const char* data, size_t len, int format) const -> bool {
+	if (len == 0) {
 		common::ERROR("server_logger", "Invalid archive size: {}", get_file_name().c_str());
 		return false;
 	}
 
-	auto compressed_file = file_util(file_name);  // temp object, overrides the file with compressed data
-	return compressed_file.write_content(compressed_data.c_str(), compressed_data.size());
+	// Reserve the worst case on disk and let the codec write straight into the mapping
+	auto zlen = bundle::bound(format, len);
+	auto output = mapped_file{};
+	if (!output.map_write(file_name, bundle::MAX_HEADER_SIZE + zlen)) {
+		common::ERROR("server_logger", "Cannot map output for compression: {}", get_file_name().c_str());
+		return false;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	auto packed = bundle::pack(format, data, len, output.get_data() + bundle::MAX_HEADER_SIZE, zlen);
+	metrics::record_codec(codec_histogram::compress_time, format, metrics::elapsed_ns(start), len,
+						  packed ? bundle::MAX_HEADER_SIZE + zlen : len);
+
+	if (!packed) {
+		// Same fallback as bundle::pack on containers: keep the bytes unpacked
+		memcpy(output.get_data(), data, len);
+		return output.finish(len);
+	}
+
+	// Encapsulate the same way bundle::pack does: header right-aligned in a zeroed MAX_HEADER_SIZE prefix
+	auto header = std::string{} + char(0x70) + char(format) + bundle::vlebit(len) + bundle::vlebit(zlen);
+	memset(output.get_data(), 0, bundle::MAX_HEADER_SIZE);
+	memcpy(output.get_data() + bundle::MAX_HEADER_SIZE - header.size(), header.data(), header.size());
+	return output.finish(bundle::MAX_HEADER_SIZE + zlen);
+}
+
+// Frames written with a trained dictionary record their size, so they unpack straight into the output too
+static auto unpack_dictionary(uint32_t dictionary_id, const char* in, size_t in_len, char* out, size_t out_len) -> bool {
+	auto dictionary = dictionary_store::get_instance().find(dictionary_id);
+	if (!dictionary) {
+		common::ERROR("server_logger", "Unknown compression dictionary {}", dictionary_id);
+		return false;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	auto unpacked = dictionary->decompress(in, in_len, out, out_len);
+	metrics::record_codec(codec_histogram::decompress_time, metrics::DICTIONARY_CODEC, metrics::elapsed_ns(start),
+						  in_len, out_len);
+	return unpacked;
+}
+
+auto file_util::decompress(const std::string& download_path, uint32_t dictionary_id, bool chunked,
+						   uint32_t* checksum) const -> bool {
+	auto input = mapped_file{};
+	if (!input.map_read(file_name, server_config::get_instance().get_mmap_populate())) {
+		common::ERROR("server_logger", "Cannot decompress data of file: {}", get_file_name().c_str());
+		return false;
+	}
+
+	auto output = mapped_file{};
+	auto in = input.get_data();
+	auto in_len = input.get_size();
+
+	if (dictionary_id) {
+		auto out_len = size_t{0};
+		if (!zstd_dictionary::content_size(in, in_len, out_len) || !output.map_write(download_path, out_len)) {
+			common::ERROR("server_logger", "Cannot map output for decompression: {}", download_path);
+			return false;
+		}
+
+		if (!unpack_dictionary(dictionary_id, in, in_len, output.get_data(), out_len)) {
+			common::ERROR("server_logger", "Corrupted archive: {}", get_file_name().c_str());
+			output.finish(0);
+			return false;
+		}
+		if (checksum) *checksum = crc32c::update(0, output.get_data(), out_len);
+		return output.finish(out_len);
+	}
+
+	if (chunked) {	// large upload compressed block by block
+		if (!upload_pipeline::is_chunked(in, in_len)) {
+			common::ERROR("server_logger", "Corrupted archive: {}", get_file_name().c_str());
+			return false;
+		}
+
+		auto out_len = upload_pipeline::raw_length(in);
+		if (!output.map_write(download_path, out_len)) {
+			common::ERROR("server_logger", "Cannot map output for decompression: {}", download_path);
+			return false;
+		}
+
+		if (!upload_pipeline::unpack(in, in_len, output.get_data(), out_len, checksum)) {
+			common::ERROR("server_logger", "Corrupted archive: {}", get_file_name().c_str());
+			output.finish(0);
+			return false;
+		}
+		return output.finish(out_len);
+	}
+
+	if (in_len == 0 || !bundle::is_packed(in, in_len)) {  // stored unpacked, plain copy
+		if (!output.map_write(download_path, in_len)) return false;
+		if (in_len) memcpy(output.get_data(), in, in_len);
+		if (checksum) *checksum = crc32c::update(0, in, in_len);
+		return output.finish(in_len);
+	}
+
+	auto format = bundle::type_of(in, in_len);
+	auto out_len = bundle::len(in, in_len) + bundle::unc_payload(format);
+	if (!output.map_write(download_path, out_len)) {
+		common::ERROR("server_logger", "Cannot map output for decompression: {}", download_path);
+		return false;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	auto unpacked = bundle::unpack(format, bundle::zptr(in, in_len), bundle::zlen(in, in_len), output.get_data(), out_len);
+	metrics::record_codec(codec_histogram::decompress_time, format, metrics::elapsed_ns(start), in_len, out_len);
+
+	if (!unpacked) {
+		common::ERROR("server_logger", "Corrupted archive: {}", get_file_name().c_str());
+		output.finish(0);
+		return false;
+	}
+
+	if (checksum) *checksum = crc32c::update(0, output.get_data(), out_len);
+	return output.finish(out_len);
 }
 
-auto file_util::decompress(const std::string& download_path) const -> bool {
-	auto compressed_data = std::string{};
-	if (!read_file(compressed_data)) {
+auto file_util::decompress_content(std::string& content, uint32_t dictionary_id, bool chunked) const -> bool {
+	auto input = mapped_file{};
+	if (!input.map_read(file_name, server_config::get_instance().get_mmap_populate())) {
 		common::ERROR("server_logger", "Cannot decompress data of file: {}", get_file_name().c_str());
 		return false;
 	}
 
-	auto decompressed_data = bundle::unpack(compressed_data);
-	auto decompressed_file = file_util(download_path);
-	return decompressed_file.write_content(decompressed_data.c_str(), decompressed_data.size());
+	if (!unpack(input.get_data(), input.get_size(), content, dictionary_id, chunked)) {
+		common::ERROR("server_logger", "Corrupted archive: {}", get_file_name().c_str());
+		return false;
+	}
+
+	return true;
+}
+
+auto file_util::unpack(const char* data, size_t len, std::string& content, uint32_t dictionary_id, bool chunked)
+	-> bool {
+	if (dictionary_id) {
+		auto out_len = size_t{0};
+		if (!zstd_dictionary::content_size(data, len, out_len)) return false;
+
+		content.resize(out_len);
+		return unpack_dictionary(dictionary_id, data, len, content.data(), out_len);
+	}
+
+	if (chunked) {
+		if (!upload_pipeline::is_chunked(data, len)) return false;
+		content.resize(upload_pipeline::raw_length(data));
+		return upload_pipeline::unpack(data, len, content.data(), content.size());
+	}
+
+	if (len == 0 || !bundle::is_packed(data, len)) {  // stored unpacked, plain copy
+		content.assign(data, len);
+		return true;
+	}
+
+	auto format = bundle::type_of(data, len);
+	auto out_len = bundle::len(data, len) + bundle::unc_payload(format);
+	content.resize(out_len);
+
+	auto start = std::chrono::steady_clock::now();
+	auto unpacked = bundle::unpack(format, bundle::zptr(data, len), bundle::zlen(data, len), content.data(), out_len);
+	metrics::record_codec(codec_histogram::decompress_time, format, metrics::elapsed_ns(start), len, out_len);
+
+	if (!unpacked) return false;
+	content.resize(out_len);
+	return true;
+}
+
+auto file_util::checksum_content(uint32_t dictionary_id, bool chunked, const std::function<bool(size_t)>& paced,
+								 uint32_t& checksum) const -> bool {
+	static constexpr size_t SLICE = 1 << 20;
+
+	auto input = mapped_file{};
+	if (!input.map_read(file_name, false)) return false;  // faulted in as the stream advances
+
+	auto in = input.get_data();
+	auto in_len = input.get_size();
+	checksum = 0;
+	if (chunked) {
+		return upload_pipeline::unpack_blocks(in, in_len,
+											  [&](const char* raw, size_t raw_len, size_t packed_len) -> bool {
+												  checksum = crc32c::update(checksum, raw, raw_len);
+												  return paced(packed_len);
+											  });
+	}
+
+	if (!dictionary_id && (in_len == 0 || !bundle::is_packed(in, in_len))) {  // stored unpacked
+		for (auto offset = size_t{0}; offset < in_len; offset += SLICE) {
+			auto len = std::min(in_len - offset, SLICE);
+			checksum = crc32c::update(checksum, in + offset, len);
+			if (!paced(len)) return false;
+		}
+		return true;
+	}
+
+	// Written whole by a single cold upload below pipeline_min_bytes, so it is small enough to unpack in memory
+	auto content = std::string{};
+	if (!unpack(in, in_len, content, dictionary_id)) return false;
+	checksum = crc32c::update(0, content.data(), content.size());
+	return paced(in_len);
+}
+
+auto file_util::content_size(uint32_t dictionary_id, bool chunked, uint64_t& size) const -> bool {
+	auto input = mapped_file{};
+	if (!input.map_read(file_name, false)) return false;  // only the headers are faulted in
+
+	auto in = input.get_data();
+	auto in_len = input.get_size();
+	if (dictionary_id) {
+		auto out_len = size_t{0};
+		if (!zstd_dictionary::content_size(in, in_len, out_len)) return false;
+		size = out_len;
+	} else if (chunked) {
+		if (!upload_pipeline::is_chunked(in, in_len)) return false;
+		size = upload_pipeline::raw_length(in);
+	} else {
+		size = in_len && bundle::is_packed(in, in_len) ? bundle::len(in, in_len) : in_len;
+	}
+
+	return true;
 }
 
 auto file_util::exists() const -> bool { return fs::exists(file_name); }
@@ -151,9 +392,93 @@ auto file_util::scan_directory(std::vector<std::string>& files) const -> bool {
 	return true;
 }
 
-auto json_util::serialize(const Json::Value& json_val, std::string& str) -> bool {
+mapped_file::~mapped_file() {
+	unmap();
+	if (fd >= 0) close(fd);
+}
+
+auto mapped_file::unmap() -> void {
+	if (data) munmap(data, size);
+	data = nullptr;
+}
+
+auto mapped_file::map_read(const std::string& path, bool populate) -> bool {
+	fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		common::ERROR("server_logger", "Unable to open file {}: {}", path, strerror(errno));
+		return false;
+	}
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0) {
+		common::ERROR("server_logger", "Unable to stat file {}: {}", path, strerror(errno));
+		return false;
+	}
+
+	size = file_stat.st_size;
+	if (size == 0) return true;	 // nothing to map
+
+	auto ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+	if (ptr == MAP_FAILED) {
+		common::ERROR("server_logger", "Unable to map file {}: {}", path, strerror(errno));
+		return false;
+	}
+
+	data = static_cast<char*>(ptr);
+	madvise(data, size, MADV_SEQUENTIAL);
+	return true;
+}
+
+auto mapped_file::map_write(const std::string& path, size_t capacity) -> bool {
+	fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		common::ERROR("server_logger", "Unable to open file {}: {}", path, strerror(errno));
+		return false;
+	}
+
+	writable = true;
+	size = capacity;
+	if (size == 0) return true;
+
+	// Preallocate so page faults on the mapping never hit ENOSPC as SIGBUS
+	auto ret = posix_fallocate(fd, 0, size);
+	if (ret != 0) {
+		common::ERROR("server_logger", "Unable to preallocate {} bytes for {}: {}", size, path, strerror(ret));
+		return false;
+	}
+
+	auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED) {
+		common::ERROR("server_logger", "Unable to map file {}: {}", path, strerror(errno));
+		return false;
+	}
+
+	data = static_cast<char*>(ptr);
+	madvise(data, size, MADV_SEQUENTIAL);
+	return true;
+}
+
+auto mapped_file::finish(size_t final_size) -> bool {
+	unmap();
+	if (!writable) return true;
+
+	if (ftruncate(fd, final_size) != 0) {
+		common::ERROR("server_logger", "Unable to trim mapped file: {}", strerror(errno));
+		return false;
+	}
+
+	size = final_size;
+	return true;
+}
+
+auto mapped_file::get_data() const -> char* { return data; }
+
+auto mapped_file::get_size() const -> size_t { return size; }
+
+auto json_util::serialize(const Json::Value& json_val, std::string& str, bool compact) -> bool {
 	auto swb = Json::StreamWriterBuilder{};
 	swb["emitUTF8"] = true;	 // Ensure UTF-8 encoding
+	if (compact) swb["indentation"] = "";  // single line, e.g. for journal records
 
 	auto writer = std::unique_ptr<Json::StreamWriter>(swb.newStreamWriter());
 	auto ss = std::stringstream{};
@@ -0,0 +1,297 @@
+#include "simd_codec.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace ricox {
+static constexpr size_t SLACK = 32;	 // vector stores may write this far past the decoded bytes
+static constexpr uint8_t INVALID = 0xff;
+
+static auto hex_value(char c) -> int {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// Decodes the escape or '+' at in[i] into out[o], returns the input bytes consumed
+static auto decode_special(std::string_view in, size_t i, char* out, size_t& o) -> size_t {
+	if (in[i] == '%' && i + 2 < in.size()) {
+		auto high = hex_value(in[i + 1]);
+		auto low = hex_value(in[i + 2]);
+		if (high >= 0 && low >= 0) {
+			out[o++] = static_cast<char>((high << 4) | low);
+			return 3;
+		}
+	}
+
+	out[o++] = in[i] == '+' ? ' ' : in[i];
+	return 1;
+}
+
+static auto url_decode_tail(std::string_view in, size_t i, char* out, size_t o) -> size_t {
+	while (i < in.size()) {
+		if (in[i] == '%' || in[i] == '+') {
+			i += decode_special(in, i, out, o);
+		} else {
+			out[o++] = in[i++];
+		}
+	}
+	return o;
+}
+
+static constexpr auto make_base64_table() -> std::array<uint8_t, 256> {
+	auto table = std::array<uint8_t, 256>{};
+	for (auto& v : table) v = INVALID;
+
+	constexpr auto alphabet = std::string_view{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+	for (auto i = size_t{0}; i < alphabet.size(); ++i) table[static_cast<uint8_t>(alphabet[i])] = static_cast<uint8_t>(i);
+	table['-'] = 62;  // URL-safe alphabet
+	table['_'] = 63;
+	return table;
+}
+
+static constexpr auto BASE64 = make_base64_table();
+
+// Decodes complete quads from in[i], then the padded or unpadded final one, appending at out[o]
+static auto base64_decode_tail(std::string_view in, size_t i, char* out, size_t& o) -> bool {
+	auto n = in.size();
+	while (n > i && in[n - 1] == '=') --n;	// padding is optional
+	if (in.size() - n > 2) return false;
+
+	for (; i + 4 <= n; i += 4) {
+		auto a = BASE64[static_cast<uint8_t>(in[i])];
+		auto b = BASE64[static_cast<uint8_t>(in[i + 1])];
+		auto c = BASE64[static_cast<uint8_t>(in[i + 2])];
+		auto d = BASE64[static_cast<uint8_t>(in[i + 3])];
+		if (a == INVALID || b == INVALID || c == INVALID || d == INVALID) return false;
+
+		auto triple = (uint32_t{a} << 18) | (uint32_t{b} << 12) | (uint32_t{c} << 6) | d;
+		out[o++] = static_cast<char>(triple >> 16);
+		out[o++] = static_cast<char>(triple >> 8);
+		out[o++] = static_cast<char>(triple);
+	}
+
+	auto rest = n - i;
+	if (rest == 1) return false;
+	if (rest == 0) return true;
+
+	auto a = BASE64[static_cast<uint8_t>(in[i])];
+	auto b = BASE64[static_cast<uint8_t>(in[i + 1])];
+	auto c = rest == 3 ? BASE64[static_cast<uint8_t>(in[i + 2])] : uint8_t{0};
+	if (a == INVALID || b == INVALID || c == INVALID) return false;
+
+	auto triple = (uint32_t{a} << 18) | (uint32_t{b} << 12) | (uint32_t{c} << 6);
+	out[o++] = static_cast<char>(triple >> 16);
+	if (rest == 3) out[o++] = static_cast<char>(triple >> 8);
+	return true;
+}
+
+#if defined(__x86_64__)
+// One pass per vector: copy plain bytes, turn '+' into ' ', stop at the first '%' and let the scalar code take it
+__attribute__((target("sse4.1"))) static auto url_decode_sse(std::string_view in, char* out) -> size_t {
+	auto i = size_t{0};
+	auto o = size_t{0};
+	auto percent = _mm_set1_epi8('%');
+	auto plus = _mm_set1_epi8('+');
+	auto space = _mm_set1_epi8(' ');
+
+	while (i + 16 <= in.size()) {
+		auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in.data() + i));
+		v = _mm_blendv_epi8(v, space, _mm_cmpeq_epi8(v, plus));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + o), v);
+
+		auto escapes = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, percent)));
+		if (!escapes) {
+			i += 16;
+			o += 16;
+			continue;
+		}
+
+		auto k = static_cast<size_t>(__builtin_ctz(escapes));
+		i += k;
+		o += k;
+		i += decode_special(in, i, out, o);
+	}
+
+	return url_decode_tail(in, i, out, o);
+}
+
+__attribute__((target("avx2"))) static auto url_decode_avx2(std::string_view in, char* out) -> size_t {
+	auto i = size_t{0};
+	auto o = size_t{0};
+	auto percent = _mm256_set1_epi8('%');
+	auto plus = _mm256_set1_epi8('+');
+	auto space = _mm256_set1_epi8(' ');
+
+	while (i + 32 <= in.size()) {
+		auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in.data() + i));
+		v = _mm256_blendv_epi8(v, space, _mm256_cmpeq_epi8(v, plus));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + o), v);
+
+		auto escapes = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, percent)));
+		if (!escapes) {
+			i += 32;
+			o += 32;
+			continue;
+		}
+
+		auto k = static_cast<size_t>(__builtin_ctz(escapes));
+		i += k;
+		o += k;
+		i += decode_special(in, i, out, o);
+	}
+
+	return url_decode_tail(in, i, out, o);
+}
+
+// Base64 after Muła and Lemire: map ASCII to 6-bit values by the high nibble, validate with a bitmask lookup on
+// the low nibble, then merge four 6-bit values into three bytes with two multiply-adds and a shuffle
+__attribute__((target("sse4.1,ssse3"))) static auto base64_decode_sse(std::string_view in, char* out, size_t& o)
+	-> bool {
+	auto shift_lut = _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	auto mask_lut = _mm_setr_epi8(static_cast<char>(0xa8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+								  static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+								  static_cast<char>(0xf8), static_cast<char>(0xf8), static_cast<char>(0xf8),
+								  static_cast<char>(0xf8), static_cast<char>(0xf0), 0x54, 0x50, 0x50, 0x50, 0x54);
+	auto bit_lut = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80), 0, 0, 0, 0, 0, 0,
+								 0, 0);
+	auto pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+	auto i = size_t{0};
+	while (i + 16 < in.size()) {  // the last quad may be padded, the scalar code handles it
+		auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in.data() + i));
+		auto high = _mm_and_si128(_mm_srli_epi32(v, 4), _mm_set1_epi8(0x0f));
+		auto low = _mm_and_si128(v, _mm_set1_epi8(0x0f));
+
+		auto invalid = _mm_cmpeq_epi8(
+			_mm_and_si128(_mm_shuffle_epi8(mask_lut, low), _mm_shuffle_epi8(bit_lut, high)), _mm_setzero_si128());
+		if (_mm_movemask_epi8(invalid)) break;	// '=', URL-safe characters or garbage: scalar from here
+
+		auto shift = _mm_blendv_epi8(_mm_shuffle_epi8(shift_lut, high), _mm_set1_epi8(16),
+									 _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+		v = _mm_add_epi8(v, shift);
+
+		auto merged = _mm_madd_epi16(_mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + o), _mm_shuffle_epi8(merged, pack));
+		i += 16;
+		o += 12;
+	}
+
+	return base64_decode_tail(in, i, out, o);
+}
+
+__attribute__((target("avx2"))) static auto base64_decode_avx2(std::string_view in, char* out, size_t& o) -> bool {
+	auto shift_lut = _mm256_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 19, 4, -65, -65,
+									  -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	auto f8 = static_cast<char>(0xf8);
+	auto mask_lut = _mm256_setr_epi8(static_cast<char>(0xa8), f8, f8, f8, f8, f8, f8, f8, f8, f8,
+									 static_cast<char>(0xf0), 0x54, 0x50, 0x50, 0x50, 0x54, static_cast<char>(0xa8), f8,
+									 f8, f8, f8, f8, f8, f8, f8, f8, static_cast<char>(0xf0), 0x54, 0x50, 0x50, 0x50, 0x54);
+	auto bit_lut = _mm256_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80), 0, 0, 0, 0, 0,
+									0, 0, 0, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80), 0, 0,
+									0, 0, 0, 0, 0, 0);
+	auto pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8,
+								 14, 13, 12, -1, -1, -1, -1);
+	auto compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);	// the 12 bytes of each lane next to each other
+
+	auto i = size_t{0};
+	while (i + 32 < in.size()) {
+		auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in.data() + i));
+		auto high = _mm256_and_si256(_mm256_srli_epi32(v, 4), _mm256_set1_epi8(0x0f));
+		auto low = _mm256_and_si256(v, _mm256_set1_epi8(0x0f));
+
+		auto invalid = _mm256_cmpeq_epi8(
+			_mm256_and_si256(_mm256_shuffle_epi8(mask_lut, low), _mm256_shuffle_epi8(bit_lut, high)),
+			_mm256_setzero_si256());
+		if (_mm256_movemask_epi8(invalid)) break;
+
+		auto shift = _mm256_blendv_epi8(_mm256_shuffle_epi8(shift_lut, high), _mm256_set1_epi8(16),
+										_mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+		v = _mm256_add_epi8(v, shift);
+
+		auto merged = _mm256_madd_epi16(_mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140)),
+										_mm256_set1_epi32(0x00011000));
+		auto packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(merged, pack), compact);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + o), packed);
+		i += 32;
+		o += 24;
+	}
+
+	return base64_decode_tail(in, i, out, o);
+}
+
+enum class isa_level : uint8_t { scalar, sse41, avx2 };
+
+static auto detect_isa() -> isa_level {
+	static const auto level = []() -> isa_level {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) return isa_level::avx2;
+		if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3")) return isa_level::sse41;
+		return isa_level::scalar;
+	}();
+	return level;
+}
+#endif
+
+auto simd_codec::url_decode_scalar(std::string_view in, std::string& out) -> void {
+	out.resize(in.size());
+	out.resize(url_decode_tail(in, 0, out.data(), 0));
+}
+
+auto simd_codec::base64_decode_scalar(std::string_view in, std::string& out) -> bool {
+	out.resize(in.size() / 4 * 3 + 3);
+	auto o = size_t{0};
+	auto ok = base64_decode_tail(in, 0, out.data(), o);
+	out.resize(ok ? o : 0);
+	return ok;
+}
+
+auto simd_codec::url_decode(std::string_view in, std::string& out) -> void {
+#if defined(__x86_64__)
+	auto level = detect_isa();
+	if (level != isa_level::scalar) {
+		out.resize(in.size() + SLACK);
+		auto o = level == isa_level::avx2 ? url_decode_avx2(in, out.data()) : url_decode_sse(in, out.data());
+		out.resize(o);
+		return;
+	}
+#endif
+	url_decode_scalar(in, out);
+}
+
+auto simd_codec::base64_decode(std::string_view in, std::string& out) -> bool {
+#if defined(__x86_64__)
+	auto level = detect_isa();
+	if (level != isa_level::scalar) {
+		out.resize(in.size() / 4 * 3 + SLACK);
+		auto o = size_t{0};
+		auto ok = level == isa_level::avx2 ? base64_decode_avx2(in, out.data(), o)
+										   : base64_decode_sse(in, out.data(), o);
+		out.resize(ok ? o : 0);
+		return ok;
+	}
+#endif
+	return base64_decode_scalar(in, out);
+}
+
+auto simd_codec::isa() -> const char* {
+#if defined(__x86_64__)
+	switch (detect_isa()) {
+		case isa_level::avx2:
+			return "avx2";
+		case isa_level::sse41:
+			return "sse4.1";
+		default:
+			break;
+	}
+#endif
+	return "scalar";
+}
+
+}  // namespace ricox
@@ -0,0 +1,92 @@
+#include "small_file_cache.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "server_config.hpp"
+
+#include <algorithm>
+
+namespace ricox {
+small_file_cache::small_file_cache()
+	: capacity_bytes{server_config::get_instance().get_small_file_cache_bytes()},
+	  max_file_size{server_config::get_instance().get_small_file_max_size()},
+	  used_bytes{0} {}
+
+auto small_file_cache::get_instance() -> small_file_cache& {
+	static auto instance = small_file_cache{};
+	return instance;
+}
+
+auto small_file_cache::is_cacheable(size_t size) const -> bool {
+	return size > 0 && size <= max_file_size && size <= capacity_bytes;
+}
+
+auto small_file_cache::find(const std::string& etag) -> content_ptr {
+	auto lock = std::lock_guard{mutex};
+	auto it = cache.find(etag);
+	if (it == cache.end()) {
+		metrics::add(counter::small_cache_misses);
+		return nullptr;
+	}
+
+	metrics::add(counter::small_cache_hits);
+	lru.splice(lru.begin(), lru, it->second.lru_pos);  // mark as most recently used
+	return it->second.content;
+}
+
+auto small_file_cache::insert(const std::string& etag, content_ptr content) -> void {
+	if (!content || !is_cacheable(content->size())) return;
+
+	auto lock = std::lock_guard{mutex};
+	if (cache.contains(etag)) return;  // same ETag means same bytes
+
+	lru.push_front(etag);
+	used_bytes += content->size();
+	cache.try_emplace(etag, entry{std::move(content), lru.begin()});
+	evict();
+}
+
+auto small_file_cache::evict() -> void {
+	// Buffers still referencing evicted content keep it alive until it has been sent
+	while (used_bytes > capacity_bytes && !lru.empty()) {
+		auto it = cache.find(lru.back());
+		used_bytes -= it->second.content->size();
+		cache.erase(it);
+		lru.pop_back();
+	}
+}
+
+auto small_file_cache::erase(const std::string& etag) -> void {
+	auto lock = std::lock_guard{mutex};
+	auto it = cache.find(etag);
+	if (it == cache.end()) return;
+
+	used_bytes -= it->second.content->size();
+	lru.erase(it->second.lru_pos);
+	cache.erase(it);
+}
+
+auto small_file_cache::size_bytes() const -> size_t {
+	auto lock = std::lock_guard{mutex};
+	return used_bytes;
+}
+
+auto small_file_cache::add_to_buffer(evbuffer* buffer, const content_ptr& content, uint64_t offset, uint64_t length)
+	-> bool {
+	if (offset >= content->size()) return true;
+	length = std::min<uint64_t>(length, content->size() - offset);
+
+	auto ref = new content_ptr{content};  // released by libevent once the chunk has been drained
+	auto ret = evbuffer_add_reference(
+		buffer, content->data() + offset, length,
+		[](const void*, size_t, void* arg) -> void { delete static_cast<content_ptr*>(arg); }, ref);
+
+	if (ret != 0) {
+		common::ERROR("server_logger", "Unable to add cached content to buffer");
+		delete ref;
+		return false;
+	}
+
+	return true;
+}
+
+}  // namespace ricox
@@ -0,0 +1,188 @@
+#include "snapshot_manager.hpp"
+#include "commit_queue.hpp"
+#include "logger.hpp"
+#include "reclaimer.hpp"
+#include "server_config.hpp"
+#include "server_utils.hpp"
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace ricox {
+static constexpr const char* SNAPSHOT_PREFIX = "snapshot-";
+static constexpr const char* SNAPSHOT_SUFFIX = ".json";
+
+snapshot_manager::snapshot_manager()
+	: directory{server_config::get_instance().get_snapshot_path()},
+	  interval{server_config::get_instance().get_snapshot_interval_s()},
+	  retention{std::max<size_t>(server_config::get_instance().get_snapshot_retention(), 1)},
+	  next_id{1},
+	  stopping{false} {}
+
+snapshot_manager::~snapshot_manager() {
+	{
+		auto lock = std::lock_guard{mutex};
+		stopping = true;
+	}
+
+	cv.notify_all();
+	if (worker.joinable()) worker.join();
+}
+
+auto snapshot_manager::get_instance() -> snapshot_manager& {
+	static auto instance = snapshot_manager{};
+	return instance;
+}
+
+auto snapshot_manager::snapshot_file(const snapshot& s) const -> std::string {
+	return directory + "/" + SNAPSHOT_PREFIX + std::to_string(s.id) + "-" + std::to_string(s.time_created) +
+		   SNAPSHOT_SUFFIX;
+}
+
+auto snapshot_manager::start() -> bool {
+	auto dir = file_util{directory};
+	if (!dir.create_directory()) {
+		common::ERROR("server_logger", "Failed to create snapshot directory: {}", directory);
+		return false;
+	}
+
+	// Files are named snapshot-<id>-<time created>.json
+	auto files = std::vector<std::string>{};
+	dir.scan_directory(files);
+	for (const auto& file : files) {
+		auto name = file.substr(file.find_last_of('/') + 1);
+		if (!name.starts_with(SNAPSHOT_PREFIX) || !name.ends_with(SNAPSHOT_SUFFIX)) continue;
+
+		auto fields = name.substr(strlen(SNAPSHOT_PREFIX));
+		fields.resize(fields.size() - strlen(SNAPSHOT_SUFFIX));
+		auto dash = fields.find('-');
+		if (dash == 0 || dash == std::string::npos || fields.find_first_not_of("0123456789-") != std::string::npos) {
+			continue;
+		}
+
+		auto loaded = std::make_shared<snapshot>();
+		loaded->id = std::stoull(fields.substr(0, dash));
+		loaded->time_created = static_cast<std::time_t>(std::stoll(fields.substr(dash + 1)));
+		if (!data_manager::read_index(file, loaded->index)) continue;
+
+		auto lock = std::lock_guard{mutex};
+		next_id = std::max(next_id, loaded->id + 1);
+		snapshots.emplace(loaded->id, std::move(loaded));
+	}
+
+	drop_expired();	 // the retention may have been lowered since
+	common::INFO("server_logger", "Loaded {} index snapshots", list().size());
+
+	if (interval.count() && !worker.joinable()) worker = std::thread{[this]() -> void { run(); }};
+	return true;
+}
+
+auto snapshot_manager::run() -> void {
+	while (true) {
+		{
+			auto lock = std::unique_lock{mutex};
+			cv.wait_for(lock, interval, [this]() -> bool { return stopping; });
+			if (stopping) return;
+		}
+
+		create();
+	}
+}
+
+auto snapshot_manager::create() -> snapshot_ptr {
+	auto taken = snapshot_ptr{};
+	{
+		// Under the publish lock, so a commit releasing files either sees this snapshot or is already in it
+		auto publish_lock = commit_queue::get_instance().lock_publish();
+		auto lock = std::lock_guard{mutex};
+		taken = std::make_shared<const snapshot>(
+			snapshot{next_id++, std::time(nullptr), data_manager::get_instance().snapshot()});
+		snapshots.emplace(taken->id, taken);
+	}
+
+	common::INFO("server_logger", "Took index snapshot {} of {} entries", taken->id, taken->index.size());
+	worker_pool::get_instance().submit([taken, path = snapshot_file(*taken)]() -> void {
+		if (!data_manager::write_index(taken->index, path)) {
+			common::ERROR("server_logger", "Failed to persist index snapshot {}", taken->id);
+		}
+	});
+
+	drop_expired();
+	return taken;
+}
+
+auto snapshot_manager::drop_expired() -> void {
+	auto publish_lock = commit_queue::get_instance().lock_publish();
+	auto lock = std::lock_guard{mutex};
+	while (snapshots.size() > retention) {
+		auto dropped = std::move(snapshots.begin()->second);
+		snapshots.erase(snapshots.begin());
+		std::remove(snapshot_file(*dropped).c_str());
+
+		// Files packed into segments are dropped by segment compaction once nothing refers to their block
+		auto retired = size_t{0};
+		dropped->index.for_each([&](const std::string&, const storage_info& info) -> void {
+			if (info.in_segment() || is_referenced(info)) return;
+			reclaimer::get_instance().retire(info.file_path);
+			++retired;
+		});
+
+		common::INFO("server_logger", "Dropped index snapshot {}, retiring {} files only it held", dropped->id,
+					 retired);
+	}
+}
+
+auto snapshot_manager::is_referenced(const storage_info& info) const -> bool {
+	// A file packed into a segment keeps the path it was packed from, only a standalone record holds the file
+	auto holds = [&](const storage_info& held) -> bool {
+		return !held.in_segment() && held.file_path == info.file_path;
+	};
+
+	// The same version in the index, current or kept in its URL's version chain
+	auto held = storage_info{};
+	if (data_manager::get_instance().find_version(info.file_url, info.version, held) && holds(held)) return true;
+
+	return std::any_of(snapshots.begin(), snapshots.end(), [&](const auto& entry) -> bool {
+		auto held = entry.second->index.find(info.file_url);
+		return held && holds(*held);
+	});
+}
+
+auto snapshot_manager::release(const std::vector<storage_info>& previous) -> void {
+	auto lock = std::lock_guard{mutex};
+	for (const auto& info : previous) {
+		if (info.in_segment() || is_referenced(info)) continue;
+		reclaimer::get_instance().retire(info.file_path);
+	}
+}
+
+auto snapshot_manager::find(uint64_t id) const -> snapshot_ptr {
+	auto lock = std::lock_guard{mutex};
+	auto it = snapshots.find(id);
+	return it == snapshots.end() ? nullptr : it->second;
+}
+
+auto snapshot_manager::find_version(std::string_view url, uint64_t version, storage_info& info) const -> bool {
+	auto lock = std::lock_guard{mutex};
+	for (auto it = snapshots.rbegin(); it != snapshots.rend(); ++it) {
+		auto held = it->second->index.find(url);
+		if (held && held->version == version) {
+			info = *held;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+auto snapshot_manager::list() const -> std::vector<snapshot_ptr> {
+	auto lock = std::lock_guard{mutex};
+	auto result = std::vector<snapshot_ptr>{};
+	result.reserve(snapshots.size());
+	for (const auto& [_, s] : snapshots) result.push_back(s);
+	return result;
+}
+
+}  // namespace ricox
@@ -0,0 +1,131 @@
+#include "trace.hpp"
+#include "logger.hpp"
+#include "loop_executor.hpp"
+#include "server_config.hpp"
+#include "server_utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+
+namespace ricox {
+static constexpr const char* TRACE_HEADER = "X-Trace";
+
+request_trace::request_trace(uint64_t trace_id, const char* handler, std::string_view path)
+	: trace_id{trace_id}, start_ns{now_ns()}, reply_ns{0}, handler{handler}, path{path} {
+	spans.reserve(8);
+}
+
+auto request_trace::now_ns() -> uint64_t {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::system_clock::now().time_since_epoch())
+		.count();
+}
+
+auto request_trace::begin(evhttp_request* req, const char* handler, std::string_view path)
+	-> request_trace* {
+	if (!server_config::get_instance().get_trace_allowed()) return nullptr;
+
+	auto header = evhttp_find_header(evhttp_request_get_input_headers(req), TRACE_HEADER);
+	if (!header || std::strcmp(header, "0") == 0) return nullptr;
+
+	static auto next_id = std::atomic<uint64_t>{1};
+	auto trace = new request_trace{next_id.fetch_add(1, std::memory_order_relaxed), handler, path};
+	evhttp_add_header(evhttp_request_get_output_headers(req), "X-Trace-Id", std::to_string(trace->trace_id).c_str());
+	return trace;
+}
+
+auto request_trace::add_span(const char* name, uint64_t start_ns, uint64_t end_ns) -> void {
+	spans.push_back({name, start_ns, end_ns - start_ns});
+}
+
+auto request_trace::mark_reply() -> void { reply_ns = now_ns(); }
+
+auto request_trace::get_trace_id() const -> uint64_t { return trace_id; }
+
+auto request_trace::get_start_ns() const -> uint64_t { return start_ns; }
+
+auto request_trace::finish() -> void {
+	auto owned = std::unique_ptr<request_trace>{this};
+	auto end_ns = now_ns();
+	if (reply_ns) add_span("send", reply_ns, end_ns);
+	add_span(handler.c_str(), start_ns, end_ns);  // whole request as the enclosing span
+	auto escaped_path = Json::Value{path};	// let jsoncpp do the string escaping
+	auto path_json = std::string{};
+	json_util::serialize(escaped_path, path_json, true);
+
+	// One complete ("X") event per span; tid groups the spans of a request on one track
+	auto ss = std::stringstream{};
+	for (const auto& s : spans) {
+		ss << "{\"name\":\"" << s.name << "\",\"cat\":\"" << handler << "\",\"ph\":\"X\",\"ts\":"
+		   << s.start_ns / 1000 << "." << (s.start_ns % 1000) / 100 << ",\"dur\":" << s.duration_ns / 1000 << "."
+		   << (s.duration_ns % 1000) / 100 << ",\"pid\":1,\"tid\":" << trace_id << ",\"args\":{\"path\":" << path_json
+		   << "}},\n";
+	}
+
+	trace_writer::get_instance().write(ss.str());
+}
+
+auto request_trace::abandon(evhttp_request* req) -> void {
+	// A reference chain's cleanup runs when its buffer is freed, which libevent does when it frees the request:
+	// right after the close for a reply already queued, or once a pending handler replies to the detached request.
+	// Finished from the loop afterwards, spans of the handler that sent that reply may still be closing.
+	static const char marker = 0;
+	auto cleanup = [](const void*, size_t, void* arg) -> void {
+		loop_executor::get_instance().post([trace = static_cast<request_trace*>(arg)]() -> void { trace->finish(); });
+	};
+	if (evbuffer_add_reference(evhttp_request_get_output_buffer(req), &marker, 1, cleanup, this) != 0) {
+		common::ERROR("server_logger", "Unable to hold trace {} until its request is freed", trace_id);
+	}
+}
+
+trace_writer::trace_writer()
+	: path{server_config::get_instance().get_trace_path()},
+	  max_bytes{server_config::get_instance().get_trace_max_bytes()},
+	  written{0} {
+	open_output();
+}
+
+auto trace_writer::open_output() -> void {
+	auto file = file_util{path};
+	written = file.exists() ? static_cast<size_t>(std::max<int64_t>(file.get_file_size(), 0)) : 0;
+	output.open(path, std::ios::app);
+	if (!output.is_open()) {
+		common::ERROR("server_logger", "Unable to open trace output {}", path);
+		return;
+	}
+
+	// Chrome's JSON Array Format tolerates the missing closing bracket, so events can simply be appended
+	if (written == 0) {
+		output << "[\n";
+		written = 2;
+	}
+}
+
+auto trace_writer::get_instance() -> trace_writer& {
+	static auto instance = trace_writer{};
+	return instance;
+}
+
+auto trace_writer::write(const std::string& events) -> void {
+	auto lock = std::lock_guard{mutex};
+	if (max_bytes && written + events.size() > max_bytes && written > 2) {
+		// Rotate: the previous output is kept as one older file, anything before it is dropped
+		output.close();
+		auto rotated = path + ".1";
+		if (std::rename(path.c_str(), rotated.c_str()) != 0) {
+			common::ERROR("server_logger", "Unable to rotate trace output {} to {}", path, rotated);
+		}
+		open_output();
+	}
+
+	if (!output.is_open()) return;
+	output << events;
+	output.flush();
+	written += events.size();
+}
+
+}  // namespace ricox
@@ -0,0 +1,274 @@
+#include "upload_pipeline.hpp"
+#include "bundle.hpp"
+#include "checksum.hpp"
+#include "io_backend.hpp"
+#include "logger.hpp"
+#include "loop_executor.hpp"
+#include "metrics.hpp"
+#include "server_config.hpp"
+#include "server_utils.hpp"
+#include "worker_pool.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace ricox {
+static constexpr size_t MIN_BLOCK_BYTES = 64 << 10;
+static constexpr size_t MAX_BLOCK_BYTES = 256 << 20;  // raw_length of a chunk is 32 bits
+
+upload_pipeline::upload_pipeline(std::string temp_path, std::shared_ptr<const void> owner, const char* data,
+								 uint64_t size, int format, callback done)
+	: temp_path{std::move(temp_path)},
+	  owner{std::move(owner)},
+	  data{data},
+	  size{size},
+	  format{format},
+	  block_bytes{std::clamp(server_config::get_instance().get_pipeline_block_bytes(), MIN_BLOCK_BYTES,
+							 MAX_BLOCK_BYTES)},
+	  window{server_config::get_instance().get_pipeline_window()},
+	  done{std::move(done)},
+	  fd{-1},
+	  offset{sizeof(chunked_header)},  // the header is written last, once every block is on disk
+	  checksum{0},
+	  next_compress{0},
+	  next_write{0},
+	  in_flight{0},
+	  writing{false},
+	  failed{false} {
+	if (window == 0) window = 2 * worker_pool::get_instance().size();
+	blocks.resize((size + block_bytes - 1) / block_bytes);
+}
+
+upload_pipeline::~upload_pipeline() {
+	if (fd >= 0) close(fd);
+}
+
+auto upload_pipeline::start(std::string temp_path, std::shared_ptr<const std::string> content, int format,
+							callback done) -> void {
+	auto data = content->data();
+	auto size = content->size();
+	run(std::make_shared<upload_pipeline>(std::move(temp_path), std::move(content), data, size, format,
+										  std::move(done)));
+}
+
+auto upload_pipeline::start(std::string temp_path, std::shared_ptr<const mapped_file> input, int format,
+							callback done) -> void {
+	auto data = input->get_data();
+	auto size = input->get_size();
+	run(std::make_shared<upload_pipeline>(std::move(temp_path), std::move(input), data, size, format,
+										  std::move(done)));
+}
+
+auto upload_pipeline::run(std::shared_ptr<upload_pipeline> pipeline) -> void {
+	pipeline->fd = open(pipeline->temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (pipeline->fd < 0) {
+		common::ERROR("server_logger", "Unable to open file {}: {}", pipeline->temp_path, strerror(errno));
+		pipeline->finish(false, std::move(pipeline->done));
+		return;
+	}
+
+	auto lock = std::unique_lock{pipeline->mutex};
+	pipeline->schedule(lock);
+}
+
+auto upload_pipeline::schedule(std::unique_lock<std::mutex>& lock) -> void {
+	// Backpressure: compression runs at most `window` blocks ahead of the writer
+	while (!failed && next_compress < blocks.size() && next_compress < next_write + window) {
+		auto index = next_compress++;
+		++in_flight;
+		worker_pool::get_instance().submit([pipeline = shared_from_this(), index]() -> void {
+			pipeline->compress_block(index);
+		});
+	}
+}
+
+auto upload_pipeline::compress_block(size_t index) -> void {
+	auto raw = data + index * block_bytes;
+	auto len = static_cast<size_t>(std::min<uint64_t>(block_bytes, size - index * block_bytes));
+
+	auto packed = std::string{};
+	auto zlen = bundle::bound(format, len);
+	packed.resize(zlen);
+
+	auto start = std::chrono::steady_clock::now();
+	auto ok = bundle::pack(format, raw, len, packed.data(), zlen) && zlen < len;
+	metrics::record_codec(codec_histogram::compress_time, format, metrics::elapsed_ns(start), len, ok ? zlen : len);
+
+	auto lock = std::unique_lock{mutex};
+	auto& b = blocks[index];
+	if (ok) {
+		packed.resize(zlen);
+		b.packed = std::move(packed);
+		b.format = static_cast<uint32_t>(format);
+	}  // else stored: the writer takes the bytes straight from the upload
+	b.ready = true;
+	--in_flight;
+	write_ready(lock);
+}
+
+auto upload_pipeline::write_ready(std::unique_lock<std::mutex>& lock) -> void {
+	if (!writing) {
+		writing = true;
+		while (!failed && next_write < blocks.size() && blocks[next_write].ready) {
+			auto index = next_write;
+			auto& b = blocks[index];
+			auto raw_len = static_cast<size_t>(std::min<uint64_t>(block_bytes, size - index * block_bytes));
+			auto header = chunk_header{b.format, static_cast<uint32_t>(b.format ? b.packed.size() : raw_len),
+									   static_cast<uint32_t>(raw_len)};
+			auto raw = data + index * block_bytes;
+			auto payload = b.format ? b.packed.data() : raw;
+
+			// Only the writer touches fd, offset and checksum, compression of other blocks goes on meanwhile
+			lock.unlock();
+			checksum = crc32c::update(checksum, raw, raw_len);
+			auto& backend = io_backend::get_instance();
+			auto ok = backend.write(fd, &header, sizeof(header), offset) &&
+					  backend.write(fd, payload, header.packed_length, offset + sizeof(header));
+			lock.lock();
+
+			if (!ok) {
+				common::ERROR("server_logger", "Failed to write block {} of {}", index, temp_path);
+				failed = true;
+				break;
+			}
+
+			offset += sizeof(header) + header.packed_length;
+			b.packed = std::string{};  // release the memory, the window slot is free again
+			++next_write;
+			schedule(lock);
+		}
+		writing = false;
+	}
+
+	// Done once every block is written, or after a failure once no compression task still refers to the file
+	if (!done || in_flight > 0 || writing || (!failed && next_write < blocks.size())) return;
+
+	auto cb = std::move(done);
+	done = nullptr;
+	auto ok = !failed;
+	lock.unlock();
+	finish(ok, std::move(cb));
+}
+
+auto upload_pipeline::finish(bool ok, callback cb) -> void {
+	if (ok) {
+		auto header = chunked_header{chunked_header::MAGIC, static_cast<uint32_t>(blocks.size()), size};
+		if (!io_backend::get_instance().write(fd, &header, sizeof(header), 0)) {
+			common::ERROR("server_logger", "Failed to write header of {}", temp_path);
+			ok = false;
+		}
+	}
+
+	if (fd >= 0) close(fd);
+	fd = -1;
+	if (!ok) std::remove(temp_path.c_str());
+
+	loop_executor::get_instance().post([cb = std::move(cb), ok, checksum = checksum]() -> void { cb(ok, checksum); });
+}
+
+auto upload_pipeline::is_chunked(const char* data, size_t len) -> bool {
+	auto header = chunked_header{};
+	if (len < sizeof(header)) return false;
+
+	std::memcpy(&header, data, sizeof(header));
+	if (header.magic != chunked_header::MAGIC) return false;
+
+	// The magic alone could be the first bytes of a file stored unpacked, the whole block chain has to match too
+	auto pos = sizeof(header);
+	auto raw = uint64_t{0};
+	for (auto i = uint32_t{0}; i < header.block_count; ++i) {
+		auto chunk = chunk_header{};
+		if (len - pos < sizeof(chunk)) return false;
+
+		std::memcpy(&chunk, data + pos, sizeof(chunk));
+		pos += sizeof(chunk);
+		if (len - pos < chunk.packed_length || (chunk.format == 0 && chunk.packed_length != chunk.raw_length)) {
+			return false;
+		}
+
+		pos += chunk.packed_length;
+		raw += chunk.raw_length;
+	}
+
+	return pos == len && raw == header.raw_length;
+}
+
+auto upload_pipeline::raw_length(const char* data) -> uint64_t {
+	auto header = chunked_header{};
+	std::memcpy(&header, data, sizeof(header));
+	return header.raw_length;
+}
+
+auto upload_pipeline::unpack(const char* data, size_t len, char* out, size_t out_len, uint32_t* checksum) -> bool {
+	if (!is_chunked(data, len) || raw_length(data) != out_len) return false;
+
+	auto header = chunked_header{};
+	std::memcpy(&header, data, sizeof(header));
+
+	auto pos = sizeof(header);
+	auto written = size_t{0};
+	if (checksum) *checksum = 0;
+	for (auto i = uint32_t{0}; i < header.block_count; ++i) {
+		auto chunk = chunk_header{};
+		std::memcpy(&chunk, data + pos, sizeof(chunk));
+		pos += sizeof(chunk);
+
+		if (chunk.format == 0) {
+			std::memcpy(out + written, data + pos, chunk.raw_length);
+		} else {
+			auto raw_len = size_t{chunk.raw_length};
+			auto start = std::chrono::steady_clock::now();
+			auto unpacked = bundle::unpack(chunk.format, data + pos, chunk.packed_length, out + written, raw_len);
+			metrics::record_codec(codec_histogram::decompress_time, chunk.format, metrics::elapsed_ns(start),
+								  chunk.packed_length, chunk.raw_length);
+			if (!unpacked) return false;
+		}
+
+		// Checksummed block by block while the output is still in cache
+		if (checksum) *checksum = crc32c::update(*checksum, out + written, chunk.raw_length);
+
+		pos += chunk.packed_length;
+		written += chunk.raw_length;
+	}
+
+	return true;
+}
+
+auto upload_pipeline::unpack_blocks(const char* data, size_t len, const block_sink& sink) -> bool {
+	if (!is_chunked(data, len)) return false;
+
+	auto header = chunked_header{};
+	std::memcpy(&header, data, sizeof(header));
+
+	auto pos = sizeof(header);
+	auto buffer = std::string{};
+	for (auto i = uint32_t{0}; i < header.block_count; ++i) {
+		auto chunk = chunk_header{};
+		std::memcpy(&chunk, data + pos, sizeof(chunk));
+		pos += sizeof(chunk);
+
+		auto raw = data + pos;	// stored blocks are handed over in place
+		if (chunk.format != 0) {
+			auto raw_len = size_t{chunk.raw_length};
+			if (buffer.size() < raw_len) buffer.resize(raw_len);
+
+			auto start = std::chrono::steady_clock::now();
+			auto unpacked = bundle::unpack(chunk.format, data + pos, chunk.packed_length, buffer.data(), raw_len);
+			metrics::record_codec(codec_histogram::decompress_time, chunk.format, metrics::elapsed_ns(start),
+								  chunk.packed_length, chunk.raw_length);
+			if (!unpacked) return false;
+			raw = buffer.data();
+		}
+
+		if (!sink(raw, chunk.raw_length, sizeof(chunk) + chunk.packed_length)) return false;
+		pos += chunk.packed_length;
+	}
+
+	return true;
+}
+
+}  // namespace ricox
@@ -0,0 +1,64 @@
+#include "worker_pool.hpp"
+#include "server_config.hpp"
+
+#include <algorithm>
+
+namespace ricox {
+worker_pool::worker_pool() : stopping{false} {
+	auto count = server_config::get_instance().get_worker_threads();
+	if (count == 0) count = std::max(1u, std::thread::hardware_concurrency());
+
+	workers.reserve(count);
+	for (auto i = size_t{0}; i < count; ++i) workers.emplace_back([this]() -> void { run(); });
+}
+
+worker_pool::~worker_pool() {
+	{
+		auto lock = std::lock_guard{mutex};
+		stopping = true;
+	}
+
+	cv.notify_all();
+	for (auto& worker : workers) {
+		if (worker.joinable()) worker.join();
+	}
+}
+
+auto worker_pool::get_instance() -> worker_pool& {
+	static auto instance = worker_pool{};
+	return instance;
+}
+
+auto worker_pool::submit(task t) -> void {
+	{
+		auto lock = std::lock_guard{mutex};
+		tasks.push_back(std::move(t));
+	}
+
+	cv.notify_one();
+}
+
+auto worker_pool::pending() -> size_t {
+	auto lock = std::lock_guard{mutex};
+	return tasks.size();
+}
+
+auto worker_pool::size() const -> size_t { return workers.size(); }
+
+auto worker_pool::run() -> void {
+	while (true) {
+		auto t = task{};
+		{
+			auto lock = std::unique_lock{mutex};
+			cv.wait(lock, [this]() -> bool { return stopping || !tasks.empty(); });
+			if (tasks.empty()) return;	// stopping and drained
+
+			t = std::move(tasks.front());
+			tasks.pop_front();
+		}
+
+		t();
+	}
+}
+
+}  // namespace ricox
@@ -0,0 +1,132 @@
+#include "base64.hpp"
+#include "simd_codec.hpp"
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// Compares the request decoders against the byte-at-a-time url_decode the server used and libbase64
+static constexpr size_t INPUT_COUNT = 20000;
+static constexpr size_t ROUNDS = 50;
+
+static auto from_hex(uint8_t x) -> uint8_t {
+	return x - (x <= '9' ? '0' : (x >= 'a' ? 'a' - 10 : (x >= 'A' ? 'A' - 10 : 0)));
+}
+
+static auto legacy_url_decode(std::string_view str, std::string& result) -> void {
+	result.clear();
+	result.reserve(str.size());
+
+	for (auto i = size_t{0}; i < str.size(); ++i) {
+		if (str[i] == '%' && i + 2 < str.size() && isxdigit(str[i + 1]) && isxdigit(str[i + 2])) {
+			result += static_cast<char>((from_hex(str[i + 1]) << 4) | from_hex(str[i + 2]));
+			i += 2;
+		} else if (str[i] == '+')
+			result += ' ';
+		else
+			result += str[i];
+	}
+}
+
+// Download paths as the file list renders them: mostly plain, some names with escaped spaces, brackets or UTF-8
+static auto make_path(std::mt19937& rng) -> std::string {
+	static const char* dirs[] = {"/download/hot/", "/download/cold/", "/download/hot/2024/", "/download/cold/archive/"};
+	static const char* escaped[] = {"%20", "%28", "%29", "%E6%8A%A5", "%E5%91%8A", "+"};
+
+	auto path = std::string{dirs[rng() % 4]};
+	auto length = 8 + rng() % 56;
+	for (auto i = size_t{0}; i < length; ++i) {
+		if (rng() % 12 == 0) {
+			path += escaped[rng() % 6];
+		} else {
+			path += static_cast<char>('a' + rng() % 26);
+		}
+	}
+
+	return path + (rng() % 2 ? ".pdf" : ".tar.gz");
+}
+
+// FileName headers: base64 of names between a few bytes and a couple hundred, some of them UTF-8
+static auto make_file_name(std::mt19937& rng) -> std::string {
+	auto name = std::string{};
+	auto length = 4 + rng() % 160;
+	for (auto i = size_t{0}; i < length; ++i) {
+		if (rng() % 8 == 0) {
+			name += "\xe6\x96\x87";
+		} else {
+			name += static_cast<char>('a' + rng() % 26);
+		}
+	}
+
+	return base64_encode(name + ".dat");
+}
+
+static auto seconds_since(std::chrono::steady_clock::time_point start) -> double {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static auto report(const char* name, size_t bytes, double seconds) -> void {
+	printf("%-20s %8.1f MB/s  %6.1f ns/input\n", name, static_cast<double>(bytes) / (1024 * 1024) / seconds,
+		   seconds * 1e9 / static_cast<double>(INPUT_COUNT * ROUNDS));
+}
+
+template <typename F>
+static auto run(const char* name, const std::vector<std::string>& inputs, size_t bytes, F decode) -> void {
+	auto start = std::chrono::steady_clock::now();
+	for (auto round = size_t{0}; round < ROUNDS; ++round) {
+		for (const auto& input : inputs) decode(input);
+	}
+	report(name, bytes * ROUNDS, seconds_since(start));
+}
+
+auto main(int argc, char* argv[]) -> int {
+	printf("kernels: %s\n", ricox::simd_codec::isa());
+
+	auto rng = std::mt19937{42};
+	auto paths = std::vector<std::string>{};
+	auto names = std::vector<std::string>{};
+	auto path_bytes = size_t{0};
+	auto name_bytes = size_t{0};
+	for (auto i = size_t{0}; i < INPUT_COUNT; ++i) {
+		paths.push_back(make_path(rng));
+		names.push_back(make_file_name(rng));
+		path_bytes += paths.back().size();
+		name_bytes += names.back().size();
+	}
+	printf("%zu paths, %zu bytes on average; %zu names, %zu bytes on average\n", paths.size(),
+		   path_bytes / paths.size(), names.size(), name_bytes / names.size());
+
+	// Every decoder has to agree with the implementation it replaces before it is timed
+	auto expected = std::string{};
+	auto out = std::string{};
+	for (auto i = size_t{0}; i < INPUT_COUNT; ++i) {
+		legacy_url_decode(paths[i], expected);
+		ricox::simd_codec::url_decode(paths[i], out);
+		if (out != expected) {
+			printf("url_decode mismatch for %s\n", paths[i].c_str());
+			return 1;
+		}
+
+		if (!ricox::simd_codec::base64_decode(names[i], out) || out != base64_decode(names[i])) {
+			printf("base64_decode mismatch for %s\n", names[i].c_str());
+			return 1;
+		}
+	}
+
+	run("url legacy", paths, path_bytes, [&](const std::string& in) -> void { legacy_url_decode(in, out); });
+	run("url scalar", paths, path_bytes,
+		[&](const std::string& in) -> void { ricox::simd_codec::url_decode_scalar(in, out); });
+	run("url simd", paths, path_bytes, [&](const std::string& in) -> void { ricox::simd_codec::url_decode(in, out); });
+
+	auto sink = size_t{0};
+	run("base64 libbase64", names, name_bytes, [&](const std::string& in) -> void { sink += base64_decode(in).size(); });
+	run("base64 scalar", names, name_bytes,
+		[&](const std::string& in) -> void { sink += ricox::simd_codec::base64_decode_scalar(in, out); });
+	run("base64 simd", names, name_bytes,
+		[&](const std::string& in) -> void { sink += ricox::simd_codec::base64_decode(in, out); });
+
+	return sink == 0;
+}
@@ -0,0 +1,117 @@
+#include "bundle.hpp"
+#include "dictionary_store.hpp"
+#include "logger.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// Compares per-file bundle packing of small, similar cold files against a zstd dictionary trained on a sample of them
+static constexpr size_t FILE_COUNT = 20000;
+static constexpr size_t TRAIN_COUNT = 2000;
+static constexpr size_t DICTIONARY_CAPACITY = 64 * 1024;
+static constexpr int DICTIONARY_LEVEL = 3;
+static constexpr int BUNDLE_TYPE = 4;  // default "bundle_type" of the server config
+
+static auto make_file(std::mt19937& rng, size_t i) -> std::string {
+	static const char* levels[] = {"INFO", "WARN", "ERROR", "DEBUG"};
+	static const char* services[] = {"checkout", "inventory", "billing", "search", "auth"};
+
+	auto file = std::string{"{\"tenant\":\"acme\",\"records\":["};
+	auto records = 2 + rng() % 6;
+	for (auto r = size_t{0}; r < records; ++r) {
+		if (r) file += ",";
+		file += "{\"timestamp\":\"2024-01-" + std::to_string(10 + rng() % 20) + "T" + std::to_string(rng() % 24) +
+				":" + std::to_string(rng() % 60) + ":00Z\",\"level\":\"" + levels[rng() % 4] + "\",\"service\":\"" +
+				services[rng() % 5] + "\",\"request_id\":\"" + std::to_string(rng()) + "\",\"latency_ms\":" +
+				std::to_string(rng() % 2000) + ",\"message\":\"request " + std::to_string(i) +
+				" completed with status " + std::to_string(200 + rng() % 4 * 100) + "\"}";
+	}
+
+	return file + "]}";
+}
+
+static auto seconds_since(std::chrono::steady_clock::time_point start) -> double {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static auto report(const char* name, size_t raw, size_t packed, double compress_s, double decompress_s) -> void {
+	auto mb = static_cast<double>(raw) / (1024 * 1024);
+	printf("%-12s ratio %6.2f  compress %8.1f MB/s  decompress %8.1f MB/s\n", name,
+		   static_cast<double>(raw) / static_cast<double>(packed), mb / compress_s, mb / decompress_s);
+}
+
+auto main(int argc, char* argv[]) -> int {
+	auto bench_logger = ricox::common::create_logger("server_logger", {std::make_shared<ricox::std_flush>()});
+
+	auto rng = std::mt19937{42};
+	auto files = std::vector<std::string>{};
+	auto raw = size_t{0};
+	for (auto i = size_t{0}; i < FILE_COUNT; ++i) {
+		files.push_back(make_file(rng, i));
+		raw += files.back().size();
+	}
+	printf("%zu files, %zu bytes on average\n", files.size(), raw / files.size());
+
+	// Current cold path: every file packed on its own
+	auto packed = std::vector<std::string>{};
+	packed.reserve(files.size());
+	auto start = std::chrono::steady_clock::now();
+	for (const auto& file : files) packed.push_back(bundle::pack(BUNDLE_TYPE, file));
+	auto compress_s = seconds_since(start);
+
+	start = std::chrono::steady_clock::now();
+	for (auto i = size_t{0}; i < files.size(); ++i) {
+		if (bundle::unpack(packed[i]) != files[i]) {
+			printf("%-12s round trip failed for file %zu\n", "bundle", i);
+			return 1;
+		}
+	}
+	auto decompress_s = seconds_since(start);
+
+	auto packed_size = size_t{0};
+	for (const auto& file : packed) packed_size += file.size();
+	report("bundle", raw, packed_size, compress_s, decompress_s);
+
+	if (!ricox::zstd_dictionary::available()) {
+		printf("%-12s skipped, built without zstd\n", "dictionary");
+		return 0;
+	}
+
+	// Dictionary path: train on a sample, then compress every file with it
+	start = std::chrono::steady_clock::now();
+	auto samples = std::vector<std::string>{files.begin(), files.begin() + TRAIN_COUNT};
+	auto content = std::string{};
+	if (!ricox::zstd_dictionary::train(samples, DICTIONARY_CAPACITY, content)) {
+		printf("%-12s training failed\n", "dictionary");
+		return 1;
+	}
+	auto dictionary = ricox::zstd_dictionary{1, "acme", std::move(content), DICTIONARY_LEVEL};
+	printf("dictionary   %zu bytes trained in %.1f ms\n", dictionary.get_content().size(), seconds_since(start) * 1000);
+
+	auto compressed = std::vector<std::string>(files.size());
+	start = std::chrono::steady_clock::now();
+	for (auto i = size_t{0}; i < files.size(); ++i) {
+		if (!dictionary.compress(files[i].data(), files[i].size(), compressed[i])) return 1;
+	}
+	compress_s = seconds_since(start);
+
+	auto out = std::string{};
+	start = std::chrono::steady_clock::now();
+	for (auto i = size_t{0}; i < files.size(); ++i) {
+		out.resize(files[i].size());
+		if (!dictionary.decompress(compressed[i].data(), compressed[i].size(), out.data(), out.size()) ||
+			out != files[i]) {
+			printf("%-12s round trip failed for file %zu\n", "dictionary", i);
+			return 1;
+		}
+	}
+	decompress_s = seconds_since(start);
+
+	auto compressed_size = size_t{0};
+	for (const auto& file : compressed) compressed_size += file.size();
+	report("dictionary", raw, compressed_size, compress_s, decompress_s);
+	return 0;
+}
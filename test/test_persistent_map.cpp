@@ -0,0 +1,163 @@
+#include "data_manager.hpp"
+#include "persistent_map.hpp"
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Checks the persistent map the index rests on against std::unordered_map under random sets and erases, with hashes
+// that force full collisions into shared leaves and long common prefixes into deep chains of nodes
+static constexpr size_t KEY_COUNT = 3000;
+static constexpr size_t OPERATIONS = 200000;
+static constexpr size_t CHECK_EVERY = 5000;  // full comparison, and a copy kept to check it never changes
+static constexpr size_t RETENTION = 3;
+
+struct plain_hash final {
+	auto operator()(const std::string& key) const -> size_t { return std::hash<std::string>{}(key); }
+};
+
+struct colliding_hash final {	// a few hundred distinct hashes for thousands of keys: most leaves hold several
+	auto operator()(const std::string& key) const -> size_t { return std::hash<std::string>{}(key) % 251; }
+};
+
+struct deep_hash final {  // the low 55 bits always agree, so two hashes only part at the last levels
+	auto operator()(const std::string& key) const -> size_t {
+		return (std::hash<std::string>{}(key) % 509) << 55 | 0x15555555555555;
+	}
+};
+
+template <typename Hash>
+using test_map = ricox::persistent_map<std::string, uint64_t, Hash>;
+using reference_map = std::unordered_map<std::string, uint64_t>;
+
+template <typename Hash>
+static auto same(const test_map<Hash>& map, const reference_map& expected, const std::vector<std::string>& keys)
+	-> bool {
+	if (map.size() != expected.size() || map.empty() != expected.empty()) return false;
+
+	auto visited = size_t{0};
+	auto matches = true;
+	map.for_each([&](const std::string& key, uint64_t value) -> void {
+		auto it = expected.find(key);
+		matches = matches && it != expected.end() && it->second == value;
+		++visited;
+	});
+	if (!matches || visited != expected.size()) return false;
+
+	for (const auto& key : keys) {
+		auto found = map.find(key);
+		auto it = expected.find(key);
+		if ((found == nullptr) != (it == expected.end()) || (found && *found != it->second)) return false;
+	}
+	return true;
+}
+
+template <typename Hash>
+static auto check(const char* name, const std::vector<std::string>& keys) -> bool {
+	auto rng = std::mt19937{42};
+	auto map = test_map<Hash>{};
+	auto expected = reference_map{};
+	auto kept = std::vector<std::pair<test_map<Hash>, reference_map>>{};
+
+	for (auto i = size_t{1}; i <= OPERATIONS; ++i) {
+		const auto& key = keys[rng() % keys.size()];
+		if (rng() % 3) {
+			map = map.set(key, i);
+			expected[key] = i;
+		} else {
+			map = map.erase(key);
+			expected.erase(key);
+		}
+
+		auto found = map.find(key);
+		auto it = expected.find(key);
+		if (map.size() != expected.size() || (found == nullptr) != (it == expected.end()) ||
+			(found && *found != it->second)) {
+			printf("%s: mismatch after operation %zu on %s\n", name, i, key.c_str());
+			return false;
+		}
+
+		if (i % CHECK_EVERY) continue;
+		if (!same(map, expected, keys)) {
+			printf("%s: full comparison failed after operation %zu\n", name, i);
+			return false;
+		}
+		kept.emplace_back(map, expected);
+	}
+
+	for (const auto& [copy, at_copy] : kept) {
+		if (!same(copy, at_copy, keys)) {
+			printf("%s: a kept copy changed with later updates\n", name);
+			return false;
+		}
+	}
+
+	// Erasing every key, which drops each emptied node on the way, leaves a map that takes new keys again
+	for (const auto& key : keys) {
+		map = map.erase(key);
+		expected.erase(key);
+	}
+	if (!same(map, expected, keys) || map.erase(keys.front()).size() != 0) {
+		printf("%s: not empty after erasing every key\n", name);
+		return false;
+	}
+	map = map.set(keys.front(), 1);
+	if (map.size() != 1 || !map.find(keys.front()) || *map.find(keys.front()) != 1) {
+		printf("%s: cannot reuse an emptied map\n", name);
+		return false;
+	}
+
+	printf("%-10s %zu operations on %zu keys, %zu copies kept: ok\n", name, OPERATIONS, keys.size(), kept.size());
+	return true;
+}
+
+// Version chains are updated the way data_manager::apply retires a version: newest first, trimmed to the retention,
+// each update a new map while the copies taken before it keep their chains
+static auto check_chains(const std::vector<std::string>& keys) -> bool {
+	auto chains = ricox::version_map{};
+	auto copies = std::vector<ricox::version_map>{};
+	auto urls = std::vector<std::string>{keys.begin(), keys.begin() + 50};
+	auto rng = std::mt19937{7};
+
+	for (auto version = uint64_t{1}; version <= 2000; ++version) {
+		auto earlier = ricox::storage_info{};
+		earlier.file_url = urls[rng() % urls.size()];
+		earlier.version = version;
+
+		auto held = chains.find(earlier.file_url);
+		auto chain = held ? *held : std::vector<ricox::storage_info>{};
+		chain.insert(chain.begin(), earlier);
+		while (chain.size() > RETENTION) chain.pop_back();
+		chains = chains.set(earlier.file_url, std::move(chain));
+
+		if (version % 100 == 0) copies.push_back(chains);
+	}
+
+	for (auto i = size_t{0}; i < copies.size(); ++i) {
+		auto bound = (i + 1) * 100;
+		auto valid = true;
+		copies[i].for_each([&](const std::string& url, const std::vector<ricox::storage_info>& chain) -> void {
+			valid = valid && !chain.empty() && chain.size() <= RETENTION && chain.front().version <= bound;
+			for (auto j = size_t{1}; j < chain.size(); ++j) valid = valid && chain[j - 1].version > chain[j].version;
+			for (const auto& info : chain) valid = valid && info.file_url == url;
+		});
+		if (!valid || copies[i].size() > urls.size()) {
+			printf("chains: copy %zu is not trimmed newest first, or changed after it was taken\n", i);
+			return false;
+		}
+	}
+
+	printf("chains     %zu URLs trimmed to %zu versions: ok\n", chains.size(), RETENTION);
+	return true;
+}
+
+auto main(int argc, char* argv[]) -> int {
+	auto keys = std::vector<std::string>{};
+	for (auto i = size_t{0}; i < KEY_COUNT; ++i) keys.push_back("/download/cold/file-" + std::to_string(i) + ".dat");
+
+	auto ok = check<plain_hash>("plain", keys) && check<colliding_hash>("colliding", keys) &&
+			  check<deep_hash>("deep", keys) && check_chains(keys);
+	return ok ? 0 : 1;
+}